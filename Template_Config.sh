@@ -122,6 +122,7 @@
 ####################################################################################################
 #TURB_DRIVING                   # turns on turbulent driving/stirring. see begrun for parameters that must be set
 #TURB_DRIVING_SPECTRUMGRID=128  # activates on-the-fly calculation of the turbulent velocity, vorticity, and smoothed-velocity power spectra, evaluated on a grid of linear-size TURB_DRIVING_SPECTRUMGRID elements. Requires BOX_PERIODIC
+#TURB_DRIVING_FASTMODESUM       # evaluate the driving acceleration with per-axis phase recurrences (three cos/sin per particle instead of one per mode) and OpenMP threads; same modes, spectrum, and solenoidal/compressive split
 ####################################################################################################
 
 
@@ -134,6 +135,9 @@
 #PM_PLACEHIGHRESREGION=1+2+16   # adds a second-level (nested) PM grid before the tree: value denotes particle types (via bit-mask) to place high-res PMGRID around. Requires PMGRID.
 #PM_HIRES_REGION_CLIPPING=1000  # optional additional criterion for boundaries in 'zoom-in' type simulations: clips gas particles that escape the hires region in zoom/isolated sims, specifically those whose nearest-neighbor distance exceeds this value (in code units)
 #PM_HIRES_REGION_CLIPDM         # split low-res DM particles that enter high-res region (completely surrounded by high-res)
+#PM_ASSIGNMENT_ORDER=3          # mass-assignment/interpolation kernel of the periodic PM grid: 2=cloud-in-cell (default), 3=triangular-shaped-cloud, 4=piecewise-cubic-spline (27 or 64 instead of 8 mesh points per particle, but much less aliasing: allows a coarser PMGRID at fixed accuracy)
+#PM_INTERLACE                   # compute the periodic PM force/potential/tidal tensor on two meshes offset by half a cell and average them (cancels the leading aliasing terms, at twice the PM cost)
+#PM_PENCIL_FFT                  # decompose the periodic PM mesh into 2D pencils instead of 1D slabs, with a parallel FFT built from serial FFTW plans (every task takes part in the FFT, and the mesh memory per task drops to ~PMGRID^3/NTask: needed when NTask>PMGRID, or for very large PMGRID). Requires USE_FFTW3; no PM tidal tensor or power spectra.
 ## -----------------------------------------------------------------------------------------------------
 # ---------------------------------------- Adaptive Grav. Softening (including Lagrangian conservation terms!)
 #ADAPTIVE_GRAVSOFT_FORGAS       # allows variable softening length for gas particles (scaled with local inter-element separation), so gravity traces same density field seen by hydro
@@ -154,6 +158,10 @@
 ## -----------------------------------------------------------------------------------------------------
 # --------------------------------------- Pure-Tree Options for Direct N-body of small-N groups (recommended for hard binaries, etc)
 #GRAVITY_ACCURATE_FEWBODY_INTEGRATION # enables a suite: GRAVITY_HYBRID_OPENING_CRIT, TIDAL_TIMESTEP_CRITERION, LONG_INTEGER_TIME, to more accurately follow few-body point-like dynamics in the tree. currently compatible only with pure-tree gravity.
+## -----------------------------------------------------------------------------------------------------
+# --------------------------------------- Higher-Order Tree Multipoles and Grouped Tree Walks (fewer node interactions/traversals at fixed force accuracy)
+#GRAVITY_TREE_QUADRUPOLE        # tree nodes carry quadrupole moments, used for accelerations/potentials/tidal tensors in the tree (or short-range TreePM) walk, with an opening criterion of the next order
+#GRAVITY_GROUPED_TREEWALK=16    # nearby active particles (up to this many; default 16) share one gravity tree walk and interaction list, with nodes opened conservatively for the whole group
 ## ----------------------------------------------------------------------------------------------------
 # -------------------------------------- arbitrary time-dependent dark energy equations-of-state, expansion histories, or gravitational constants
 #GR_TABULATED_COSMOLOGY         # enable reading tabulated cosmological/gravitational parameters (top-level switch)
@@ -179,6 +187,7 @@
 #FOF_SECONDARY_LINK_TYPES=1+16+32   # bitflag: sum of 2^type for the seconary types which can be linked to nearest primaries (will be 'seen' when calculating group properties)
 #FOF_DENSITY_SPLIT_TYPES=1+2+16+32  # bitflag: sum of 2^type for which the densities should be calculated seperately (i.e. if 1+2+16+32, fof densities are separately calculated for types 0,1,4,5, and shared for types 2,3)
 #FOF_GROUP_MIN_SIZE=32              # minimum number of identified members required to qualify as a 'group': default is 32
+#FOF_UNIONFIND                     # link FoF groups with a (multi-threaded) union-find locally, and join them across tasks by label propagation with pointer jumping in O(log) communication rounds
 ## ----------------------------------------------------------------------------------------------------
 # -------------------------------------  Subhalo on-the-fly finder options (uses "subfind" source code).
 ## ----------------------------------------------------------------------------------------------------
@@ -189,6 +198,8 @@
 ## ----------------------------------------------------------------------------------------------------
 #SUBFIND_REMOVE_GAS_STRUCTURES      # delete (do not save) any structures which are entirely gas (or have fewer than target number of elements which are non-gas, with the rest in gas)
 #SUBFIND_SAVE_PARTICLEDATA          # save all particle positions,velocity,type,mass in subhalo file (in addition to IDs: this is highly redundant with snapshots, so makes subhalo info more like a snapshot)
+#SUBFIND_OPENMP_SERIAL_GROUPS       # process the (small) groups which are each done on a single task in parallel over the OpenMP threads of that task (each thread with its own local tree). requires OPENMP
+#SUBFIND_INCREMENTAL_UNBIND=10      # unbind incrementally: subtract the unbound particles from the existing tree and recompute only potentials that may have changed enough to matter, rebuilding the tree once this percentage (default=10) of its mass has been unbound
 ####################################################################################################
 
 
@@ -321,6 +332,7 @@
 #COOL_LOW_TEMPERATURES          # allow fine-structure and molecular cooling to ~10 K; account for optical thickness and line-trapping effects with proper opacities [requires METALS]. attempts to interpolate between optically-thin and optically-thick cooling limits even if explicit rad-hydro not enabled. Cite Hopkins et al. arXiv:1702.06148
 #COOL_MOLECFRAC=4               # track molecular H2 fractions for use in COOL_LOW_TEMPERATURES and thermochemistry using different estimators: (1) simplest, fit to density+temperature from Glover+Clark 2012; (2) Krumholz+Gnedin 2010 fit vs. column+metallicity; (3) Gnedin+Draine 2014 fit vs column+metallicity+MW radiation field; (4) Krumholz, McKee, & Tumlinson 2009 local equilibrium cloud model vs column, metallicity, incident FUV; (5) explicit local equilibrium H2 fraction explicitly tracking rates, metals, clumping, shielding, UV [cite Hopkins et al. 2021]; (6) explicit non-equilibrium integration of rates in level 5 [cite Hopkins et al. 2021]
 #COOL_UVB_SELFSHIELD_RAHMATI    # use an updated (Hopkins et al. 2021, in prep) version [fixes problematic behavior at densities >> 100 cm^-3] version of the Rahmati et al. 2013MNRAS.431.2261R UV background self-shielding, as compared to the older Hopkins et al. 2018MNRAS.480..800H treatment of self-shielding from the UVB
+#COOL_EQM_FASTPATH              # skip the full cooling solution for cells whose cooling time is far from their timestep (ratio set by the run-time parameter CoolingFastPathTimeRatio): the tabular cooling takes the explicit update when t_cool >> dt, CHIMES takes the equilibrium tables when t_cool << dt; hit/miss counts are written to cpu.txt
 ## ----------------------------------------------------------------------------------------------------
 # ---- GRACKLE: alternative chemical network using external libraries for solving thermochemistry+cooling. These treat molecular hydrogen, in particular, in more detail than our default networks, and are more accurate for 'primordial' (e.g. 1st-star) gas. But they have less-accurate treatment of
 # ----            effects such as dust-gas coupling and radiative feedback (Compton and photo-electric and local ionization heating) and high-optical-depth effects, so are usually less accurate for low-redshift, metal-rich star formation or planet formation simulations.
@@ -338,6 +350,8 @@
 #CHIMES_STELLAR_FLUXES          # couple UV fluxes from the luminosity tree to CHIMES (requires FIRE modules for radiation transport/coupling: use permissions follow those modules)
 #CHIMES_TURB_DIFF_IONS          # turbulent diffusions of CHIMES abundances. Requires TURB_DIFF_METALS and TURB_DIFF_METALS_LOWORDER (see modules for metal diffusion above: use/citation policy follows those)
 #CHIMES_METAL_DEPLETION         # uses density-dependent metal depletion factors (Jenkins 2009, De Cia et al. 2016) to obtain gas-phase abundances for chemical network
+#CHIMES_PERSISTENT_SOLVER       # keep one CVode workspace per OpenMP thread (re-initialized per particle instead of re-created), and order the chemistry loop by each particle's previous CVode step count (most expensive first)
+#CHIMES_ANALYTIC_JACOBIAN       # give CVode the Jacobian of the reaction network computed from the rate tables, instead of building it by finite differences of the rate equations
 ## ------------ CHIMES de-bugging and special behaviors ------------------------------------------------------------------------
 #CHIMES_HYDROGEN_ONLY           # hydrogen-only. This is ignored if METALS are also set.
 #CHIMES_REDUCED_OUTPUT          # full CHIMES abundance array only output in some snapshots
@@ -395,6 +409,17 @@
 #OPENMP=2                       # top-level switch for explicit OpenMP implementation
 #PTHREADS_NUM_THREADS=4         # custom PTHREADs implementation (don't enable with OPENMP)
 #MULTIPLEDOMAINS=16             # Multi-Domain option for the top-tree level (alters load-balancing)
+#OPENMP_TREEBUILD               # build the gravity/neighbor tree with OpenMP tasks over disjoint sub-trees (same tree as the serial build, up to the random split of nearly-coincident particles). requires OPENMP
+#USE_NONBLOCKING_XCHANGE        # overlap computation with communication in the neighbor-loop exchange (sparse count exchange, imports evaluated as they arrive). requires MPI-3
+#HYDRO_NGBLIST_CACHE            # cache the local neighbor lists of the first pair-wise hydro loop in each step and re-use them in the following loops (gradients, hydro forces), instead of re-walking the tree
+#HYDRO_KERNEL_SIMD              # evaluate neighbor separations and kernels in the density and hydro loops in batches (tiles), so they can be vectorized (SIMD). gcc needs -fno-trapping-math (or -ffast-math) for this
+#HOTCOLD_PARTICLE_LAYOUT        # keep a dense copy of the fields the neighbor-tree walk reads (position, kernel length, time) apart from the (large) particle structure, to reduce memory traffic in the walk. costs ~40 bytes per particle
+#OPENMP_PEANO_REORDER           # sort the particles into Peano-Hilbert order (after each domain decomposition) with a threaded radix sort and an out-of-place (threaded) copy, instead of serial sorting and swapping
+#OPENMP_PM                      # thread the particle-mesh mass assignment and force/potential read-out (sorting the particle-mesh lists with a threaded radix sort, and depositing without atomics). requires OPENMP
+#ACTIVE_PARTICLE_ARRAY          # keep the active particles in a contiguous array (as well as the linked list), which the threads of the loops over local particles claim in chunks with an atomic compare-and-swap, instead of taking particles off the list one at a time in a critical section
+#THREAD_WORK_STEALING           # give each thread its own cost-balanced (Peano-Hilbert-ordered) range of the active particles in the threaded particle loops, and let threads which run out of work steal from the others; thread busy/idle times are written to cpu.txt. requires OPENMP (enables ACTIVE_PARTICLE_ARRAY)
+#PERFORMANCE_TRACE              # named, nestable timers (every generic neighbor loop times itself, with its exports/imports/buffer rounds/bytes and compute/comm/wait times), written with their min/avg/max over tasks and threads to perf_timers.csv, with a histogram of the load of the tasks in perf_load.csv; =2 also writes every timer call as a Chrome-trace event (perf_trace/trace_<task>.json)
+#DOMAIN_MEASURED_COST           # balance the domains with the measured time spent on each particle (and on its exported copies on other tasks) in the neighbor loops and cooling, in units of the measured time per gravity interaction, instead of the neighbor-number and stellar-age heuristics
 ####################################################################################################
 
 
@@ -428,6 +453,9 @@
 #OUTPUT_TWOPOINT_ENABLED        # allows user to calculate mass 2-point function by enabling and setting restartflag=5
 #IO_DISABLE_HDF5                # disable HDF5 I/O support (for both reading/writing; use only if HDF5 not install-able)
 #IO_COMPRESS_HDF5     		    # write HDF5 in compressed form (will slow down snapshot I/O and may cause issues on old machines, but reduce snapshots 2x)
+#IO_PARALLEL_HDF5               # allow SnapFormat=4: snapshots written as one HDF5 file by all tasks with collective (MPI-IO) writes. requires a parallel HDF5 library
+#IO_ASYNC_SNAPSHOTS             # snapshot files are built in memory and written to disk by a background thread while the run continues (needs memory for one full snapshot file on each writing task)
+#IO_RESTART_ANY_NTASK           # restart files in a checksummed, decomposition-independent format: a run can be restarted (RestartFlag=1) on a different number of MPI tasks
 #IO_SUPPRESS_TIMEBIN_STDOUT=10  # only prints timebin-list to log file if highest active timebin index is within N (value set) of the highest timebin (dt_bin=2^(-N)*dt_bin,max)
 #IO_SUBFIND_IN_OLD_ASCII_FORMAT # write sub-find outputs in the old massive ascii-table format (unweildy and can cause lots of filesystem issues, but here for backwards compatibility)
 #IO_SUBFIND_READFOF_FROMIC      # try read already existing FOF files associated with a run instead of recomputing them: not de-bugged
@@ -520,6 +548,7 @@
 # ----- Load-Balancing
 #ALLOW_IMBALANCED_GASPARTICLELOAD # increases All.MaxPartSph to All.MaxPart: can allow better load-balancing in some cases, but uses more memory. But use me if you run into errors where it can't fit the domain (where you would increase PartAllocFac, but can't for some reason)
 #SEPARATE_STELLARDOMAINDECOMP   # separate stars (ptype=4) and other non-gas particles in domain decomposition (may help load-balancing)
+#DOMAIN_MULTICONSTRAINT         # balance the gravity, hydro, feedback, and chemistry work and the particle and gas-particle memory of the domains separately (each within its own mean), instead of one combined work-load; the balance of each is written to the cpu log
 ####################################################################################################
 
 
@@ -35,20 +35,26 @@ void compute_grav_accelerations(void)
 {
   CPU_Step[CPU_MISC] += measure_time();
   PRINT_STATUS("Start gravity force computation...");
+  PERF_TIMER_START("gravity");
 
 #ifdef PMGRID
   if(All.PM_Ti_endstep == All.Ti_Current)
     {
+      PERF_TIMER_START("long_range_force");
       long_range_force();
+      PERF_TIMER_STOP("long_range_force");
       CPU_Step[CPU_MESH] += measure_time();
     }
 #endif
 
+  PERF_TIMER_START("gravity_tree");
   gravity_tree();		/* computes gravity accel. */
 
   /* For the first timestep, we redo it to allow usage of relative opening criterion for consistent accuracy */
   if(All.TypeOfOpeningCriterion == 1 && All.Ti_Current == 0) {gravity_tree();}
+  PERF_TIMER_STOP("gravity_tree");
 
+  PERF_TIMER_STOP("gravity");
   PRINT_STATUS(" ..gravity force computation done");
 }
 
@@ -56,6 +62,7 @@ void compute_grav_accelerations(void)
 
 void compute_hydro_densities_and_forces(void)
 {
+  PERF_TIMER_START("hydro");
   if(All.TotN_gas > 0)
     {
         PRINT_STATUS("Start hydrodynamics computation...");
@@ -73,6 +80,9 @@ void compute_hydro_densities_and_forces(void)
          */
 
         PRINT_STATUS(" ..density & tree-update computation done...");
+#ifdef HYDRO_NGBLIST_CACHE
+        ngb_cache_allocate(); /* neighbor lists found by the first pair-wise loop below are re-used by the following ones */
+#endif
 
 #ifdef HYDRO_VOLUME_CORRECTIONS
         cellcorrections_calc(); /* must be called after density, and after the update of hmax in the tree [because it depends on bi-directional search], but before gradients where quantities dependent on volumetric elements such as density are needed */
@@ -84,13 +94,18 @@ void compute_hydro_densities_and_forces(void)
         interpolate_fluxes_opacities_gasgrains();
 #endif
 
+        PERF_TIMER_START("hydro_gradient_calc");
         hydro_gradient_calc(); /* calculates the gradients of hydrodynamical quantities  */
+        PERF_TIMER_STOP("hydro_gradient_calc");
         PRINT_STATUS(" ..gradient computation done.");
 
 #ifdef TURB_DIFF_DYNAMIC
         dynamic_diff_calc(); /* This MUST be called immediately following gradient calculations */
 #endif
         hydro_force();		/* adds hydrodynamical accelerations and computes du/dt  */
+#ifdef HYDRO_NGBLIST_CACHE
+        ngb_cache_free();
+#endif
         compute_additional_forces_for_all_particles(); /* other accelerations that need to be computed are done here */
         PRINT_STATUS(" ..hydro force computation done.");
 
@@ -106,6 +121,7 @@ void compute_hydro_densities_and_forces(void)
 #endif
         compute_additional_forces_for_all_particles();
     }
+  PERF_TIMER_STOP("hydro");
 }
 
 
@@ -55,9 +55,16 @@ int *Exportindex;
 int *Send_offset, *Send_count, *Recv_count, *Recv_offset, *Sendcount;
 
 int TakeLevel;
+#ifdef DOMAIN_MEASURED_COST
+float *XchangeImportCost;
+#endif
 
 int FirstActiveParticle;
 int *NextActiveParticle;
+#ifdef ACTIVE_PARTICLE_ARRAY
+int *ActiveParticleList;
+int NumActiveParticle;
+#endif
 unsigned char *ProcessedFlag;
 
 int TimeBinCount[TIMEBINS];
@@ -290,6 +297,10 @@ struct particle_data *P,	/*!< holds particle data on local processor */
 struct sph_particle_data *SphP,	/*!< holds SPH particle data on local processor */
  *DomainSphBuf;			/*!< buffer for SPH particle data in domain decomposition */
 
+#ifdef HOTCOLD_PARTICLE_LAYOUT
+struct particle_hot *PHot;	/*!< walk-critical copy of particle fields on local processor */
+#endif
+
 peanokey *DomainKeyBuf;
 
 /* global state of system
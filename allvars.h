@@ -52,18 +52,37 @@
 #define HAVE_HDF5               /* default to using HDF5 */
 #include <hdf5.h>
 #endif
+#if defined(IO_PARALLEL_HDF5) && !defined(H5_HAVE_PARALLEL)
+#error "IO_PARALLEL_HDF5 requires an HDF5 library built with parallel (MPI-IO) support"
+#endif
 #if !defined(OUTPUT_POSITIONS_IN_DOUBLE) && defined(HAVE_HDF5)
 #define OUTPUT_POSITIONS_IN_DOUBLE /* recommended to always default to recording positions in double-precision: there's not really a good reason not to do this unless we need to match unformatted binary */
 #endif
 #if !defined(LONG_INTEGER_TIME)
 #define LONG_INTEGER_TIME   /* always recommended: on modern machines the memory overhead cost of this is negligible */
 #endif
+#if defined(THREAD_WORK_STEALING) && defined(_OPENMP)
+#define THREAD_WORK_STEALING_IS_ACTIVE /* the scheduler needs OpenMP, and hands out slots of the active-particle array */
+#ifndef ACTIVE_PARTICLE_ARRAY
+#define ACTIVE_PARTICLE_ARRAY
+#endif
+#define THREAD_SCHEDULER_COST_NEIGHBORS 0 /* cost estimates used to balance the threads: neighbor number, or gravity interactions */
+#define THREAD_SCHEDULER_COST_GRAVITY   1
+#endif
 
 
 #define DO_PREPROCESSOR_EXPAND_(VAL)  VAL ## 1
 #define EXPAND_PREPROCESSOR_(VAL)     DO_PREPROCESSOR_EXPAND_(VAL) /* checks for a NON-ZERO value of this parameter */
 #define CHECK_IF_PREPROCESSOR_HAS_NUMERICAL_VALUE_(VAL) !(EXPAND_PREPROCESSOR_(VAL) == 1) /* returns True if a non-zero int value of VAL is set */
 
+#ifdef PERFORMANCE_TRACE
+#if CHECK_IF_PREPROCESSOR_HAS_NUMERICAL_VALUE_(PERFORMANCE_TRACE)
+#if (PERFORMANCE_TRACE > 1)
+#define PERFORMANCE_TRACE_EVENTS /* also write every call of a timer as a Chrome-trace event */
+#endif
+#endif
+#endif
+
 #if !defined(SLOPE_LIMITER_TOLERANCE)
 #if defined(AGGRESSIVE_SLOPE_LIMITERS)
 #define SLOPE_LIMITER_TOLERANCE 2
@@ -1150,6 +1169,10 @@ typedef MyInputFloat MyInputPosFloat;
 struct unbind_data
 {
   int index;
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+  int pot_update; /* set if the potential of this particle is recomputed in the current unbinding pass */
+  double pot_mass_removed; /* mass unbound from the structure when the potential of this particle was last computed */
+#endif
 };
 
 
@@ -1421,7 +1444,12 @@ z=((z)>boxHalf_Z)?((z)-boxSize_Z):(((z)<-boxHalf_Z)?((z)+boxSize_Z):(z)))
 /*****************************************************************/
 
 #define terminate(x) {char termbuf[2000]; sprintf(termbuf, "TERMINATE issued on task=%d, function '%s()', file '%s', line %d: '%s'\n", ThisTask, __FUNCTION__, __FILE__, __LINE__, x); fflush(stdout); printf("%s", termbuf); fflush(stdout); MPI_Abort(MPI_COMM_WORLD, 1); exit(0);}
-#define endrun(x) {if(x==0) {MPI_Finalize(); exit(0);} else {char termbuf[2000]; sprintf(termbuf, "ENDRUN issued on task=%d, function '%s()', file '%s', line %d: error level %d\n", ThisTask, __FUNCTION__, __FILE__, __LINE__, x); fflush(stdout); printf("%s", termbuf); fflush(stdout); MPI_Abort(MPI_COMM_WORLD, x); exit(0);}}
+#ifdef IO_ASYNC_SNAPSHOTS
+#define ENDRUN_WAIT_FOR_IO async_snapshot_wait(); /* a clean exit must not discard a snapshot still being written in the background */
+#else
+#define ENDRUN_WAIT_FOR_IO
+#endif
+#define endrun(x) {if(x==0) {ENDRUN_WAIT_FOR_IO MPI_Finalize(); exit(0);} else {char termbuf[2000]; sprintf(termbuf, "ENDRUN issued on task=%d, function '%s()', file '%s', line %d: error level %d\n", ThisTask, __FUNCTION__, __FILE__, __LINE__, x); fflush(stdout); printf("%s", termbuf); fflush(stdout); MPI_Abort(MPI_COMM_WORLD, x); exit(0);}}
 #define PRINT_WARNING(...) {char termbuf1[1000], termbuf2[1000]; sprintf(termbuf1, "WARNING issued on task=%d, function %s(), file %s, line %d", ThisTask, __FUNCTION__, __FILE__, __LINE__); sprintf(termbuf2, __VA_ARGS__); fflush(stdout); printf("%s: %s\n", termbuf1, termbuf2); fflush(stdout);}
 #ifdef IO_REDUCED_MODE
 #define PRINT_STATUS(...) {if(All.HighestActiveTimeBin == All.HighestOccupiedTimeBin) {if(ThisTask==0) {fflush(stdout); printf( __VA_ARGS__ ); printf("\n"); fflush(stdout);}}}
@@ -1431,6 +1459,22 @@ z=((z)>boxHalf_Z)?((z)-boxSize_Z):(((z)<-boxHalf_Z)?((z)+boxSize_Z):(z)))
 
 #define MACRO_NAME_CONCATENATE(A, B) MACRO_NAME_CONCATENATE_(A, B)
 #define MACRO_NAME_CONCATENATE_(A, B) A##B
+#define MACRO_NAME_STRING(A) MACRO_NAME_STRING_(A)
+#define MACRO_NAME_STRING_(A) #A
+
+#ifdef PERFORMANCE_TRACE /* named, nestable timers of the performance trace (see system/perf_trace.c); call outside of parallel regions */
+#define PERF_TIMER_START(name) perf_timer_start(name)
+#define PERF_TIMER_STOP(name) perf_timer_stop(name)
+#else
+#define PERF_TIMER_START(name)
+#define PERF_TIMER_STOP(name)
+#endif
+
+#ifdef DOMAIN_MEASURED_COST /* adds the measured time dt spent on particle i to its cost at the level being measured this step (as GravCost) */
+#define DOMAIN_MEASURED_COST_ADD(i,dt) {if(TakeLevel >= 0) {P[i].WorkCost[TakeLevel] += (float) (dt);}}
+#else
+#define DOMAIN_MEASURED_COST_ADD(i,dt)
+#endif
 
 
 /*********************************************************/
@@ -1439,6 +1483,10 @@ z=((z)>boxHalf_Z)?((z)-boxSize_Z):(((z)<-boxHalf_Z)?((z)+boxSize_Z):(z)))
 
 extern int FirstActiveParticle;
 extern int *NextActiveParticle;
+#ifdef ACTIVE_PARTICLE_ARRAY
+extern int *ActiveParticleList;  /*!< indices of the active particles, in the same order as the linked list (time bin by time bin), or in index (Peano-Hilbert) order with THREAD_WORK_STEALING */
+extern int NumActiveParticle;    /*!< number of entries in ActiveParticleList */
+#endif
 extern unsigned char *ProcessedFlag;
 extern int TimeBinCount[TIMEBINS];
 extern int TimeBinCountSph[TIMEBINS];
@@ -1485,6 +1533,9 @@ extern int RestartFlag;		/*!< taken from command line used to start code. 0 is n
 extern int RestartSnapNum;
 extern int SelRnd;
 extern int TakeLevel;
+#ifdef DOMAIN_MEASURED_COST
+extern float *XchangeImportCost; /*!< measured time of the evaluation of each imported element in the generic neighbor loops (NULL outside of them) */
+#endif
 extern int *Exportflag;	        /*!< Buffer used for flagging whether a particle needs to be exported to another process */
 extern int *Exportnodecount;
 extern int *Exportindex;
@@ -1704,6 +1755,9 @@ extern struct global_data_all_processes
   double InitGasTemp;		/*!< may be used to set the temperature in the IC's */
   double InitGasU;		/*!< the same, but converted to thermal energy per unit mass */
   double MinGasTemp;		/*!< may be used to set a floor for the gas temperature */
+#ifdef COOL_EQM_FASTPATH
+  double CoolingFastPathTimeRatio; /*!< cells with cooling times this many times longer (tabular) or shorter (CHIMES) than their timestep skip the full cooling solution (<=0 disables) */
+#endif
 #ifdef CHIMES
   int ChimesThermEvolOn;        /*!< Flag to determine whether to evolve the temperature in CHIMES. */
 #ifdef CHIMES_STELLAR_FLUXES
@@ -2400,6 +2454,9 @@ extern ALIGN(32) struct particle_data
 #endif
 
     float GravCost[GRAVCOSTLEVELS];   /*!< weight factor used for balancing the work-load */
+#ifdef DOMAIN_MEASURED_COST
+    float WorkCost[GRAVCOSTLEVELS];   /*!< measured time spent on this particle (and its imported copies) in the non-gravity loops, per level as GravCost */
+#endif
 
 #ifdef WAKEUP
     integertime dt_step;
@@ -2456,6 +2513,29 @@ extern ALIGN(32) struct particle_data
 #define BPP(i) P[(i)]
 #endif
 
+#ifdef HOTCOLD_PARTICLE_LAYOUT
+/*! This structure holds a dense copy of the (few) fields the neighbor-tree walk reads for every candidate particle,
+ *  so the walk streams through small contiguous entries instead of pulling the (very large) particle_data entry. It is
+ *  derived data: P remains the authoritative copy, and PHot is refreshed from it whenever these fields change
+ *  (tree construction, drift, the kernel-length update) -- it is never exchanged, re-ordered, or written to restarts. */
+extern struct particle_hot
+{
+    MyDouble Pos[3];                /*!< particle position (copy of P[i].Pos) */
+    MyFloat Hsml;                   /*!< kernel length (copy of PPP[i].Hsml) */
+    integertime Ti_current;         /*!< current time on integer timeline (copy of P[i].Ti_current) */
+}
+ *PHot;                             /*!< walk-critical particle fields on local processor */
+#define PHOT_UPDATE(i) {PHot[(i)].Pos[0]=P[(i)].Pos[0]; PHot[(i)].Pos[1]=P[(i)].Pos[1]; PHot[(i)].Pos[2]=P[(i)].Pos[2]; PHot[(i)].Hsml=PPP[(i)].Hsml; PHot[(i)].Ti_current=P[(i)].Ti_current;}
+#define PHOT_POS(i) (PHot[(i)].Pos)
+#define PHOT_HSML(i) (PHot[(i)].Hsml)
+#define PHOT_TI_CURRENT(i) (PHot[(i)].Ti_current)
+#else
+#define PHOT_UPDATE(i) {}
+#define PHOT_POS(i) (P[(i)].Pos)
+#define PHOT_HSML(i) (PPP[(i)].Hsml)
+#define PHOT_TI_CURRENT(i) (P[(i)].Ti_current)
+#endif
+
 
 #if defined(HYDRO_TENSOR_FACE_CORRECTIONS_NGBITER)
 #define HYDRO_TENSOR_FACE_CORRECTIONS_NUMBER_MOMWTS 15
@@ -3218,6 +3298,19 @@ enum siofields
 extern long Nexport, Nimport;
 extern int BufferFullFlag;
 extern int NextParticle;
+/* NextParticle is the shared position of the threads in the active set, in the loops over local particles: with ACTIVE_PARTICLE_ARRAY it is a
+    slot in ActiveParticleList (which the threads claim in chunks, see active_particle_claim_chunk), otherwise the index of the next particle in
+    the linked list. It is -1 once the set is used up. These macros give its start, the particle it points to, and the position after it. */
+#ifdef ACTIVE_PARTICLE_ARRAY
+#define ACTIVE_CURSOR_FIRST         ((NumActiveParticle > 0) ? 0 : -1)
+#define ACTIVE_CURSOR_PARTICLE(c)   (ActiveParticleList[(c)])
+#define ACTIVE_CURSOR_NEXT(c)       ((((c) + 1) < NumActiveParticle) ? ((c) + 1) : -1)
+#define ACTIVE_PARTICLE_MAXCHUNK    32 /* largest number of slots claimed at once */
+#else
+#define ACTIVE_CURSOR_FIRST         (FirstActiveParticle)
+#define ACTIVE_CURSOR_PARTICLE(c)   (c)
+#define ACTIVE_CURSOR_NEXT(c)       (NextActiveParticle[(c)])
+#endif
 extern int NextJ;
 extern int TimerFlag;
 
@@ -3275,6 +3368,9 @@ extern ALIGN(32) struct NODE
 #endif
 
   MyFloat maxsoft;		/*!< hold the maximum gravitational softening of particle in the node */
+#ifdef GRAVITY_TREE_QUADRUPOLE
+  MyFloat quad[6];		/*!< second mass moments sum(m*y_i*y_j) about the center-of-mass s, ordered xx,yy,zz,xy,xz,yz */
+#endif
 
 #ifdef DM_SCALARFIELD_SCREENING
   MyFloat s_dm[3];
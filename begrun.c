@@ -83,6 +83,11 @@ void begrun(void)
 
   read_parameter_file(ParameterFile);	/* ... read in parameters for this run */
 
+#ifdef HYDRO_KERNEL_SIMD
+  double kernel_lane_err = kernel_main_lane_check(); /* the batched hydro kernel must reproduce kernel_main */
+  if(kernel_lane_err > 1.e-10) {if(ThisTask == 0) {printf("HYDRO_KERNEL_SIMD: the branch-free kernel deviates from kernel_main by a relative %g (KERNEL_FUNCTION=%d, NUMDIMS=%d). Aborting.\n", kernel_lane_err, KERNEL_FUNCTION, NUMDIMS);} endrun(6574);}
+#endif
+
   mymalloc_init();
 
 #ifdef DEBUG
@@ -262,6 +267,9 @@ void begrun(void)
 #ifdef CHIMES
       All.ChimesThermEvolOn = all.ChimesThermEvolOn;
 #endif
+#ifdef COOL_EQM_FASTPATH
+      All.CoolingFastPathTimeRatio = all.CoolingFastPathTimeRatio;
+#endif
 
         /* allow softenings to be modified during the run */
         if(All.ComovingIntegrationOn)
@@ -395,6 +403,14 @@ void begrun(void)
 
 
       if(All.TimeMax != all.TimeMax) {readjust_timebase(All.TimeMax, all.TimeMax);}
+
+#ifdef IO_RESTART_ANY_NTASK
+      /* the restart files were read in equal slices of the particle list, so distribute the particles over the domains now,
+         with the softenings and TreeDomainUpdateFrequency from the parameter file rather than those stored in the restart files */
+      if(ThisTask == 0) {printf("Doing a domain decomposition for the restarted particle distribution.\n"); fflush(stdout);}
+      if(All.ComovingIntegrationOn) {set_softenings();}
+      domain_Decomposition(0, 0, 0);
+#endif
     }
 
 #ifdef GALSF_EFFECTIVE_EQS
@@ -1158,6 +1174,12 @@ void read_parameter_file(char *fname)
         id[nt++] = STRING;
 #endif
 
+#ifdef COOL_EQM_FASTPATH
+      strcpy(tag[nt], "CoolingFastPathTimeRatio");
+      addr[nt] = &All.CoolingFastPathTimeRatio;
+      id[nt++] = REAL;
+#endif
+
       strcpy(tag[nt], "TimeLimitCPU");
       strcpy(alternate_tag[nt], "MaxSimulationWallTime_in_Seconds");
       addr[nt] = &All.TimeLimitCPU;
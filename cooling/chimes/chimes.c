@@ -40,6 +40,80 @@
 #ifdef CHIMES
 
 
+#ifdef CHIMES_PERSISTENT_SOLVER
+/* CVode workspace for one length of the integrated vector (the number of species in the reduced network, plus one if the 
+ * temperature is evolved). Re-using it for a vector of a different length would require re-creating it, so each thread keeps 
+ * one of these for every length that it encounters. */ 
+struct chimes_solver_workspace 
+{
+  void *cvode_mem; 
+  N_Vector y; 
+  N_Vector abstol_vector; 
+  SUNMatrix A_sun; 
+  SUNLinearSolver LS_sun; 
+}; 
+
+/* Per-thread workspaces: the current rates arrays, and the CVode workspaces indexed by vector length. These are created on 
+ * first use by the thread that owns them, kept for the whole run, and re-initialised with CVodeReInit() for each particle. */ 
+struct chimes_thread_workspace 
+{
+  int rates_allocated; 
+  struct chimes_current_rates_struct chimes_current_rates; 
+  struct chimes_solver_workspace solver[CHIMES_TOTSIZE + 2]; 
+}; 
+
+static struct chimes_thread_workspace *chimes_thread_workspaces = NULL; 
+static int chimes_N_thread_workspaces = 0; 
+
+/** 
+ * @brief Allocates the per-thread workspaces. 
+ * 
+ * Allocates one (empty) #chimes_thread_workspace for each 
+ * OpenMP thread. This must be called outside of any 
+ * parallel region, before the first call to #chimes_network(). 
+ */ 
+void allocate_chimes_thread_workspaces(void) 
+{
+  if (chimes_thread_workspaces != NULL) 
+    return; 
+
+  chimes_N_thread_workspaces = 1; 
+#ifdef _OPENMP
+  chimes_N_thread_workspaces = omp_get_max_threads(); 
+#endif
+  chimes_thread_workspaces = (struct chimes_thread_workspace *) calloc(chimes_N_thread_workspaces, sizeof(struct chimes_thread_workspace)); 
+}
+
+/** 
+ * @brief Returns the workspace of the calling thread. 
+ * 
+ * @param myGlobalVars The #globalVariables struct. 
+ */ 
+static struct chimes_thread_workspace *get_chimes_thread_workspace(struct globalVariables *myGlobalVars) 
+{
+  int thread_id = 0; 
+  struct chimes_thread_workspace *workspace; 
+#ifdef _OPENMP
+  thread_id = omp_get_thread_num(); 
+#endif
+
+  if ((chimes_thread_workspaces == NULL) || (thread_id >= chimes_N_thread_workspaces)) 
+    {
+      printf("CHIMES error: no solver workspace for thread %d (%d allocated). allocate_chimes_thread_workspaces() must be called first, and the number of threads must not grow afterwards.\n", thread_id, chimes_N_thread_workspaces); 
+      chimes_exit(); 
+    }
+
+  workspace = &chimes_thread_workspaces[thread_id]; 
+  if (workspace->rates_allocated == 0) 
+    {
+      allocate_current_rates_memory(&(workspace->chimes_current_rates), myGlobalVars); 
+      workspace->rates_allocated = 1; 
+    }
+
+  return workspace; 
+}
+#endif 
+
 /** 
  * @brief Sets equilibrium abundances. 
  * 
@@ -74,6 +148,51 @@ void set_equilibrium_abundances_from_tables(struct UserData data)
   return;
 }
 
+#ifdef COOL_EQM_FASTPATH
+/** 
+ * @brief Checks whether the equilibrium tables apply. 
+ * 
+ * Returns 1 if the temperature and density of the gas lie 
+ * within the range of the equilibrium abundance tables, its 
+ * metallicity is not above that range (below it, the lowest 
+ * bin is used, as in #set_equilibrium_abundances_from_tables()), 
+ * and any additional (local) radiation fields are weaker than 
+ * the first spectrum, for which the tables were computed, by 
+ * at least the factor CHIMES_EQM_FASTPATH_RADIATION_RATIO. 
+ * Returns 0 otherwise. 
+ * 
+ * @param data The #UserData struct containing the input data. 
+ */ 
+static int eqm_tables_apply(struct UserData data) 
+{
+  int i; 
+  ChimesFloat log_T, log_nH, log_Z; 
+
+  const int N_T = chimes_table_eqm_abundances.N_Temperatures;
+  const int N_nH = chimes_table_eqm_abundances.N_Densities;
+  const int N_Z = chimes_table_eqm_abundances.N_Metallicities; 
+
+  log_T = chimes_log10(data.myGasVars->temperature); 
+  log_nH = chimes_log10(data.myGasVars->nH_tot); 
+  log_Z = chimes_log10(chimes_max(data.myGasVars->metallicity, CHIMES_FLT_MIN)); 
+
+  if ((log_T < chimes_table_eqm_abundances.Temperatures[0]) || (log_T > chimes_table_eqm_abundances.Temperatures[N_T - 1])) 
+    return 0; 
+  if ((log_nH < chimes_table_eqm_abundances.Densities[0]) || (log_nH > chimes_table_eqm_abundances.Densities[N_nH - 1])) 
+    return 0; 
+  if (log_Z > chimes_table_eqm_abundances.Metallicities[N_Z - 1]) 
+    return 0; 
+
+  for (i = 1; i < data.myGlobalVars->N_spectra; i++) 
+    {
+      if (data.myGasVars->isotropic_photon_density[i] * CHIMES_EQM_FASTPATH_RADIATION_RATIO > data.myGasVars->isotropic_photon_density[0]) 
+	return 0; 
+    }
+
+  return 1; 
+}
+#endif
+
 /** 
  * @brief Prints the gasVariables struct. 
  * 
@@ -176,8 +295,15 @@ void chimes_network(struct gasVariables *myGasVars, struct globalVariables *myGl
   struct Species_Structure species[myGlobalVars->totalNumberOfSpecies];  
   struct UserData data;
 
+#ifdef CHIMES_PERSISTENT_SOLVER
+  struct chimes_thread_workspace *workspace = get_chimes_thread_workspace(myGlobalVars); 
+  struct chimes_solver_workspace *solver; 
+  long int N_cvode_steps; 
+  myGasVars->N_cvode_steps = 0; 
+#else 
   struct chimes_current_rates_struct chimes_current_rates; 
   allocate_current_rates_memory(&chimes_current_rates, myGlobalVars); 
+#endif
 
   set_species_structures(species, myGasVars, &total_network_size, &nonmolecular_network_size, myGlobalVars);
 
@@ -186,7 +312,11 @@ void chimes_network(struct gasVariables *myGasVars, struct globalVariables *myGl
   data.myGasVars = myGasVars;
   data.myGlobalVars = myGlobalVars;
   data.species = species; 
+#ifdef CHIMES_PERSISTENT_SOLVER
+  data.chimes_current_rates = &(workspace->chimes_current_rates); 
+#else 
   data.chimes_current_rates = &chimes_current_rates; 
+#endif
 
   if (myGasVars->temperature <= myGlobalVars->T_mol)
     {
@@ -258,7 +388,9 @@ void chimes_network(struct gasVariables *myGasVars, struct globalVariables *myGl
       else	  
 	do_equilibrium_cooling(data); 
 
+#ifndef CHIMES_PERSISTENT_SOLVER
       free_current_rates_memory(&chimes_current_rates, myGlobalVars); 
+#endif
 
       return;
     }
@@ -338,7 +470,9 @@ void chimes_network(struct gasVariables *myGasVars, struct globalVariables *myGl
       if (data.myGasVars->ThermEvolOn == 1) 
 	myGasVars->temperature = chimes_max(new_energy / (1.5f * calculate_total_number_density(myGasVars->abundances, myGasVars->nH_tot, myGlobalVars) * BOLTZMANNCGS), myGasVars->TempFloor); 
       
+#ifndef CHIMES_PERSISTENT_SOLVER
       free_current_rates_memory(&chimes_current_rates, myGlobalVars); 
+#endif
 
       return; 
     }
@@ -348,7 +482,67 @@ void chimes_network(struct gasVariables *myGasVars, struct globalVariables *myGl
        * Explicit solution is insufficient. * 
        * Use implicit solver.               *
        **************************************/ 
+
+#ifdef COOL_EQM_FASTPATH
+      if (myGlobalVars->eqm_fastpath_ratio > 0) 
+	{
+	  /* If the gas cools (or heats) to equilibrium 
+	   * well within the time step, its final state 
+	   * is given by the equilibrium tables, so take 
+	   * it from there (as for ForceEqOn == 1) rather 
+	   * than integrating the full network. */ 
+	  if ((myGasVars->ThermEvolOn == 1) && (fabs(cool_rate) * myGasVars->hydro_timestep > myGlobalVars->eqm_fastpath_ratio * old_energy) && (eqm_tables_apply(data) == 1)) 
+	    {
+	      do_equilibrium_cooling(data); 
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+	      myGlobalVars->N_eqm_fastpath[0]++; 
+
+#ifndef CHIMES_PERSISTENT_SOLVER
+	      free_current_rates_memory(&chimes_current_rates, myGlobalVars); 
+#endif
+
+	      return; 
+	    }
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+	  myGlobalVars->N_eqm_fastpath[1]++; 
+	}
+#endif
+
       
+#ifdef CHIMES_PERSISTENT_SOLVER
+      /* Take the workspace of this thread for the 
+       * current vector length, creating the vectors 
+       * the first time that this length is needed. */ 
+      if (myGasVars->ThermEvolOn == 0) 
+	solver = &(workspace->solver[data.network_size]); 
+      else 
+	solver = &(workspace->solver[data.network_size + 1]); 
+
+      if (solver->cvode_mem == NULL) 
+	{
+	  if (myGasVars->ThermEvolOn == 0)
+	    {
+	      solver->y = N_VNew_Serial(data.network_size);
+	      solver->abstol_vector = N_VNew_Serial(data.network_size);
+	    }
+	  else 
+	    {
+	      solver->y = N_VNew_Serial(data.network_size + 1);
+	      solver->abstol_vector = N_VNew_Serial(data.network_size + 1);
+	    }
+	}
+      y = solver->y; 
+      abstol_vector = solver->abstol_vector; 
+
+      if (myGasVars->ThermEvolOn == 1)
+	{
+	  internal_energy = myGasVars->temperature * 1.5f * calculate_total_number_density(myGasVars->abundances, myGasVars->nH_tot, myGlobalVars) * BOLTZMANNCGS;
+	  NV_Ith_S(y, data.network_size) = (realtype) internal_energy;
+#else 
       /* Create a serial vector of length network_size
        * for the initial conditions. */
       if (myGasVars->ThermEvolOn == 0)
@@ -362,6 +556,7 @@ void chimes_network(struct gasVariables *myGasVars, struct globalVariables *myGl
 	  internal_energy = myGasVars->temperature * 1.5f * calculate_total_number_density(myGasVars->abundances, myGasVars->nH_tot, myGlobalVars) * BOLTZMANNCGS;
 	  NV_Ith_S(y, data.network_size) = (realtype) internal_energy;
 	  abstol_vector = N_VNew_Serial(data.network_size + 1);
+#endif
 
 	  /* For the integration of the thermal energy,
 	   * set the absolute tolerance to the minimum 
@@ -390,6 +585,51 @@ void chimes_network(struct gasVariables *myGasVars, struct globalVariables *myGl
       reltol = (realtype) myGlobalVars->relativeTolerance;
       abstol_scalar = (realtype) myGlobalVars->absoluteTolerance;
     
+#ifdef CHIMES_PERSISTENT_SOLVER
+      if (solver->cvode_mem == NULL) 
+	{
+	  /* First use of this workspace: create and 
+	   * initialise the solver as below, and attach 
+	   * a dense matrix and linear solver that are 
+	   * kept together with it. */ 
+	  cvode_mem = CVodeCreate(CV_BDF);
+	  data.cvode_mem = cvode_mem;
+	  CVodeSetUserData(cvode_mem, &data);
+	  CVodeSetMaxNumSteps(cvode_mem, MAXSTEPS);
+	  CVodeSetErrHandlerFn(cvode_mem, chimes_err_handler_fn, &data); 
+	  CVodeInit(cvode_mem, f, 0.0f, y);
+
+	  if (myGasVars->ThermEvolOn == 0)
+	    solver->A_sun = SUNDenseMatrix(data.network_size, data.network_size);
+	  else 
+	    solver->A_sun = SUNDenseMatrix(data.network_size + 1, data.network_size + 1);
+	  solver->LS_sun = SUNLinSol_Dense(y, solver->A_sun);
+	  CVodeSetLinearSolver(cvode_mem, solver->LS_sun, solver->A_sun);
+#ifdef CHIMES_ANALYTIC_JACOBIAN
+	  CVodeSetJacFn(cvode_mem, chimes_jacobian); 
+#endif
+	  CVodeSetMaxConvFails(cvode_mem, 5000);
+	  solver->cvode_mem = cvode_mem; 
+	}
+      else 
+	{
+	  /* Re-use the workspace: point it at the data 
+	   * of this particle, and restart the integration 
+	   * from t = 0 with the new initial conditions. 
+	   * This also resets the step size and step 
+	   * counters, and forces a new Jacobian. */ 
+	  cvode_mem = solver->cvode_mem; 
+	  data.cvode_mem = cvode_mem;
+	  CVodeSetUserData(cvode_mem, &data);
+	  CVodeSetErrHandlerFn(cvode_mem, chimes_err_handler_fn, &data); 
+	  CVodeReInit(cvode_mem, 0.0f, y); 
+	}
+
+      if ((myGasVars->ThermEvolOn == 0) && (myGlobalVars->scale_metal_tolerances == 0))
+	CVodeSStolerances(cvode_mem, reltol, abstol_scalar);
+      else
+	CVodeSVtolerances(cvode_mem, reltol, abstol_vector); 
+#else 
       /* Use CVodeCreate to create the solver 
        * memory and specify the Backward Differentiation
        * Formula. Note that CVODE now uses Newton iteration
@@ -438,10 +678,16 @@ void chimes_network(struct gasVariables *myGasVars, struct globalVariables *myGl
       /* Attach the matrix and linear 
        * solver to CVode. */ 
       CVodeSetLinearSolver(cvode_mem, LS_sun, A_sun);
+#ifdef CHIMES_ANALYTIC_JACOBIAN
+      /* Use the analytic Jacobian rather than 
+       * difference quotients of f. */ 
+      CVodeSetJacFn(cvode_mem, chimes_jacobian); 
+#endif
       
       /* Specify the maximum number of convergence 
        * test failures. */
       CVodeSetMaxConvFails(cvode_mem, 5000);
+#endif
 
       /* Call CVode() to integrate the chemistry. */ 
       CVode(cvode_mem, (realtype) myGasVars->hydro_timestep, y, &t, CV_NORMAL);
@@ -465,6 +711,12 @@ void chimes_network(struct gasVariables *myGasVars, struct globalVariables *myGl
       if (myGasVars->ThermEvolOn == 1)
 	myGasVars->temperature = chimes_max(((ChimesFloat) NV_Ith_S(y, data.network_size)) / (1.5f * calculate_total_number_density(myGasVars->abundances, myGasVars->nH_tot, myGlobalVars) * BOLTZMANNCGS), myGasVars->TempFloor); 
 
+#ifdef CHIMES_PERSISTENT_SOLVER
+      /* Record the work done, to order the 
+       * particles by cost on the next step. */ 
+      if (CVodeGetNumSteps(cvode_mem, &N_cvode_steps) == CV_SUCCESS) 
+	myGasVars->N_cvode_steps = (int) N_cvode_steps; 
+#else 
       SUNLinSolFree(LS_sun);
       SUNMatDestroy(A_sun);
       N_VDestroy_Serial(y);
@@ -472,6 +724,7 @@ void chimes_network(struct gasVariables *myGasVars, struct globalVariables *myGl
       CVodeFree(&cvode_mem);
 
       free_current_rates_memory(&chimes_current_rates, myGlobalVars); 
+#endif
 
       return;
   }
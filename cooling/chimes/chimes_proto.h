@@ -20,6 +20,9 @@
 #include <sundials/sundials_types.h>
 #include <nvector/nvector_serial.h> 
 #include <sundials/sundials_dense.h>
+#ifdef CHIMES_ANALYTIC_JACOBIAN
+#include <sundials/sundials_matrix.h>
+#endif
 #include <hdf5.h>
 
 
@@ -35,6 +38,13 @@
 /*!< String length for species names. */
 #define CHIMES_NAME_STR_LENGTH 8 
 
+#ifdef COOL_EQM_FASTPATH
+/*!< The equilibrium tables (computed for the first spectrum only) are only used by the COOL_EQM_FASTPATH 
+ * fast path if all other radiation fields are weaker than the first spectrum by at least this factor. 
+ * This is independent of eqm_fastpath_ratio, which compares the cooling time with the timestep. */ 
+#define CHIMES_EQM_FASTPATH_RADIATION_RATIO 100.0 
+#endif
+
 #ifndef chimes_max
 #define chimes_max(a,b) ((a) > (b) ? (a) : (b))
 #endif
@@ -83,6 +93,9 @@ struct gasVariables
   ChimesFloat constant_heating_rate;     /*!< Extra heating term to add to the radiative cooling rates (positive for heating). Units: erg s^-1 cm^-3. */
   ChimesFloat *abundances;               /*!<  Abundance array, defined for species i as n_i / n_H. */ 
   void *hybrid_data;                     /*!< Structure containing extra data for the hybrid cooling function. */ 
+#ifdef CHIMES_PERSISTENT_SOLVER
+  int N_cvode_steps;                     /*!< Number of internal CVode steps taken in the last call to #chimes_network() (0 if the implicit solver was not needed); used to order the particles by expected cost. */
+#endif
 };
 
 /**  
@@ -114,6 +127,10 @@ struct globalVariables
   int scale_metal_tolerances;                  /*!< Scale the absolute tolerances by the corresponding element abundance. */
   int chimes_debug;                            /*!< If set to 1, print gasVariables if CVODE returns an error or warning message. */ 
   int hybrid_cooling_mode;                     /*!< 0 - do not use hybrid cooling; 1 - use hybrid cooling. */
+#ifdef COOL_EQM_FASTPATH
+  ChimesFloat eqm_fastpath_ratio;              /*!< Use the equilibrium tables when the cooling time is shorter than hydro_timestep / eqm_fastpath_ratio (0 - never). */ 
+  long long N_eqm_fastpath[2];                 /*!< Number of particles that used the equilibrium tables [0], or went on to CVode [1], when the fast path was enabled. */ 
+#endif
   void *hybrid_data;                           /*!< Structure containing extra data for the hybrid cooling function. */
   double (*hybrid_cooling_fn)(struct gasVariables *myGasVars, struct globalVariables *myGlobalVars); /*!< Hybrid cooling function. */
   void (*allocate_gas_hybrid_data_fn)(struct gasVariables *myGasVars); /*!< Allocate memory for the gasVars hybrid_data struct. */
@@ -609,6 +626,9 @@ void chimes_err_handler_fn(int error_code, const char *module, const char *funct
 void cvErrHandler(int error_code, const char *module, const char *function, char *msg, void *data);
 void set_equilibrium_abundances_from_tables(struct UserData data);
 void chimes_print_gas_vars(FILE *log_file, struct gasVariables *myGasVars, struct globalVariables *myGlobalVars); 
+#ifdef CHIMES_PERSISTENT_SOLVER
+void allocate_chimes_thread_workspaces(void); 
+#endif
 
 // init_chimes.c 
 void chimes_exit_default(void); 
@@ -631,6 +651,9 @@ void load_redshift_dependent_UVB(ChimesFloat redshift, int bin_index, struct glo
 // rate_equations.c 
 void check_constraint_equations(struct gasVariables *myGasVars, struct globalVariables *myGlobalVars);
 int f(realtype t, N_Vector y, N_Vector ydot, void *user_data);
+#ifdef CHIMES_ANALYTIC_JACOBIAN
+int chimes_jacobian(realtype t, N_Vector y, N_Vector fy, SUNMatrix J, void *user_data, N_Vector tmp1, N_Vector tmp2, N_Vector tmp3);
+#endif
 
 // update_rates.c 
 void set_initial_rate_coefficients(struct gasVariables *myGasVars, struct globalVariables *myGlobalVars, struct UserData data); 
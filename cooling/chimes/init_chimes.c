@@ -3447,6 +3447,12 @@ void init_chimes(struct globalVariables *myGlobalVars)
   myGlobalVars->hybrid_cooling_fn = NULL;
   myGlobalVars->allocate_gas_hybrid_data_fn = NULL;
   myGlobalVars->free_gas_hybrid_data_fn = NULL;
+
+#ifdef CHIMES_PERSISTENT_SOLVER
+  /* Per-thread solver workspaces, which are 
+   * kept between calls to chimes_network(). */ 
+  allocate_chimes_thread_workspaces(); 
+#endif
 }
 
 /** 
@@ -3474,6 +3480,10 @@ void allocate_gas_abundances_memory(struct gasVariables *myGasVars, struct globa
     (*myGlobalVars->allocate_gas_hybrid_data_fn)(myGasVars);
   else
     myGasVars->hybrid_data = NULL; 
+
+#ifdef CHIMES_PERSISTENT_SOLVER
+  myGasVars->N_cvode_steps = 0; 
+#endif
 }
 
 /** 
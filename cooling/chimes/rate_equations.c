@@ -32,6 +32,8 @@
 #include <nvector/nvector_serial.h> 
 #include <sundials/sundials_types.h>
 #include <sundials/sundials_dense.h> 
+#include <sundials/sundials_math.h> 
+#include <sunmatrix/sunmatrix_dense.h> 
 #include "../../allvars.h"
 #include "chimes_vars.h"
 
@@ -564,5 +566,329 @@ int f(realtype t, N_Vector y, N_Vector ydot, void *user_data)
   return 0;
 }
 
+#ifdef CHIMES_ANALYTIC_JACOBIAN
+/** 
+ * @brief Adds one reaction to the Jacobian. 
+ * 
+ * Adds the derivative of the rate of one reaction with respect 
+ * to the abundance of species k to the rows of the species that 
+ * the reaction destroys and creates. Each list ends after n 
+ * entries or at its first negative entry, and the last product 
+ * is created last_product_yield times per reaction (the number 
+ * of electrons released in Auger ionisations, otherwise 1). 
+ * Species that are not in the vector y are skipped. 
+ * 
+ * @param J The Jacobian matrix. 
+ * @param y_index Position in y of each species (-1 if not integrated). 
+ * @param k The species with respect to which the rate is differentiated. 
+ * @param dr The derivative of the rate with respect to the abundance of k. 
+ * @param reactants The species destroyed by the reaction. 
+ * @param n_reactants Maximum number of reactants. 
+ * @param products The species created by the reaction. 
+ * @param n_products Maximum number of products. 
+ * @param last_product_yield Number of times the last product is created. 
+ */ 
+static void jacobian_add_reaction(SUNMatrix J, int *y_index, int k, realtype dr, int *reactants, int n_reactants, int *products, int n_products, realtype last_product_yield) 
+{
+  int m; 
+
+  if ((y_index[k] < 0) || (dr == 0)) 
+    return; 
+
+  for (m = 0; m < n_reactants; m++) 
+    {
+      if (reactants[m] < 0) 
+	break; 
+      if (y_index[reactants[m]] >= 0) 
+	SM_ELEMENT_D(J, y_index[reactants[m]], y_index[k]) -= dr; 
+    }
+
+  for (m = 0; m < n_products; m++) 
+    {
+      if (products[m] < 0) 
+	break; 
+      if (y_index[products[m]] >= 0) 
+	SM_ELEMENT_D(J, y_index[products[m]], y_index[k]) += (m == n_products - 1) ? dr * last_product_yield : dr; 
+    }
+}
+
+/** 
+ * @brief Adds one mass-action reaction to the Jacobian. 
+ * 
+ * For a reaction with rate = coefficient * x_0 * x_1 * ..., 
+ * where x_i are the abundances of its reactants, adds the 
+ * derivatives with respect to each reactant. Repeated reactants 
+ * (e.g. H2 + H2) are handled by summing over each occurrence. 
+ * 
+ * @param J The Jacobian matrix. 
+ * @param y_index Position in y of each species (-1 if not integrated). 
+ * @param x The abundance array. 
+ * @param coefficient The rate divided by the product of the reactant abundances. 
+ * @param reactants The reactants (also the species destroyed by the reaction). 
+ * @param n_reactants Maximum number of reactants. 
+ * @param products The species created by the reaction. 
+ * @param n_products Maximum number of products. 
+ * @param last_product_yield Number of times the last product is created. 
+ */ 
+static void jacobian_add_mass_action(SUNMatrix J, int *y_index, ChimesFloat *x, realtype coefficient, int *reactants, int n_reactants, int *products, int n_products, realtype last_product_yield) 
+{
+  int k, m; 
+  realtype dr; 
+
+  for (k = 0; k < n_reactants; k++) 
+    {
+      if (reactants[k] < 0) 
+	break; 
+
+      dr = coefficient; 
+      for (m = 0; m < n_reactants; m++) 
+	{
+	  if (reactants[m] < 0) 
+	    break; 
+	  if (m != k) 
+	    dr *= x[reactants[m]]; 
+	}
+
+      jacobian_add_reaction(J, y_index, reactants[k], dr, reactants, n_reactants, products, n_products, last_product_yield); 
+    }
+}
+
+/** 
+ * @brief Defines the Jacobian of the right-hand side function. 
+ * 
+ * Computes the Jacobian of f() directly from the reaction tables 
+ * (the same reactant and product lists used by update_rates() and 
+ * update_rate_vector()), rather than letting CVode build it from 
+ * one evaluation of f() per column. The rate coefficients are held 
+ * fixed, so the weak dependences of some coefficients on the 
+ * abundances (e.g. through shielding, or the collisional 
+ * dissociation of H2) are neglected. This matrix is only used in 
+ * the Newton iteration, so these approximations can affect the 
+ * convergence rate but not the accuracy of the solution. 
+ * 
+ * If thermal evolution is switched on, the energy column is 
+ * computed from one difference quotient of f(), and the energy 
+ * row from the cooling and photoheating channels that are linear 
+ * in the abundances (the molecular cooling functions, Compton 
+ * cooling and cosmic ray heating are neglected). 
+ * 
+ * @param t Current time. 
+ * @param y Vector containing the variables to be integrated. 
+ * @param fy The right-hand side function evaluated at y. 
+ * @param J Output Jacobian matrix (dense). 
+ * @param user_data The #UserData struct containing the input data. 
+ * @param tmp1 Work vector. 
+ * @param tmp2 Work vector. 
+ * @param tmp3 Work vector. 
+ */ 
+int chimes_jacobian(realtype t, N_Vector y, N_Vector fy, SUNMatrix J, void *user_data, N_Vector tmp1, N_Vector tmp2, N_Vector tmp3) 
+{
+  int i, j, n, xHII_index; 
+  int y_index[CHIMES_TOTSIZE]; 
+  ChimesFloat log_xHII, d_xHII, x_elec, cr_secondary[2]; 
+  realtype coefficient, dr, E, dE, dC; 
+  struct UserData *data = (struct UserData *) user_data; 
+  struct gasVariables *myGasVars = data->myGasVars; 
+  struct globalVariables *myGlobalVars = data->myGlobalVars; 
+  struct chimes_current_rates_struct *rates = data->chimes_current_rates; 
+  ChimesFloat *x = myGasVars->abundances; 
+  ChimesFloat nH = myGasVars->nH_tot; 
+  const int mol = data->mol_flag_index; 
+  const int E_row = data->network_size; 
+
+  SUNMatZero(J); 
+
+  /* Energy column, from a difference quotient of f. 
+   * This has to come first, as f() overwrites the 
+   * abundances, temperature and rates in the UserData. */ 
+  if (myGasVars->ThermEvolOn == 1) 
+    {
+      E = NV_Ith_S(y, E_row); 
+      dE = SUNRsqrt(UNIT_ROUNDOFF) * chimes_max(fabs(E), CHIMES_FLT_MIN); 
+      N_VScale(1.0, y, tmp1); 
+      NV_Ith_S(tmp1, E_row) = E + dE; 
+      dE = NV_Ith_S(tmp1, E_row) - E; 
+      if ((dE > 0) && (f(t, tmp1, tmp2, user_data) == 0)) 
+	{
+	  for (i = 0; i <= E_row; i++) 
+	    SM_ELEMENT_D(J, i, E_row) = (NV_Ith_S(tmp2, i) - NV_Ith_S(fy, i)) / dE; 
+	}
+    }
+
+  /* Set the abundances, temperature and rates at y, 
+   * as in f(). */ 
+  i = 0; 
+  for (j = 0; j < myGlobalVars->totalNumberOfSpecies; j++) 
+    {
+      if (data->species[j].include_species == 1) 
+	{
+	  x[j] = (ChimesFloat) NV_Ith_S(y, i); 
+	  y_index[j] = i; 
+	  i++; 
+	}
+      else 
+	y_index[j] = -1; 
+    }
+
+  if (myGasVars->ThermEvolOn == 1) 
+    myGasVars->temperature = chimes_max(((ChimesFloat) NV_Ith_S(y, E_row)) / (1.5f * calculate_total_number_density(x, nH, myGlobalVars) * BOLTZMANNCGS), 10.1f); 
+
+  update_rate_coefficients(myGasVars, myGlobalVars, *data, myGasVars->ThermEvolOn); 
+  update_rates(myGasVars, myGlobalVars, *data); 
+
+  // T_dependent reactions: rate = coefficient * nH^(n-1) * x_0 * ... * x_(n-1) 
+  for (i = 0; i < chimes_table_T_dependent.N_reactions[mol]; i++) 
+    {
+      coefficient = rates->T_dependent_rate_coefficient[i]; 
+      for (n = 1; n < 3; n++) 
+	{
+	  if (chimes_table_T_dependent.reactants[chimes_flatten_index_2d(i, n, 3)] < 0) 
+	    break; 
+	  coefficient *= nH; 
+	}
+      jacobian_add_mass_action(J, y_index, x, coefficient, &(chimes_table_T_dependent.reactants[chimes_flatten_index_2d(i, 0, 3)]), 3, &(chimes_table_T_dependent.products[chimes_flatten_index_2d(i, 0, 3)]), 3, 1.0); 
+    }
+
+  // constant reactions 
+  for (i = 0; i < chimes_table_constant.N_reactions[mol]; i++) 
+    jacobian_add_mass_action(J, y_index, x, chimes_table_constant.rates[i] * nH, &(chimes_table_constant.reactants[chimes_flatten_index_2d(i, 0, 2)]), 2, &(chimes_table_constant.products[chimes_flatten_index_2d(i, 0, 3)]), 3, 1.0); 
+
+  // recombination_AB reactions 
+  for (i = 0; i < chimes_table_recombination_AB.N_reactions[mol]; i++) 
+    jacobian_add_mass_action(J, y_index, x, rates->recombination_AB_rate_coefficient[i] * nH, &(chimes_table_recombination_AB.reactants[chimes_flatten_index_2d(i, 0, 2)]), 2, &(chimes_table_recombination_AB.products[i]), 1, 1.0); 
+
+  // grain_recombination reactions 
+  for (i = 0; i < chimes_table_grain_recombination.N_reactions[mol]; i++) 
+    jacobian_add_mass_action(J, y_index, x, rates->grain_recombination_rate_coefficient[i] * nH * myGasVars->dust_ratio, &(chimes_table_grain_recombination.reactants[chimes_flatten_index_2d(i, 0, 2)]), 2, &(chimes_table_grain_recombination.products[i]), 1, 1.0); 
+
+  // cosmic_ray reactions (the secondary ionisation factor is held fixed) 
+  if (myGasVars->cr_rate > 0.0) 
+    {
+      log_xHII = chimes_log10(chimes_max(x[myGlobalVars->speciesIndices[sp_HII]], CHIMES_FLT_MIN)); 
+      const int N_xHII = chimes_table_bins.N_secondary_cosmic_ray_xHII; 
+      chimes_get_table_index(chimes_table_bins.secondary_cosmic_ray_xHII, N_xHII, log_xHII, &xHII_index, &d_xHII); 
+      for (j = 0; j < 2; j++) 
+	cr_secondary[j] = 1.0f + chimes_exp10(chimes_interpol_2d_fix_x(chimes_table_cosmic_ray.secondary_ratio, j, xHII_index, d_xHII, N_xHII)); 
+
+      for (i = 0; i < chimes_table_cosmic_ray.N_reactions[mol]; i++) 
+	{
+	  dr = myGasVars->cr_rate * chimes_table_cosmic_ray.rates[i]; 
+	  for (j = 0; j < 2; j++) 
+	    {
+	      if (i == chimes_table_cosmic_ray.secondary_base_reaction[j]) 
+		dr *= cr_secondary[j]; 
+	    }
+	  jacobian_add_reaction(J, y_index, chimes_table_cosmic_ray.reactants[i], dr, &(chimes_table_cosmic_ray.reactants[i]), 1, &(chimes_table_cosmic_ray.products[chimes_flatten_index_2d(i, 0, 3)]), 3, 1.0); 
+	}
+    }
+
+  if (mol) 
+    {
+      // H2_dust_formation: rate = coefficient * x_0 (the second reactant does not enter the rate) 
+      jacobian_add_reaction(J, y_index, chimes_table_H2_dust_formation.reactants[0], rates->H2_dust_formation_rate_coefficient * myGasVars->dust_ratio * nH, chimes_table_H2_dust_formation.reactants, 2, chimes_table_H2_dust_formation.products, 1, 1.0); 
+
+      // H2_collis_dissoc 
+      for (i = 0; i < chimes_table_H2_collis_dissoc.N_reactions[mol]; i++) 
+	jacobian_add_mass_action(J, y_index, x, rates->H2_collis_dissoc_rate_coefficient[i] * nH, &(chimes_table_H2_collis_dissoc.reactants[chimes_flatten_index_2d(i, 0, 2)]), 2, &(chimes_table_H2_collis_dissoc.products[chimes_flatten_index_2d(i, 0, 3)]), 3, 1.0); 
+
+      // CO_cosmic_ray: rate = coefficient * sqrt(xCO), where the coefficient is proportional to xH2 
+      if (myGasVars->cr_rate > 0.0) 
+	{
+	  for (i = 0; i < chimes_table_CO_cosmic_ray.N_reactions[mol]; i++) 
+	    {
+	      j = chimes_table_CO_cosmic_ray.reactants[i]; 
+	      if (x[j] > 0) 
+		jacobian_add_reaction(J, y_index, j, 0.5 * rates->CO_cosmic_ray_rate[i] / x[j], &(chimes_table_CO_cosmic_ray.reactants[i]), 1, &(chimes_table_CO_cosmic_ray.products[chimes_flatten_index_2d(i, 0, 2)]), 2, 1.0); 
+	      if (x[myGlobalVars->speciesIndices[sp_H2]] > 0) 
+		jacobian_add_reaction(J, y_index, myGlobalVars->speciesIndices[sp_H2], rates->CO_cosmic_ray_rate[i] / x[myGlobalVars->speciesIndices[sp_H2]], &(chimes_table_CO_cosmic_ray.reactants[i]), 1, &(chimes_table_CO_cosmic_ray.products[chimes_flatten_index_2d(i, 0, 2)]), 2, 1.0); 
+	    }
+	}
+    }
+
+  // Photo-reactions: rate = coefficient * x_0 
+  if (myGlobalVars->N_spectra > 0) 
+    {
+      for (i = 0; i < chimes_table_photoion_fuv.N_reactions[mol]; i++) 
+	jacobian_add_mass_action(J, y_index, x, rates->photoion_fuv_rate_coefficient[i], &(chimes_table_photoion_fuv.reactants[i]), 1, &(chimes_table_photoion_fuv.products[chimes_flatten_index_2d(i, 0, 2)]), 2, 1.0); 
+
+      for (i = 0; i < chimes_table_photoion_euv.N_reactions[mol]; i++) 
+	jacobian_add_mass_action(J, y_index, x, rates->photoion_euv_rate_coefficient[i], &(chimes_table_photoion_euv.reactants[i]), 1, &(chimes_table_photoion_euv.products[chimes_flatten_index_2d(i, 0, 2)]), 2, 1.0); 
+
+      for (i = 0; i < chimes_table_photoion_auger_fuv.N_reactions[mol]; i++) 
+	jacobian_add_mass_action(J, y_index, x, rates->photoion_auger_fuv_rate_coefficient[i], &(chimes_table_photoion_auger_fuv.reactants[i]), 1, &(chimes_table_photoion_auger_fuv.products[chimes_flatten_index_2d(i, 0, 2)]), 2, chimes_table_photoion_auger_fuv.number_of_electrons[i]); 
+
+      for (i = 0; i < chimes_table_photoion_auger_euv.N_reactions[mol]; i++) 
+	jacobian_add_mass_action(J, y_index, x, rates->photoion_auger_euv_rate_coefficient[i], &(chimes_table_photoion_auger_euv.reactants[i]), 1, &(chimes_table_photoion_auger_euv.products[chimes_flatten_index_2d(i, 0, 2)]), 2, chimes_table_photoion_auger_euv.number_of_electrons[i]); 
+
+      for (i = 0; i < chimes_table_photodissoc_group1.N_reactions[mol]; i++) 
+	jacobian_add_mass_action(J, y_index, x, rates->photodissoc_group1_rate_coefficient[i], &(chimes_table_photodissoc_group1.reactants[i]), 1, &(chimes_table_photodissoc_group1.products[chimes_flatten_index_2d(i, 0, 2)]), 2, 1.0); 
+
+      if (mol == 1) 
+	{
+	  for (i = 0; i < chimes_table_photodissoc_group2.N_reactions[mol]; i++) 
+	    jacobian_add_mass_action(J, y_index, x, rates->photodissoc_group2_rate_coefficient[i], &(chimes_table_photodissoc_group2.reactants[i]), 1, &(chimes_table_photodissoc_group2.products[chimes_flatten_index_2d(i, 0, 2)]), 2, 1.0); 
+
+	  for (i = 0; i < chimes_table_H2_photodissoc.N_reactions[mol]; i++) 
+	    jacobian_add_mass_action(J, y_index, x, rates->H2_photodissoc_rate_coefficient[i], &(chimes_table_H2_photodissoc.reactants[i]), 1, &(chimes_table_H2_photodissoc.products[chimes_flatten_index_2d(i, 0, 2)]), 2, 1.0); 
+
+	  for (i = 0; i < chimes_table_CO_photodissoc.N_reactions[mol]; i++) 
+	    jacobian_add_mass_action(J, y_index, x, rates->CO_photodissoc_rate_coefficient[i], &(chimes_table_CO_photodissoc.reactants[i]), 1, &(chimes_table_CO_photodissoc.products[chimes_flatten_index_2d(i, 0, 2)]), 2, 1.0); 
+	}
+    }
+
+  /* Energy row: d(-Lambda_net)/dx from the cooling and 
+   * photoheating channels that are linear in the abundances. 
+   * Below the temperature floor f() only allows net 
+   * heating, so this row is left at zero. */ 
+  if ((myGasVars->ThermEvolOn == 1) && (myGasVars->temperature > myGasVars->TempFloor)) 
+    {
+      update_cooling_rates(myGasVars, myGlobalVars, *data); 
+      x_elec = x[myGlobalVars->speciesIndices[sp_elec]]; 
+      j = myGlobalVars->speciesIndices[sp_elec]; 
+
+      for (i = 0; i < chimes_table_cooling.N_coolants; i++) 
+	{
+	  dC = nH * nH * rates->cooling_rate[i]; 
+	  if (y_index[chimes_table_cooling.coolants[i]] >= 0) 
+	    SM_ELEMENT_D(J, E_row, y_index[chimes_table_cooling.coolants[i]]) -= dC * x_elec; 
+	  if (y_index[j] >= 0) 
+	    SM_ELEMENT_D(J, E_row, y_index[j]) -= dC * x[chimes_table_cooling.coolants[i]]; 
+	}
+
+      for (i = 0; i < chimes_table_cooling.N_coolants_2d; i++) 
+	{
+	  dC = nH * nH * rates->cooling_rate_2d[i]; 
+	  if (y_index[chimes_table_cooling.coolants_2d[i]] >= 0) 
+	    SM_ELEMENT_D(J, E_row, y_index[chimes_table_cooling.coolants_2d[i]]) -= dC * x_elec; 
+	  if (y_index[j] >= 0) 
+	    SM_ELEMENT_D(J, E_row, y_index[j]) -= dC * x[chimes_table_cooling.coolants_2d[i]]; 
+	}
+
+      for (i = 0; i < chimes_table_cooling.N_coolants_4d; i++) 
+	{
+	  if (y_index[chimes_table_cooling.coolants_4d[i]] >= 0) 
+	    SM_ELEMENT_D(J, E_row, y_index[chimes_table_cooling.coolants_4d[i]]) -= nH * rates->cooling_rate_4d[i]; 
+	}
+
+      if (myGlobalVars->N_spectra > 0) 
+	{
+	  for (i = 0; i < chimes_table_photoion_fuv.N_reactions[mol]; i++) 
+	    {
+	      if (y_index[chimes_table_photoion_fuv.reactants[i]] >= 0) 
+		SM_ELEMENT_D(J, E_row, y_index[chimes_table_photoion_fuv.reactants[i]]) += nH * rates->photoion_fuv_heat_rate[i]; 
+	    }
+
+	  for (i = 0; i < chimes_table_photoion_euv.N_reactions[mol]; i++) 
+	    {
+	      if (y_index[chimes_table_photoion_euv.reactants[i]] >= 0) 
+		SM_ELEMENT_D(J, E_row, y_index[chimes_table_photoion_euv.reactants[i]]) += nH * rates->photoion_euv_heat_rate[i]; 
+	    }
+	}
+    }
+
+  return 0; 
+}
+#endif
+
 
 #endif
@@ -23,6 +23,9 @@
     they are only defined once in a global operation, then locked for particle-by-particle operations */
 /* requires the cooling table TREECOOL, which is included in the GIZMO source in the cooling directory */
 #define NCOOLTAB  2000 /* defines size of cooling table */
+#if defined(COOL_EQM_FASTPATH) && !defined(CHIMES) && !defined(COOL_GRACKLE) && !defined(RT_INFRARED)
+#define COOL_EQM_FASTPATH_TABULAR /* explicit fast path in DoCooling (RT_INFRARED iterates on the dust cooling as well, so uses the full iteration) */
+#endif
 
 #if !defined(CHIMES)
 static double Tmin = -1.0, Tmax = 9.0, deltaT; /* minimum/maximum temp, in log10(T/K) and temperature gridding: will be appropriately set in make_cooling_tables subroutine below */
@@ -48,6 +51,48 @@ struct Chimes_depletion_data_structure *ChimesDepletionData;
 #endif
 
 
+#ifdef CHIMES_PERSISTENT_SOLVER
+/* orders particles by the number of CVode steps their previous chemistry update took (most expensive first, ties by index), so the dynamic loop below
+    hands out the longest integrations first and the cheap ones (explicit or equilibrium updates) fill in the gaps at the end */
+static int chimes_compare_expected_cost(const void *a, const void *b)
+{
+    int i = *(const int *) a, j = *(const int *) b;
+    if(ChimesGasVars[i].N_cvode_steps > ChimesGasVars[j].N_cvode_steps) {return -1;}
+    if(ChimesGasVars[i].N_cvode_steps < ChimesGasVars[j].N_cvode_steps) {return +1;}
+    return (i < j) ? -1 : ((i > j) ? +1 : 0);
+}
+#endif
+
+
+#ifdef COOL_EQM_FASTPATH
+/* counts of cells which took (n[1]) or did not take (n[0]) the fast path in DoCooling, on this task since the last call to cooling_fastpath_counts */
+#ifdef COOL_EQM_FASTPATH_TABULAR
+static long long CoolingFastPath_N[2];
+static void cooling_fastpath_record(int hit)
+{
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+    CoolingFastPath_N[hit]++;
+}
+#endif
+
+/* returns the numbers of cells on this task which took the fast path (hits) or went through the full cooling/chemistry solution (misses) since the
+    last call, and resets them. CHIMES counts the particles which used the equilibrium tables as hits, and those integrated with CVode as misses. */
+void cooling_fastpath_counts(long long *n_hit, long long *n_miss)
+{
+#ifdef CHIMES
+    *n_hit = ChimesGlobalVars.N_eqm_fastpath[0]; *n_miss = ChimesGlobalVars.N_eqm_fastpath[1];
+    ChimesGlobalVars.N_eqm_fastpath[0] = ChimesGlobalVars.N_eqm_fastpath[1] = 0;
+#elif defined(COOL_EQM_FASTPATH_TABULAR)
+    *n_hit = CoolingFastPath_N[1]; *n_miss = CoolingFastPath_N[0];
+    CoolingFastPath_N[0] = CoolingFastPath_N[1] = 0;
+#else
+    *n_hit = *n_miss = 0;
+#endif
+}
+#endif
+
 
 /* this is the 'parent' loop to do the cell cooling+chemistry. this is now openmp-parallelized, since the semi-implicit iteration can be a non-negligible cost */
 void cooling_parent_routine(void)
@@ -55,8 +100,14 @@ void cooling_parent_routine(void)
     PRINT_STATUS("Cooling and Chemistry update");
     /* Determine indices of active particles. */
     int N_active=0, i, j, *active_indices; active_indices = (int *) malloc(N_gas * sizeof(int));
+#ifdef ACTIVE_PARTICLE_ARRAY
+    for(j = 0; j < NumActiveParticle; j++)
+    {
+        i = ActiveParticleList[j];
+#else
     for (i = FirstActiveParticle; i >= 0; i = NextActiveParticle[i])
     {
+#endif
         if(P[i].Type != 0) {continue;}
         if(P[i].Mass <= 0) {continue;}
 #ifdef GALSF_EFFECTIVE_EQS
@@ -68,6 +119,12 @@ void cooling_parent_routine(void)
         active_indices[N_active] = i;
         N_active++;
 	}
+#ifdef CHIMES_PERSISTENT_SOLVER
+    qsort(active_indices, N_active, sizeof(int), chimes_compare_expected_cost); /* longest-expected-first */
+#endif
+#if defined(CHIMES) && defined(COOL_EQM_FASTPATH)
+    ChimesGlobalVars.eqm_fastpath_ratio = (ChimesFloat) All.CoolingFastPathTimeRatio; /* can be changed on restart, so set here rather than in init_chimes */
+#endif
 
 #ifdef _OPENMP
 #pragma omp parallel private(i, j)
@@ -79,7 +136,11 @@ void cooling_parent_routine(void)
     for(j=0;j<N_active;j++)
     {
         i=active_indices[j]; /* actual particle index */
+#ifdef DOMAIN_MEASURED_COST
+        double t0_cost = my_second();
+#endif
         do_the_cooling_for_particle(i); /* do the actual cooling */
+        DOMAIN_MEASURED_COST_ADD(i, timediff(t0_cost, my_second())); /* stiff cooling can dominate the work of a particle */
     }
     } /* close parallel block */
     free(active_indices); /* free memory */
@@ -251,6 +312,20 @@ double DoCooling(double u_old, double rho, double dt, double ne_guess, int targe
     u = u_old; u_lower = u; u_upper = u; /* initialize values */
     LambdaNet = CoolingRateFromU(u, rho, ne_guess, target);
 
+#ifdef COOL_EQM_FASTPATH_TABULAR
+    int fastpath = 0;
+    if(All.CoolingFastPathTimeRatio > 0)
+    {
+        /* fast path: if the cooling (or heating) time is longer than CoolingFastPathTimeRatio times the timestep, u changes by less than a fraction
+            1/CoolingFastPathTimeRatio of itself, and the explicit update is accurate to second order in that fraction. take it and start the iteration
+            below from a zero-width bracket around it: this skips the bracketing and bisection, leaving one rate evaluation at the new u (so the
+            ionization state stored for the cell is consistent with it) */
+        if(fabs(ratefact * LambdaNet * dt) * All.CoolingFastPathTimeRatio < u_old) {fastpath = 1; u_lower = u_upper = u_old + ratefact * LambdaNet * dt;}
+        cooling_fastpath_record(fastpath);
+    }
+    if(!fastpath)
+#endif
+    {
     /* bracketing */
     if(u - u_old - ratefact * LambdaNet * dt < 0)	/* heating */
     {
@@ -270,6 +345,7 @@ double DoCooling(double u_old, double rho, double dt, double ne_guess, int targe
             u_upper /= 1.1; u_lower /= 1.1; iter_lower++;
         }
     }
+    }
 
     /* core iteration to convergence */
     do
@@ -103,11 +103,20 @@ static int *domainCountStars;
 #endif
 
 static int domain_allocated_flag = 0;
+#ifdef DOMAIN_MEASURED_COST
+static double MeasuredCostUnit = 1; /*!< time per gravity interaction, used to convert the measured work of the particles to the units of GravCost */
+#endif
 
 static int maxLoad, maxLoadsph;
 #ifdef SEPARATE_STELLARDOMAINDECOMP
 static int maxLoadstars;
 #endif
+#ifdef DOMAIN_MULTICONSTRAINT
+enum {DOMAIN_CONSTRAINT_GRAVITY, DOMAIN_CONSTRAINT_HYDRO, DOMAIN_CONSTRAINT_FEEDBACK, DOMAIN_CONSTRAINT_CHEMISTRY, DOMAIN_CONSTRAINT_PARTICLES, DOMAIN_CONSTRAINT_GAS};
+static const char *DomainConstraintName[DOMAIN_NCONSTRAINTS] = {"gravity", "hydro", "feedback", "chemistry", "particles", "gas"};
+static float *domainConstraintCost; /*!< the costs of each top-level leaf in each constraint (DOMAIN_NCONSTRAINTS consecutive values per leaf) */
+static double DomainConstraintBalance[DOMAIN_NCONSTRAINTS]; /*!< max/mean over tasks of each constraint in the last decomposition */
+#endif
 
 static double totgravcost, gravcost, totsphcost, sphcost;
 static long long totpartcount;
@@ -119,6 +128,7 @@ static int UseAllParticles;
 void domain_Decomposition(int UseAllTimeBins, int SaveKeys, int do_particle_mergesplit_key)
 {
     int i, ret, retsum, diff, highest_bin_to_include; size_t bytes, all_bytes; double t0, t1;
+    PERF_TIMER_START("domain_Decomposition");
     
     /* call first -before- a merge-split, to be sure particles are in the correct order in the tree */
     // TO: we don't have to call this before merge_and_split particles() 
@@ -198,6 +208,10 @@ void domain_Decomposition(int UseAllTimeBins, int SaveKeys, int do_particle_merg
       all_bytes += bytes;
       domainCountSph = (int *) mymalloc("domainCountSph", bytes = (MaxTopNodes * sizeof(int)));
       all_bytes += bytes;
+#ifdef DOMAIN_MULTICONSTRAINT
+      domainConstraintCost = (float *) mymalloc("domainConstraintCost", bytes = (MaxTopNodes * DOMAIN_NCONSTRAINTS * sizeof(float)));
+      all_bytes += bytes;
+#endif
 #ifdef SEPARATE_STELLARDOMAINDECOMP
       toGoStars = (int *) mymalloc("toGoStars", bytes = (sizeof(int) * NTask)); all_bytes += bytes;
       toGetStars = (int *) mymalloc("toGetStars", bytes = (sizeof(int) * NTask)); all_bytes += bytes;
@@ -245,6 +259,9 @@ void domain_Decomposition(int UseAllTimeBins, int SaveKeys, int do_particle_merg
       myfree(toGoStars);
 #endif
 
+#ifdef DOMAIN_MULTICONSTRAINT
+      myfree(domainConstraintCost);
+#endif
       myfree(domainCountSph);
       myfree(domainCount);
       myfree(domainWorkSph);
@@ -304,6 +321,7 @@ void domain_Decomposition(int UseAllTimeBins, int SaveKeys, int do_particle_merg
   DomainTask = (int *) (TopNodes + NTopnodes);
   force_treeallocate((int) (All.TreeAllocFactor * All.MaxPart) + NTopnodes, All.MaxPart);
   reconstruct_timebins();
+  PERF_TIMER_STOP("domain_Decomposition");
 }
 
 /*! This function allocates all the stuff that will be required for the tree-construction/walk later on */
@@ -372,22 +390,27 @@ void domain_allocate_trick(void)
     have additional, expensive physics which only apply to a subset of particles, it may be worth 
     up-weighting those particles here, so the code knows to try and spread them around. otherwise, 
     they may end up all bunched onto the same processor */
-double domain_particle_cost_multiplier(int i)
+static double domain_gas_ngb_multiplier(int i)
 {
-    double multiplier = 0;
-    
-    if(P[i].Type == 0) /* for gas, weight particles with large neighbor number more, since they require more work */
-    {
-        double nngb_reduced = PPP[i].NumNgb; /* remember, in density.c we reduce this by pow(1/NUMDIMS), for use in other routines: need to correct here */
+    double multiplier, nngb_reduced = PPP[i].NumNgb; /* remember, in density.c we reduce this by pow(1/NUMDIMS), for use in other routines: need to correct here */
 #if (NUMDIMS==3)
-        multiplier = nngb_reduced*nngb_reduced*nngb_reduced / All.DesNumNgb;
+    multiplier = nngb_reduced*nngb_reduced*nngb_reduced / All.DesNumNgb;
 #elif (NUMDIMS==2)
-        multiplier = nngb_reduced*nngb_reduced / All.DesNumNgb;
+    multiplier = nngb_reduced*nngb_reduced / All.DesNumNgb;
 #else
-        multiplier = nngb_reduced / All.DesNumNgb;
+    multiplier = nngb_reduced / All.DesNumNgb;
 #endif
-        if(multiplier < 0.5) {multiplier = 0.5;} // floor //
-    } // end gas check
+    if(multiplier < 0.5) {multiplier = 0.5;} // floor //
+    return multiplier;
+}
+
+double domain_particle_cost_multiplier(int i)
+{
+#ifdef DOMAIN_MEASURED_COST
+    return P[i].WorkCost[TakeLevel] / MeasuredCostUnit; /* the measured time spent on the particle outside of gravity, in units of the time per gravity interaction */
+#else
+    double multiplier = 0;
+    if(P[i].Type == 0) {multiplier = domain_gas_ngb_multiplier(i);} /* for gas, weight particles with large neighbor number more, since they require more work */
 
 #if defined(GALSF) /* with star formation active, we will up-weight star particles which are active feedback sources */
 #ifndef CHIMES /* With CHIMES, the chemistry dominates the cost, so we boost (dense) gas but not stars. */
@@ -407,6 +430,7 @@ double domain_particle_cost_multiplier(int i)
     
     
     return multiplier;
+#endif
 }
 
 
@@ -417,6 +441,74 @@ double domain_particle_costfactor(int i)
 }
 
 
+/* total work of particle i used to balance the domains, given its cost multiplier wt: the heuristic multipliers scale the gravity cost, while
+    the measured costs are already in units of gravity interactions, and are added to it */
+double domain_particle_work(int i, double wt)
+{
+#ifdef DOMAIN_MEASURED_COST
+    return domain_particle_costfactor(i) + wt;
+#else
+    return (1 + wt) * domain_particle_costfactor(i);
+#endif
+}
+
+
+#ifdef DOMAIN_MULTICONSTRAINT
+/*! splits the cost of particle i over the constraints which are balanced separately: its gravity cost, the parts of its cost multiplier
+ *  from the hydro loops (gas), feedback (other particles: the stars), and chemistry (dense gas with CHIMES), and its memory footprint.
+ *  With DOMAIN_MEASURED_COST, the measured work of the gas (which includes its cooling) is its hydro cost, that of the others their feedback cost. */
+void domain_particle_cost_vector(int i, float *cost)
+{
+    int k; for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {cost[k] = 0;}
+    cost[DOMAIN_CONSTRAINT_GRAVITY] = domain_particle_costfactor(i);
+    cost[DOMAIN_CONSTRAINT_PARTICLES] = 1;
+    if(P[i].Type == 0) {cost[DOMAIN_CONSTRAINT_GAS] = 1;}
+    if(!(TimeBinActive[P[i].TimeBin] || UseAllParticles)) {return;} /* as for the hydro work-load, only active particles count */
+#ifdef DOMAIN_MEASURED_COST
+    cost[(P[i].Type == 0) ? DOMAIN_CONSTRAINT_HYDRO : DOMAIN_CONSTRAINT_FEEDBACK] = domain_particle_cost_multiplier(i);
+#else
+    if(P[i].Type == 0)
+    {
+        cost[DOMAIN_CONSTRAINT_HYDRO] = domain_gas_ngb_multiplier(i);
+#ifdef CHIMES
+        double nH_cgs = SphP[i].Density * All.cf_a3inv * UNIT_DENSITY_IN_NHCGS; if(nH_cgs > 1) {cost[DOMAIN_CONSTRAINT_CHEMISTRY] = 10.0;}
+#endif
+    } else {cost[DOMAIN_CONSTRAINT_FEEDBACK] = domain_particle_cost_multiplier(i);}
+#endif
+}
+#endif
+
+
+#ifdef DOMAIN_MEASURED_COST
+/* measured cpu time and number of interactions of the gravity walks at each level, summed on the local task since the level was last reset */
+static double MeasuredGravTime[GRAVCOSTLEVELS], MeasuredGravCount[GRAVCOSTLEVELS];
+
+/*! starts a new measurement of the costs at the given level (called when its gravity costs are re-zeroed in the tree-walk) */
+void domain_measured_cost_reset(int level)
+{
+    int i; for(i = 0; i < NumPart; i++) {P[i].WorkCost[level] = 0;}
+    MeasuredGravTime[level] = MeasuredGravCount[level] = 0;
+}
+
+/*! records the cpu time (summed over threads) and the number of interactions of a gravity walk on the local task at the given level */
+void domain_measured_cost_gravity(int level, double t_cpu, double n_interactions)
+{
+    MeasuredGravTime[level] += t_cpu; MeasuredGravCount[level] += n_interactions;
+}
+
+/*! sets the time unit in which the measured costs are converted to the units of GravCost: the global time per gravity interaction at the
+    level used for the decomposition, or if gravity was not measured there, the mean measured time per particle (so the measured work
+    dominates the constant floor of the cost factor), or else unity */
+static void domain_measured_cost_unit(void)
+{
+    int i; double loc[3] = {MeasuredGravTime[TakeLevel], MeasuredGravCount[TakeLevel], 0}, tot[3];
+    for(i = 0; i < NumPart; i++) {loc[2] += P[i].WorkCost[TakeLevel];}
+    MPI_Allreduce(loc, tot, 3, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    if(tot[0] > 0 && tot[1] > 0) {MeasuredCostUnit = tot[0] / tot[1];} else {if(tot[2] > 0) {MeasuredCostUnit = tot[2] / (1. + All.TotNumPart);} else {MeasuredCostUnit = 1;}}
+}
+#endif
+
+
 
 /*! This function carries out the actual domain decomposition for all
  *  particle types. It will try to balance the work-load for each domain,
@@ -436,6 +528,9 @@ int domain_decompose(void)
   //double sumworkstars,maxworkstars;
 #endif
 
+#ifdef DOMAIN_MEASURED_COST
+  domain_measured_cost_unit();
+#endif
   for(i = 0; i < 6; i++)
     NtypeLocal[i] = 0;
 
@@ -446,7 +541,7 @@ int domain_decompose(void)
 #endif
         NtypeLocal[P[i].Type]++;
         double wt = domain_particle_cost_multiplier(i);
-        gravcost += (1 + wt) * domain_particle_costfactor(i);
+        gravcost += domain_particle_work(i, wt);
         if(TimeBinActive[P[i].TimeBin] || UseAllParticles) {sphcost += wt;}
     }
   /* because Ntype[] is of type `long long', we cannot do a simple MPI_Allreduce() to sum the total particle numbers */
@@ -465,8 +560,13 @@ int domain_decompose(void)
     return 1;
 
   /* find the split of the domain grid */
+#ifdef DOMAIN_MULTICONSTRAINT
+  domain_findSplit_multiconstraint(multipledomains * NTask, NTopleaves);
+  domain_assign_multiconstraint(multipledomains);
+#else
   domain_findSplit_work_balanced(multipledomains * NTask, NTopleaves);
   domain_assign_load_or_work_balanced(1,multipledomains);
+#endif
 
   status = domain_check_memory_bound(multipledomains);
 
@@ -488,6 +588,9 @@ int domain_decompose(void)
 	  endrun(0);
 	}
     }
+#ifdef DOMAIN_MULTICONSTRAINT
+  domain_multiconstraint_balance(multipledomains);
+#endif
 
 
   if(ThisTask == 0)
@@ -535,6 +638,9 @@ int domain_decompose(void)
         printf("Balance: gravity work-load balance=%g   memory-balance=%g   hydro work-load balance=%g\n",
 	     maxwork / (sumwork / NTask), maxload / (((double) sumload) / NTask),
 	     maxworksph / ((sumworksph + 1.0e-30) / NTask));
+#ifdef DOMAIN_MULTICONSTRAINT
+        domain_multiconstraint_report(stdout);
+#endif
     }
 
   /* flag the particles that need to be exported */
@@ -1729,6 +1835,225 @@ void domain_findSplit_load_balanced(int ncpu, int ndomain)
 
 
 
+#ifdef DOMAIN_MULTICONSTRAINT
+#define DOMAIN_MULTICONSTRAINT_PASSES 16 /* maximum number of refinement sweeps over the segment boundaries */
+
+/* normalization of the constraints: each is scaled so that its mean per segment is unity, constraints without any cost are ignored */
+static void domain_multiconstraint_norm(int nseg, int ndomain, double *fac)
+{
+  int i, k; double tot[DOMAIN_NCONSTRAINTS];
+  for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {tot[k] = 0;}
+  for(i = 0; i < ndomain; i++) {for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {tot[k] += domainConstraintCost[i * DOMAIN_NCONSTRAINTS + k];}}
+  for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {fac[k] = (tot[k] > 0) ? nseg / tot[k] : 0;}
+}
+
+/* the largest normalized constraint of the two segments a and b (with costs seg[DOMAIN_NCONSTRAINTS*a+k]) */
+static double domain_multiconstraint_pairmax(double *seg, int a, int b)
+{
+  int k; double m = 0;
+  for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {m = DMAX(m, DMAX(seg[a * DOMAIN_NCONSTRAINTS + k], seg[b * DOMAIN_NCONSTRAINTS + k]));}
+  return m;
+}
+
+/* moves the top-level leaf 'leaf' from segment a to segment b in the normalized segment costs */
+static void domain_multiconstraint_move(double *seg, double *fac, int leaf, int a, int b)
+{
+  int k; for(k = 0; k < DOMAIN_NCONSTRAINTS; k++)
+  {
+    double c = fac[k] * domainConstraintCost[leaf * DOMAIN_NCONSTRAINTS + k];
+    seg[a * DOMAIN_NCONSTRAINTS + k] -= c; seg[b * DOMAIN_NCONSTRAINTS + k] += c;
+  }
+}
+
+/*! This function splits the Peano-Hilbert ordered top-level leaves into ncpu contiguous segments, balancing all the constraints at once:
+ *  the segments are first cut so that the sum of their normalized constraints is equal (as in domain_findSplit_work_balanced), then the
+ *  boundaries between neighboring segments are moved one leaf at a time (in sweeps over all boundaries, until no move helps) whenever this
+ *  lowers the largest normalized constraint of the two segments. The segments stay contiguous, and are never emptied.
+ */
+void domain_findSplit_multiconstraint(int ncpu, int ndomain)
+{
+  int i, k, start, end, pass, n_moved;
+  double fac[DOMAIN_NCONSTRAINTS], work, work_before, workavg, workavg_before, nactive;
+  double *seg = (double *) mymalloc("seg", ncpu * DOMAIN_NCONSTRAINTS * sizeof(double));
+
+  domain_multiconstraint_norm(ncpu, ndomain, fac);
+  for(k = 0, nactive = 0; k < DOMAIN_NCONSTRAINTS; k++) {if(fac[k] > 0) {nactive++;}}
+
+  workavg = 1.0; work_before = workavg_before = 0; start = 0;
+  for(i = 0; i < ncpu; i++)
+    {
+      end = start;
+      for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {seg[i * DOMAIN_NCONSTRAINTS + k] = fac[k] * domainConstraintCost[end * DOMAIN_NCONSTRAINTS + k];}
+      for(k = 0, work = 0; k < DOMAIN_NCONSTRAINTS; k++) {work += seg[i * DOMAIN_NCONSTRAINTS + k] / nactive;}
+      while((work + work_before < workavg + workavg_before) || (i == ncpu - 1 && end < ndomain - 1))
+	{
+	  if((ndomain - end) > (ncpu - i)) {end++;} else {break;}
+	  for(k = 0; k < DOMAIN_NCONSTRAINTS; k++)
+	    {
+	      double c = fac[k] * domainConstraintCost[end * DOMAIN_NCONSTRAINTS + k];
+	      seg[i * DOMAIN_NCONSTRAINTS + k] += c; work += c / nactive;
+	    }
+	}
+      DomainStartList[i] = start;
+      DomainEndList[i] = end;
+      work_before += work;
+      workavg_before += workavg;
+      start = end + 1;
+    }
+
+  for(pass = 0; pass < DOMAIN_MULTICONSTRAINT_PASSES; pass++)
+    {
+      for(i = 0, n_moved = 0; i < ncpu - 1; i++)
+	{
+	  while(1)
+	    {
+	      double m_now = domain_multiconstraint_pairmax(seg, i, i + 1);
+	      if(DomainEndList[i] > DomainStartList[i]) /* try to shift the last leaf of segment i to segment i+1 */
+		{
+		  domain_multiconstraint_move(seg, fac, DomainEndList[i], i, i + 1);
+		  if(domain_multiconstraint_pairmax(seg, i, i + 1) < m_now * (1 - 1.0e-6)) {DomainEndList[i]--; DomainStartList[i + 1]--; n_moved++; continue;}
+		  domain_multiconstraint_move(seg, fac, DomainEndList[i], i + 1, i);
+		}
+	      if(DomainEndList[i + 1] > DomainStartList[i + 1]) /* try to shift the first leaf of segment i+1 to segment i */
+		{
+		  domain_multiconstraint_move(seg, fac, DomainStartList[i + 1], i + 1, i);
+		  if(domain_multiconstraint_pairmax(seg, i, i + 1) < m_now * (1 - 1.0e-6)) {DomainEndList[i]++; DomainStartList[i + 1]++; n_moved++; continue;}
+		  domain_multiconstraint_move(seg, fac, DomainStartList[i + 1], i, i + 1);
+		}
+	      break;
+	    }
+	}
+      if(n_moved == 0) {break;}
+    }
+
+  myfree(seg);
+}
+
+struct domain_multiconstraint_segment {double max; int n;};
+
+static int domain_multiconstraint_sort_max(const void *a, const void *b)
+{
+  if(((struct domain_multiconstraint_segment *) a)->max > ((struct domain_multiconstraint_segment *) b)->max) {return -1;}
+  if(((struct domain_multiconstraint_segment *) a)->max < ((struct domain_multiconstraint_segment *) b)->max) {return +1;}
+  return 0;
+}
+
+/*! This function assigns the multipledomains*NTask segments to the tasks (multipledomains each), generalizing the queues of
+ *  domain_assign_load_or_work_balanced to all constraints: the segments are taken in order of decreasing largest normalized constraint,
+ *  and each goes to whichever of the least-loaded tasks in each constraint ends up with the smallest largest normalized constraint.
+ *  For each constraint, the tasks are kept in a list sorted by their load in it.
+ */
+void domain_assign_multiconstraint(int multipledomains)
+{
+  int i, k, n, q, ta, target, best_queue, nseg = multipledomains * NTask;
+  double fac[DOMAIN_NCONSTRAINTS], best_balance;
+  double *segcost = (double *) mymalloc("segcost", nseg * DOMAIN_NCONSTRAINTS * sizeof(double));
+  double *taskcost = (double *) mymalloc("taskcost", NTask * DOMAIN_NCONSTRAINTS * sizeof(double));
+  int *taskcount = (int *) mymalloc("taskcount", NTask * sizeof(int));
+  struct domain_multiconstraint_segment *order = (struct domain_multiconstraint_segment *) mymalloc("order", nseg * sizeof(struct domain_multiconstraint_segment));
+  int *qnext = (int *) mymalloc("qnext", DOMAIN_NCONSTRAINTS * NTask * sizeof(int));
+  int *qprev = (int *) mymalloc("qprev", DOMAIN_NCONSTRAINTS * NTask * sizeof(int));
+  int qfirst[DOMAIN_NCONSTRAINTS], qlast[DOMAIN_NCONSTRAINTS];
+  int *segtask = (int *) mymalloc("segtask", nseg * sizeof(int));
+
+  domain_multiconstraint_norm(NTask, NTopleaves, fac);
+  for(n = 0; n < nseg; n++)
+    {
+      for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {segcost[n * DOMAIN_NCONSTRAINTS + k] = 0;}
+      for(i = DomainStartList[n]; i <= DomainEndList[n]; i++)
+        {for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {segcost[n * DOMAIN_NCONSTRAINTS + k] += fac[k] * domainConstraintCost[i * DOMAIN_NCONSTRAINTS + k];}}
+      for(k = 0, order[n].max = 0; k < DOMAIN_NCONSTRAINTS; k++) {order[n].max = DMAX(order[n].max, segcost[n * DOMAIN_NCONSTRAINTS + k]);}
+      order[n].n = n;
+    }
+  qsort(order, nseg, sizeof(struct domain_multiconstraint_segment), domain_multiconstraint_sort_max);
+
+  for(ta = 0; ta < NTask; ta++) {taskcount[ta] = 0; for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {taskcost[ta * DOMAIN_NCONSTRAINTS + k] = 0;}}
+  for(q = 0; q < DOMAIN_NCONSTRAINTS; q++)
+    {
+      for(ta = 0; ta < NTask; ta++) {qnext[q * NTask + ta] = ta + 1; qprev[q * NTask + ta] = ta - 1;}
+      qnext[q * NTask + NTask - 1] = -1; qfirst[q] = 0; qlast[q] = NTask - 1;
+    }
+
+  for(i = 0; i < nseg; i++)
+    {
+      n = order[i].n;
+      for(q = 0, best_balance = 1.0e30, best_queue = -1, target = -1; q < DOMAIN_NCONSTRAINTS; q++)
+	{
+	  if(fac[q] <= 0) {continue;} /* this constraint is empty, its queue is not ordered */
+	  for(ta = qfirst[q]; taskcount[ta] == multipledomains; ta = qnext[q * NTask + ta]) {}
+	  double bal; for(k = 0, bal = 0; k < DOMAIN_NCONSTRAINTS; k++) {bal = DMAX(bal, segcost[n * DOMAIN_NCONSTRAINTS + k] + taskcost[ta * DOMAIN_NCONSTRAINTS + k]);}
+	  if(bal < best_balance) {best_balance = bal; best_queue = q; target = ta;}
+	}
+      if(best_queue < 0) {for(target = 0; taskcount[target] == multipledomains; target++) {}} /* no costs at all */
+      segtask[n] = target; taskcount[target]++;
+      for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {taskcost[target * DOMAIN_NCONSTRAINTS + k] += segcost[n * DOMAIN_NCONSTRAINTS + k];}
+
+      for(q = 0; q < DOMAIN_NCONSTRAINTS; q++) /* re-insert the target into each queue, in order of its new load (which only grows) */
+	{
+	  int *nx = qnext + q * NTask, *pv = qprev + q * NTask;
+	  double value = taskcost[target * DOMAIN_NCONSTRAINTS + q];
+	  if(pv[target] >= 0) {nx[pv[target]] = nx[target];} else {qfirst[q] = nx[target];}
+	  if(nx[target] >= 0) {pv[nx[target]] = pv[target];} else {qlast[q] = pv[target];}
+	  for(ta = qlast[q]; ta >= 0 && value < taskcost[ta * DOMAIN_NCONSTRAINTS + q]; ta = pv[ta]) {}
+	  if(ta < 0) /* insert as the first element */
+	    {
+	      nx[target] = qfirst[q]; pv[target] = -1;
+	      if(qfirst[q] >= 0) {pv[qfirst[q]] = target;} else {qlast[q] = target;}
+	      qfirst[q] = target;
+	    }
+	  else /* insert behind ta */
+	    {
+	      nx[target] = nx[ta]; pv[target] = ta;
+	      if(nx[ta] >= 0) {pv[nx[ta]] = target;} else {qlast[q] = target;}
+	      nx[ta] = target;
+	    }
+	}
+    }
+
+  /* re-order the segments by task (keeping their Peano-Hilbert order within each task), as domain_assign_load_or_work_balanced does */
+  for(ta = 0; ta < NTask; ta++) {taskcount[ta] = 0;}
+  int *start = (int *) mymalloc("start", nseg * sizeof(int)), *end = (int *) mymalloc("end", nseg * sizeof(int));
+  for(n = 0; n < nseg; n++)
+    {
+      int m = segtask[n] * multipledomains + taskcount[segtask[n]]++;
+      start[m] = DomainStartList[n]; end[m] = DomainEndList[n];
+    }
+  for(n = 0; n < nseg; n++)
+    {
+      DomainStartList[n] = start[n]; DomainEndList[n] = end[n];
+      for(i = DomainStartList[n]; i <= DomainEndList[n]; i++) {DomainTask[i] = n / multipledomains;}
+    }
+
+  myfree(end); myfree(start); myfree(segtask); myfree(qprev); myfree(qnext); myfree(order); myfree(taskcount); myfree(taskcost); myfree(segcost);
+}
+
+/*! records the balance (max/mean over tasks) of each constraint for the final assignment of the leaves to the tasks */
+void domain_multiconstraint_balance(int multipledomains)
+{
+  int i, k, m, ta; double tot[DOMAIN_NCONSTRAINTS], max[DOMAIN_NCONSTRAINTS], c[DOMAIN_NCONSTRAINTS];
+  for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {tot[k] = max[k] = 0;}
+  for(ta = 0; ta < NTask; ta++)
+    {
+      for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {c[k] = 0;}
+      for(m = 0; m < multipledomains; m++)
+        for(i = DomainStartList[ta * multipledomains + m]; i <= DomainEndList[ta * multipledomains + m]; i++)
+          {for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {c[k] += domainConstraintCost[i * DOMAIN_NCONSTRAINTS + k];}}
+      for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {tot[k] += c[k]; max[k] = DMAX(max[k], c[k]);}
+    }
+  for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {DomainConstraintBalance[k] = (tot[k] > 0) ? max[k] / (tot[k] / NTask) : 0;}
+}
+
+/*! writes the balance of each constraint in the last domain decomposition (constraints without any cost are shown as zero) */
+void domain_multiconstraint_report(FILE *fd)
+{
+  int k; fprintf(fd, "domain balance (max/mean over tasks, last decomposition):");
+  for(k = 0; k < DOMAIN_NCONSTRAINTS; k++) {fprintf(fd, " %s=%g", DomainConstraintName[k], DomainConstraintBalance[k]);}
+  fprintf(fd, "\n");
+}
+#endif
+
+
+
 
 
 
@@ -2170,7 +2495,7 @@ int domain_check_for_local_refine(int i, double countlimit, double costlimit)
 			  break;
 		      }
 
-		  topNodes[sub].Cost += (1 + domain_particle_cost_multiplier(mp[p].index)) * domain_particle_costfactor(mp[p].index);
+		  topNodes[sub].Cost += domain_particle_work(mp[p].index, domain_particle_cost_multiplier(mp[p].index));
 		  topNodes[sub].Count++;
 		}
 
@@ -2545,6 +2870,9 @@ void domain_sumCost(void)
   local_domainWorkSph = (float *) mymalloc("local_domainWorkSph", NTopnodes * sizeof(float));
   local_domainCount = (int *) mymalloc("local_domainCount", NTopnodes * sizeof(int));
   local_domainCountSph = (int *) mymalloc("local_domainCountSph", NTopnodes * sizeof(int));
+#ifdef DOMAIN_MULTICONSTRAINT
+  float *local_domainConstraintCost = (float *) mymalloc("local_domainConstraintCost", NTopnodes * DOMAIN_NCONSTRAINTS * sizeof(float));
+#endif
 #ifdef SEPARATE_STELLARDOMAINDECOMP
   int *local_domainCountStars;
   //float *local_domainWorkStars;
@@ -2562,6 +2890,9 @@ void domain_sumCost(void)
       local_domainWorkSph[i] = 0;
       local_domainCount[i] = 0;
       local_domainCountSph[i] = 0;
+#ifdef DOMAIN_MULTICONSTRAINT
+      for(n = 0; n < DOMAIN_NCONSTRAINTS; n++) {local_domainConstraintCost[i * DOMAIN_NCONSTRAINTS + n] = 0;}
+#endif
 #ifdef SEPARATE_STELLARDOMAINDECOMP
       //local_domainWorkStars[i] = 0;
       local_domainCountStars[i] = 0;
@@ -2584,10 +2915,14 @@ void domain_sumCost(void)
 
       no = topNodes[no].Leaf;
       double wt = domain_particle_cost_multiplier(n);
-      local_domainWork[no] += (1 + wt) * domain_particle_costfactor(n);
+      local_domainWork[no] += domain_particle_work(n, wt);
       local_domainCount[no] += 1;
       if(TimeBinActive[P[n].TimeBin] || UseAllParticles) {local_domainWorkSph[no] += wt;}
       if(P[n].Type == 0) {local_domainCountSph[no] += 1;}
+#ifdef DOMAIN_MULTICONSTRAINT
+      float cost[DOMAIN_NCONSTRAINTS]; domain_particle_cost_vector(n, cost);
+      for(i = 0; i < DOMAIN_NCONSTRAINTS; i++) {local_domainConstraintCost[no * DOMAIN_NCONSTRAINTS + i] += cost[i];}
+#endif
 
 #ifdef SEPARATE_STELLARDOMAINDECOMP
         if(P[n].Type == 4) {local_domainCountStars[no] += 1;}
@@ -2598,11 +2933,17 @@ void domain_sumCost(void)
   MPI_Allreduce(local_domainWorkSph, domainWorkSph, NTopleaves, MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD);
   MPI_Allreduce(local_domainCount, domainCount, NTopleaves, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
   MPI_Allreduce(local_domainCountSph, domainCountSph, NTopleaves, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+#ifdef DOMAIN_MULTICONSTRAINT
+  MPI_Allreduce(local_domainConstraintCost, domainConstraintCost, NTopleaves * DOMAIN_NCONSTRAINTS, MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD);
+#endif
 #ifdef SEPARATE_STELLARDOMAINDECOMP
   //MPI_Allreduce(local_domainWorkStars, domainWorkStars, NTopleaves, MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD);
   MPI_Allreduce(local_domainCountStars, domainCountStars, NTopleaves, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
   //myfree(local_domainWorkStars);
   myfree(local_domainCountStars);
+#endif
+#ifdef DOMAIN_MULTICONSTRAINT
+  myfree(local_domainConstraintCost);
 #endif
   myfree(local_domainCountSph);
   myfree(local_domainCount);
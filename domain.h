@@ -9,6 +9,19 @@
  */
 
 double domain_particle_cost_multiplier(int i);
+double domain_particle_work(int i, double wt);
+#ifdef DOMAIN_MULTICONSTRAINT
+#define DOMAIN_NCONSTRAINTS 6 /* balanced separately: gravity, hydro, feedback, and chemistry work, and the numbers of particles and gas particles */
+void domain_particle_cost_vector(int i, float *cost);
+void domain_findSplit_multiconstraint(int ncpu, int ndomain);
+void domain_assign_multiconstraint(int multipledomains);
+void domain_multiconstraint_balance(int multipledomains);
+void domain_multiconstraint_report(FILE *fd);
+#endif
+#ifdef DOMAIN_MEASURED_COST
+void domain_measured_cost_reset(int level);
+void domain_measured_cost_gravity(int level, double t_cpu, double n_interactions);
+#endif
 void domain_findSplit_work_balanced(int ncpu, int ndomain);
 void domain_findSplit_load_balanced(int ncpu, int ndomain);
 int domain_sort_loadorigin(const void *a, const void *b);
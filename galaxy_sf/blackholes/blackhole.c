@@ -672,6 +672,7 @@ void blackhole_final_operations(void)
                 fac_bh_shift = 1.0; // jump all the way
 #endif
                 for(k = 0; k < 3; k++) {P[n].Pos[k] += (BPP(n).BH_MinPotPos[k]-P[n].Pos[k]) * fac_bh_shift;}
+                PHOT_UPDATE(n);
             }
 #endif
 
@@ -712,6 +713,7 @@ void blackhole_final_operations(void)
 #endif
 #if defined(BH_FOLLOW_ACCRETED_COM) && !defined(BH_REPOSITION_ON_POTMIN)
             for(k=0;k<3;k++) {P[n].Pos[k] = (P[n].Pos[k]*m_new + BlackholeTempInfo[i].accreted_centerofmass[k]) / m_new;}
+            PHOT_UPDATE(n);
 #endif
 #if defined(BH_FOLLOW_ACCRETED_ANGMOM)
             for(k=0;k<3;k++) {BPP(n).BH_Specific_AngMom[k] = (BPP(n).BH_Specific_AngMom[k]*P[n].Mass + BlackholeTempInfo[i].accreted_J[k]) / m_new;}
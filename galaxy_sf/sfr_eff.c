@@ -571,11 +571,15 @@ void star_formation_parent_routine(void)
 
 		      P[NumPart + stars_spawned] = P[i];
 		      P[NumPart + stars_spawned].Type = 4;
+		      PHOT_UPDATE(NumPart + stars_spawned); /* the new star is linked into the tree below, so the walks can find it */
 #ifdef DO_DENSITY_AROUND_STAR_PARTICLES
               P[NumPart + stars_spawned].DensAroundStar = SphP[i].Density;
 #endif
 		      NextActiveParticle[NumPart + stars_spawned] = FirstActiveParticle;
 		      FirstActiveParticle = NumPart + stars_spawned;
+#ifdef ACTIVE_PARTICLE_ARRAY
+		      ActiveParticleList[NumActiveParticle++] = NumPart + stars_spawned;
+#endif
 		      NumForceUpdate++;
 
 		      TimeBinCount[P[NumPart + stars_spawned].TimeBin]++;
@@ -53,6 +53,10 @@ static float shortrange_table[NTAB], shortrange_table_potential[NTAB];
 #ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
 static float shortrange_table_tidal[NTAB];
 #endif
+#if defined(GRAVITY_TREE_QUADRUPOLE) && defined(PMGRID)
+/*! short-range suppression of the 2nd, 3rd, and 4th radial derivatives of the Green's function, needed for the quadrupole terms */
+static float shortrange_table_quadrupole[3][NTAB];
+#endif
 /*! toggles after first tree-memory allocation, has only influence on log-files */
 static int first_flag = 0;
 
@@ -106,6 +110,64 @@ static double fac_intp;
 #define GRAVITY_NGB_PERIODIC_BOX_LONG_Z(x,y,z,sign) (fabs(z))
 #endif
 
+
+#ifdef GRAVITY_TREE_QUADRUPOLE
+/*! adds the second mass moments of an element of mass m at offset (dx,dy,dz) from the geometric center of its parent node.
+    the moments are summed relative to the geometric center (rather than the origin) so there is no cancellation when they
+    are shifted to the center-of-mass at the end, in force_quadrupole_finish */
+static inline void force_quadrupole_add(double quad[6], double m, double dx, double dy, double dz)
+{
+    quad[0] += m*dx*dx; quad[1] += m*dy*dy; quad[2] += m*dz*dz;
+    quad[3] += m*dx*dy; quad[4] += m*dx*dz; quad[5] += m*dy*dz;
+}
+
+/*! shifts the moments summed about the geometric center of node no to its center-of-mass s (parallel-axis theorem), and stores them */
+static inline void force_quadrupole_finish(int no, double quad[6], double mass, MyFloat s[3])
+{
+    double dx = s[0] - Nodes[no].center[0], dy = s[1] - Nodes[no].center[1], dz = s[2] - Nodes[no].center[2];
+    force_quadrupole_add(quad, -mass, dx, dy, dz);
+    int k; for(k=0;k<6;k++) {Nodes[no].quad[k] = quad[k];}
+}
+
+/*! with quadrupoles the leading error of an accepted node is its octupole term, ~G*M*len^3/r^5 (rather than G*M*len^2/r^4),
+    which is what the relative opening criterion compares to ErrTolForceAcc times the old acceleration */
+#define GRAVITY_RELATIVE_OPENING_CRIT(mass,len,r2,aold) ((mass) * (len) * (len) * (len) > (r2) * (r2) * sqrt(r2) * (aold))
+
+/*! quadrupole correction to the potential, acceleration, and (if tidal is non-null) tidal tensor [ordered xx,yy,zz,xy,xz,yz]
+    from a node with second moments q, at separation (dx,dy,dz) = node center-of-mass minus target, outside of all softening lengths.
+    With g(r) the Green's function [1/r, or erfc(r/2asmth)/r for the TreePM short-range part], b_n = (-1/r d/dr)^n g, and the terms
+    are -1/2 q_ij d_ij g for the potential and its first and second derivatives, in the same sign conventions as the monopole terms */
+static inline void force_quadrupole_terms(MyFloat q[6], double dx, double dy, double dz, double r, int tabindex, double *pot, double acc[3], double *tidal)
+{
+    double r_inv = 1./r, r2_inv = r_inv*r_inv, b1 = r_inv*r2_inv, b2 = 3.*b1*r2_inv, b3 = 5.*b2*r2_inv, b4 = 7.*b3*r2_inv;
+#ifdef PMGRID
+    b1 *= shortrange_table[tabindex]; b2 *= shortrange_table_quadrupole[0][tabindex]; b3 *= shortrange_table_quadrupole[1][tabindex]; b4 *= shortrange_table_quadrupole[2][tabindex];
+#endif
+    double tr_q = q[0] + q[1] + q[2], qr[3], rqr;
+    qr[0] = q[0]*dx + q[3]*dy + q[4]*dz;
+    qr[1] = q[3]*dx + q[1]*dy + q[5]*dz;
+    qr[2] = q[4]*dx + q[5]*dy + q[2]*dz;
+    rqr = dx*qr[0] + dy*qr[1] + dz*qr[2];
+    double fac_r = 0.5 * (rqr*b3 - tr_q*b2);
+    acc[0] = dx*fac_r - qr[0]*b2;
+    acc[1] = dy*fac_r - qr[1]*b2;
+    acc[2] = dz*fac_r - qr[2]*b2;
+    if(tidal)
+    {
+        double fac_d = 0.5 * (tr_q*b2 - rqr*b3), fac_rr = 0.5 * (rqr*b4 - tr_q*b3);
+        tidal[0] = q[0]*b2 + fac_d - 2.*dx*qr[0]*b3 + dx*dx*fac_rr;
+        tidal[1] = q[1]*b2 + fac_d - 2.*dy*qr[1]*b3 + dy*dy*fac_rr;
+        tidal[2] = q[2]*b2 + fac_d - 2.*dz*qr[2]*b3 + dz*dz*fac_rr;
+        tidal[3] = q[3]*b2 - (dx*qr[1] + dy*qr[0])*b3 + dx*dy*fac_rr;
+        tidal[4] = q[4]*b2 - (dx*qr[2] + dz*qr[0])*b3 + dx*dz*fac_rr;
+        tidal[5] = q[5]*b2 - (dy*qr[2] + dz*qr[1])*b3 + dy*dz*fac_rr;
+    }
+    *pot = 0.5 * (tr_q*b1 - rqr*b2);
+}
+#else
+#define GRAVITY_RELATIVE_OPENING_CRIT(mass,len,r2,aold) ((mass) * (len) * (len) > (r2) * (r2) * (aold))
+#endif
+
 /*! This function is a driver routine for constructing the gravitational
  *  oct-tree, which is done by calling a small number of other functions.
  */
@@ -113,6 +175,9 @@ int force_treebuild(int npart, struct unbind_data *mp)
 {
 
     int flag;
+#ifdef HOTCOLD_PARTICLE_LAYOUT
+    particle_hot_refresh_all(); /* particles have been exchanged/re-ordered since the last build, so the walk-critical copy is re-derived */
+#endif
     do
     {
         Numnodestree = force_treebuild_single(npart, mp);
@@ -149,6 +214,275 @@ int force_treebuild(int npart, struct unbind_data *mp)
 
 
 
+#ifdef OPENMP_TREEBUILD
+/*! The threaded tree construction (OPENMP_TREEBUILD) does not insert particles one-by-one, but builds the
+ *  oct-tree top-down: the particles of each local top-level leaf are partitioned recursively into octants
+ *  (using the same morton-key/geometric sub-node choice as the serial insertion), and an octant holding two
+ *  or more particles becomes an internal node, exactly as it would if particles were inserted serially.
+ *  Disjoint sub-trees are then built concurrently as OpenMP tasks. Threads claim blocks of nodes from a shared
+ *  counter, and any gaps left by partially-used blocks are closed at the end, so the nodes occupy the same
+ *  contiguous index range as before. The topology is independent of the insertion order, and identical to the
+ *  serial build except for the randomized split of nodes smaller than EPSILON_FOR_TREERND_SUBNODE_SPLITTING
+ *  times the softening (only reached for nearly-coincident particles): with USE_PREGENERATED_RANDOM_NUMBER_TABLE
+ *  or NOTREERND that choice is the same as in the serial build, but otherwise the serial build draws it from the
+ *  (sequential) gsl generator, which the threads cannot reproduce, so the tree below such nodes -- and with it
+ *  the forces, at the bitwise level -- can differ from the serial build. */
+#define TREEBUILD_NODEBLOCK     64      /*!< number of nodes each thread claims at once from the shared free-node counter */
+#define TREEBUILD_TASK_MINPART  4096    /*!< sub-trees containing more particles than this are spawned as separate OpenMP tasks */
+#define TREEBUILD_MAXDEPTH      128     /*!< refuse to open deeper nodes than this (nodes below are unresolvable in double precision) */
+static int treebuild_nextfree;          /*!< shared free-node counter for the threaded construction */
+static int treebuild_nodelimit;         /*!< first node index which may not be used */
+static int treebuild_overflow;          /*!< flags that we ran out of nodes */
+static int treebuild_toodeep;           /*!< a particle in a node deeper than TREEBUILD_MAXDEPTH (or -1): not a memory problem, so fatal */
+static peanokey *treebuild_morton;      /*!< morton keys of the particles being inserted */
+static struct treebuild_nodeblock {int next, end;} *treebuild_blocks; /*!< current node block owned by each thread */
+
+/*! returns the daughter (0-7) of node 'no' into which particle i falls, making the same choice as the serial insertion (except for the randomized split without USE_PREGENERATED_RANDOM_NUMBER_TABLE, see above) */
+static inline int force_treebuild_get_subnode(int i, int no, int shift, int rep)
+{
+    int subnode;
+    if(shift >= 0) {subnode = (int) ((treebuild_morton[i] >> shift) & 7);}
+    else
+    {
+        subnode = 0;
+        if(P[i].Pos[0] > Nodes[no].center[0]) {subnode += 1;}
+        if(P[i].Pos[1] > Nodes[no].center[1]) {subnode += 2;}
+        if(P[i].Pos[2] > Nodes[no].center[2]) {subnode += 4;}
+    }
+#ifndef NOTREERND
+    if(Nodes[no].len < EPSILON_FOR_TREERND_SUBNODE_SPLITTING * All.ForceSoftening[P[i].Type])
+    {
+#ifdef USE_PREGENERATED_RANDOM_NUMBER_TABLE
+        subnode = (int) (8.0 * get_random_number((P[i].ID + rep) % (RNDTABLE + (rep & 3))));
+#else
+        /* the gsl generator used by the serial build is neither thread-safe nor independent of the call order, so use a deterministic hash of (ID, depth) here (a different, but equally valid, split) */
+        unsigned long long h = (unsigned long long) P[i].ID + 0x9E3779B97F4A7C15ULL * (unsigned long long) (rep + 1);
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL; h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL; h ^= (h >> 31);
+        subnode = (int) (h >> 61);
+#endif
+        if(subnode >= 8) {subnode = 7;}
+    }
+#endif
+    return subnode;
+}
+
+/*! creates a new (empty) internal node as daughter 'subnode' of node 'father', taking it from the block owned by this thread */
+static inline int force_treebuild_new_node(int father, int subnode)
+{
+    int nfree, j;
+#ifdef _OPENMP
+    struct treebuild_nodeblock *block = &treebuild_blocks[omp_get_thread_num()];
+#else
+    struct treebuild_nodeblock *block = &treebuild_blocks[0];
+#endif
+    if(block->next >= block->end)
+    {
+        int start;
+#ifdef _OPENMP
+#pragma omp atomic capture
+#endif
+        {start = treebuild_nextfree; treebuild_nextfree += TREEBUILD_NODEBLOCK;}
+        if(start >= treebuild_nodelimit)
+        {
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+            treebuild_overflow = 1;
+            return -1;
+        }
+        block->next = start; block->end = IMIN(start + TREEBUILD_NODEBLOCK, treebuild_nodelimit);
+    }
+    nfree = block->next++;
+
+    MyFloat lenhalf = 0.25 * Nodes[father].len;
+    Nodes[nfree].len = 0.5 * Nodes[father].len;
+    Nodes[nfree].center[0] = Nodes[father].center[0] + ((subnode & 1) ? lenhalf : -lenhalf);
+    Nodes[nfree].center[1] = Nodes[father].center[1] + ((subnode & 2) ? lenhalf : -lenhalf);
+    Nodes[nfree].center[2] = Nodes[father].center[2] + ((subnode & 4) ? lenhalf : -lenhalf);
+    for(j = 0; j < 8; j++) {Nodes[nfree].u.suns[j] = -1;}
+    Nodes[father].u.suns[subnode] = nfree;
+    return nfree;
+}
+
+/*! sorts the particle list of node 'no' in place into its eight daughters (an in-place 8-way bucket sort), returning the counts per daughter */
+static void force_treebuild_partition(int *list, int n, int no, int shift, int rep, int *count)
+{
+    int j, b, s, start[8], next[8];
+    for(b = 0; b < 8; b++) {count[b] = 0;}
+    for(j = 0; j < n; j++) {count[force_treebuild_get_subnode(list[j], no, shift, rep)]++;}
+    for(b = 0, s = 0; b < 8; b++) {start[b] = next[b] = s; s += count[b];}
+    for(b = 0; b < 8; b++)
+    {
+        while(next[b] < start[b] + count[b])
+        {
+            int p = list[next[b]];
+            s = force_treebuild_get_subnode(p, no, shift, rep);
+            if(s == b) {next[b]++;} else {list[next[b]] = list[next[s]]; list[next[s]] = p; next[s]++;}
+        }
+    }
+}
+
+/*! builds the sub-tree below (existing, empty) node 'no' containing the n particles in 'list'. 'shift' and
+ *  'rep' are the morton-key bit shift and depth of the node, as tracked in the serial insertion loop */
+static void force_treebuild_subtree(int *list, int n, int no, int shift, int rep)
+{
+    int j, offset, count[8];
+    if(treebuild_overflow || treebuild_toodeep >= 0) {return;}
+    if(rep > TREEBUILD_MAXDEPTH)
+    {
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+        treebuild_toodeep = list[0];
+        return;
+    }
+    force_treebuild_partition(list, n, no, shift, rep, count);
+    for(j = 0, offset = 0; j < 8; offset += count[j], j++)
+    {
+        if(count[j] == 0) {continue;}
+        if(count[j] == 1) {Nodes[no].u.suns[j] = list[offset]; continue;} /* a single particle becomes a leaf */
+        int nn = force_treebuild_new_node(no, j), *sublist = list + offset, subcount = count[j];
+        if(nn < 0) {return;}
+        if(subcount > TREEBUILD_TASK_MINPART)
+        {
+#ifdef _OPENMP
+#pragma omp task firstprivate(sublist, subcount, nn, shift, rep)
+#endif
+            force_treebuild_subtree(sublist, subcount, nn, shift - 3, rep + 1);
+        }
+        else {force_treebuild_subtree(sublist, subcount, nn, shift - 3, rep + 1);}
+    }
+}
+
+/*! threaded replacement for the particle-insertion loop of force_treebuild_single: all particles are inserted
+ *  below the (already created) top-level nodes, using nodes from index nfree on. Returns -1 if we run out of nodes */
+static int force_treebuild_insert_threaded(int npart, struct unbind_data *mp, peanokey *morton_list, int nfree, int *numnodes)
+{
+    int i, j, k, no, nthreads = 1, n_holes = 0, *leaf_of_part, *partlist, *leaf_offset, *leaf_depth, *hole_start, *hole_end, *remap;
+#ifdef _OPENMP
+    nthreads = omp_get_max_threads();
+#endif
+    leaf_of_part = (int *) mymalloc("leaf_of_part", npart * sizeof(int));
+    partlist = (int *) mymalloc("partlist", npart * sizeof(int));
+    leaf_offset = (int *) mymalloc("leaf_offset", (NTopleaves + 1) * sizeof(int));
+    leaf_depth = (int *) mymalloc("leaf_depth", NTopleaves * sizeof(int));
+    treebuild_blocks = (struct treebuild_nodeblock *) mymalloc("treebuild_blocks", nthreads * sizeof(struct treebuild_nodeblock));
+
+    /* compute the keys and find the top-level leaf of every particle: this is a read-only walk of TopNodes, so trivially parallel */
+#ifdef _OPENMP
+#pragma omp parallel for private(i, no) schedule(static)
+#endif
+    for(k = 0; k < npart; k++)
+    {
+        peanokey key, morton;
+        if(mp) {i = mp[k].index;} else {i = k;}
+        key = peano_and_morton_key((int) ((P[i].Pos[0] - DomainCorner[0]) * DomainFac),
+                                   (int) ((P[i].Pos[1] - DomainCorner[1]) * DomainFac),
+                                   (int) ((P[i].Pos[2] - DomainCorner[2]) * DomainFac), BITS_PER_DIMENSION, &morton);
+        morton_list[i] = morton;
+        no = 0;
+        while(TopNodes[no].Daughter >= 0) {no = TopNodes[no].Daughter + (key - TopNodes[no].StartKey) / (TopNodes[no].Size / 8);}
+        leaf_of_part[k] = TopNodes[no].Leaf;
+    }
+    for(no = 0; no < NTopnodes; no++) /* depth of each top-level leaf, which fixes the morton-key shift at which its sub-tree starts */
+    {
+        if(TopNodes[no].Daughter >= 0) {continue;}
+        peanokey size; int depth;
+        for(depth = 0, size = PEANOCELLS; size > TopNodes[no].Size; size /= 8) {depth++;}
+        leaf_depth[TopNodes[no].Leaf] = depth;
+    }
+
+    /* bucket the particles by top-level leaf (a counting sort on the leading bits of the Peano-Hilbert key) */
+    for(j = 0; j <= NTopleaves; j++) {leaf_offset[j] = 0;}
+    for(k = 0; k < npart; k++) {leaf_offset[leaf_of_part[k] + 1]++;}
+    for(j = 1; j <= NTopleaves; j++) {leaf_offset[j] += leaf_offset[j - 1];}
+    for(k = 0; k < npart; k++) {if(mp) {i = mp[k].index;} else {i = k;} partlist[leaf_offset[leaf_of_part[k]]++] = i;}
+    for(j = NTopleaves; j > 0; j--) {leaf_offset[j] = leaf_offset[j - 1];}
+    leaf_offset[0] = 0;
+
+    /* now build the sub-trees of the different top-level leaves (and, recursively, their large sub-trees) as independent tasks */
+    treebuild_morton = morton_list; treebuild_overflow = 0; treebuild_toodeep = -1;
+    treebuild_nextfree = nfree; treebuild_nodelimit = All.MaxPart + MaxNodes - 1;
+    for(j = 0; j < nthreads; j++) {treebuild_blocks[j].next = treebuild_blocks[j].end = 0;}
+#ifdef _OPENMP
+#pragma omp parallel private(j)
+#pragma omp single
+#endif
+    {
+        for(j = 0; j < NTopleaves; j++)
+        {
+            int n_leaf = leaf_offset[j + 1] - leaf_offset[j], *list_leaf = partlist + leaf_offset[j], no_leaf = DomainNodeIndex[j], depth = leaf_depth[j];
+            if(n_leaf <= 0) {continue;}
+#ifdef _OPENMP
+#pragma omp task firstprivate(n_leaf, list_leaf, no_leaf, depth)
+#endif
+            force_treebuild_subtree(list_leaf, n_leaf, no_leaf, 3 * (BITS_PER_DIMENSION - 1) - 3 * depth, depth);
+        }
+    }
+
+    if(treebuild_toodeep >= 0) /* more nodes would not help here, so stop instead of asking force_treebuild for a larger allocation */
+    {
+        i = treebuild_toodeep;
+        printf("task %d: maximum tree depth %d reached in threaded tree construction for particle %d (ID=%llu, Type=%d, Pos=%g|%g|%g): particles at (nearly) coincident positions cannot be separated.\n",
+               ThisTask, TREEBUILD_MAXDEPTH, i, (unsigned long long) P[i].ID, P[i].Type, P[i].Pos[0], P[i].Pos[1], P[i].Pos[2]);
+        endrun(1);
+    }
+    if(treebuild_overflow)
+    {
+        printf("task %d: maximum number %d of tree-nodes reached in threaded tree construction.\n", ThisTask, MaxNodes);
+        if(All.TreeAllocFactor > 5.0)
+        {
+            printf("task %d: looks like a serious problem, stopping with particle dump.\n", ThisTask);
+            dump_particles();
+            endrun(1);
+        }
+        myfree(treebuild_blocks); myfree(leaf_depth); myfree(leaf_offset); myfree(partlist); myfree(leaf_of_part);
+        return -1;
+    }
+
+    /* close the gaps left by partially-used node blocks: collect them in ascending order, then fill those below the new end
+        of the node list with the nodes that sit above it, and re-point the daughter references to the moved nodes */
+    hole_start = (int *) mymalloc("hole_start", nthreads * sizeof(int));
+    hole_end = (int *) mymalloc("hole_end", nthreads * sizeof(int));
+    int nodes_end = IMIN(treebuild_nextfree, treebuild_nodelimit), n_used = nodes_end - nfree;
+    for(j = 0; j < nthreads; j++)
+    {
+        if(treebuild_blocks[j].next >= treebuild_blocks[j].end) {continue;}
+        for(k = n_holes; k > 0 && hole_start[k - 1] > treebuild_blocks[j].next; k--) {hole_start[k] = hole_start[k - 1]; hole_end[k] = hole_end[k - 1];}
+        hole_start[k] = treebuild_blocks[j].next; hole_end[k] = treebuild_blocks[j].end; n_holes++;
+        n_used -= treebuild_blocks[j].end - treebuild_blocks[j].next;
+    }
+    int new_end = nfree + n_used, src = new_end, h_src = 0;
+    remap = (int *) mymalloc("remap", (nodes_end - new_end + 1) * sizeof(int));
+    while(h_src < n_holes && hole_end[h_src] <= src) {h_src++;}
+    for(j = 0; j < n_holes && hole_start[j] < new_end; j++)
+    {
+        for(k = hole_start[j]; k < hole_end[j] && k < new_end; k++)
+        {
+            while(h_src < n_holes && src >= hole_start[h_src]) {if(src < hole_end[h_src]) {src = hole_end[h_src];} h_src++;} /* skip gaps above the new end */
+            Nodes[k] = Nodes[src];
+            remap[src - new_end] = k;
+            src++;
+        }
+    }
+    if(nodes_end > new_end)
+    {
+#ifdef _OPENMP
+#pragma omp parallel for private(j) schedule(static)
+#endif
+        for(no = All.MaxPart; no < new_end; no++)
+        {
+            for(j = 0; j < 8; j++) {if(Nodes[no].u.suns[j] >= new_end && Nodes[no].u.suns[j] < All.MaxPart + MaxNodes) {Nodes[no].u.suns[j] = remap[Nodes[no].u.suns[j] - new_end];}}
+        }
+    }
+    *numnodes += n_used;
+
+    myfree(remap); myfree(hole_end); myfree(hole_start); myfree(treebuild_blocks); myfree(leaf_depth); myfree(leaf_offset); myfree(partlist); myfree(leaf_of_part);
+    return 0;
+}
+#endif
+
+
 /*! Constructs the gravitational oct-tree.
  *
  *  The index convention for accessing tree nodes is the following: the
@@ -208,6 +542,13 @@ int force_treebuild_single(int npart, struct unbind_data *mp)
 
     morton_list = (peanokey *) mymalloc("morton_list", NumPart * sizeof(peanokey));
 
+#ifdef OPENMP_TREEBUILD
+    if(force_treebuild_insert_threaded(npart, mp, morton_list, nfree, &numnodes) < 0)
+    {
+        myfree(morton_list);
+        return -1;
+    }
+#else
     /* now we insert all particles */
     for(k = 0; k < npart; k++)
     {
@@ -391,6 +732,7 @@ int force_treebuild_single(int npart, struct unbind_data *mp)
             }
         }
     }
+#endif
 
     myfree(morton_list);
 
@@ -531,6 +873,9 @@ void force_update_node_recursive(int no, int sib, int father)
 #endif
 
     MyFloat maxsoft;
+#ifdef GRAVITY_TREE_QUADRUPOLE
+    double quad[6];
+#endif
 
     if(no >= All.MaxPart && no < All.MaxPart + MaxNodes)	/* internal node */
     {
@@ -589,6 +934,9 @@ void force_update_node_recursive(int no, int sib, int father)
         divVmax = 0;
         count_particles = 0;
         maxsoft = 0;
+#ifdef GRAVITY_TREE_QUADRUPOLE
+        for(k = 0; k < 6; k++) {quad[k] = 0;}
+#endif
 
         for(j = 0; j < 8; j++)
         {
@@ -624,6 +972,10 @@ void force_update_node_recursive(int no, int sib, int father)
                         vs[0] += (Nodes[p].u.d.mass * Extnodes[p].vs[0]);
                         vs[1] += (Nodes[p].u.d.mass * Extnodes[p].vs[1]);
                         vs[2] += (Nodes[p].u.d.mass * Extnodes[p].vs[2]);
+#ifdef GRAVITY_TREE_QUADRUPOLE
+                        for(k = 0; k < 6; k++) {quad[k] += Nodes[p].quad[k];}
+                        force_quadrupole_add(quad, Nodes[p].u.d.mass, Nodes[p].u.d.s[0] - Nodes[no].center[0], Nodes[p].u.d.s[1] - Nodes[no].center[1], Nodes[p].u.d.s[2] - Nodes[no].center[2]);
+#endif
 #ifdef RT_USE_TREECOL_FOR_NH
                         gasmass += Nodes[p].gasmass;
 #endif
@@ -705,6 +1057,9 @@ void force_update_node_recursive(int no, int sib, int father)
                     vs[0] += (pa->Mass * pa->Vel[0]);
                     vs[1] += (pa->Mass * pa->Vel[1]);
                     vs[2] += (pa->Mass * pa->Vel[2]);
+#ifdef GRAVITY_TREE_QUADRUPOLE
+                    force_quadrupole_add(quad, pa->Mass, pa->Pos[0] - Nodes[no].center[0], pa->Pos[1] - Nodes[no].center[1], pa->Pos[2] - Nodes[no].center[2]);
+#endif
 #ifdef RT_USE_TREECOL_FOR_NH
                     if(pa->Type == 0) gasmass += pa->Mass;
 #ifdef BH_ALPHADISK_ACCRETION
@@ -874,6 +1229,9 @@ void force_update_node_recursive(int no, int sib, int father)
         Nodes[no].u.d.s[1] = s[1];
         Nodes[no].u.d.s[2] = s[2];
         Nodes[no].GravCost = 0;
+#ifdef GRAVITY_TREE_QUADRUPOLE
+        force_quadrupole_finish(no, quad, mass, s);
+#endif
 #ifdef RT_USE_TREECOL_FOR_NH
         Nodes[no].gasmass = gasmass;
 #endif
@@ -995,6 +1353,9 @@ void force_exchange_pseudodata(void)
 #if defined(ADAPTIVE_GRAVSOFT_FORGAS) || defined(ADAPTIVE_GRAVSOFT_FORALL)
         MyFloat maxsoft;
 #endif
+#ifdef GRAVITY_TREE_QUADRUPOLE
+        MyFloat quad[6];
+#endif
 #ifdef RT_USE_GRAVTREE
         MyFloat stellar_lum[N_RT_FREQ_BINS];
 #ifdef CHIMES_STELLAR_FLUXES
@@ -1062,6 +1423,9 @@ void force_exchange_pseudodata(void)
 #if defined(ADAPTIVE_GRAVSOFT_FORGAS) || defined(ADAPTIVE_GRAVSOFT_FORALL)
             DomainMoment[i].maxsoft = Nodes[no].maxsoft;
 #endif
+#ifdef GRAVITY_TREE_QUADRUPOLE
+            int k_q; for(k_q=0;k_q<6;k_q++) {DomainMoment[i].quad[k_q] = Nodes[no].quad[k_q];}
+#endif
 #ifdef RT_USE_GRAVTREE
             int k; for(k=0;k<N_RT_FREQ_BINS;k++) {DomainMoment[i].stellar_lum[k] = Nodes[no].stellar_lum[k];}
 #ifdef CHIMES_STELLAR_FLUXES
@@ -1154,6 +1518,9 @@ void force_exchange_pseudodata(void)
 #if defined(ADAPTIVE_GRAVSOFT_FORGAS) || defined(ADAPTIVE_GRAVSOFT_FORALL)
                     Nodes[no].maxsoft = DomainMoment[i].maxsoft;
 #endif
+#ifdef GRAVITY_TREE_QUADRUPOLE
+                    int k_q; for(k_q=0;k_q<6;k_q++) {Nodes[no].quad[k_q] = DomainMoment[i].quad[k_q];}
+#endif
 #ifdef RT_USE_GRAVTREE
                     int k; for(k=0;k<N_RT_FREQ_BINS;k++) {Nodes[no].stellar_lum[k] = DomainMoment[i].stellar_lum[k];}
 #ifdef CHIMES_STELLAR_FLUXES
@@ -1228,6 +1595,9 @@ void force_treeupdate_pseudos(int no)
 #endif
 
     MyFloat maxsoft;
+#ifdef GRAVITY_TREE_QUADRUPOLE
+    double quad[6]={0};
+#endif
 
 #ifdef RT_SEPARATELY_TRACK_LUMPOS
     rt_source_lum_s[0] = 0;
@@ -1280,6 +1650,10 @@ void force_treeupdate_pseudos(int no)
             s[0] += (Nodes[p].u.d.mass * Nodes[p].u.d.s[0]);
             s[1] += (Nodes[p].u.d.mass * Nodes[p].u.d.s[1]);
             s[2] += (Nodes[p].u.d.mass * Nodes[p].u.d.s[2]);
+#ifdef GRAVITY_TREE_QUADRUPOLE
+            int k_q; for(k_q=0;k_q<6;k_q++) {quad[k_q] += Nodes[p].quad[k_q];}
+            force_quadrupole_add(quad, Nodes[p].u.d.mass, Nodes[p].u.d.s[0] - Nodes[no].center[0], Nodes[p].u.d.s[1] - Nodes[no].center[1], Nodes[p].u.d.s[2] - Nodes[no].center[2]);
+#endif
 #ifdef RT_USE_GRAVTREE
             int k; for(k=0;k<N_RT_FREQ_BINS;k++) {stellar_lum[k] += (Nodes[p].stellar_lum[k]);}
 #ifdef CHIMES_STELLAR_FLUXES
@@ -1420,6 +1794,9 @@ void force_treeupdate_pseudos(int no)
     Extnodes[no].vs[1] = vs[1];
     Extnodes[no].vs[2] = vs[2];
     Nodes[no].u.d.mass = mass;
+#ifdef GRAVITY_TREE_QUADRUPOLE
+    force_quadrupole_finish(no, quad, mass, s);
+#endif
 #ifdef RT_USE_GRAVTREE
     int k; for(k=0;k<N_RT_FREQ_BINS;k++) {Nodes[no].stellar_lum[k] = stellar_lum[k];}
 #ifdef CHIMES_STELLAR_FLUXES
@@ -1621,6 +1998,9 @@ int force_treeevaluate(int target, int mode, int *exportflag, int *exportnodecou
 #ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
     int i1, i2; double fac2_tidal, fac_tidal; MyDouble tidal_tensorps[3][3];
 #endif
+#ifdef GRAVITY_TREE_QUADRUPOLE
+    MyFloat *quad = 0; /* points to the quadrupole moments of the current interaction partner, if it is a node */
+#endif
 #if defined(REDUCE_TREEWALK_BRANCHING) && defined(PMGRID)
     double dxx, dyy, dzz, pdxx, pdyy, pdzz;
 #endif
@@ -1846,6 +2226,9 @@ int force_treeevaluate(int target, int mode, int *exportflag, int *exportnodecou
         {
             if(no < maxPart)
             {
+#ifdef GRAVITY_TREE_QUADRUPOLE
+                quad = 0;
+#endif
                 /* the index of the node is the index of the particle */
                 if(P[no].Ti_current != ti_Current)
                 {
@@ -2217,7 +2600,7 @@ int force_treeevaluate(int target, int mode, int *exportflag, int *exportnodecou
                     }
 
 #if defined(REDUCE_TREEWALK_BRANCHING) && defined(PMGRID)
-                    if((mass * nop->len * nop->len > r2 * r2 * aold) |
+                    if(GRAVITY_RELATIVE_OPENING_CRIT(mass, nop->len, r2, aold) |
                        ((pdxx < 0.60 * nop->len) & (pdyy < 0.60 * nop->len) & (pdzz < 0.60 * nop->len)))
                     {
                         /* open cell */
@@ -2225,7 +2608,7 @@ int force_treeevaluate(int target, int mode, int *exportflag, int *exportnodecou
                         continue;
                     }
 #else
-                    if(mass * nop->len * nop->len > r2 * r2 * aold)
+                    if(GRAVITY_RELATIVE_OPENING_CRIT(mass, nop->len, r2, aold))
                     {
                         /* open cell */
                         no = nop->u.d.nextnode;
@@ -2278,6 +2661,9 @@ int force_treeevaluate(int target, int mode, int *exportflag, int *exportnodecou
 
                 if(TakeLevel >= 0) {nop->GravCost += 1.0;}
                 no = nop->u.d.sibling;	/* ok, node can be used */
+#ifdef GRAVITY_TREE_QUADRUPOLE
+                quad = nop->quad;
+#endif
 
 #ifdef BH_CALC_DISTANCES // NOTE: moved this to AFTER the checks for node opening, because we only want to record BH positions from the nodes that actually get used for the force calculation - MYG
                 if(nop->bh_mass > 0)        /* found a node with non-zero BH mass */
@@ -2471,6 +2857,33 @@ int force_treeevaluate(int target, int mode, int *exportflag, int *exportnodecou
                 acc_x += FLT(dx * fac);
                 acc_y += FLT(dy * fac);
                 acc_z += FLT(dz * fac);
+#ifdef GRAVITY_TREE_QUADRUPOLE
+                if(quad && (r >= h)) /* accepted nodes lie outside all softening lengths, so this is only false inside the target's own (adaptive) softening */
+                {
+#ifndef PMGRID
+                    int tabindex = 0; /* no short-range tables to look up */
+#endif
+                    double acc_q[3], pot_q;
+#ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
+                    double tidal_q[6];
+                    force_quadrupole_terms(quad, dx, dy, dz, r, tabindex, &pot_q, acc_q, tidal_q);
+                    tidal_tensorps[0][0] += tidal_q[0];
+                    tidal_tensorps[1][1] += tidal_q[1];
+                    tidal_tensorps[2][2] += tidal_q[2];
+                    tidal_tensorps[0][1] += tidal_q[3];
+                    tidal_tensorps[0][2] += tidal_q[4];
+                    tidal_tensorps[1][2] += tidal_q[5];
+#else
+                    force_quadrupole_terms(quad, dx, dy, dz, r, tabindex, &pot_q, acc_q, 0);
+#endif
+                    acc_x += FLT(acc_q[0]);
+                    acc_y += FLT(acc_q[1]);
+                    acc_z += FLT(acc_q[2]);
+#ifdef EVALPOTENTIAL
+                    pot += FLT(pot_q);
+#endif
+                }
+#endif
 
 
 #if defined(BH_DYNFRICTION_FROMTREE)
@@ -2791,6 +3204,338 @@ int force_treeevaluate(int target, int mode, int *exportflag, int *exportnodecou
 
 
 
+#ifdef GRAVITY_GROUPED_TREEWALK_IS_ACTIVE
+/*! Grouped version of the gravity walk (for local targets, i.e. mode 0). Consecutive active particles (in the order of the active-particle
+ *  list, which follows the Peano-Hilbert order of the particles) which lie close together are walked through the tree once, against the
+ *  bounding box of the group: a node is only used if it would be used by every point in that box (the opening criteria are evaluated at the
+ *  distance of the box from the node, with the largest softening and smallest relative-opening tolerance of the group), otherwise it is
+ *  opened. This builds one interaction list of particles and nodes for the whole group, which every member then sums in a tight loop. The
+ *  forces are therefore at least as accurate as with the per-particle walk, while the tree is traversed (and nodes loaded) once per group
+ *  instead of once per particle. Branches on other tasks (pseudo-particles) are exported for every member, exactly as in force_treeevaluate.
+ */
+
+#ifdef ACTIVE_PARTICLE_ARRAY
+/*! takes the next group off the front of list[0..n_list-1], the chunk of the active-particle array claimed by the calling thread. The group
+ *  grows along the list as long as its members fit in a box no larger than the tree leaf holding the first one. */
+int force_treeevaluate_group_collect(int *group, int *list, int n_list)
+{
+    int n_group = 0, i, k, leader = list[0];
+#else
+/*! takes the next group off the active-particle list: called from within the critical section of gravity_primary_loop (since it advances
+ *  NextParticle). The group grows along the list as long as its members fit in a box no larger than the tree leaf holding the first one. */
+int force_treeevaluate_group_collect(int *group)
+{
+    int n_group = 0, i, k, leader = NextParticle;
+#endif
+    double len = (Father[leader] >= 0) ? Nodes[Father[leader]].len : 0, off_min[3] = {0,0,0}, off_max[3] = {0,0,0};
+#ifdef ACTIVE_PARTICLE_ARRAY
+    for(i = leader; (i >= 0) && (n_group < GRAVITY_GROUP_MAXSIZE); i = (n_group < n_list) ? list[n_group] : -1)
+#else
+    for(i = leader; (i >= 0) && (n_group < GRAVITY_GROUP_MAXSIZE); i = NextActiveParticle[i])
+#endif
+    {
+        double d[3]; for(k=0;k<3;k++) {d[k] = P[i].Pos[k] - P[leader].Pos[k];}
+        GRAVITY_NEAREST_XYZ(d[0],d[1],d[2],-1);
+        for(k=0;k<3;k++) {if(DMAX(off_max[k],d[k]) - DMIN(off_min[k],d[k]) > len) {break;}}
+        if(k < 3) {break;} /* would make the group too extended: it ends here */
+        for(k=0;k<3;k++) {off_min[k] = DMIN(off_min[k],d[k]); off_max[k] = DMAX(off_max[k],d[k]);}
+        group[n_group++] = i; ProcessedFlag[i] = 0;
+    }
+#ifndef ACTIVE_PARTICLE_ARRAY
+    NextParticle = i;
+#endif
+    return n_group;
+}
+
+/*! appends a particle or node to the interaction list of the group */
+static inline void force_treeevaluate_group_add(struct gravity_group_workspace *ws, MyDouble *pos, double mass, double soft, int node)
+{
+    if(ws->N_list >= ws->MaxList)
+    {
+        ws->MaxList = DMAX(2 * ws->MaxList, 1024);
+        ws->x = (double *) realloc(ws->x, ws->MaxList * sizeof(double)); ws->y = (double *) realloc(ws->y, ws->MaxList * sizeof(double));
+        ws->z = (double *) realloc(ws->z, ws->MaxList * sizeof(double)); ws->mass = (double *) realloc(ws->mass, ws->MaxList * sizeof(double));
+        ws->soft = (double *) realloc(ws->soft, ws->MaxList * sizeof(double)); ws->node = (int *) realloc(ws->node, ws->MaxList * sizeof(int));
+        if(!(ws->x && ws->y && ws->z && ws->mass && ws->soft && ws->node)) {printf("Task %d failed to grow the grouped-walk interaction list to %d entries\n", ThisTask, ws->MaxList); endrun(9213);}
+    }
+    ws->x[ws->N_list] = pos[0]; ws->y[ws->N_list] = pos[1]; ws->z[ws->N_list] = pos[2];
+    ws->mass[ws->N_list] = mass; ws->soft[ws->N_list] = soft; ws->node[ws->N_list] = node;
+    ws->N_list++;
+}
+
+void force_treeevaluate_group_free(struct gravity_group_workspace *ws)
+{
+    free(ws->pseudo); free(ws->node); free(ws->soft); free(ws->mass); free(ws->z); free(ws->y); free(ws->x);
+    memset(ws, 0, sizeof(struct gravity_group_workspace));
+}
+
+/*! walks the tree for the group of n_group local active particles, exports them where needed, and evaluates and stores their accelerations
+ *  (and potentials and tidal tensors, if enabled). Returns the number of interactions, or -1 if the export buffer filled up, in which case
+ *  none of the group counts as done. */
+int force_treeevaluate_group(int *group, int n_group, int *exportflag, int *exportnodecount, int *exportindex, struct gravity_group_workspace *ws)
+{
+    struct NODE *nop;
+    int no, k, m, task, nexp, ninteractions = 0, leader = group[0], maxPart = All.MaxPart, maxNodes = MaxNodes;
+    long bunchSize = All.BunchSize;
+    integertime ti_Current = All.Ti_Current;
+    double errTol2 = All.ErrTolTheta * All.ErrTolTheta, aold = MAX_REAL_NUMBER, soft = 0, box_c[3], box_e[3], off_min[3] = {0,0,0}, off_max[3] = {0,0,0};
+#ifdef PMGRID
+    double rcut = All.Rcut[0], asmthfac = 0.5 / All.Asmth[0] * (NTAB / 3.0);
+#endif
+
+    /* bounding box of the group (built from offsets to the first member, so it is well-defined across periodic boundaries), the largest
+        softening, and the most demanding relative-opening tolerance among its members */
+    for(m = 0; m < n_group; m++)
+    {
+        int i = group[m]; double d[3]; for(k=0;k<3;k++) {d[k] = P[i].Pos[k] - P[leader].Pos[k];}
+        GRAVITY_NEAREST_XYZ(d[0],d[1],d[2],-1);
+        for(k=0;k<3;k++) {off_min[k] = DMIN(off_min[k],d[k]); off_max[k] = DMAX(off_max[k],d[k]);}
+        soft = DMAX(soft, All.ForceSoftening[P[i].Type]);
+        aold = DMIN(aold, All.ErrTolForceAcc * P[i].OldAcc);
+    }
+    for(k=0;k<3;k++) {box_c[k] = P[leader].Pos[k] + 0.5*(off_min[k] + off_max[k]); box_e[k] = 0.5*(off_max[k] - off_min[k]);}
+
+    /* walk the tree once for the whole group, building the shared interaction list */
+    ws->N_list = ws->N_pseudo = 0;
+    no = maxPart; /* root node */
+    while(no >= 0)
+    {
+        if(no < maxPart) /* a single particle: always goes on the list (the members skip themselves at zero separation) */
+        {
+            if(P[no].Ti_current != ti_Current)
+            {
+                LOCK_PARTNODEDRIFT;
+#ifdef _OPENMP
+#pragma omp critical(_partnodedrift_)
+#endif
+                drift_particle(no, ti_Current);
+                UNLOCK_PARTNODEDRIFT;
+            }
+            if(P[no].Mass > 0) {force_treeevaluate_group_add(ws, P[no].Pos, P[no].Mass, All.ForceSoftening[P[no].Type], -1);}
+            if(TakeLevel >= 0) {P[no].GravCost[TakeLevel] += n_group;}
+            no = Nextnode[no];
+            continue;
+        }
+        if(no >= maxPart + maxNodes) /* pseudo particle: the branch lives on another task, so the members are exported there below */
+        {
+            if(ws->N_pseudo >= ws->MaxPseudo)
+            {
+                ws->MaxPseudo = DMAX(2 * ws->MaxPseudo, 64);
+                if(!(ws->pseudo = (int *) realloc(ws->pseudo, ws->MaxPseudo * sizeof(int)))) {printf("Task %d failed to grow the grouped-walk export list to %d entries\n", ThisTask, ws->MaxPseudo); endrun(9214);}
+            }
+            ws->pseudo[ws->N_pseudo++] = no - (maxPart + maxNodes);
+            no = Nextnode[no - maxNodes];
+            continue;
+        }
+
+        nop = &Nodes[no];
+        double mass = nop->u.d.mass;
+        if(!(nop->u.d.bitflags & (1 << BITFLAG_MULTIPLEPARTICLES))) {if(mass) {no = nop->u.d.nextnode; continue;}} /* open cell */
+        if(nop->Ti_current != ti_Current)
+        {
+            LOCK_PARTNODEDRIFT;
+#ifdef _OPENMP
+#pragma omp critical(_partnodedrift_)
+#endif
+            force_drift_node(no, ti_Current);
+            UNLOCK_PARTNODEDRIFT;
+        }
+
+        /* r2 is the squared distance of the node center-of-mass from the nearest point of the group's box, and dc the distance of its
+            geometric center from the box along each axis: the opening criteria use these in place of the distances to a single target */
+        double d[3], dc[3], r2 = 0;
+        for(k=0;k<3;k++) {d[k] = nop->u.d.s[k] - box_c[k]; dc[k] = nop->center[k] - box_c[k];}
+        GRAVITY_NEAREST_XYZ(d[0],d[1],d[2],-1);
+        GRAVITY_NEAREST_XYZ(dc[0],dc[1],dc[2],-1);
+        for(k=0;k<3;k++) {double dd = fabs(d[k]) - box_e[k]; if(dd > 0) {r2 += dd*dd;} dc[k] = fabs(dc[k]) - box_e[k];}
+#ifdef PMGRID
+        double eff_dist = rcut + 0.5 * nop->len;
+        if((dc[0] > eff_dist) || (dc[1] > eff_dist) || (dc[2] > eff_dist)) {no = nop->u.d.sibling; continue;} /* beyond the short-range force of every member */
+#endif
+        if(errTol2)	/* check Barnes-Hut opening criterion */
+        {
+            if(nop->len * nop->len > r2 * errTol2) {no = nop->u.d.nextnode; continue;}
+        }
+#ifndef GRAVITY_HYBRID_OPENING_CRIT
+        else		/* check relative opening criterion */
+#else
+        if(!(All.Ti_Current == 0 && RestartFlag != 1))
+#endif
+        {
+            if((r2 < (soft+0.6*nop->len)*(soft+0.6*nop->len)) || (r2 < (nop->maxsoft+0.6*nop->len)*(nop->maxsoft+0.6*nop->len))) {no = nop->u.d.nextnode; continue;}
+            if(GRAVITY_RELATIVE_OPENING_CRIT(mass, nop->len, r2, aold)) {no = nop->u.d.nextnode; continue;}
+            if((dc[0] < 0.60 * nop->len) && (dc[1] < 0.60 * nop->len) && (dc[2] < 0.60 * nop->len)) {no = nop->u.d.nextnode; continue;} /* a member may lie inside the cell */
+        }
+        /* nodes are only used outside the softening of every member and particle in them, so they always act as unsoftened multipoles */
+        double h = DMAX(soft, nop->maxsoft);
+        if(r2 < h * h) {no = nop->u.d.nextnode; continue;}
+
+        if(TakeLevel >= 0) {nop->GravCost += n_group;}
+        if(mass > 0) {force_treeevaluate_group_add(ws, nop->u.d.s, mass, nop->maxsoft, no);}
+        no = nop->u.d.sibling;	/* ok, node can be used */
+    }
+
+    /* export every member to the tasks holding the branches we reached: same bookkeeping as in force_treeevaluate */
+    for(m = 0; m < n_group; m++)
+    {
+        int target = group[m];
+        for(k = 0; k < ws->N_pseudo; k++)
+        {
+            if(exportflag[task = DomainTask[ws->pseudo[k]]] != target)
+            {
+                exportflag[task] = target;
+                exportnodecount[task] = NODELISTLENGTH;
+            }
+            if(exportnodecount[task] == NODELISTLENGTH)
+            {
+                int exitFlag = 0;
+                LOCK_NEXPORT;
+#ifdef _OPENMP
+#pragma omp critical(_nexport_)
+#endif
+                {
+                    if(Nexport >= bunchSize)
+                    {
+                        /* out of buffer space. Need to discard work for this group and interrupt */
+                        BufferFullFlag = 1;
+                        exitFlag = 1;
+                    }
+                    else
+                    {
+                        nexp = Nexport;
+                        Nexport++;
+                    }
+                }
+                UNLOCK_NEXPORT;
+                if(exitFlag) {return -1;}
+
+                exportnodecount[task] = 0;
+                exportindex[task] = nexp;
+                DataIndexTable[nexp].Task = task;
+                DataIndexTable[nexp].Index = target;
+                DataIndexTable[nexp].IndexGet = nexp;
+            }
+            DataNodeList[exportindex[task]].NodeList[exportnodecount[task]++] = DomainNodeIndex[ws->pseudo[k]];
+            if(exportnodecount[task] < NODELISTLENGTH) {DataNodeList[exportindex[task]].NodeList[exportnodecount[task]] = -1;}
+        }
+    }
+
+    /* now each member sums up the shared list */
+    for(m = 0; m < n_group; m++)
+    {
+        int target = group[m], ptype = P[target].Type;
+        double pos_x = P[target].Pos[0], pos_y = P[target].Pos[1], pos_z = P[target].Pos[2], soft_target = All.ForceSoftening[ptype];
+        MyLongDouble acc_x = 0, acc_y = 0, acc_z = 0;
+#ifdef EVALPOTENTIAL
+        MyLongDouble pot = 0;
+#endif
+#ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
+        int i1, i2; MyDouble tidal_tensorps[3][3]; for(i1 = 0; i1 < 3; i1++) {for(i2 = 0; i2 < 3; i2++) {tidal_tensorps[i1][i2] = 0;}}
+#endif
+        for(k = 0; k < ws->N_list; k++)
+        {
+            double dx = ws->x[k] - pos_x, dy = ws->y[k] - pos_y, dz = ws->z[k] - pos_z, mass = ws->mass[k];
+            GRAVITY_NEAREST_XYZ(dx,dy,dz,-1);
+            double r2 = dx * dx + dy * dy + dz * dz;
+            if(r2 <= 0) {continue;} /* the target itself */
+            double r = sqrt(r2), h = DMAX(soft_target, ws->soft[k]), fac, facpot, fac2_tidal;
+#ifdef PMGRID
+            int tabindex = (int) (asmthfac * r);
+            if(tabindex >= NTAB || tabindex < 0) {continue;}
+#else
+            int tabindex = 0;
+#endif
+            if(r >= h)
+            {
+                fac = mass / (r2 * r);
+                facpot = -mass / r;
+                fac2_tidal = 3.0 * mass / (r2 * r2 * r);
+            }
+            else
+            {
+                double h_inv = 1.0 / h, h3_inv = h_inv * h_inv * h_inv, u = r * h_inv;
+                fac = mass * kernel_gravity(u, h_inv, h3_inv, 1);
+                facpot = mass * kernel_gravity(u, h_inv, h3_inv, -1);
+                fac2_tidal = mass * kernel_gravity(u, h_inv, h3_inv, 2);
+            }
+#ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
+            double fac_tidal = fac; /* before the short-range factor (needed for the tidal field) */
+#endif
+#ifdef PMGRID
+            fac *= shortrange_table[tabindex];
+            facpot *= shortrange_table_potential[tabindex];
+#endif
+            acc_x += FLT(dx * fac);
+            acc_y += FLT(dy * fac);
+            acc_z += FLT(dz * fac);
+#ifdef EVALPOTENTIAL
+            pot += FLT(facpot);
+#if defined(BOX_PERIODIC) && !defined(GRAVITY_NOT_PERIODIC) && !defined(PMGRID)
+            pot += FLT(mass * ewald_pot_corr(dx, dy, dz));
+#endif
+#endif
+#ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
+#ifdef PMGRID
+            tidal_tensorps[0][0] += ((-fac_tidal + dx * dx * fac2_tidal) * shortrange_table[tabindex]) + dx * dx * fac2_tidal / 3.0 * shortrange_table_tidal[tabindex];
+            tidal_tensorps[0][1] += ((dx * dy * fac2_tidal) * shortrange_table[tabindex]) + dx * dy * fac2_tidal / 3.0 * shortrange_table_tidal[tabindex];
+            tidal_tensorps[0][2] += ((dx * dz * fac2_tidal) * shortrange_table[tabindex]) + dx * dz * fac2_tidal / 3.0 * shortrange_table_tidal[tabindex];
+            tidal_tensorps[1][1] += ((-fac_tidal + dy * dy * fac2_tidal) * shortrange_table[tabindex]) + dy * dy * fac2_tidal / 3.0 * shortrange_table_tidal[tabindex];
+            tidal_tensorps[1][2] += ((dy * dz * fac2_tidal) * shortrange_table[tabindex]) + dy * dz * fac2_tidal / 3.0 * shortrange_table_tidal[tabindex];
+            tidal_tensorps[2][2] += ((-fac_tidal + dz * dz * fac2_tidal) * shortrange_table[tabindex]) + dz * dz * fac2_tidal / 3.0 * shortrange_table_tidal[tabindex];
+#else
+            tidal_tensorps[0][0] += (-fac_tidal + dx * dx * fac2_tidal);
+            tidal_tensorps[0][1] += (dx * dy * fac2_tidal);
+            tidal_tensorps[0][2] += (dx * dz * fac2_tidal);
+            tidal_tensorps[1][1] += (-fac_tidal + dy * dy * fac2_tidal);
+            tidal_tensorps[1][2] += (dy * dz * fac2_tidal);
+            tidal_tensorps[2][2] += (-fac_tidal + dz * dz * fac2_tidal);
+#endif
+#endif
+#ifdef GRAVITY_TREE_QUADRUPOLE
+            if(ws->node[k] >= 0) /* accepted nodes are always outside the softening, see above */
+            {
+                double acc_q[3], pot_q;
+#ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
+                double tidal_q[6];
+                force_quadrupole_terms(Nodes[ws->node[k]].quad, dx, dy, dz, r, tabindex, &pot_q, acc_q, tidal_q);
+                tidal_tensorps[0][0] += tidal_q[0]; tidal_tensorps[1][1] += tidal_q[1]; tidal_tensorps[2][2] += tidal_q[2];
+                tidal_tensorps[0][1] += tidal_q[3]; tidal_tensorps[0][2] += tidal_q[4]; tidal_tensorps[1][2] += tidal_q[5];
+#else
+                force_quadrupole_terms(Nodes[ws->node[k]].quad, dx, dy, dz, r, tabindex, &pot_q, acc_q, 0);
+#endif
+                acc_x += FLT(acc_q[0]);
+                acc_y += FLT(acc_q[1]);
+                acc_z += FLT(acc_q[2]);
+#ifdef EVALPOTENTIAL
+                pot += FLT(pot_q);
+#endif
+            }
+#endif
+        }
+        ninteractions += ws->N_list;
+
+        /* store result at the proper place */
+        P[target].GravAccel[0] = acc_x;
+        P[target].GravAccel[1] = acc_y;
+        P[target].GravAccel[2] = acc_z;
+#ifdef EVALPOTENTIAL
+        P[target].Potential = pot;
+#endif
+#ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
+        tidal_tensorps[1][0] = tidal_tensorps[0][1];
+        tidal_tensorps[2][0] = tidal_tensorps[0][2];
+        tidal_tensorps[2][1] = tidal_tensorps[1][2];
+        for(i1 = 0; i1 < 3; i1++) {for(i2 = 0; i2 < 3; i2++) {P[target].tidal_tensorps[i1][i2] = tidal_tensorps[i1][i2];}}
+#endif
+    }
+    return ninteractions;
+}
+#endif // GRAVITY_GROUPED_TREEWALK_IS_ACTIVE
+
+
+
+
+
 #ifdef BOX_PERIODIC
 /*! This function computes the Ewald correction, and is needed if periodic
  *  boundary conditions together with a pure tree algorithm are used. Note
@@ -3173,6 +3918,9 @@ int force_treeevaluate_potential(int target, int mode, int *nexport, int *nsend_
     double r2, dx, dy, dz, mass, r, u, h, h_inv;
     double pos_x, pos_y, pos_z, aold;
     double fac, dxx, dyy, dzz;
+#ifdef GRAVITY_TREE_QUADRUPOLE
+    MyFloat *quad = 0;
+#endif
 #ifdef PMGRID
     int tabindex;
     double eff_dist, rcut, asmth, asmthfac;
@@ -3254,6 +4002,9 @@ int force_treeevaluate_potential(int target, int mode, int *nexport, int *nsend_
         {
             if(no < All.MaxPart)	/* single particle */
             {
+#ifdef GRAVITY_TREE_QUADRUPOLE
+                quad = 0;
+#endif
                 /* the index of the node is the index of the particle */
                 /* observe the sign  */
                 if(P[no].Ti_current != All.Ti_Current) {drift_particle(no, All.Ti_Current);}
@@ -3425,7 +4176,7 @@ int force_treeevaluate_potential(int target, int mode, int *nexport, int *nsend_
                     }
 
 #ifdef REDUCE_TREEWALK_BRANCHING
-                    if((mass * nop->len * nop->len > r2 * r2 * aold) |
+                    if(GRAVITY_RELATIVE_OPENING_CRIT(mass, nop->len, r2, aold) |
                        ((fabs(dxx) < 0.60 * nop->len) & (fabs(dyy) < 0.60 * nop->len) & (fabs(dzz) < 0.60 * nop->len)))
                     {
                         /* open cell */
@@ -3433,7 +4184,7 @@ int force_treeevaluate_potential(int target, int mode, int *nexport, int *nsend_
                         continue;
                     }
 #else
-                    if(mass * nop->len * nop->len > r2 * r2 * aold)
+                    if(GRAVITY_RELATIVE_OPENING_CRIT(mass, nop->len, r2, aold))
                     {
                         /* open cell */
                         no = nop->u.d.nextnode;
@@ -3489,6 +4240,9 @@ int force_treeevaluate_potential(int target, int mode, int *nexport, int *nsend_
                 }
 #endif // #if defined(ADAPTIVE_GRAVSOFT_FORGAS) || defined(ADAPTIVE_GRAVSOFT_FORALL) //
                 no = nop->u.d.sibling;	/* node can be used */
+#ifdef GRAVITY_TREE_QUADRUPOLE
+                quad = nop->quad;
+#endif
             }
 
             r = sqrt(r2);
@@ -3505,6 +4259,17 @@ int force_treeevaluate_potential(int target, int mode, int *nexport, int *nsend_
                 if(r >= h)
                 {
                     pot += FLT(-fac * mass / r);
+#ifdef GRAVITY_TREE_QUADRUPOLE
+                    if(quad)
+                    {
+#ifndef PMGRID
+                        int tabindex = 0; /* no short-range tables to look up */
+#endif
+                        double pot_q, acc_q[3];
+                        force_quadrupole_terms(quad, dx, dy, dz, r, tabindex, &pot_q, acc_q, 0);
+                        pot += FLT(pot_q);
+                    }
+#endif
                 } else {
                     h_inv = 1.0 / h;
                     u = r * h_inv;
@@ -3586,6 +4351,9 @@ int subfind_force_treeevaluate_potential(int target, int mode, int *nexport, int
         {
             if(no < All.MaxPart)	/* single particle */
             {
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+                if(Father[no] < 0) {no = Nextnode[no]; continue;} /* unbound, and already subtracted from the tree */
+#endif
                 /* the index of the node is the index of the particle */
                 /* observe the sign */
 
@@ -3710,6 +4478,30 @@ int subfind_force_treeevaluate_potential(int target, int mode, int *nexport, int
         PotDataResult[target].Potential = pot;
     return 0;
 }
+
+
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+/*! removes the local particle p (unbound) from the tree built for the unbinding: its mass and center of mass are subtracted from all
+ *  the nodes containing it, and it is marked (Father=-1) to be skipped by subfind_force_treeevaluate_potential. Only the moments used by
+ *  the potential walk are updated. Once all tasks are done removing particles, the top-level nodes have to be brought up to date with
+ *  force_exchange_pseudodata() and force_treeupdate_pseudos(All.MaxPart), as after a tree construction */
+void subfind_force_tree_remove_particle(int p)
+{
+    int no = Father[p], k;
+    Father[p] = -1;
+    while(no >= 0)
+    {
+        double mass = Nodes[no].u.d.mass - P[p].Mass;
+        if(mass > 1.0e-10 * Nodes[no].u.d.mass)
+        {
+            for(k = 0; k < 3; k++) {Nodes[no].u.d.s[k] = (Nodes[no].u.d.mass * Nodes[no].u.d.s[k] - P[p].Mass * P[p].Pos[k]) / mass;}
+            Nodes[no].u.d.mass = mass;
+        }
+        else {for(k = 0; k < 3; k++) {Nodes[no].u.d.s[k] = Nodes[no].center[k];} Nodes[no].u.d.mass = 0;} /* node emptied (up to round-off) */
+        no = Nodes[no].u.d.father;
+    }
+}
+#endif
 #endif // SUBFIND //
 
 
@@ -3776,6 +4568,13 @@ void force_treeallocate(int maxnodes, int maxpart)
             shortrange_table_potential[i] = erfc(u);
 #ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
             shortrange_table_tidal[i] = 4.0 * u * u * u / sqrt(M_PI) * exp(-u * u);
+#endif
+#if defined(GRAVITY_TREE_QUADRUPOLE) && defined(PMGRID)
+            /* b_n = (-1/r d/dr)^n [erfc(alpha*r)/r] = (2n-1)!!/r^(2n+1) * table, with u = alpha*r, alpha = 1/(2*asmth), from the
+                recurrence b_n = [(2n-1) b_(n-1) + (2*alpha^2)^n/(alpha*sqrt(pi)) * exp(-u^2)]/r^2 */
+            shortrange_table_quadrupole[0][i] = shortrange_table[i] + 4.0 / 3.0 * u * u * u / sqrt(M_PI) * exp(-u * u);
+            shortrange_table_quadrupole[1][i] = shortrange_table_quadrupole[0][i] + 8.0 / 15.0 * pow(u, 5) / sqrt(M_PI) * exp(-u * u);
+            shortrange_table_quadrupole[2][i] = shortrange_table_quadrupole[1][i] + 16.0 / 105.0 * pow(u, 7) / sqrt(M_PI) * exp(-u * u);
 #endif
         }
     }
@@ -41,6 +41,31 @@ int force_treeevaluate(int target, int mode, int *exportflag, int *exportnodecou
 int force_treeevaluate_ewald_correction(int target, int mode, int *exportflag, int *exportnodecount, int *exportindex);
 int force_treeevaluate_potential(int target, int type, int *nexport, int *nsend_local);
 
+/* the grouped walk only evaluates the plain gravitational terms (with optional potential, tidal tensor, and quadrupoles): modules which do
+    additional per-target work inside the gravity walk, or need per-target softenings or PM split scales, keep the per-particle walk */
+#if defined(GRAVITY_GROUPED_TREEWALK) && !(defined(ADAPTIVE_GRAVSOFT_FORGAS) || defined(ADAPTIVE_GRAVSOFT_FORALL) || defined(RT_USE_GRAVTREE) || defined(RT_USE_TREECOL_FOR_NH) || defined(BH_CALC_DISTANCES) || defined(DM_SCALARFIELD_SCREENING) || defined(COMPUTE_JERK_IN_GRAVTREE) || defined(BH_DYNFRICTION_FROMTREE) || defined(COUNT_MASS_IN_GRAVTREE) || defined(BH_SEED_FROM_LOCALGAS_TOTALMENCCRITERIA) || defined(SINGLE_STAR_SINK_DYNAMICS) || defined(GRAVITY_ACCURATE_FEWBODY_INTEGRATION) || defined(BINARY) || defined(PM_PLACEHIGHRESREGION) || defined(SINGLE_STAR_TIMESTEPPING) || defined(SINGLE_STAR_FIND_BINARIES) || defined(SINGLE_STAR_FB_TIMESTEPLIMIT) || defined(NEIGHBORS_MUST_BE_COMPUTED_EXPLICITLY_IN_FORCETREE) || defined(RT_OTVET) || defined(CHIMES_STELLAR_FLUXES) || defined(HERMITE_INTEGRATION) || defined(ADAPTIVE_TREEFORCE_UPDATE))
+#define GRAVITY_GROUPED_TREEWALK_IS_ACTIVE
+#if CHECK_IF_PREPROCESSOR_HAS_NUMERICAL_VALUE_(GRAVITY_GROUPED_TREEWALK)
+#define GRAVITY_GROUP_MAXSIZE (GRAVITY_GROUPED_TREEWALK) /* maximum number of active particles walked together */
+#else
+#define GRAVITY_GROUP_MAXSIZE 16
+#endif
+struct gravity_group_workspace /* per-thread interaction list of the grouped walk, grown as needed */
+{
+    int N_list, MaxList, N_pseudo, MaxPseudo;
+    double *x, *y, *z, *mass, *soft; /* position, mass, and softening of each particle or accepted node in the list */
+    int *node; /* index of the node, or -1 for particles */
+    int *pseudo; /* top-level leaves (indices into DomainTask/DomainNodeIndex) reached on other tasks */
+};
+#ifdef ACTIVE_PARTICLE_ARRAY
+int force_treeevaluate_group_collect(int *group, int *list, int n_list);
+#else
+int force_treeevaluate_group_collect(int *group);
+#endif
+int force_treeevaluate_group(int *group, int n_group, int *exportflag, int *exportnodecount, int *exportindex, struct gravity_group_workspace *ws);
+void force_treeevaluate_group_free(struct gravity_group_workspace *ws);
+#endif
+
 void force_drift_node(int no, integertime time1);
      
 void force_tree_discardpartials(void);
@@ -97,13 +122,19 @@ void   ngb_update_nodes(void);
 void   ngb_treesearch_notsee(int no);
 
 int ngb_treefind_fof_primary(MyDouble searchcenter[3], MyFloat hsml, int target, int *startnode, int mode,
-			    int *nexport, int *nsend_local, int MyFOF_PRIMARY_LINK_TYPES);
+			    int *nexport, int *nsend_local, int MyFOF_PRIMARY_LINK_TYPES, int *ngblist);
 int ngb_clear_buf(MyDouble searchcenter[3], MyFloat hguess, int numngb);
 void ngb_treefind_flagexport(MyDouble searchcenter[3], MyFloat hguess);
 
 
 int ngb_treefind_pairs_threads(MyDouble searchcenter[3], MyFloat hsml, int target, int *startnode,
 		       int mode, int *exportflag, int *exportnodecount, int *exportindex, int *ngblist);		       
+#ifdef HYDRO_NGBLIST_CACHE
+int ngb_treefind_pairs_threads_cached(MyDouble searchcenter[3], MyFloat hsml, int target, int *startnode,
+                                      int mode, int *exportflag, int *exportnodecount, int *exportindex, int *ngblist);
+void ngb_cache_allocate(void);
+void ngb_cache_free(void);
+#endif
 int ngb_treefind_variable_targeted(MyDouble searchcenter[3], MyFloat hsml, int target, int *startnode, int mode,
  			  int *nexport, int *nsend_local, int TARGET_BITMASK);
 int ngb_treefind_pairs_targeted(MyDouble searchcenter[3], MyFloat hsml, int target, int *startnode, int mode,
@@ -373,6 +373,7 @@ void force_update_hmax(void)
 
   for(i = FirstActiveParticle; i >= 0; i = NextActiveParticle[i])
   {
+    PHOT_UPDATE(i); /* kernel lengths of active particles were just re-computed */
 #if defined(ADAPTIVE_GRAVSOFT_FORALL)
     if(P[i].Mass > 0)
 #else
@@ -133,11 +133,14 @@ void gravity_tree(void)
         TakeLevel = -1;
     }
     if(TakeLevel >= 0) {for(i = 0; i < NumPart; i++) {P[i].GravCost[TakeLevel] = 0;}} /* re-zero the cost [will be re-summed] */
+#ifdef DOMAIN_MEASURED_COST
+    if(TakeLevel >= 0) {domain_measured_cost_reset(TakeLevel);} /* the measured costs of the other loops in this step are re-summed at the same level */
+#endif
 
     /* begin main communication and tree-walk loop. note the ewald-iter terms here allow for multiple iterations for periodic-tree corrections if needed */
     for(Ewald_iter = 0; Ewald_iter <= ewald_max; Ewald_iter++)
     {
-        NextParticle = FirstActiveParticle;	/* begin with this index */
+        NextParticle = ACTIVE_CURSOR_FIRST;	/* begin with this index */
         do /* primary point-element loop */
         {
             iter++;
@@ -177,8 +180,8 @@ void gravity_tree(void)
                 while(NextParticle >= 0)
                 {
                     if(NextParticle == last_nextparticle) {break;}
-                    if(ProcessedFlag[NextParticle] != 1) {break;}
-                    ProcessedFlag[NextParticle] = 2; NextParticle = NextActiveParticle[NextParticle];
+                    if(ProcessedFlag[ACTIVE_CURSOR_PARTICLE(NextParticle)] != 1) {break;}
+                    ProcessedFlag[ACTIVE_CURSOR_PARTICLE(NextParticle)] = 2; NextParticle = ACTIVE_CURSOR_NEXT(NextParticle);
                 }
                 if(NextParticle == save_NextParticle) {endrun(114408);} /* in this case, the buffer is too small to process even a single particle */
 
@@ -572,6 +575,9 @@ void gravity_tree(void)
     /* Now the force computation is finished: gather timing and diagnostic information */
     t1 = WallclockTime = my_second(); timeall = timediff(t0, t1);
     timetree = timetree1 + timetree2; timewait = timewait1 + timewait2; timecomm = timecommsumm1 + timecommsumm2;
+#ifdef DOMAIN_MEASURED_COST
+    if(TakeLevel >= 0) {domain_measured_cost_gravity(TakeLevel, timetree * maxThreads, Costtotal);} /* calibrates the measured costs against the gravity costs */
+#endif
     MPI_Reduce(&timetree, &sumt, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
     MPI_Reduce(&timetree, &maxt, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
     MPI_Reduce(&timetree1, &sumt1, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
@@ -622,18 +628,58 @@ void *gravity_primary_loop(void *p)
     int i, j, ret, thread_id = *(int *) p, *exportflag, *exportnodecount, *exportindex;
     exportflag = Exportflag + thread_id * NTask; exportnodecount = Exportnodecount + thread_id * NTask; exportindex = Exportindex + thread_id * NTask;
     for(j = 0; j < NTask; j++) {exportflag[j] = -1;} /* Note: exportflag is local to each thread */
+#ifdef GRAVITY_GROUPED_TREEWALK_IS_ACTIVE
+    int group[GRAVITY_GROUP_MAXSIZE], n_group; struct gravity_group_workspace ws; memset(&ws, 0, sizeof(struct gravity_group_workspace));
+#endif
+
+#ifdef ACTIVE_PARTICLE_ARRAY
+    int k_slot = 0, n_slot = 0, max_chunk = ACTIVE_PARTICLE_MAXCHUNK; /* chunk of the active-particle array claimed by this thread (no lock needed) */
+#ifdef GRAVITY_GROUPED_TREEWALK_IS_ACTIVE
+    max_chunk = IMAX(max_chunk, GRAVITY_GROUP_MAXSIZE); /* so a chunk can hold a full group */
+#endif
+#ifdef THREAD_WORK_STEALING_IS_ACTIVE
+    thread_scheduler_begin(THREAD_SCHEDULER_COST_GRAVITY);
+#endif
+#endif
 
     while(1)
     {
+#ifdef GRAVITY_GROUPED_TREEWALK_IS_ACTIVE
+        n_group = 0;
+#endif
+#ifdef ACTIVE_PARTICLE_ARRAY
+        if(BufferFullFlag != 0) {break;}
+        if(n_slot <= 0) {k_slot = active_particle_claim_chunk(max_chunk, &n_slot); if(k_slot < 0) {break;}}
+#ifdef GRAVITY_GROUPED_TREEWALK_IS_ACTIVE
+        if(!Ewald_iter) {n_group = force_treeevaluate_group_collect(group, ActiveParticleList + k_slot, n_slot); k_slot += n_group; n_slot -= n_group;} /* group of nearby particles from the claimed chunk */
+        else
+#endif
+        {i = ActiveParticleList[k_slot++]; n_slot--;}
+#else
         int exitFlag = 0;
         LOCK_NEXPORT;
 #ifdef _OPENMP
 #pragma omp critical(_nexport_)
 #endif
         if(BufferFullFlag != 0 || NextParticle < 0) {exitFlag=1;}
+#ifdef GRAVITY_GROUPED_TREEWALK_IS_ACTIVE
+            else if(!Ewald_iter) {n_group = force_treeevaluate_group_collect(group);} /* take a group of nearby particles off the list, walked together */
+#endif
             else {i=NextParticle; ProcessedFlag[i]=0; NextParticle=NextActiveParticle[NextParticle];}
         UNLOCK_NEXPORT;
         if(exitFlag) {break;}
+#endif
+
+#ifdef GRAVITY_GROUPED_TREEWALK_IS_ACTIVE
+        if(n_group > 0)
+        {
+            ret = force_treeevaluate_group(group, n_group, exportflag, exportnodecount, exportindex, &ws);
+            if(ret < 0) {break;} /* export buffer has filled up */
+            Costtotal += ret;
+            for(j = 0; j < n_group; j++) {ProcessedFlag[group[j]] = 1;} /* group successfully finished */
+            continue;
+        }
+#endif
 
 #ifdef HERMITE_INTEGRATION /* if we are in the Hermite extra loops and a particle is not flagged for this, simply mark it done and move on */
         if(HermiteOnlyFlag && !eligible_for_hermite(i)) {ProcessedFlag[i]=1; continue;}
@@ -657,6 +703,12 @@ void *gravity_primary_loop(void *p)
         }
         ProcessedFlag[i] = 1;	/* particle successfully finished */
     } // while loop
+#ifdef THREAD_WORK_STEALING_IS_ACTIVE
+    thread_scheduler_end();
+#endif
+#ifdef GRAVITY_GROUPED_TREEWALK_IS_ACTIVE
+    force_treeevaluate_group_free(&ws);
+#endif
     return NULL;
 }
 
@@ -21,6 +21,12 @@
   #define fftw_mpi_plan_dft_c2r_3d	    fftwf_mpi_plan_dft_c2r_3d 
   #define fftw_execute			    fftwf_execute 
   #define fftw_destroy_plan		    fftwf_destroy_plan
+  #define fftw_plan_many_dft		    fftwf_plan_many_dft
+  #define fftw_plan_many_dft_r2c	    fftwf_plan_many_dft_r2c
+  #define fftw_plan_many_dft_c2r	    fftwf_plan_many_dft_c2r
+  #define fftw_execute_dft		    fftwf_execute_dft
+  #define fftw_execute_dft_r2c		    fftwf_execute_dft_r2c
+  #define fftw_execute_dft_c2r		    fftwf_execute_dft_c2r
 #endif
 
 #endif
@@ -116,6 +116,48 @@ static struct part_slab_data
 
 static int *part_sortindex;
 
+#ifdef OPENMP_PM
+static d_fftw_real *part_weight; /* mass times CIC weight of each slot of part[] */
+#include "pm_omp_binning.h"
+
+/*! threaded version of the loops which determine the cells each particle accesses (see pm_omp_binning.h): particle i fills
+ *  the slots 8*i ... 8*i+7 of part[], and its binned masses are stored in part_weight[]. Particles outside of the mesh
+ *  patch of grid grnr (and gas in the second phase of DM_SCALARFIELD_SCREENING) get empty slots. Returns the number of
+ *  valid entries, num_on_grid. */
+static int pm_nonperiodic_omp_fill_part(int grnr, double to_slab_fac, int skip_gas)
+{
+  int i, n_on = 0;
+#ifdef _OPENMP
+#pragma omp parallel for private(i) reduction(+:n_on) schedule(static)
+#endif
+  for(i = 0; i < NumPart; i++)
+    {
+      int j, xx, yy, zz, k, on = 1;
+      long slab[3];
+      double d[3];
+      if(skip_gas) {if(P[i].Type == 0) {on = 0;}}
+      for(j = 0; j < 3; j++) {if(P[i].Pos[j] < All.Corner[grnr][j] || P[i].Pos[j] >= All.UpperCorner[grnr][j]) {on = 0;}}
+      if(on)
+        {
+          for(j = 0; j < 3; j++) {slab[j] = (int) (to_slab_fac * (P[i].Pos[j] - All.Corner[grnr][j])); d[j] = to_slab_fac * (P[i].Pos[j] - All.Corner[grnr][j]) - slab[j];}
+          n_on++;
+        }
+      for(xx = 0; xx < 2; xx++)
+        for(yy = 0; yy < 2; yy++)
+          for(zz = 0; zz < 2; zz++)
+            {
+              k = (i << 3) + (xx << 2) + (yy << 1) + zz;
+              part_sortindex[k] = k;
+              if(!on) {part[k].partindex = -1; part[k].globalindex = GRID * GRID * ((large_array_offset) GRID2); part_weight[k] = 0; continue;} /* sorted behind the last mesh point */
+              part[k].partindex = k;
+              part[k].globalindex = ((large_array_offset) GRID2) * (GRID * (slab[0] + xx) + slab[1] + yy) + slab[2] + zz;
+              part_weight[k] = (P[i].Mass > 0) ? P[i].Mass * (xx ? d[0] : 1.0 - d[0]) * (yy ? d[1] : 1.0 - d[1]) * (zz ? d[2] : 1.0 - d[2]) : 0;
+            }
+    }
+  return n_on * 8;
+}
+#endif
+
 
 /*! This function determines the particle extension of all particles, and for
  *  those types selected with PM_PLACEHIGHRESREGION if this is used, and then
@@ -459,6 +501,15 @@ void pm_init_nonperiodic_allocate(void)
     }
   bytes_tot += bytes;
 
+#ifdef OPENMP_PM
+  if(!(part_weight = (d_fftw_real *) mymalloc("part_weight", bytes = 8 * NumPart * sizeof(d_fftw_real))))
+    {
+      printf("failed to allocate memory for `part_weight' (%g MB).\n", bytes / (1024.0 * 1024.0));
+      endrun(1);
+    }
+  bytes_tot += bytes;
+#endif
+
 #ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
   if(!(tidal_workspace = (fftw_real *) mymalloc("tidal_workspace", bytes = maxfftsize * sizeof(d_fftw_real))))
     {
@@ -491,6 +542,9 @@ void pm_init_nonperiodic_free(void)
   /* deallocate memory */
 #ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
   myfree(tidal_workspace);
+#endif
+#ifdef OPENMP_PM
+  myfree(part_weight);
 #endif
   myfree(part_sortindex);
   myfree(part);
@@ -802,6 +856,13 @@ int pmforce_nonperiodic(int grnr)
 
 
       /* determine the cells each particles accesses, and how many particles lie on the grid patch */
+#ifdef OPENMP_PM
+#ifdef DM_SCALARFIELD_SCREENING
+      num_on_grid = pm_nonperiodic_omp_fill_part(grnr, to_slab_fac, phase == 1);
+#else
+      num_on_grid = pm_nonperiodic_omp_fill_part(grnr, to_slab_fac, 0);
+#endif
+#else
       for(i = 0, num_on_grid = 0; i < NumPart; i++)
 	{
 #ifdef DM_SCALARFIELD_SCREENING
@@ -836,12 +897,15 @@ int pmforce_nonperiodic(int grnr)
 		  num_on_grid++;
 		}
 	}
+#endif
 
       /* note: num_on_grid can be up to 8 times larger than the particle number,  
          but num_field_points will generally be much smaller */
 
       /* bring the part-field into the order of the accessed cells. This allow the removal of duplicates */
-#ifdef MYSORT
+#if defined(OPENMP_PM)
+      pm_omp_sort_part(8 * NumPart);
+#elif defined(MYSORT)
       mysort_pmnonperiodic(part_sortindex, num_on_grid, sizeof(int), pm_nonperiodic_compare_sortindex);
 #else
       qsort(part_sortindex, num_on_grid, sizeof(int), pm_nonperiodic_compare_sortindex);
@@ -909,6 +973,9 @@ int pmforce_nonperiodic(int grnr)
       for(i = 0; i < num_field_points; i++)
 	localfield_d_data[i] = 0;
 
+#ifdef OPENMP_PM
+      pm_omp_deposit(localfield_d_data, part_weight, num_on_grid);
+#else
       for(i = 0; i < num_on_grid; i += 8)
 	{
 	  pindex = (part[i].partindex >> 3);
@@ -931,6 +998,7 @@ int pmforce_nonperiodic(int grnr)
 	  localfield_d_data[part[i + 6].localindex] += P[pindex].Mass * (dx) * dy * (1.0 - dz);
 	  localfield_d_data[part[i + 7].localindex] += P[pindex].Mass * (dx) * dy * dz;
 	}
+#endif
 
 
       /* clear local FFT-mesh density field */
@@ -1119,15 +1187,24 @@ int pmforce_nonperiodic(int grnr)
 
       double pot;
 
-      for(i = 0, j = 0; i < NumPart; i++)
+      j = 0;
+#if defined(OPENMP_PM) && defined(_OPENMP)
+#pragma omp parallel for private(j, slab_x, slab_y, slab_z, dx, dy, dz, pot) schedule(static)
+#endif
+      for(i = 0; i < NumPart; i++)
 	{
 #ifdef PM_PLACEHIGHRESREGION
 	  if(grnr == 1)
 	    if(!(pmforce_is_particle_high_res(P[i].Type, P[i].Pos)))
 	      continue;
 #endif
+#ifdef OPENMP_PM
+	  j = i << 3; /* the slots of particle i */
+	  if(part[j].partindex < 0) continue;
+#else
 	  while(j < num_on_grid && (part[j].partindex >> 3) != i)
 	    j++;
+#endif
 
 	  slab_x = (int) (to_slab_fac * (P[i].Pos[0] - All.Corner[grnr][0]));
 	  dx = to_slab_fac * (P[i].Pos[0] - All.Corner[grnr][0]) - slab_x;
@@ -1277,7 +1354,11 @@ int pmforce_nonperiodic(int grnr)
 
 	  /* read out the forces, which all have been assembled in localfield_data */
 
-	  for(i = 0, j = 0; i < NumPart; i++)
+	  j = 0;
+#if defined(OPENMP_PM) && defined(_OPENMP)
+#pragma omp parallel for private(j, slab_x, slab_y, slab_z, dx, dy, dz, acc_dim) schedule(static)
+#endif
+	  for(i = 0; i < NumPart; i++)
 	    {
 #ifdef DM_SCALARFIELD_SCREENING
 	      if(phase == 1)
@@ -1289,8 +1370,13 @@ int pmforce_nonperiodic(int grnr)
 		if(!(pmforce_is_particle_high_res(P[i].Type, P[i].Pos)))
 		  continue;
 #endif
+#ifdef OPENMP_PM
+	      j = i << 3; /* the slots of particle i */
+	      if(part[j].partindex < 0) continue;
+#else
 	      while(j < num_on_grid && (part[j].partindex >> 3) != i)
 		j++;
+#endif
 
 	      slab_x = (int) (to_slab_fac * (P[i].Pos[0] - All.Corner[grnr][0]));
 	      dx = to_slab_fac * (P[i].Pos[0] - All.Corner[grnr][0]) - slab_x;
@@ -1692,6 +1778,9 @@ int pmpotential_nonperiodic(int grnr)
   pm_init_nonperiodic_allocate();
 
   /* determine the cells each particles accesses, and how many particles lie on the grid patch */
+#ifdef OPENMP_PM
+  num_on_grid = pm_nonperiodic_omp_fill_part(grnr, to_slab_fac, 0);
+#else
   for(i = 0, num_on_grid = 0; i < NumPart; i++)
     {
       if(P[i].Pos[0] < All.Corner[grnr][0] || P[i].Pos[0] >= All.UpperCorner[grnr][0])
@@ -1721,12 +1810,15 @@ int pmpotential_nonperiodic(int grnr)
 	      num_on_grid++;
 	    }
     }
+#endif
 
   /* note: num_on_grid can be up to 8 times larger than the particle number,  
      but num_field_points will generally be much smaller */
 
   /* bring the part-field into the order of the accessed cells. This allow the removal of duplicates */
-#ifdef MYSORT
+#if defined(OPENMP_PM)
+  pm_omp_sort_part(8 * NumPart);
+#elif defined(MYSORT)
   mysort_pmnonperiodic(part_sortindex, num_on_grid, sizeof(int), pm_nonperiodic_compare_sortindex);
 #else
   qsort(part_sortindex, num_on_grid, sizeof(int), pm_nonperiodic_compare_sortindex);
@@ -1792,6 +1884,9 @@ int pmpotential_nonperiodic(int grnr)
   for(i = 0; i < num_field_points; i++)
     localfield_d_data[i] = 0;
 
+#ifdef OPENMP_PM
+  pm_omp_deposit(localfield_d_data, part_weight, num_on_grid);
+#else
   for(i = 0; i < num_on_grid; i += 8)
     {
       pindex = (part[i].partindex >> 3);
@@ -1814,6 +1909,7 @@ int pmpotential_nonperiodic(int grnr)
       localfield_d_data[part[i + 6].localindex] += P[pindex].Mass * (dx) * dy * (1.0 - dz);
       localfield_d_data[part[i + 7].localindex] += P[pindex].Mass * (dx) * dy * dz;
     }
+#endif
 
 
   /* clear local FFT-mesh density field */
@@ -1982,15 +2078,24 @@ int pmpotential_nonperiodic(int grnr)
 
   /* read out the potential values which all have been assembled in localfield_data */
 
-  for(i = 0, j = 0; i < NumPart; i++)
+  j = 0;
+#if defined(OPENMP_PM) && defined(_OPENMP)
+#pragma omp parallel for private(j, slab_x, slab_y, slab_z, dx, dy, dz, pot) schedule(static)
+#endif
+  for(i = 0; i < NumPart; i++)
     {
 #ifdef PM_PLACEHIGHRESREGION
       if(grnr == 1)
 	if(!(pmforce_is_particle_high_res(P[i].Type, P[i].Pos)))
 	  continue;
 #endif
+#ifdef OPENMP_PM
+      j = i << 3; /* the slots of particle i */
+      if(part[j].partindex < 0) continue;
+#else
       while(j < num_on_grid && (part[j].partindex >> 3) != i)
 	j++;
+#endif
 
       slab_x = (int) (to_slab_fac * (P[i].Pos[0] - All.Corner[grnr][0]));
       dx = to_slab_fac * (P[i].Pos[0] - All.Corner[grnr][0]) - slab_x;
@@ -0,0 +1,83 @@
+#ifndef PM_OMP_BINNING_H
+#define PM_OMP_BINNING_H
+
+/* threaded (OPENMP_PM) sorting and mass deposit of the particle-mesh lists, shared by the PM routines (pm_periodic.c,
+    pm_periodic_pencil.c, pm_nonperiodic.c). With OPENMP_PM, the particle i always owns the slots n_slots*i ... n_slots*(i+1)-1
+    of part[] (n_slots is the number of mesh points per particle), so the lists can be filled by all threads at once: the slots
+    of particles which are not put on the mesh get partindex=-1 and a globalindex larger than that of any mesh point, so that
+    after sorting they follow the num_on_grid valid entries. The including file must define the (static) part[] and
+    part_sortindex[] arrays, and the large_array_offset and fftw_real types. */
+
+/*! stable LSD radix sort (8 bits per pass) of part_sortindex[0..n-1] by part[].globalindex, threaded as peano_radix_sort():
+ *  each thread histograms and scatters its own contiguous block of the input. Passes over digits which are the same for all
+ *  keys are skipped. */
+static void pm_omp_sort_part(int n)
+{
+  int i, shift, n_threads = 1;
+  large_array_offset key_or = 0, key_and = ~((large_array_offset) 0);
+  int *src = part_sortindex, *dst, *tmp;
+#ifdef _OPENMP
+  n_threads = omp_get_max_threads();
+#endif
+  int *count = (int *) mymalloc("pm_sort_count", n_threads * 256 * sizeof(int));
+  tmp = dst = (int *) mymalloc("pm_sort_tmp", n * sizeof(int));
+
+#ifdef _OPENMP
+#pragma omp parallel for private(i) reduction(|:key_or) reduction(&:key_and)
+#endif
+  for(i = 0; i < n; i++) {key_or |= part[part_sortindex[i]].globalindex; key_and &= part[part_sortindex[i]].globalindex;}
+
+  for(shift = 0; shift < (int) (8 * sizeof(large_array_offset)); shift += 8)
+    {
+      if((((key_or ^ key_and) >> shift) & 0xFF) == 0) continue; /* this digit is identical for all keys */
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+      {
+        int j, d, th = 0, n_team = 1;
+#ifdef _OPENMP
+        th = omp_get_thread_num(); n_team = omp_get_num_threads();
+#endif
+        int *c = count + 256 * th, j_start = (int) (((long long) n * th) / n_team), j_end = (int) (((long long) n * (th + 1)) / n_team);
+        for(d = 0; d < 256; d++) {c[d] = 0;}
+        for(j = j_start; j < j_end; j++) {c[(part[src[j]].globalindex >> shift) & 0xFF]++;}
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+        { /* exclusive prefix sum over (digit, thread), which gives every thread its own output range for every digit */
+          int k, t, sum = 0;
+          for(k = 0; k < 256; k++) {for(t = 0; t < n_team; t++) {int tmp_count = count[256 * t + k]; count[256 * t + k] = sum; sum += tmp_count;}}
+        }
+        for(j = j_start; j < j_end; j++) {dst[c[(part[src[j]].globalindex >> shift) & 0xFF]++] = src[j];}
+      }
+      dst = src; src = (src == part_sortindex) ? tmp : part_sortindex; /* the sorted output of this pass is the input of the next */
+    }
+  if(src != part_sortindex) {memcpy(part_sortindex, src, n * sizeof(int));}
+
+  myfree(tmp);
+  myfree(count);
+}
+
+/*! adds the weights of the sorted entries 0..n-1 (weight[] is indexed by the slot in part[]) to the mesh points they belong
+ *  to, field[part[].localindex]. After the sort the entries of each mesh point are contiguous, and every thread takes whole
+ *  runs of them, so no two threads write to the same element (no atomics are needed); the sort being stable, each sum is
+ *  carried out in particle order, so the result does not depend on the number of threads. */
+static void pm_omp_deposit(fftw_real *field, fftw_real *weight, int n)
+{
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+  {
+    int k, k_end, th = 0, n_team = 1;
+#ifdef _OPENMP
+    th = omp_get_thread_num(); n_team = omp_get_num_threads();
+#endif
+    k = (int) (((long long) n * th) / n_team); k_end = (int) (((long long) n * (th + 1)) / n_team);
+    while(k > 0 && k < n && part[part_sortindex[k]].localindex == part[part_sortindex[k - 1]].localindex) {k++;} /* the run started on the previous thread */
+    while(k_end > 0 && k_end < n && part[part_sortindex[k_end]].localindex == part[part_sortindex[k_end - 1]].localindex) {k_end++;}
+    for(; k < k_end; k++) {field[part[part_sortindex[k]].localindex] += weight[part_sortindex[k]];}
+  }
+}
+
+#endif
@@ -18,7 +18,7 @@
 #include "../proto.h"
 
 #ifdef PMGRID
-#ifdef BOX_PERIODIC
+#if defined(BOX_PERIODIC) && !defined(PM_PENCIL_FFT) /* with PM_PENCIL_FFT, the routines below are replaced by those in pm_periodic_pencil.c */
 
 #ifndef USE_FFTW3
 #ifdef NOTYPEPREFIX_FFTW
@@ -103,6 +103,49 @@ static struct part_slab_data
 static int *part_sortindex;
 
 
+#include "pm_periodic_assignment.h"
+
+#ifdef OPENMP_PM
+static d_fftw_real *part_weight; /* mass times assignment weight of each slot of part[] */
+#include "pm_omp_binning.h"
+
+/*! threaded version of the loops which determine the cells each particle accesses (see pm_omp_binning.h): particle i fills
+ *  the slots PM_STENCIL*i ... PM_STENCIL*(i+1)-1 of part[], and its binned masses are stored in part_weight[]. Particles
+ *  which are not put on the mesh (not in typelist for mode!=0, or gas in the second phase of DM_SCALARFIELD_SCREENING)
+ *  get empty slots. Returns the number of valid entries, num_on_grid. */
+static int pm_periodic_omp_fill_part(int mode, int *typelist, int skip_gas)
+{
+  int i, n_on = 0;
+#ifdef _OPENMP
+#pragma omp parallel for private(i) reduction(+:n_on) schedule(static)
+#endif
+  for(i = 0; i < NumPart; i++)
+    {
+      int j, st, on = 1;
+      double st_weight[PM_STENCIL];
+      large_array_offset st_offset[PM_STENCIL];
+      MyDouble pp[3];
+      if(mode) {if(typelist[P[i].Type] == 0) {on = 0;}}
+      if(skip_gas) {if(P[i].Type == 0) {on = 0;}}
+      if(on)
+        {
+          for(j = 0; j < 3; j++) {pp[j] = P[i].Pos[j]; pp[j] = WRAP_POSITION_UNIFORM_BOX(pp[j]);}
+          pm_periodic_stencil(pp, to_slab_fac, st_offset, st_weight);
+          n_on++;
+        }
+      for(st = 0; st < PM_STENCIL; st++)
+        {
+          part[i * PM_STENCIL + st].partindex = on ? i * PM_STENCIL + st : -1;
+          part[i * PM_STENCIL + st].globalindex = on ? st_offset[st] : PMGRID * PMGRID * ((large_array_offset) PMGRID2); /* beyond the last mesh point */
+          part_weight[i * PM_STENCIL + st] = (on && P[i].Mass > 0) ? pm_grid_weight * P[i].Mass * st_weight[st] : 0;
+          part_sortindex[i * PM_STENCIL + st] = i * PM_STENCIL + st;
+        }
+    }
+  return n_on * PM_STENCIL;
+}
+#endif
+
+
 /*! This routines generates the FFTW-plans to carry out the parallel FFTs
  *  later on. Some auxiliary variables are also initialized.
  */
@@ -234,20 +277,29 @@ void pm_init_periodic_allocate(void)
   bytes_tot += bytes;
 
   if(!
-     (part = (struct part_slab_data *) mymalloc("part", bytes = 8 * NumPart * sizeof(struct part_slab_data))))
+     (part = (struct part_slab_data *) mymalloc("part", bytes = PM_STENCIL * NumPart * sizeof(struct part_slab_data))))
     {
       printf("failed to allocate memory for `part' (%g MB).\n", bytes / (1024.0 * 1024.0));
       endrun(1);
     }
   bytes_tot += bytes;
 
-  if(!(part_sortindex = (int *) mymalloc("part_sortindex", bytes = 8 * NumPart * sizeof(int))))
+  if(!(part_sortindex = (int *) mymalloc("part_sortindex", bytes = PM_STENCIL * NumPart * sizeof(int))))
     {
       printf("failed to allocate memory for `part_sortindex' (%g MB).\n", bytes / (1024.0 * 1024.0));
       endrun(1);
     }
   bytes_tot += bytes;
 
+#ifdef OPENMP_PM
+  if(!(part_weight = (d_fftw_real *) mymalloc("part_weight", bytes = PM_STENCIL * NumPart * sizeof(d_fftw_real))))
+    {
+      printf("failed to allocate memory for `part_weight' (%g MB).\n", bytes / (1024.0 * 1024.0));
+      endrun(1);
+    }
+  bytes_tot += bytes;
+#endif
+
 #ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
   if(!(tidal_workspace = (fftw_real *) mymalloc("tidal_workspace", bytes = maxfftsize * sizeof(d_fftw_real))))
     {
@@ -285,6 +337,9 @@ void pm_init_periodic_free(void)
   /* allocate the memory to hold the FFT fields */
 #ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
   myfree(tidal_workspace);
+#endif
+#ifdef OPENMP_PM
+  myfree(part_weight);
 #endif
   myfree(part_sortindex);
   myfree(part);
@@ -308,11 +363,11 @@ void pm_init_periodic_free(void)
 
 /*! Calculates the long-range periodic force given the particle positions
  *  using the PM method.  The force is Gaussian filtered with Asmth, given in
- *  mesh-cell units. We carry out a CIC charge assignment, and compute the
- *  potenial by Fourier transform methods. The potential is finite differenced
- *  using a 4-point finite differencing formula, and the forces are
- *  interpolated tri-linearly to the particle positions. The CIC kernel is
- *  deconvolved. Note that the particle distribution is not in the slab
+ *  mesh-cell units. We carry out a CIC (or, with PM_ASSIGNMENT_ORDER, TSC or
+ *  PCS) charge assignment, and compute the potenial by Fourier transform
+ *  methods. The potential is finite differenced using a 4-point finite
+ *  differencing formula, and the forces are interpolated to the particle
+ *  positions with the same kernel, which is deconvolved. Note that the particle distribution is not in the slab
  *  decomposition that is used for the FFT. Instead, overlapping patches
  *  between local domains and FFT slabs are communicated as needed.
  *
@@ -321,20 +376,22 @@ void pm_init_periodic_free(void)
 void pmforce_periodic(int mode, int *typelist)
 {
   double k2, kx, ky, kz, smth;
-  double dx, dy, dz;
+  double st_weight[PM_STENCIL];
   double fx, fy, fz, ff;
   double asmth2, fac, acc_dim;
   int i, j, slab, level, sendTask, recvTask, task;
   int x, y, z, yl, zl, yr, zr, yll, zll, yrr, zrr, ip, dim;
-  int slab_x, slab_y, slab_z;
-  int slab_xx, slab_yy, slab_zz;
-  int num_on_grid, num_field_points, pindex, xx, yy, zz;
+  int st;
+  int num_on_grid, num_field_points, pindex, xx;
   MPI_Status status;
   int *localfield_count, *localfield_first, *localfield_offset, *localfield_togo;
   MyDouble pp[3], *pos;
-  large_array_offset offset, *localfield_globalindex, *import_globalindex;
+  large_array_offset offset, st_offset[PM_STENCIL], *localfield_globalindex, *import_globalindex;
   d_fftw_real *localfield_d_data, *import_d_data;
   fftw_real *localfield_data, *import_data;
+#ifdef PM_INTERLACE
+  if(mode == 0 && pm_grid_weight == 1) {PM_INTERLACED_CALL(pmforce_periodic(mode, typelist)); return;} /* (the power spectrum is always measured on the unshifted mesh) */
+#endif
 
 #ifdef DM_SCALARFIELD_SCREENING
   int phase;
@@ -358,6 +415,13 @@ void pmforce_periodic(int mode, int *typelist)
 #endif
 
       /* determine the cells each particles accesses */
+#ifdef OPENMP_PM
+#ifdef DM_SCALARFIELD_SCREENING
+      num_on_grid = pm_periodic_omp_fill_part(mode, typelist, phase == 1);
+#else
+      num_on_grid = pm_periodic_omp_fill_part(mode, typelist, 0);
+#endif
+#else
       for(i = 0, num_on_grid = 0; i < NumPart; i++)
 	{
 	  if(mode)
@@ -387,42 +451,23 @@ void pmforce_periodic(int mode, int *typelist)
 	  else
 	    pos = P[i].Pos;
 
-	  slab_x = (int) (to_slab_fac * pos[0]);
-	  slab_y = (int) (to_slab_fac * pos[1]);
-	  slab_z = (int) (to_slab_fac * pos[2]);
-
-        if(slab_x >= PMGRID) slab_x -= PMGRID;
-        if(slab_y >= PMGRID) slab_y -= PMGRID;
-        if(slab_z >= PMGRID) slab_z -= PMGRID;
-
-	  for(xx = 0; xx < 2; xx++)
-	    for(yy = 0; yy < 2; yy++)
-	      for(zz = 0; zz < 2; zz++)
-		{
-		  slab_xx = slab_x + xx;
-		  slab_yy = slab_y + yy;
-		  slab_zz = slab_z + zz;
-
-		  if(slab_xx >= PMGRID)
-		    slab_xx -= PMGRID;
-		  if(slab_yy >= PMGRID)
-		    slab_yy -= PMGRID;
-		  if(slab_zz >= PMGRID)
-		    slab_zz -= PMGRID;
-
-		  offset = ((large_array_offset) PMGRID2) * (PMGRID * slab_xx + slab_yy) + slab_zz;
-
-		  part[num_on_grid].partindex = (i << 3) + (xx << 2) + (yy << 1) + zz;
-		  part[num_on_grid].globalindex = offset;
-		  part_sortindex[num_on_grid] = num_on_grid;
-		  num_on_grid++;
-		}
+	  pm_periodic_stencil(pos, to_slab_fac, st_offset, st_weight);
+	  for(st = 0; st < PM_STENCIL; st++)
+	    {
+	      part[num_on_grid].partindex = i * PM_STENCIL + st;
+	      part[num_on_grid].globalindex = st_offset[st];
+	      part_sortindex[num_on_grid] = num_on_grid;
+	      num_on_grid++;
+	    }
 	}
-      /* note: num_on_grid will be  8 times larger than the particle number,
+#endif
+      /* note: num_on_grid will be PM_STENCIL times larger than the particle number,
          but num_field_points will generally be much smaller */
 
       /* bring the part-field into the order of the accessed cells. This allow the removal of duplicates */
-#ifdef MYSORT
+#if defined(OPENMP_PM)
+      pm_omp_sort_part(PM_STENCIL * NumPart);
+#elif defined(MYSORT)
       mysort_pmperiodic(part_sortindex, num_on_grid, sizeof(int), pm_periodic_compare_sortindex);
 #else
       qsort(part_sortindex, num_on_grid, sizeof(int), pm_periodic_compare_sortindex);
@@ -494,9 +539,12 @@ void pmforce_periodic(int mode, int *typelist)
       for(i = 0; i < num_field_points; i++)
 	localfield_d_data[i] = 0;
 
-      for(i = 0; i < num_on_grid; i += 8)
+#ifdef OPENMP_PM
+      pm_omp_deposit(localfield_d_data, part_weight, num_on_grid);
+#else
+      for(i = 0; i < num_on_grid; i += PM_STENCIL)
 	{
-	  pindex = (part[i].partindex >> 3);
+	  pindex = part[i].partindex / PM_STENCIL;
         if(P[pindex].Mass<=0) continue;
 
         /* possible bugfix: Y.Feng:  (was if(mode)) */
@@ -513,27 +561,11 @@ void pmforce_periodic(int mode, int *typelist)
 	  else
 	    pos = P[pindex].Pos;
 
-	  slab_x = (int) (to_slab_fac * pos[0]);
-	  slab_y = (int) (to_slab_fac * pos[1]);
-	  slab_z = (int) (to_slab_fac * pos[2]);
-        /* possible bugfix: Y.Feng:  */
-        if(slab_x >= PMGRID) slab_x -= PMGRID;
-        if(slab_y >= PMGRID) slab_y -= PMGRID;
-        if(slab_z >= PMGRID) slab_z -= PMGRID;
-
-	  dx = to_slab_fac * pos[0] - slab_x;
-	  dy = to_slab_fac * pos[1] - slab_y;
-	  dz = to_slab_fac * pos[2] - slab_z;
-
-	  localfield_d_data[part[i + 0].localindex] += P[pindex].Mass * (1.0 - dx) * (1.0 - dy) * (1.0 - dz);
-	  localfield_d_data[part[i + 1].localindex] += P[pindex].Mass * (1.0 - dx) * (1.0 - dy) * dz;
-	  localfield_d_data[part[i + 2].localindex] += P[pindex].Mass * (1.0 - dx) * dy * (1.0 - dz);
-	  localfield_d_data[part[i + 3].localindex] += P[pindex].Mass * (1.0 - dx) * dy * dz;
-	  localfield_d_data[part[i + 4].localindex] += P[pindex].Mass * (dx) * (1.0 - dy) * (1.0 - dz);
-	  localfield_d_data[part[i + 5].localindex] += P[pindex].Mass * (dx) * (1.0 - dy) * dz;
-	  localfield_d_data[part[i + 6].localindex] += P[pindex].Mass * (dx) * dy * (1.0 - dz);
-	  localfield_d_data[part[i + 7].localindex] += P[pindex].Mass * (dx) * dy * dz;
+	  pm_periodic_stencil(pos, to_slab_fac, 0, st_weight);
+	  for(st = 0; st < PM_STENCIL; st++)
+	    localfield_d_data[part[i + st].localindex] += pm_grid_weight * P[pindex].Mass * st_weight[st];
 	}
+#endif
 
       /* clear local FFT-mesh density field */
       for(i = 0; i < fftsize; i++)
@@ -666,7 +698,7 @@ void pmforce_periodic(int mode, int *typelist)
 			  fz = sin(fz) / fz;
 			}
 		      ff = 1 / (fx * fy * fz);
-		      smth *= ff * ff * ff * ff;
+		      smth *= pm_periodic_deconvolution(ff);
 
 		      /* end deconvolution */
 
@@ -754,10 +786,19 @@ void pmforce_periodic(int mode, int *typelist)
 
 	  double pot;
 
-	  for(i = 0, j = 0; i < NumPart; i++)
+	  j = 0;
+#if defined(OPENMP_PM) && defined(_OPENMP)
+#pragma omp parallel for private(j, xx, st, pp, st_weight, pot) schedule(static)
+#endif
+	  for(i = 0; i < NumPart; i++)
 	    {
-	      while(j < num_on_grid && (part[j].partindex >> 3) != i)
+#ifdef OPENMP_PM
+	      j = i * PM_STENCIL; /* the slots of particle i */
+	      if(part[j].partindex < 0) continue;
+#else
+	      while(j < num_on_grid && part[j].partindex / PM_STENCIL != i)
               j++;
+#endif
 
             /* possible bugfix: Y.Feng:  (otherwise just pp[xx]=Pos[xx]) */
             /* make sure that particles are properly box-wrapped */
@@ -766,22 +807,9 @@ void pmforce_periodic(int mode, int *typelist)
                 pp[xx] = P[i].Pos[xx];
                 pp[xx] = WRAP_POSITION_UNIFORM_BOX(pp[xx]);
             }
-            slab_x = (int) (to_slab_fac * pp[0]);
-            slab_y = (int) (to_slab_fac * pp[1]);
-            slab_z = (int) (to_slab_fac * pp[2]);
-            dx = to_slab_fac * pp[0] - slab_x;
-            dy = to_slab_fac * pp[1] - slab_y;
-            dz = to_slab_fac * pp[2] - slab_z;
-
-            pot =
-            +localfield_data[part[j + 0].localindex] * (1.0 - dx) * (1.0 - dy) * (1.0 - dz)
-            + localfield_data[part[j + 1].localindex] * (1.0 - dx) * (1.0 - dy) * dz
-            + localfield_data[part[j + 2].localindex] * (1.0 - dx) * dy * (1.0 - dz)
-            + localfield_data[part[j + 3].localindex] * (1.0 - dx) * dy * dz
-            + localfield_data[part[j + 4].localindex] * (dx) * (1.0 - dy) * (1.0 - dz)
-            + localfield_data[part[j + 5].localindex] * (dx) * (1.0 - dy) * dz
-            + localfield_data[part[j + 6].localindex] * (dx) * dy * (1.0 - dz)
-            + localfield_data[part[j + 7].localindex] * (dx) * dy * dz;
+            pm_periodic_stencil(pp, to_slab_fac, 0, st_weight);
+            for(st = 0, pot = 0; st < PM_STENCIL; st++)
+              pot += localfield_data[part[j + st].localindex] * st_weight[st];
 
 	      P[i].PM_Potential += pot * fac * (2 * All.BoxSize / PMGRID);
 	      /* compensate the finite differencing factor */ ;
@@ -928,15 +956,24 @@ void pmforce_periodic(int mode, int *typelist)
 
 	      /* read out the forces, which all have been assembled in localfield_data */
 
-	      for(i = 0, j = 0; i < NumPart; i++)
+	      j = 0;
+#if defined(OPENMP_PM) && defined(_OPENMP)
+#pragma omp parallel for private(j, xx, st, pp, st_weight, acc_dim) schedule(static)
+#endif
+	      for(i = 0; i < NumPart; i++)
 		{
 #ifdef DM_SCALARFIELD_SCREENING
 		  if(phase == 1)
 		    if(P[i].Type == 0)	/* baryons don't get an extra scalar force */
 		      continue;
 #endif
-            while(j < num_on_grid && (part[j].partindex >> 3) != i)
+#ifdef OPENMP_PM
+            j = i * PM_STENCIL; /* the slots of particle i */
+            if(part[j].partindex < 0) continue;
+#else
+            while(j < num_on_grid && part[j].partindex / PM_STENCIL != i)
                 j++;
+#endif
 
             /* possible bugfix: Y.Feng:  (otherwise just pp[xx]=Pos[xx]) */
             /* make sure that particles are properly box-wrapped */
@@ -945,22 +982,9 @@ void pmforce_periodic(int mode, int *typelist)
                 pp[xx] = P[i].Pos[xx];
                 pp[xx] = WRAP_POSITION_UNIFORM_BOX(pp[xx]);
             }
-            slab_x = (int) (to_slab_fac * pp[0]);
-            slab_y = (int) (to_slab_fac * pp[1]);
-            slab_z = (int) (to_slab_fac * pp[2]);
-            dx = to_slab_fac * pp[0] - slab_x;
-            dy = to_slab_fac * pp[1] - slab_y;
-            dz = to_slab_fac * pp[2] - slab_z;
-
-            acc_dim =
-		    +localfield_data[part[j + 0].localindex] * (1.0 - dx) * (1.0 - dy) * (1.0 - dz)
-		    + localfield_data[part[j + 1].localindex] * (1.0 - dx) * (1.0 - dy) * dz
-		    + localfield_data[part[j + 2].localindex] * (1.0 - dx) * dy * (1.0 - dz)
-		    + localfield_data[part[j + 3].localindex] * (1.0 - dx) * dy * dz
-		    + localfield_data[part[j + 4].localindex] * (dx) * (1.0 - dy) * (1.0 - dz)
-		    + localfield_data[part[j + 5].localindex] * (dx) * (1.0 - dy) * dz
-		    + localfield_data[part[j + 6].localindex] * (dx) * dy * (1.0 - dz)
-		    + localfield_data[part[j + 7].localindex] * (dx) * dy * dz;
+            pm_periodic_stencil(pp, to_slab_fac, 0, st_weight);
+            for(st = 0, acc_dim = 0; st < PM_STENCIL; st++)
+              acc_dim += localfield_data[part[j + st].localindex] * st_weight[st];
             
 		  P[i].GravPM[dim] += acc_dim;
 		}
@@ -986,26 +1010,28 @@ void pmforce_periodic(int mode, int *typelist)
 
 /*! Calculates the long-range potential using the PM method.  The potential is
  *  Gaussian filtered with Asmth, given in mesh-cell units. We carry out a CIC
- *  charge assignment, and compute the potenial by Fourier transform
- *  methods. The CIC kernel is deconvolved.
+ *  (or TSC/PCS) charge assignment, and compute the potenial by Fourier transform
+ *  methods. The assignment kernel is deconvolved.
  */
 void pmpotential_periodic(void)
 {
   double k2, kx, ky, kz, smth;
-  double dx, dy, dz;
+  double st_weight[PM_STENCIL];
   double fx, fy, fz, ff;
   double asmth2, fac, pot;
   int i, j, slab, level, sendTask, recvTask, task;
   int x, y, z, ip;
-  int slab_x, slab_y, slab_z;
-  int slab_xx, slab_yy, slab_zz;
-  int num_on_grid, num_field_points, pindex, xx, yy, zz;
+  int st;
+  int num_on_grid, num_field_points, pindex, xx;
   MyDouble pp[3];
   MPI_Status status;
   int *localfield_count, *localfield_first, *localfield_offset, *localfield_togo;
-  large_array_offset offset, *localfield_globalindex, *import_globalindex;
+  large_array_offset offset, st_offset[PM_STENCIL], *localfield_globalindex, *import_globalindex;
   d_fftw_real *localfield_d_data, *import_d_data;
   fftw_real *localfield_data, *import_data;
+#ifdef PM_INTERLACE
+  if(pm_grid_weight == 1) {PM_INTERLACED_CALL(pmpotential_periodic()); return;}
+#endif
 
   PRINT_STATUS("Starting periodic PM-potential calculation.  (presently allocated=%g MB)", AllocatedBytes / (1024.0 * 1024.0));
   asmth2 = (2 * M_PI) * All.Asmth[0] / All.BoxSize;
@@ -1017,6 +1043,9 @@ void pmpotential_periodic(void)
 
 
   /* determine the cells each particles accesses */
+#ifdef OPENMP_PM
+  num_on_grid = pm_periodic_omp_fill_part(0, 0, 0);
+#else
   for(i = 0, num_on_grid = 0; i < NumPart; i++)
     {
         /* possible bugfix: Y.Feng:  (otherwise just pp[xx]=Pos[xx]) */
@@ -1026,42 +1055,24 @@ void pmpotential_periodic(void)
             pp[xx] = P[i].Pos[xx];
             pp[xx] = WRAP_POSITION_UNIFORM_BOX(pp[xx]);
         }
-        slab_x = (int) (to_slab_fac * pp[0]);
-        slab_y = (int) (to_slab_fac * pp[1]);
-        slab_z = (int) (to_slab_fac * pp[2]);
-        if(slab_x >= PMGRID) slab_x -= PMGRID;
-        if(slab_y >= PMGRID) slab_y -= PMGRID;
-        if(slab_z >= PMGRID) slab_z -= PMGRID;
-
-      for(xx = 0; xx < 2; xx++)
-	for(yy = 0; yy < 2; yy++)
-	  for(zz = 0; zz < 2; zz++)
-	    {
-	      slab_xx = slab_x + xx;
-	      slab_yy = slab_y + yy;
-	      slab_zz = slab_z + zz;
-
-	      if(slab_xx >= PMGRID)
-		slab_xx -= PMGRID;
-	      if(slab_yy >= PMGRID)
-		slab_yy -= PMGRID;
-	      if(slab_zz >= PMGRID)
-		slab_zz -= PMGRID;
-
-	      offset = ((large_array_offset) PMGRID2) * (PMGRID * slab_xx + slab_yy) + slab_zz;
-
-	      part[num_on_grid].partindex = (i << 3) + (xx << 2) + (yy << 1) + zz;
-	      part[num_on_grid].globalindex = offset;
-	      part_sortindex[num_on_grid] = num_on_grid;
-	      num_on_grid++;
-	    }
+        pm_periodic_stencil(pp, to_slab_fac, st_offset, st_weight);
+        for(st = 0; st < PM_STENCIL; st++)
+          {
+            part[num_on_grid].partindex = i * PM_STENCIL + st;
+            part[num_on_grid].globalindex = st_offset[st];
+            part_sortindex[num_on_grid] = num_on_grid;
+            num_on_grid++;
+          }
     }
+#endif
 
-  /* note: num_on_grid will be  8 times larger than the particle number,
+  /* note: num_on_grid will be PM_STENCIL times larger than the particle number,
      but num_field_points will generally be much smaller */
 
   /* bring the part-field into the order of the accessed cells. This allow the removal of duplicates */
-#ifdef MYSORT
+#if defined(OPENMP_PM)
+  pm_omp_sort_part(PM_STENCIL * NumPart);
+#elif defined(MYSORT)
   mysort_pmperiodic(part_sortindex, num_on_grid, sizeof(int), pm_periodic_compare_sortindex);
 #else
   qsort(part_sortindex, num_on_grid, sizeof(int), pm_periodic_compare_sortindex);
@@ -1125,9 +1136,12 @@ void pmpotential_periodic(void)
   for(i = 0; i < num_field_points; i++)
     localfield_d_data[i] = 0;
 
-  for(i = 0; i < num_on_grid; i += 8)
+#ifdef OPENMP_PM
+  pm_omp_deposit(localfield_d_data, part_weight, num_on_grid);
+#else
+  for(i = 0; i < num_on_grid; i += PM_STENCIL)
     {
-      pindex = (part[i].partindex >> 3);
+      pindex = part[i].partindex / PM_STENCIL;
         if(P[pindex].Mass<=0) continue;
 
         /* possible bugfix: Y.Feng:  (otherwise just pp[xx]=Pos[xx]) */
@@ -1137,22 +1151,11 @@ void pmpotential_periodic(void)
             pp[xx] = P[pindex].Pos[xx];
             pp[xx] = WRAP_POSITION_UNIFORM_BOX(pp[xx]);
         }
-        slab_x = (int) (to_slab_fac * pp[0]);
-        slab_y = (int) (to_slab_fac * pp[1]);
-        slab_z = (int) (to_slab_fac * pp[2]);
-        dx = to_slab_fac * pp[0] - slab_x;
-        dy = to_slab_fac * pp[1] - slab_y;
-        dz = to_slab_fac * pp[2] - slab_z;
-
-      localfield_d_data[part[i + 0].localindex] += P[pindex].Mass * (1.0 - dx) * (1.0 - dy) * (1.0 - dz);
-      localfield_d_data[part[i + 1].localindex] += P[pindex].Mass * (1.0 - dx) * (1.0 - dy) * dz;
-      localfield_d_data[part[i + 2].localindex] += P[pindex].Mass * (1.0 - dx) * dy * (1.0 - dz);
-      localfield_d_data[part[i + 3].localindex] += P[pindex].Mass * (1.0 - dx) * dy * dz;
-      localfield_d_data[part[i + 4].localindex] += P[pindex].Mass * (dx) * (1.0 - dy) * (1.0 - dz);
-      localfield_d_data[part[i + 5].localindex] += P[pindex].Mass * (dx) * (1.0 - dy) * dz;
-      localfield_d_data[part[i + 6].localindex] += P[pindex].Mass * (dx) * dy * (1.0 - dz);
-      localfield_d_data[part[i + 7].localindex] += P[pindex].Mass * (dx) * dy * dz;
+        pm_periodic_stencil(pp, to_slab_fac, 0, st_weight);
+        for(st = 0; st < PM_STENCIL; st++)
+          localfield_d_data[part[i + st].localindex] += pm_grid_weight * P[pindex].Mass * st_weight[st];
     }
+#endif
 
   /* clear local FFT-mesh density field */
   for(i = 0; i < fftsize; i++)
@@ -1273,7 +1276,7 @@ void pmpotential_periodic(void)
 		  fz = sin(fz) / fz;
 		}
 	      ff = 1 / (fx * fy * fz);
-	      smth *= ff * ff * ff * ff;
+	      smth *= pm_periodic_deconvolution(ff);
 
 	      /* end deconvolution */
 
@@ -1360,10 +1363,18 @@ void pmpotential_periodic(void)
 
   /* read out the potential values, which all have been assembled in localfield_data */
 
-  for(i = 0, j = 0; i < NumPart; i++)
+  j = 0;
+#if defined(OPENMP_PM) && defined(_OPENMP)
+#pragma omp parallel for private(j, xx, st, pp, st_weight, pot) schedule(static)
+#endif
+  for(i = 0; i < NumPart; i++)
     {
-        while(j < num_on_grid && (part[j].partindex >> 3) != i)
+#ifdef OPENMP_PM
+        j = i * PM_STENCIL; /* the slots of particle i */
+#else
+        while(j < num_on_grid && part[j].partindex / PM_STENCIL != i)
             j++;
+#endif
 
         /* possible bugfix: Y.Feng:  (otherwise just pp[xx]=Pos[xx]) */
         /* make sure that particles are properly box-wrapped */
@@ -1372,22 +1383,9 @@ void pmpotential_periodic(void)
             pp[xx] = P[i].Pos[xx];
             pp[xx] = WRAP_POSITION_UNIFORM_BOX(pp[xx]);
         }
-        slab_x = (int) (to_slab_fac * pp[0]);
-        slab_y = (int) (to_slab_fac * pp[1]);
-        slab_z = (int) (to_slab_fac * pp[2]);
-        dx = to_slab_fac * pp[0] - slab_x;
-        dy = to_slab_fac * pp[1] - slab_y;
-        dz = to_slab_fac * pp[2] - slab_z;
-
-        pot =
-        +localfield_data[part[j + 0].localindex] * (1.0 - dx) * (1.0 - dy) * (1.0 - dz)
-        + localfield_data[part[j + 1].localindex] * (1.0 - dx) * (1.0 - dy) * dz
-        + localfield_data[part[j + 2].localindex] * (1.0 - dx) * dy * (1.0 - dz)
-        + localfield_data[part[j + 3].localindex] * (1.0 - dx) * dy * dz
-        + localfield_data[part[j + 4].localindex] * (dx) * (1.0 - dy) * (1.0 - dz)
-        + localfield_data[part[j + 5].localindex] * (dx) * (1.0 - dy) * dz
-        + localfield_data[part[j + 6].localindex] * (dx) * dy * (1.0 - dz)
-        + localfield_data[part[j + 7].localindex] * (dx) * dy * dz;
+        pm_periodic_stencil(pp, to_slab_fac, 0, st_weight);
+        for(st = 0, pot = 0; st < PM_STENCIL; st++)
+          pot += localfield_data[part[j + st].localindex] * st_weight[st];
 
 #if defined(EVALPOTENTIAL) || defined(COMPUTE_POTENTIAL_ENERGY) || defined(OUTPUT_POTENTIAL)
       P[i].Potential += pot;
@@ -1700,15 +1698,15 @@ void pm_periodic_transposeBz(fftw_real * field, fftw_real * scratch)
 
 
 #ifdef PMGRID
-#ifdef BOX_PERIODIC
+#if defined(BOX_PERIODIC) && !defined(PM_PENCIL_FFT)
 
 
 
 #ifdef COMPUTE_TIDAL_TENSOR_IN_GRAVTREE
 /*! Calculates the long-range tidal field using the PM method.  The potential is
  *  Gaussian filtered with Asmth, given in mesh-cell units. We carry out a CIC
- *  charge assignment, and compute the potenial by Fourier transform
- *  methods. The CIC kernel is deconvolved.
+ *  (or TSC/PCS) charge assignment, and compute the potenial by Fourier transform
+ *  methods. The assignment kernel is deconvolved.
  *  Like the forces the derivatives are calculated by finite differences
  *  of the potential on the grid.
  */
@@ -1716,20 +1714,22 @@ void pm_periodic_transposeBz(fftw_real * field, fftw_real * scratch)
 void pmtidaltensor_periodic_diff(void)
 {
   double k2, kx, ky, kz, smth;
-  double dx, dy, dz;
+  double st_weight[PM_STENCIL];
   double fx, fy, fz, ff;
   double asmth2, fac, tidal_dim;
   MyDouble pp[3];
   int i, j, slab, level, sendTask, recvTask, task;
   int x, y, z, yl, zl, yr, zr, yll, zll, yrr, zrr, ip, dim;
-  int slab_x, slab_y, slab_z;
-  int slab_xx, slab_yy, slab_zz;
-  int num_on_grid, num_field_points, pindex, xx, yy, zz;
+  int st;
+  int num_on_grid, num_field_points, pindex, xx;
   MPI_Status status;
   int *localfield_count, *localfield_first, *localfield_offset, *localfield_togo;
-  large_array_offset offset, *localfield_globalindex, *import_globalindex;
+  large_array_offset offset, st_offset[PM_STENCIL], *localfield_globalindex, *import_globalindex;
   d_fftw_real *localfield_d_data, *import_d_data;
   fftw_real *localfield_data, *import_data;
+#ifdef PM_INTERLACE
+  if(pm_grid_weight == 1) {PM_INTERLACED_CALL(pmtidaltensor_periodic_diff()); return;}
+#endif
 
 #ifdef DM_SCALARFIELD_SCREENING
   int phase;
@@ -1769,37 +1769,16 @@ void pmtidaltensor_periodic_diff(void)
             pp[xx] = P[i].Pos[xx];
             pp[xx] = WRAP_POSITION_UNIFORM_BOX(pp[xx]);
         }
-        slab_x = (int) (to_slab_fac * pp[0]);
-        slab_y = (int) (to_slab_fac * pp[1]);
-        slab_z = (int) (to_slab_fac * pp[2]);
-        if(slab_x >= PMGRID) slab_x -= PMGRID;
-        if(slab_y >= PMGRID) slab_y -= PMGRID;
-        if(slab_z >= PMGRID) slab_z -= PMGRID;
-
-	  for(xx = 0; xx < 2; xx++)
-	    for(yy = 0; yy < 2; yy++)
-	      for(zz = 0; zz < 2; zz++)
-		{
-		  slab_xx = slab_x + xx;
-		  slab_yy = slab_y + yy;
-		  slab_zz = slab_z + zz;
-
-		  if(slab_xx >= PMGRID)
-		    slab_xx -= PMGRID;
-		  if(slab_yy >= PMGRID)
-		    slab_yy -= PMGRID;
-		  if(slab_zz >= PMGRID)
-		    slab_zz -= PMGRID;
-
-		  offset = ((large_array_offset) PMGRID2) * (PMGRID * slab_xx + slab_yy) + slab_zz;
-
-		  part[num_on_grid].partindex = (i << 3) + (xx << 2) + (yy << 1) + zz;
-		  part[num_on_grid].globalindex = offset;
-		  part_sortindex[num_on_grid] = num_on_grid;
-		  num_on_grid++;
-		}
+        pm_periodic_stencil(pp, to_slab_fac, st_offset, st_weight);
+        for(st = 0; st < PM_STENCIL; st++)
+          {
+            part[num_on_grid].partindex = i * PM_STENCIL + st;
+            part[num_on_grid].globalindex = st_offset[st];
+            part_sortindex[num_on_grid] = num_on_grid;
+            num_on_grid++;
+          }
 	}
-      /* note: num_on_grid will be  8 times larger than the particle number,
+      /* note: num_on_grid will be PM_STENCIL times larger than the particle number,
          but num_field_points will generally be much smaller */
 
       /* bring the part-field into the order of the accessed cells. This allow the removal of duplicates */
@@ -1870,9 +1849,9 @@ void pmtidaltensor_periodic_diff(void)
       for(i = 0; i < num_field_points; i++)
 	localfield_d_data[i] = 0;
 
-      for(i = 0; i < num_on_grid; i += 8) 
+      for(i = 0; i < num_on_grid; i += PM_STENCIL) 
 	{
-	  pindex = (part[i].partindex >> 3); 
+	  pindex = part[i].partindex / PM_STENCIL; 
 	  if(P[pindex].Mass<=0) continue; 
 	  
 	  /* possible bugfix: Y.Feng:  (otherwise just pp[xx]=Pos[xx]) */ 
@@ -1882,21 +1861,9 @@ void pmtidaltensor_periodic_diff(void)
 	      pp[xx] = P[pindex].Pos[xx]; 
 	      pp[xx] = WRAP_POSITION_UNIFORM_BOX(pp[xx]); 
 	  } 
-	  slab_x = (int) (to_slab_fac * pp[0]); 
-	  slab_y = (int) (to_slab_fac * pp[1]); 
-	  slab_z = (int) (to_slab_fac * pp[2]); 
-	  dx = to_slab_fac * pp[0] - slab_x; 
-	  dy = to_slab_fac * pp[1] - slab_y; 
-	  dz = to_slab_fac * pp[2] - slab_z;
-
-	  localfield_d_data[part[i + 0].localindex] += P[pindex].Mass * (1.0 - dx) * (1.0 - dy) * (1.0 - dz);
-	  localfield_d_data[part[i + 1].localindex] += P[pindex].Mass * (1.0 - dx) * (1.0 - dy) * dz;
-	  localfield_d_data[part[i + 2].localindex] += P[pindex].Mass * (1.0 - dx) * dy * (1.0 - dz);
-	  localfield_d_data[part[i + 3].localindex] += P[pindex].Mass * (1.0 - dx) * dy * dz;
-	  localfield_d_data[part[i + 4].localindex] += P[pindex].Mass * (dx) * (1.0 - dy) * (1.0 - dz);
-	  localfield_d_data[part[i + 5].localindex] += P[pindex].Mass * (dx) * (1.0 - dy) * dz;
-	  localfield_d_data[part[i + 6].localindex] += P[pindex].Mass * (dx) * dy * (1.0 - dz);
-	  localfield_d_data[part[i + 7].localindex] += P[pindex].Mass * (dx) * dy * dz;
+	  pm_periodic_stencil(pp, to_slab_fac, 0, st_weight);
+	  for(st = 0; st < PM_STENCIL; st++)
+	    localfield_d_data[part[i + st].localindex] += pm_grid_weight * P[pindex].Mass * st_weight[st];
 	} 
       
       /* clear local FFT-mesh density field */
@@ -2022,7 +1989,7 @@ void pmtidaltensor_periodic_diff(void)
 		      fz = sin(fz) / fz;
 		    }
 		  ff = 1 / (fx * fy * fz);
-		  smth *= ff * ff * ff * ff;
+		  smth *= pm_periodic_deconvolution(ff);
 
 		  /* end deconvolution */
 
@@ -2110,7 +2077,7 @@ void pmtidaltensor_periodic_diff(void)
 
       for(i = 0, j = 0; i < NumPart; i++)
 	{
-	  while(j < num_on_grid && (part[j].partindex >> 3) != i)
+	  while(j < num_on_grid && part[j].partindex / PM_STENCIL != i)
 	    j++;
 
 	  /* possible bugfix: Y.Feng:  (otherwise just pp[xx]=Pos[xx]) */ 
@@ -2120,21 +2087,9 @@ void pmtidaltensor_periodic_diff(void)
 	      pp[xx] = P[i].Pos[xx]; 
 	      pp[xx] = WRAP_POSITION_UNIFORM_BOX(pp[xx]); 
 	  } 
-	  slab_x = (int) (to_slab_fac * pp[0]); 
-	  slab_y = (int) (to_slab_fac * pp[1]); 
-	  slab_z = (int) (to_slab_fac * pp[2]); 
-	  dx = to_slab_fac * pp[0] - slab_x; dy = to_slab_fac * pp[1] - slab_y; 
-	  dz = to_slab_fac * pp[2] - slab_z; 
-	
-	  pot = 
-	      +localfield_data[part[j + 0].localindex] * (1.0 - dx) * (1.0 - dy) * (1.0 - dz) 
-	      + localfield_data[part[j + 1].localindex] * (1.0 - dx) * (1.0 - dy) * dz 
-	      + localfield_data[part[j + 2].localindex] * (1.0 - dx) * dy * (1.0 - dz) 
-	      + localfield_data[part[j + 3].localindex] * (1.0 - dx) * dy * dz 
-	      + localfield_data[part[j + 4].localindex] * (dx) * (1.0 - dy) * (1.0 - dz) 
-	      + localfield_data[part[j + 5].localindex] * (dx) * (1.0 - dy) * dz 
-	      + localfield_data[part[j + 6].localindex] * (dx) * dy * (1.0 - dz) 
-	      + localfield_data[part[j + 7].localindex] * (dx) * dy * dz; 
+	  pm_periodic_stencil(pp, to_slab_fac, 0, st_weight);
+	  for(st = 0, pot = 0; st < PM_STENCIL; st++)
+	    pot += localfield_data[part[j + st].localindex] * st_weight[st];
 	  
 	  P[i].PM_Potential += pot * fac * (2 * All.BoxSize / PMGRID);
 	  /* compensate the finite differencing factor */ ; 
@@ -2370,7 +2325,7 @@ void pmtidaltensor_periodic_diff(void)
 		if(P[i].Type == 0)	/* baryons don't get an extra scalar force */
 		  continue;
 #endif
-	      while(j < num_on_grid && (part[j].partindex >> 3) != i)
+	      while(j < num_on_grid && part[j].partindex / PM_STENCIL != i)
 		j++; 
 	      
 	      /* possible bugfix: Y.Feng:  (otherwise just pp[xx]=Pos[xx]) */ 
@@ -2380,20 +2335,9 @@ void pmtidaltensor_periodic_diff(void)
 		  pp[xx] = P[i].Pos[xx]; 
 		  pp[xx] = WRAP_POSITION_UNIFORM_BOX(pp[xx]); 
 	      } 
-	      slab_x = (int) (to_slab_fac * pp[0]); 
-	      slab_y = (int) (to_slab_fac * pp[1]); 
-	      slab_z = (int) (to_slab_fac * pp[2]); 
-	      dx = to_slab_fac * pp[0] - slab_x; 
-	      dy = to_slab_fac * pp[1] - slab_y; 
-	      dz = to_slab_fac * pp[2] - slab_z; 
-	      tidal_dim = + localfield_data[part[j + 0].localindex] * (1.0 - dx) * (1.0 - dy) * (1.0 - dz)
-		+ localfield_data[part[j + 1].localindex] * (1.0 - dx) * (1.0 - dy) * dz
-		+ localfield_data[part[j + 2].localindex] * (1.0 - dx) * dy * (1.0 - dz)
-		+ localfield_data[part[j + 3].localindex] * (1.0 - dx) * dy * dz
-		+ localfield_data[part[j + 4].localindex] * (dx) * (1.0 - dy) * (1.0 - dz)
-		+ localfield_data[part[j + 5].localindex] * (dx) * (1.0 - dy) * dz
-		+ localfield_data[part[j + 6].localindex] * (dx) * dy * (1.0 - dz)
-		+ localfield_data[part[j + 7].localindex] * (dx) * dy * dz;
+	      pm_periodic_stencil(pp, to_slab_fac, 0, st_weight);
+	      for(st = 0, tidal_dim = 0; st < PM_STENCIL; st++)
+	        tidal_dim += localfield_data[part[j + st].localindex] * st_weight[st];
 
 	      if(dim == 0)
 		{
@@ -2444,8 +2388,8 @@ void pmtidaltensor_periodic_diff(void)
 
 /*! Calculates the long-range tidal field using the PM method.  The potential is
  *  Gaussian filtered with Asmth, given in mesh-cell units. We carry out a CIC
- *  charge assignment, and compute the potenial by Fourier transform
- *  methods. The CIC kernel is deconvolved.
+ *  (or TSC/PCS) charge assignment, and compute the potenial by Fourier transform
+ *  methods. The assignment kernel is deconvolved.
  *  Note that the k's need a pre-factor of 2 M_PI / All.BoxSize.
  *  The procedure calculates the second derivates of the gravitational potential by "pulling" down k's in fourier space.
  *  Component specifies the entry in the tidal field tensor that should be calculated:
@@ -2458,20 +2402,22 @@ void pmtidaltensor_periodic_diff(void)
 void pmtidaltensor_periodic_fourier(int component)
 {
   double k2, kx, ky, kz, smth;
-  double dx, dy, dz;
+  double st_weight[PM_STENCIL];
   double fx, fy, fz, ff;
   double asmth2, fac, tidal;
   MyDouble pp[3];
   int i, j, slab, level, sendTask, recvTask, task;
   int x, y, z, ip;
-  int slab_x, slab_y, slab_z;
-  int slab_xx, slab_yy, slab_zz;
-  int num_on_grid, num_field_points, pindex, xx, yy, zz;
+  int st;
+  int num_on_grid, num_field_points, pindex, xx;
   MPI_Status status;
   int *localfield_count, *localfield_first, *localfield_offset, *localfield_togo;
-  large_array_offset offset, *localfield_globalindex, *import_globalindex;
+  large_array_offset offset, st_offset[PM_STENCIL], *localfield_globalindex, *import_globalindex;
   d_fftw_real *localfield_d_data, *import_d_data;
   fftw_real *localfield_data, *import_data;
+#ifdef PM_INTERLACE
+  if(pm_grid_weight == 1) {PM_INTERLACED_CALL(pmtidaltensor_periodic_fourier(component)); return;}
+#endif
  
   PRINT_STATUS("Starting periodic PM-Tidaltensor (component=%d) calculation.  (presently allocated=%g MB)",component, AllocatedBytes / (1024.0 * 1024.0));
   asmth2 = (2 * M_PI) * All.Asmth[0] / All.BoxSize;
@@ -2492,36 +2438,17 @@ void pmtidaltensor_periodic_fourier(int component)
             pp[xx] = P[i].Pos[xx];
             pp[xx] = WRAP_POSITION_UNIFORM_BOX(pp[xx]);
         }
-        slab_x = (int) (to_slab_fac * pp[0]);
-        slab_y = (int) (to_slab_fac * pp[1]);
-        slab_z = (int) (to_slab_fac * pp[2]);
-        if(slab_x >= PMGRID) slab_x -= PMGRID;
-        if(slab_y >= PMGRID) slab_y -= PMGRID;
-        if(slab_z >= PMGRID) slab_z -= PMGRID; 
-	
-	for(xx = 0; xx < 2; xx++) 
-	    for(yy = 0; yy < 2; yy++) 
-		for(zz = 0; zz < 2; zz++) { 
-		    slab_xx = slab_x + xx; 
-		    slab_yy = slab_y + yy; 
-		    slab_zz = slab_z + zz; 
-		    
-		    if(slab_xx >= PMGRID) 
-			slab_xx -= PMGRID; 
-		    if(slab_yy >= PMGRID) 
-			slab_yy -= PMGRID; 
-		    if(slab_zz >= PMGRID) 
-			slab_zz -= PMGRID; 
-		    
-		    offset = ((large_array_offset) PMGRID2) * (PMGRID * slab_xx + slab_yy) + slab_zz; 
-		    part[num_on_grid].partindex = (i << 3) + (xx << 2) + (yy << 1) + zz; 
-		    part[num_on_grid].globalindex = offset; 
-		    part_sortindex[num_on_grid] = num_on_grid; 
-		    num_on_grid++; 
-		} 
+        pm_periodic_stencil(pp, to_slab_fac, st_offset, st_weight);
+        for(st = 0; st < PM_STENCIL; st++)
+          {
+            part[num_on_grid].partindex = i * PM_STENCIL + st;
+            part[num_on_grid].globalindex = st_offset[st];
+            part_sortindex[num_on_grid] = num_on_grid;
+            num_on_grid++;
+          }
     } 
   
-  /* note: num_on_grid will be  8 times larger than the particle number, 
+  /* note: num_on_grid will be PM_STENCIL times larger than the particle number, 
      but num_field_points will generally be much smaller */
 
   /* bring the part-field into the order of the accessed cells. This allow the removal of duplicates */
@@ -2589,9 +2516,9 @@ void pmtidaltensor_periodic_fourier(int component)
   for(i = 0; i < num_field_points; i++)
     localfield_d_data[i] = 0;
 
-  for(i = 0; i < num_on_grid; i += 8)
+  for(i = 0; i < num_on_grid; i += PM_STENCIL)
     { 
-	pindex = (part[i].partindex >> 3);
+	pindex = part[i].partindex / PM_STENCIL;
         if(P[pindex].Mass<=0) continue;
 
         /* possible bugfix: Y.Feng:  (otherwise just pp[xx]=Pos[xx]) */
@@ -2601,21 +2528,9 @@ void pmtidaltensor_periodic_fourier(int component)
             pp[xx] = P[pindex].Pos[xx];
             pp[xx] = WRAP_POSITION_UNIFORM_BOX(pp[xx]);
         }
-        slab_x = (int) (to_slab_fac * pp[0]);
-        slab_y = (int) (to_slab_fac * pp[1]);
-        slab_z = (int) (to_slab_fac * pp[2]);
-        dx = to_slab_fac * pp[0] - slab_x;
-        dy = to_slab_fac * pp[1] - slab_y;
-        dz = to_slab_fac * pp[2] - slab_z;
-
-	localfield_d_data[part[i + 0].localindex] += P[pindex].Mass * (1.0 - dx) * (1.0 - dy) * (1.0 - dz);
-	localfield_d_data[part[i + 1].localindex] += P[pindex].Mass * (1.0 - dx) * (1.0 - dy) * dz;
-	localfield_d_data[part[i + 2].localindex] += P[pindex].Mass * (1.0 - dx) * dy * (1.0 - dz);
-	localfield_d_data[part[i + 3].localindex] += P[pindex].Mass * (1.0 - dx) * dy * dz;
-	localfield_d_data[part[i + 4].localindex] += P[pindex].Mass * (dx) * (1.0 - dy) * (1.0 - dz);
-	localfield_d_data[part[i + 5].localindex] += P[pindex].Mass * (dx) * (1.0 - dy) * dz;
-	localfield_d_data[part[i + 6].localindex] += P[pindex].Mass * (dx) * dy * (1.0 - dz);
-	localfield_d_data[part[i + 7].localindex] += P[pindex].Mass * (dx) * dy * dz;
+        pm_periodic_stencil(pp, to_slab_fac, 0, st_weight);
+        for(st = 0; st < PM_STENCIL; st++)
+          localfield_d_data[part[i + st].localindex] += pm_grid_weight * P[pindex].Mass * st_weight[st];
     }
 
   /* clear local FFT-mesh density field */
@@ -2736,7 +2651,7 @@ void pmtidaltensor_periodic_fourier(int component)
 		  fz = sin(fz) / fz;
 		}
 	      ff = 1 / (fx * fy * fz);
-	      smth *= ff * ff * ff * ff;
+	      smth *= pm_periodic_deconvolution(ff);
 
 
 	      /* end deconvolution */
@@ -2862,7 +2777,7 @@ void pmtidaltensor_periodic_fourier(int component)
 
   for(i = 0, j = 0; i < NumPart; i++)
     {
-      while(j < num_on_grid && (part[j].partindex >> 3) != i)
+      while(j < num_on_grid && part[j].partindex / PM_STENCIL != i)
 	j++;
 
         /* possible bugfix: Y.Feng:  (otherwise just pp[xx]=Pos[xx]) */
@@ -2872,22 +2787,9 @@ void pmtidaltensor_periodic_fourier(int component)
             pp[xx] = P[i].Pos[xx];
             pp[xx] = WRAP_POSITION_UNIFORM_BOX(pp[xx]);
         }
-        slab_x = (int) (to_slab_fac * pp[0]);
-        slab_y = (int) (to_slab_fac * pp[1]);
-        slab_z = (int) (to_slab_fac * pp[2]);
-        dx = to_slab_fac * pp[0] - slab_x;
-        dy = to_slab_fac * pp[1] - slab_y;
-        dz = to_slab_fac * pp[2] - slab_z; 
-	
-	tidal = 
-	    +localfield_data[part[j + 0].localindex] * (1.0 - dx) * (1.0 - dy) * (1.0 - dz)
-	    + localfield_data[part[j + 1].localindex] * (1.0 - dx) * (1.0 - dy) * dz
-	    + localfield_data[part[j + 2].localindex] * (1.0 - dx) * dy * (1.0 - dz)
-	    + localfield_data[part[j + 3].localindex] * (1.0 - dx) * dy * dz
-	    + localfield_data[part[j + 4].localindex] * (dx) * (1.0 - dy) * (1.0 - dz)
-	    + localfield_data[part[j + 5].localindex] * (dx) * (1.0 - dy) * dz
-	    + localfield_data[part[j + 6].localindex] * (dx) * dy * (1.0 - dz)
-	    + localfield_data[part[j + 7].localindex] * (dx) * dy * dz;
+        pm_periodic_stencil(pp, to_slab_fac, 0, st_weight);
+        for(st = 0, tidal = 0; st < PM_STENCIL; st++)
+          tidal += localfield_data[part[j + st].localindex] * st_weight[st];
 
 	tidal *= fac;
 
@@ -3036,7 +2938,7 @@ void powerspec(int flag, int *typeflag)
 		      fz = sin(fz) / fz;
 		    }
 		  ff = 1 / (fx * fy * fz);
-		  smth = ff * ff * ff * ff;
+		  smth = pm_periodic_deconvolution(ff);
 
 		  /* end deconvolution */
 
@@ -3254,9 +3156,10 @@ void powerspec_save(void)
 void foldonitself(int *typelist)
 {
   int i, j, level, sendTask, recvTask, istart, nbuf, n, rest, iter = 0;
-  int slab_x, slab_xx, slab_y, slab_yy, slab_z, slab_zz;
+  int k, kk, st, slab_x, cell[PM_ASSIGNMENT_ORDER];
   int *nsend_local, *nsend_offset, *nsend, count, buf_capacity;
-  double to_slab_fac_folded, dx, dy, dz;
+  double to_slab_fac_folded, w_1d[PM_ASSIGNMENT_ORDER], st_weight[PM_STENCIL];
+  large_array_offset st_offset[PM_STENCIL];
   double tstart0, tstart, tend, t0, t1;
   MyDouble pp[3];
   MyFloat *pos_sendbuf, *pos_recvbuf, *pos;
@@ -3294,7 +3197,7 @@ void foldonitself(int *typelist)
 	  if(typelist[P[i].Type] == 0)
 	    continue;
 
-	  if(nbuf + 1 >= buf_capacity)
+	  if(nbuf + PM_ASSIGNMENT_ORDER >= buf_capacity)
 	    break;
 
 
@@ -3302,17 +3205,17 @@ void foldonitself(int *typelist)
 	  pp[0] = P[i].Pos[0]; 
 	  pp[0] = WRAP_POSITION_UNIFORM_BOX(pp[0]);
 
-	  slab_x = to_slab_fac_folded * pp[0];
-	  slab_xx = slab_x + 1;
-	  slab_x %= PMGRID;
-	  slab_xx %= PMGRID;
-
-	  nsend_local[slab_to_task[slab_x]]++;
-	  nbuf++;
-
-	  if(slab_to_task[slab_x] != slab_to_task[slab_xx])
+	  /* the particle goes once to every task holding one of the slabs it is assigned to */
+	  pm_periodic_kernel_1d(to_slab_fac_folded * pp[0], cell, w_1d);
+	  for(k = 0; k < PM_ASSIGNMENT_ORDER; k++)
 	    {
-	      nsend_local[slab_to_task[slab_xx]]++;
+	      for(kk = 0; kk < k; kk++)
+		if(slab_to_task[cell[kk]] == slab_to_task[cell[k]])
+		  break;
+	      if(kk < k)
+		continue;
+
+	      nsend_local[slab_to_task[cell[k]]]++;
 	      nbuf++;
 	    }
 	}
@@ -3328,39 +3231,30 @@ void foldonitself(int *typelist)
 	  if(typelist[P[i].Type] == 0) continue;
         if(P[i].Mass <= 0) continue;
 
-	  if(nbuf + 1 >= buf_capacity)
+	  if(nbuf + PM_ASSIGNMENT_ORDER >= buf_capacity)
 	    break;
 
 	  /* make sure that particles are properly box-wrapped */
 	  pp[0] = P[i].Pos[0]; 
 	  pp[0] = WRAP_POSITION_UNIFORM_BOX(pp[0]);
 
-	  slab_x = to_slab_fac_folded * pp[0];
-	  slab_xx = slab_x + 1;
-	  slab_x %= PMGRID;
-	  slab_xx %= PMGRID;
-
-	  for(j = 0; j < 3; j++)
-	    pos_sendbuf[4 * (nsend_offset[slab_to_task[slab_x]] + nsend_local[slab_to_task[slab_x]]) + j] =
-	      P[i].Pos[j];
-
-	  pos_sendbuf[4 * (nsend_offset[slab_to_task[slab_x]] + nsend_local[slab_to_task[slab_x]]) + 3] =
-	    P[i].Mass;
-
-	  nsend_local[slab_to_task[slab_x]]++;
-	  nbuf++;
-
-	  if(slab_to_task[slab_x] != slab_to_task[slab_xx])
+	  pm_periodic_kernel_1d(to_slab_fac_folded * pp[0], cell, w_1d);
+	  for(k = 0; k < PM_ASSIGNMENT_ORDER; k++)
 	    {
-	      for(j = 0; j < 3; j++)
-		pos_sendbuf[4 * (nsend_offset[slab_to_task[slab_xx]] + nsend_local[slab_to_task[slab_xx]]) +
-			    j] = P[i].Pos[j];
+	      for(kk = 0; kk < k; kk++)
+		if(slab_to_task[cell[kk]] == slab_to_task[cell[k]])
+		  break;
+	      if(kk < k)
+		continue;
 
-	      pos_sendbuf[4 * (nsend_offset[slab_to_task[slab_xx]] + nsend_local[slab_to_task[slab_xx]]) +
-			  3] = P[i].Mass;
+	      for(j = 0; j < 3; j++)
+		pos_sendbuf[4 * (nsend_offset[slab_to_task[cell[k]]] + nsend_local[slab_to_task[cell[k]]]) + j] =
+		  P[i].Pos[j];
 
+	      pos_sendbuf[4 * (nsend_offset[slab_to_task[cell[k]]] + nsend_local[slab_to_task[cell[k]]]) + 3] =
+		P[i].Mass;
 
-	      nsend_local[slab_to_task[slab_xx]]++;
+	      nsend_local[slab_to_task[cell[k]]]++;
 	      nbuf++;
 	    }
 	}
@@ -3407,52 +3301,16 @@ void foldonitself(int *typelist)
 		      pp[j] = WRAP_POSITION_UNIFORM_BOX(pp[j]);
 		    }
 
-		  slab_x = to_slab_fac_folded * pp[0];
-		  dx = to_slab_fac_folded * pp[0] - slab_x;
-		  slab_xx = slab_x + 1;
-		  slab_x %= PMGRID;
-		  slab_xx %= PMGRID;
-
-		  slab_y = to_slab_fac_folded * pp[1];
-		  dy = to_slab_fac_folded * pp[1] - slab_y;
-		  slab_yy = slab_y + 1;
-		  slab_y %= PMGRID;
-		  slab_yy %= PMGRID;
-
-		  slab_z = to_slab_fac_folded * pp[2];
-		  dz = to_slab_fac_folded * pp[2] - slab_z;
-		  slab_zz = slab_z + 1;
-		  slab_z %= PMGRID;
-		  slab_zz %= PMGRID;
-
 		  float mass = pos[3];
 
-		  if(slab_to_task[slab_x] == ThisTask)
+		  pm_periodic_stencil(pp, to_slab_fac_folded, st_offset, st_weight);
+		  for(st = 0; st < PM_STENCIL; st++)
 		    {
-		      slab_x -= first_slab_of_task[ThisTask];
-
-		      rhogrid[(slab_x * PMGRID + slab_y) * PMGRID2 + slab_z] +=
-			mass * (1.0 - dx) * (1.0 - dy) * (1.0 - dz);
-		      rhogrid[(slab_x * PMGRID + slab_yy) * PMGRID2 + slab_z] +=
-			mass * (1.0 - dx) * dy * (1.0 - dz);
-		      rhogrid[(slab_x * PMGRID + slab_y) * PMGRID2 + slab_zz] +=
-			mass * (1.0 - dx) * (1.0 - dy) * dz;
-		      rhogrid[(slab_x * PMGRID + slab_yy) * PMGRID2 + slab_zz] += mass * (1.0 - dx) * dy * dz;
+		      slab_x = st_offset[st] / (PMGRID * ((large_array_offset) PMGRID2));
+		      if(slab_to_task[slab_x] == ThisTask)
+			rhogrid[st_offset[st] - first_slab_of_task[ThisTask] * PMGRID * ((large_array_offset) PMGRID2)] +=
+			  mass * st_weight[st];
 		    }
-
-		  if(slab_to_task[slab_xx] == ThisTask)
-		    {
-		      slab_xx -= first_slab_of_task[ThisTask];
-
-		      rhogrid[(slab_xx * PMGRID + slab_y) * PMGRID2 + slab_z] +=
-			mass * (dx) * (1.0 - dy) * (1.0 - dz);
-		      rhogrid[(slab_xx * PMGRID + slab_yy) * PMGRID2 + slab_z] +=
-			mass * (dx) * dy * (1.0 - dz);
-		      rhogrid[(slab_xx * PMGRID + slab_y) * PMGRID2 + slab_zz] +=
-			mass * (dx) * (1.0 - dy) * dz;
-		      rhogrid[(slab_xx * PMGRID + slab_yy) * PMGRID2 + slab_zz] += mass * (dx) * dy * dz;
-		    }
-
 		}
 	    }
 	}
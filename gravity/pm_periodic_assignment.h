@@ -0,0 +1,68 @@
+#ifndef PM_PERIODIC_ASSIGNMENT_H
+#define PM_PERIODIC_ASSIGNMENT_H
+
+/* mesh-assignment kernel shared by the slab (pm_periodic.c) and pencil (pm_periodic_pencil.c) decompositions of the periodic
+    PM grid. The including file must define PMGRID2 and the large_array_offset type before including this header. */
+
+/* mass-assignment (and force/potential interpolation) kernel of the mesh: each particle touches PM_ASSIGNMENT_ORDER mesh points per
+    dimension (2=CIC, 3=TSC, 4=PCS), and the kernel is deconvolved (once for the assignment, once for the interpolation) in k-space */
+#ifndef PM_ASSIGNMENT_ORDER
+#define PM_ASSIGNMENT_ORDER 2
+#endif
+#if (PM_ASSIGNMENT_ORDER < 2) || (PM_ASSIGNMENT_ORDER > 4)
+#error "PM_ASSIGNMENT_ORDER must be 2 (CIC), 3 (TSC), or 4 (PCS)"
+#endif
+#define PM_STENCIL (PM_ASSIGNMENT_ORDER * PM_ASSIGNMENT_ORDER * PM_ASSIGNMENT_ORDER)
+
+#ifdef PM_INTERLACE
+/* with interlacing, the PM calculations are done twice, with the mesh shifted by half a cell along each axis, and averaged:
+    the aliased contributions with odd sums of the image indices change sign between the two and cancel */
+static double pm_grid_shift = 0, pm_grid_weight = 1;
+#define PM_INTERLACED_CALL(call) {int k_interlace; for(k_interlace = 0; k_interlace < 2; k_interlace++) {pm_grid_shift = 0.5 * k_interlace; pm_grid_weight = 0.5; call;} pm_grid_shift = 0; pm_grid_weight = 1;}
+#else
+#define pm_grid_shift 0
+#define pm_grid_weight 1
+#endif
+
+/*! given the position u (in mesh units) along one axis, returns the indices (wrapped periodically) and weights of the
+ *  PM_ASSIGNMENT_ORDER mesh points the particle is assigned to */
+static inline void pm_periodic_kernel_1d(double u, int *cell, double *w)
+{
+    int k, i0;
+#if (PM_ASSIGNMENT_ORDER == 4) /* piecewise cubic spline */
+    i0 = (int) floor(u); double d = u - i0, e = 1 - d;
+    w[0] = e*e*e / 6.; w[1] = (4. - 6.*d*d + 3.*d*d*d) / 6.; w[2] = (4. - 6.*e*e + 3.*e*e*e) / 6.; w[3] = d*d*d / 6.; i0--;
+#elif (PM_ASSIGNMENT_ORDER == 3) /* triangular-shaped cloud */
+    i0 = (int) floor(u + 0.5); double d = u - i0;
+    w[0] = 0.5*(0.5-d)*(0.5-d); w[1] = 0.75 - d*d; w[2] = 0.5*(0.5+d)*(0.5+d); i0--;
+#else /* cloud-in-cell */
+    i0 = (int) floor(u); double d = u - i0;
+    w[0] = 1 - d; w[1] = d;
+#endif
+    for(k = 0; k < PM_ASSIGNMENT_ORDER; k++) {cell[k] = (i0 + k) % PMGRID; if(cell[k] < 0) {cell[k] += PMGRID;}}
+}
+
+/*! returns the global mesh offsets (if offset is non-null) and weights of the PM_STENCIL mesh points a particle at pos is
+ *  assigned to, for a mesh with 'fac' cells per unit length. The ordering of the points is the same for every call. */
+static inline void pm_periodic_stencil(MyDouble *pos, double fac, large_array_offset *offset, double *w)
+{
+    int k, xx, yy, zz, n, cell[3][PM_ASSIGNMENT_ORDER]; double w_1d[3][PM_ASSIGNMENT_ORDER];
+    for(k = 0; k < 3; k++) {pm_periodic_kernel_1d(fac * WRAP_POSITION_UNIFORM_BOX(pos[k]) + pm_grid_shift, cell[k], w_1d[k]);}
+    for(xx = 0, n = 0; xx < PM_ASSIGNMENT_ORDER; xx++)
+        for(yy = 0; yy < PM_ASSIGNMENT_ORDER; yy++)
+            for(zz = 0; zz < PM_ASSIGNMENT_ORDER; zz++, n++)
+            {
+                if(offset) {offset[n] = ((large_array_offset) PMGRID2) * (PMGRID * cell[0][xx] + cell[1][yy]) + cell[2][zz];}
+                w[n] = w_1d[0][xx] * w_1d[1][yy] * w_1d[2][zz];
+            }
+}
+
+/*! deconvolution factor for the mass-assignment and interpolation, given ff = 1/(sinc(kx) sinc(ky) sinc(kz)) */
+static inline double pm_periodic_deconvolution(double ff)
+{
+    int k; double f2 = ff * ff, r = 1;
+    for(k = 0; k < PM_ASSIGNMENT_ORDER; k++) {r *= f2;}
+    return r;
+}
+
+#endif
@@ -0,0 +1,815 @@
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+/*! \file pm_periodic_pencil.c
+ *  \brief routines for periodic PM-force computation on a pencil-decomposed mesh
+ */
+/*
+ * This is the alternative (PM_PENCIL_FFT) to the slab decomposition of the periodic PM mesh in pm_periodic.c. The mesh is
+ * split over a two-dimensional np1 x np2 grid of tasks: in real space each task holds the mesh lines along z ('pencils')
+ * of a block of x and y, so every task takes part in the FFT (with slabs at most PMGRID tasks can), and the mesh memory
+ * per task is ~PMGRID^3/NTask. The parallel real-to-complex FFT is assembled from serial FFTW plans along z, y, and x,
+ * with all-to-all transposes of the data within the rows (same x-range) and columns (same y-range) of the task grid in
+ * between. The mass assignment and interpolation kernel is the same as for the slabs (pm_periodic_assignment.h); the
+ * differencing of the potential is done as a multiplication in k-space, with the exact transfer function of the 4-point
+ * finite-difference formula the slab code uses, so the two give the same forces.
+ */
+
+#include "../allvars.h"
+#include "../proto.h"
+
+#ifdef PMGRID
+#if defined(BOX_PERIODIC) && defined(PM_PENCIL_FFT)
+
+#ifndef USE_FFTW3
+#error "PM_PENCIL_FFT requires USE_FFTW3"
+#endif
+#if defined(COMPUTE_TIDAL_TENSOR_IN_GRAVTREE) || defined(OUTPUT_POWERSPEC)
+#error "PM_PENCIL_FFT only provides the periodic PM force and potential: the PM tidal tensor and power spectra still require the slab decomposition"
+#endif
+
+#include "myfftw3.h"
+
+#define  PMGRID2 (2*(PMGRID/2 + 1)) /* only used for the global index of mesh points returned by pm_periodic_stencil: the pencils are not padded */
+#define  PMGRIDZ (PMGRID/2 + 1) /* number of complex modes along z of the real-to-complex transform */
+
+#if (PMGRID > 1024)
+typedef long long large_array_offset;
+#define MPI_TYPE_LARGE_ARRAY_OFFSET MPI_LONG_LONG
+#else
+typedef unsigned int large_array_offset;
+#define MPI_TYPE_LARGE_ARRAY_OFFSET MPI_UNSIGNED
+#endif
+
+#include "pm_periodic_assignment.h"
+
+/* index of a mesh point in the local blocks of the three complex layouts of the transform (the real-space pencils are
+    stored as [x][y][z], in the same order as in first_cell_of_task): z-lines ([x][y][kz] after the FFT along z), y-lines ([x][kz][y], after the transpose
+    within the row), and x-lines ([kz][ky][x], after the transpose within the column, the final layout in k-space). Indices
+    along the line direction are global, all others local. */
+#define PENCIL_INDEX_Z(x, y, kz)  (((size_t) (x) * pencil_ny + (y)) * PMGRIDZ + (kz))
+#define PENCIL_INDEX_Y(x, kz, y)  (((size_t) (x) * pencil_nkz + (kz)) * PMGRID + (y))
+#define PENCIL_INDEX_X(kz, ky, x) (((size_t) (kz) * pencil_nky + (ky)) * PMGRID + (x))
+#define PENCIL_COPY(a, b) {cmplx_re(a) = cmplx_re(b); cmplx_im(a) = cmplx_im(b);}
+
+static fftw_plan fft_forward_z, fft_inverse_z, fft_forward_y, fft_inverse_y, fft_forward_x, fft_inverse_x;
+static MPI_Comm pencil_comm_row, pencil_comm_col; /* tasks with the same x-range (rank p2), and with the same y-range (rank p1) */
+static int pencil_np1, pencil_np2, pencil_p1, pencil_p2; /* dimensions of the task grid, and the position of this task in it (ThisTask = p1*np2 + p2) */
+static int *pencil_x_start, *pencil_ky_start; /* first x (real space) and ky (k-space) of each of the np1 blocks, [np1+1] */
+static int *pencil_y_start, *pencil_kz_start; /* first y (real space) and kz (k-space) of each of the np2 blocks, [np2+1] */
+static int pencil_nx, pencil_ny, pencil_nkz, pencil_nky; /* sizes of the local blocks */
+static int *pencil_send_count, *pencil_send_offset, *pencil_recv_count, *pencil_recv_offset; /* for the transposes */
+static int x_to_pencil[PMGRID], y_to_pencil[PMGRID];
+static large_array_offset *first_cell_of_task; /* the mesh points of all tasks, concatenated in task order [NTask+1] */
+static size_t pencil_nreal, pencil_ncomplex, pencil_nxlines; /* local number of real mesh points, of complex elements in the largest layout, and in the x-lines */
+
+static fftw_real *rhogrid;
+static fftw_complex *fft_of_rhogrid, *fft_of_potential, *workspace;
+
+static MyFloat to_slab_fac;
+
+static struct part_slab_data
+{
+  large_array_offset globalindex; /* position of the mesh point in the task-ordered list of all pencils (first_cell_of_task) */
+  int partindex;
+  int localindex;
+} *part;
+
+static int *part_sortindex;
+
+#ifdef OPENMP_PM
+static fftw_real *part_weight; /* mass times assignment weight of each slot of part[] */
+#include "pm_omp_binning.h"
+#endif
+
+/* the list of mesh points the local particles touch, and of those (imported from all tasks) on the local pencils */
+static int num_on_grid, num_field_points, num_import;
+static large_array_offset *localfield_globalindex, *import_globalindex;
+static fftw_real *localfield_data, *import_data;
+static int *localfield_count, *localfield_offset, *import_count, *import_offset;
+
+int pm_periodic_compare_sortindex(const void *a, const void *b);
+
+
+/*! returns the position of the mesh point with the global index g (as returned by pm_periodic_stencil) in the concatenated
+ *  (in task order) list of the pencils, so that sorting by this key sorts the mesh points by the task holding them */
+static inline large_array_offset pm_pencil_cell(large_array_offset g)
+{
+    int x = (int) (g / (((large_array_offset) PMGRID2) * PMGRID)), y = (int) ((g / PMGRID2) % PMGRID), z = (int) (g % PMGRID2);
+    int p1 = x_to_pencil[x], p2 = y_to_pencil[y];
+    return first_cell_of_task[p1 * pencil_np2 + p2]
+        + ((large_array_offset) (x - pencil_x_start[p1]) * (pencil_y_start[p2 + 1] - pencil_y_start[p2]) + (y - pencil_y_start[p2])) * PMGRID + z;
+}
+
+
+/*! This routine sets up the task grid and the serial FFTW-plans used to carry out the parallel FFTs later on. Some
+ *  auxiliary variables are also initialized.
+ */
+void pm_init_periodic(void)
+{
+  int i, d, n[1] = {PMGRID}, np_max;
+  size_t n_zlines, n_ylines;
+  fftw_real *plan_real;
+  fftw_complex *plan_complex;
+
+  All.Asmth[0] = PM_ASMTH * All.BoxSize / PMGRID; /* note that these routines REQUIRE a uniform (BOX_LONG_X=BOX_LONG_Y=BOX_LONG_Z=1) box, so we can just use 'BoxSize' */
+  All.Rcut[0] = PM_RCUT * All.Asmth[0];
+
+  /* choose the task grid np1 x np2 = NTask as square as possible, with at most one x (and ky) plane per block of the np1
+     and one y (and kz) plane per block of the np2 */
+  for(d = 1, pencil_np2 = 0; d <= NTask; d++)
+    if(NTask % d == 0 && d <= PMGRIDZ && NTask / d <= PMGRID)
+      if(pencil_np2 == 0 || abs(NTask / d - d) < abs(pencil_np1 - pencil_np2)) {pencil_np2 = d; pencil_np1 = NTask / d;}
+  if(pencil_np2 == 0)
+    {
+      if(ThisTask == 0) {printf("PM_PENCIL_FFT: cannot arrange NTask=%d tasks in a grid with at most PMGRID=%d rows and PMGRID/2+1=%d columns\n", NTask, PMGRID, PMGRIDZ);}
+      endrun(1);
+    }
+  pencil_p1 = ThisTask / pencil_np2;
+  pencil_p2 = ThisTask % pencil_np2;
+  MPI_Comm_split(MPI_COMM_WORLD, pencil_p1, pencil_p2, &pencil_comm_row);
+  MPI_Comm_split(MPI_COMM_WORLD, pencil_p2, pencil_p1, &pencil_comm_col);
+
+  np_max = (pencil_np1 > pencil_np2) ? pencil_np1 : pencil_np2;
+  pencil_x_start = (int *) mymalloc("pencil_x_start", (2 * (pencil_np1 + 1) + 2 * (pencil_np2 + 1) + 4 * np_max) * sizeof(int));
+  pencil_ky_start = pencil_x_start + (pencil_np1 + 1);
+  pencil_y_start = pencil_ky_start + (pencil_np1 + 1);
+  pencil_kz_start = pencil_y_start + (pencil_np2 + 1);
+  pencil_send_count = pencil_kz_start + (pencil_np2 + 1);
+  pencil_send_offset = pencil_send_count + np_max;
+  pencil_recv_count = pencil_send_offset + np_max;
+  pencil_recv_offset = pencil_recv_count + np_max;
+  for(i = 0; i <= pencil_np1; i++) {pencil_x_start[i] = pencil_ky_start[i] = (int) (((long long) PMGRID * i) / pencil_np1);}
+  for(i = 0; i <= pencil_np2; i++) {pencil_y_start[i] = (int) (((long long) PMGRID * i) / pencil_np2); pencil_kz_start[i] = (int) (((long long) PMGRIDZ * i) / pencil_np2);}
+  for(i = 0; i < pencil_np1; i++) {for(d = pencil_x_start[i]; d < pencil_x_start[i + 1]; d++) {x_to_pencil[d] = i;}}
+  for(i = 0; i < pencil_np2; i++) {for(d = pencil_y_start[i]; d < pencil_y_start[i + 1]; d++) {y_to_pencil[d] = i;}}
+
+  first_cell_of_task = (large_array_offset *) mymalloc("first_cell_of_task", (NTask + 1) * sizeof(large_array_offset));
+  for(i = 0, first_cell_of_task[0] = 0; i < NTask; i++)
+    first_cell_of_task[i + 1] = first_cell_of_task[i] + ((large_array_offset) (pencil_x_start[i / pencil_np2 + 1] - pencil_x_start[i / pencil_np2]))
+      * (pencil_y_start[i % pencil_np2 + 1] - pencil_y_start[i % pencil_np2]) * PMGRID;
+
+  pencil_nx = pencil_x_start[pencil_p1 + 1] - pencil_x_start[pencil_p1];
+  pencil_nky = pencil_ky_start[pencil_p1 + 1] - pencil_ky_start[pencil_p1];
+  pencil_ny = pencil_y_start[pencil_p2 + 1] - pencil_y_start[pencil_p2];
+  pencil_nkz = pencil_kz_start[pencil_p2 + 1] - pencil_kz_start[pencil_p2];
+
+  pencil_nreal = (size_t) pencil_nx * pencil_ny * PMGRID;
+  n_zlines = (size_t) pencil_nx * pencil_ny * PMGRIDZ;
+  n_ylines = (size_t) pencil_nx * pencil_nkz * PMGRID;
+  pencil_nxlines = (size_t) pencil_nkz * pencil_nky * PMGRID;
+  pencil_ncomplex = n_zlines;
+  if(n_ylines > pencil_ncomplex) {pencil_ncomplex = n_ylines;}
+  if(pencil_nxlines > pencil_ncomplex) {pencil_ncomplex = pencil_nxlines;}
+
+  to_slab_fac = PMGRID / All.BoxSize;
+
+  /* the plans are created for arrays obtained from mymalloc, and executed on other arrays from it with the same (MIN_ALIGNMENT)
+     alignment through the new-array execute functions. With FFTW_ESTIMATE, planning does not touch the arrays. */
+  plan_real = (fftw_real *) mymalloc("plan_real", pencil_nreal * sizeof(fftw_real));
+  plan_complex = (fftw_complex *) mymalloc("plan_complex", pencil_ncomplex * sizeof(fftw_complex));
+
+  fft_forward_z = fftw_plan_many_dft_r2c(1, n, pencil_nx * pencil_ny, plan_real, NULL, 1, PMGRID, plan_complex, NULL, 1, PMGRIDZ, FFTW_ESTIMATE);
+  fft_inverse_z = fftw_plan_many_dft_c2r(1, n, pencil_nx * pencil_ny, plan_complex, NULL, 1, PMGRIDZ, plan_real, NULL, 1, PMGRID, FFTW_ESTIMATE);
+  fft_forward_y = fftw_plan_many_dft(1, n, pencil_nx * pencil_nkz, plan_complex, NULL, 1, PMGRID, plan_complex, NULL, 1, PMGRID, FFTW_FORWARD, FFTW_ESTIMATE);
+  fft_inverse_y = fftw_plan_many_dft(1, n, pencil_nx * pencil_nkz, plan_complex, NULL, 1, PMGRID, plan_complex, NULL, 1, PMGRID, FFTW_BACKWARD, FFTW_ESTIMATE);
+  fft_forward_x = fftw_plan_many_dft(1, n, pencil_nkz * pencil_nky, plan_complex, NULL, 1, PMGRID, plan_complex, NULL, 1, PMGRID, FFTW_FORWARD, FFTW_ESTIMATE);
+  fft_inverse_x = fftw_plan_many_dft(1, n, pencil_nkz * pencil_nky, plan_complex, NULL, 1, PMGRID, plan_complex, NULL, 1, PMGRID, FFTW_BACKWARD, FFTW_ESTIMATE);
+
+  myfree(plan_complex);
+  myfree(plan_real);
+
+  if(ThisTask == 0)
+    printf("PM_PENCIL_FFT: periodic PMGRID=%d mesh decomposed into %d x %d pencils (%g MB of mesh per task)\n", PMGRID, pencil_np1, pencil_np2,
+           (pencil_nreal * sizeof(fftw_real) + (2 * pencil_ncomplex + pencil_nxlines) * sizeof(fftw_complex)) / (1024.0 * 1024.0));
+}
+
+
+/*! This function allocates the memory needed to compute the long-range PM force: the local pencils of the mesh (density,
+ *  then potential and force components), two complex work arrays for the transforms (the first of which ends up holding
+ *  the transformed field), the transformed potential, and the particle-mesh lists.
+ */
+void pm_init_periodic_allocate(void)
+{
+  double bytes_tot = 0;
+  size_t bytes;
+
+  if(!(rhogrid = (fftw_real *) mymalloc("rhogrid", bytes = pencil_nreal * sizeof(fftw_real))))
+    {
+      printf("failed to allocate memory for `FFT-rhogrid' (%g MB).\n", bytes / (1024.0 * 1024.0));
+      endrun(1);
+    }
+  bytes_tot += bytes;
+
+  if(!(fft_of_rhogrid = (fftw_complex *) mymalloc("fft_of_rhogrid", bytes = pencil_ncomplex * sizeof(fftw_complex))))
+    {
+      printf("failed to allocate memory for `FFT-fft_of_rhogrid' (%g MB).\n", bytes / (1024.0 * 1024.0));
+      endrun(1);
+    }
+  bytes_tot += bytes;
+
+  if(!(workspace = (fftw_complex *) mymalloc("workspace", bytes = pencil_ncomplex * sizeof(fftw_complex))))
+    {
+      printf("failed to allocate memory for `FFT-workspace' (%g MB).\n", bytes / (1024.0 * 1024.0));
+      endrun(1);
+    }
+  bytes_tot += bytes;
+
+  if(!(fft_of_potential = (fftw_complex *) mymalloc("fft_of_potential", bytes = pencil_nxlines * sizeof(fftw_complex))))
+    {
+      printf("failed to allocate memory for `FFT-fft_of_potential' (%g MB).\n", bytes / (1024.0 * 1024.0));
+      endrun(1);
+    }
+  bytes_tot += bytes;
+
+  if(!(part = (struct part_slab_data *) mymalloc("part", bytes = PM_STENCIL * NumPart * sizeof(struct part_slab_data))))
+    {
+      printf("failed to allocate memory for `part' (%g MB).\n", bytes / (1024.0 * 1024.0));
+      endrun(1);
+    }
+  bytes_tot += bytes;
+
+  if(!(part_sortindex = (int *) mymalloc("part_sortindex", bytes = PM_STENCIL * NumPart * sizeof(int))))
+    {
+      printf("failed to allocate memory for `part_sortindex' (%g MB).\n", bytes / (1024.0 * 1024.0));
+      endrun(1);
+    }
+  bytes_tot += bytes;
+
+#ifdef OPENMP_PM
+  if(!(part_weight = (fftw_real *) mymalloc("part_weight", bytes = PM_STENCIL * NumPart * sizeof(fftw_real))))
+    {
+      printf("failed to allocate memory for `part_weight' (%g MB).\n", bytes / (1024.0 * 1024.0));
+      endrun(1);
+    }
+  bytes_tot += bytes;
+#endif
+
+  if(ThisTask == 0)
+    printf(" ..using %g MByte for periodic FFT computation. (presently allocated=%g MB)\n",
+	   bytes_tot / (1024.0 * 1024.0), AllocatedBytes / (1024.0 * 1024.0));
+}
+
+
+/*! This routine frees the space allocated for the parallel FFT algorithm.
+ */
+void pm_init_periodic_free(void)
+{
+#ifdef OPENMP_PM
+  myfree(part_weight);
+#endif
+  myfree(part_sortindex);
+  myfree(part);
+  myfree(fft_of_potential);
+  myfree(workspace);
+  myfree(fft_of_rhogrid);
+  myfree(rhogrid);
+}
+
+
+/*! transposes the complex mesh between the z-lines and the y-lines layout within the row of the task grid (all tasks of
+ *  which hold the same x-range): forward, each task sends the kz-range of the receiving task of all its y; backward, the
+ *  reverse. The data exchanged between two tasks is ordered by (x, y, kz). src is overwritten, the result is in dst.
+ */
+static void pm_pencil_transpose_yz(fftw_complex *src, fftw_complex *dst, int backward)
+{
+  int q, x, y, kz;
+  size_t n;
+
+  for(q = 0, n = 0; q < pencil_np2; q++) /* pack the data going to each task of the row */
+    {
+      pencil_send_offset[q] = (int) (2 * n);
+      for(x = 0; x < pencil_nx; x++)
+        {
+          if(backward) {for(y = pencil_y_start[q]; y < pencil_y_start[q + 1]; y++) for(kz = 0; kz < pencil_nkz; kz++, n++) PENCIL_COPY(dst[n], src[PENCIL_INDEX_Y(x, kz, y)]);}
+          else {for(y = 0; y < pencil_ny; y++) for(kz = pencil_kz_start[q]; kz < pencil_kz_start[q + 1]; kz++, n++) PENCIL_COPY(dst[n], src[PENCIL_INDEX_Z(x, y, kz)]);}
+        }
+      pencil_send_count[q] = (int) (2 * n) - pencil_send_offset[q];
+    }
+  for(q = 0, n = 0; q < pencil_np2; q++)
+    {
+      pencil_recv_offset[q] = (int) (2 * n);
+      if(backward) {n += (size_t) pencil_nx * pencil_ny * (pencil_kz_start[q + 1] - pencil_kz_start[q]);}
+      else {n += (size_t) pencil_nx * (pencil_y_start[q + 1] - pencil_y_start[q]) * pencil_nkz;}
+      pencil_recv_count[q] = (int) (2 * n) - pencil_recv_offset[q];
+    }
+
+  MPI_Alltoallv(dst, pencil_send_count, pencil_send_offset, MPI_TYPE_FFTW, src, pencil_recv_count, pencil_recv_offset, MPI_TYPE_FFTW, pencil_comm_row);
+
+  for(q = 0, n = 0; q < pencil_np2; q++) /* unpack the data received from each task of the row */
+    for(x = 0; x < pencil_nx; x++)
+      {
+        if(backward) {for(y = 0; y < pencil_ny; y++) for(kz = pencil_kz_start[q]; kz < pencil_kz_start[q + 1]; kz++, n++) PENCIL_COPY(dst[PENCIL_INDEX_Z(x, y, kz)], src[n]);}
+        else {for(y = pencil_y_start[q]; y < pencil_y_start[q + 1]; y++) for(kz = 0; kz < pencil_nkz; kz++, n++) PENCIL_COPY(dst[PENCIL_INDEX_Y(x, kz, y)], src[n]);}
+      }
+}
+
+
+/*! transposes the complex mesh between the y-lines and the x-lines layout within the column of the task grid (all tasks of
+ *  which hold the same kz-range): forward, each task sends the ky-range of the receiving task of all its x; backward, the
+ *  reverse. The data exchanged between two tasks is ordered by (x, kz, ky). src is overwritten, the result is in dst.
+ */
+static void pm_pencil_transpose_xy(fftw_complex *src, fftw_complex *dst, int backward)
+{
+  int q, x, ky, kz;
+  size_t n;
+
+  for(q = 0, n = 0; q < pencil_np1; q++) /* pack the data going to each task of the column */
+    {
+      pencil_send_offset[q] = (int) (2 * n);
+      if(backward) {for(x = pencil_x_start[q]; x < pencil_x_start[q + 1]; x++) for(kz = 0; kz < pencil_nkz; kz++) for(ky = 0; ky < pencil_nky; ky++, n++) PENCIL_COPY(dst[n], src[PENCIL_INDEX_X(kz, ky, x)]);}
+      else {for(x = 0; x < pencil_nx; x++) for(kz = 0; kz < pencil_nkz; kz++) for(ky = pencil_ky_start[q]; ky < pencil_ky_start[q + 1]; ky++, n++) PENCIL_COPY(dst[n], src[PENCIL_INDEX_Y(x, kz, ky)]);}
+      pencil_send_count[q] = (int) (2 * n) - pencil_send_offset[q];
+    }
+  for(q = 0, n = 0; q < pencil_np1; q++)
+    {
+      pencil_recv_offset[q] = (int) (2 * n);
+      if(backward) {n += (size_t) pencil_nx * pencil_nkz * (pencil_ky_start[q + 1] - pencil_ky_start[q]);}
+      else {n += (size_t) (pencil_x_start[q + 1] - pencil_x_start[q]) * pencil_nkz * pencil_nky;}
+      pencil_recv_count[q] = (int) (2 * n) - pencil_recv_offset[q];
+    }
+
+  MPI_Alltoallv(dst, pencil_send_count, pencil_send_offset, MPI_TYPE_FFTW, src, pencil_recv_count, pencil_recv_offset, MPI_TYPE_FFTW, pencil_comm_col);
+
+  for(q = 0, n = 0; q < pencil_np1; q++) /* unpack the data received from each task of the column */
+    {
+      if(backward) {for(x = 0; x < pencil_nx; x++) for(kz = 0; kz < pencil_nkz; kz++) for(ky = pencil_ky_start[q]; ky < pencil_ky_start[q + 1]; ky++, n++) PENCIL_COPY(dst[PENCIL_INDEX_Y(x, kz, ky)], src[n]);}
+      else {for(x = pencil_x_start[q]; x < pencil_x_start[q + 1]; x++) for(kz = 0; kz < pencil_nkz; kz++) for(ky = 0; ky < pencil_nky; ky++, n++) PENCIL_COPY(dst[PENCIL_INDEX_X(kz, ky, x)], src[n]);}
+    }
+}
+
+
+/*! forward real-to-complex transform of the local pencils of field: the result (in the x-lines layout) is in fk, both fk
+ *  and work (of size pencil_ncomplex) are overwritten */
+static void pm_pencil_fft_forward(fftw_real *field, fftw_complex *fk, fftw_complex *work)
+{
+  fftw_execute_dft_r2c(fft_forward_z, field, fk);
+  pm_pencil_transpose_yz(fk, work, 0);
+  fftw_execute_dft(fft_forward_y, work, work);
+  pm_pencil_transpose_xy(work, fk, 0);
+  fftw_execute_dft(fft_forward_x, fk, fk);
+}
+
+
+/*! inverse (complex-to-real) transform of fk (in the x-lines layout) to the local pencils of field: fk and work are overwritten */
+static void pm_pencil_fft_inverse(fftw_complex *fk, fftw_complex *work, fftw_real *field)
+{
+  fftw_execute_dft(fft_inverse_x, fk, fk);
+  pm_pencil_transpose_xy(fk, work, 1);
+  fftw_execute_dft(fft_inverse_y, work, work);
+  pm_pencil_transpose_yz(work, fk, 1);
+  fftw_execute_dft_c2r(fft_inverse_z, fk, field);
+}
+
+
+/*! multiplies the transformed density fk with the Green's function of the (Gaussian-smoothed) potential, times fac, and
+ *  deconvolves the mass-assignment and interpolation kernel. For DM_SCALARFIELD_SCREENING, phase=1 is the screened scalar field.
+ */
+static void pm_pencil_greens_function(fftw_complex *fk, double fac, int phase)
+{
+  int x, y, z;
+  size_t ip;
+  double kx, ky, kz, k2, smth, fx, fy, fz, asmth2;
+#ifdef DM_SCALARFIELD_SCREENING
+  double kscreening2 = pow(All.BoxSize / All.ScalarScreeningLength / (2 * M_PI), 2);
+#endif
+
+  asmth2 = (2 * M_PI) * All.Asmth[0] / All.BoxSize;
+  asmth2 *= asmth2;
+
+  for(z = 0; z < pencil_nkz; z++)
+    for(y = 0; y < pencil_nky; y++)
+      for(x = 0; x < PMGRID; x++)
+        {
+          kx = (x > PMGRID / 2) ? x - PMGRID : x;
+          ky = pencil_ky_start[pencil_p1] + y; if(ky > PMGRID / 2) {ky -= PMGRID;}
+          kz = pencil_kz_start[pencil_p2] + z; /* kz <= PMGRID/2 for the real-to-complex transform */
+          k2 = kx * kx + ky * ky + kz * kz;
+          ip = PENCIL_INDEX_X(z, y, x);
+
+          if(k2 <= 0) {cmplx_re(fk[ip]) = cmplx_im(fk[ip]) = 0.0; continue;} /* the mean density does not source the potential */
+
+#ifdef DM_SCALARFIELD_SCREENING
+          if(phase == 1)
+            smth = -All.ScalarBeta * exp(-k2 * asmth2) / (k2 + kscreening2) * fac;
+          else
+#endif
+            smth = -exp(-k2 * asmth2) / k2 * fac;
+
+          /* do deconvolution */
+          fx = fy = fz = 1;
+          if(kx != 0) {fx = (M_PI * kx) / PMGRID; fx = sin(fx) / fx;}
+          if(ky != 0) {fy = (M_PI * ky) / PMGRID; fy = sin(fy) / fy;}
+          if(kz != 0) {fz = (M_PI * kz) / PMGRID; fz = sin(fz) / fz;}
+          smth *= pm_periodic_deconvolution(1 / (fx * fy * fz));
+
+          cmplx_re(fk[ip]) *= smth;
+          cmplx_im(fk[ip]) *= smth;
+        }
+}
+
+
+/*! sets fk to the transform of the 4-point finite difference of the potential (with transform phik) along dimension dim,
+ *  times fac: fac * ((4/3) (phi[i-1] - phi[i+1]) - (1/6) (phi[i-2] - phi[i+2])) in real space is a multiplication with
+ *  -2 i fac ((4/3) sin(theta) - (1/6) sin(2 theta)), theta = 2 pi k / PMGRID, in k-space
+ */
+static void pm_pencil_force_transfer(fftw_complex *phik, fftw_complex *fk, int dim, double fac)
+{
+  int x, y, z, k = 0;
+  size_t ip;
+  double theta, d, re, im;
+
+  for(z = 0; z < pencil_nkz; z++)
+    for(y = 0; y < pencil_nky; y++)
+      for(x = 0; x < PMGRID; x++)
+        {
+          switch(dim)
+            {
+              case 0: k = x; break;
+              case 1: k = pencil_ky_start[pencil_p1] + y; break;
+              case 2: k = pencil_kz_start[pencil_p2] + z; break;
+            }
+          theta = 2 * M_PI * k / PMGRID;
+          d = 2 * fac * ((4.0 / 3) * sin(theta) - (1.0 / 6) * sin(2 * theta));
+          ip = PENCIL_INDEX_X(z, y, x);
+          re = cmplx_re(phik[ip]);
+          im = cmplx_im(phik[ip]);
+          cmplx_re(fk[ip]) = d * im;
+          cmplx_im(fk[ip]) = -d * re;
+        }
+}
+
+
+/*! determines the mesh points each local particle is assigned to, sends the list of these points to the tasks holding them
+ *  (which is kept for the read-out), and deposits the particle masses on the pencils: on return, rhogrid holds the local
+ *  part of the density field. For DM_SCALARFIELD_SCREENING, phase=1 only bins the non-gas particles.
+ */
+static void pm_pencil_assign_density(int phase)
+{
+  int i, j, st, task, pindex;
+  size_t ip;
+  double st_weight[PM_STENCIL];
+  large_array_offset st_offset[PM_STENCIL];
+
+#ifdef OPENMP_PM
+  /* particle i fills the slots PM_STENCIL*i ... PM_STENCIL*(i+1)-1 of part[] (see pm_omp_binning.h) */
+  int n_on = 0;
+#ifdef _OPENMP
+#pragma omp parallel for private(i, st, st_offset, st_weight) reduction(+:n_on) schedule(static)
+#endif
+  for(i = 0; i < NumPart; i++)
+    {
+      int on = 1;
+#ifdef DM_SCALARFIELD_SCREENING
+      if(phase == 1)
+        if(P[i].Type == 0)	/* don't bin baryonic mass in this phase */
+          on = 0;
+#endif
+      if(on) {pm_periodic_stencil(P[i].Pos, to_slab_fac, st_offset, st_weight); n_on++;}
+      for(st = 0; st < PM_STENCIL; st++)
+        {
+          part[i * PM_STENCIL + st].partindex = on ? i * PM_STENCIL + st : -1;
+          part[i * PM_STENCIL + st].globalindex = on ? pm_pencil_cell(st_offset[st]) : first_cell_of_task[NTask]; /* beyond the last mesh point */
+          part_weight[i * PM_STENCIL + st] = (on && P[i].Mass > 0) ? pm_grid_weight * P[i].Mass * st_weight[st] : 0;
+          part_sortindex[i * PM_STENCIL + st] = i * PM_STENCIL + st;
+        }
+    }
+  num_on_grid = n_on * PM_STENCIL;
+#else
+  for(i = 0, num_on_grid = 0; i < NumPart; i++)
+    {
+#ifdef DM_SCALARFIELD_SCREENING
+      if(phase == 1)
+        if(P[i].Type == 0)	/* don't bin baryonic mass in this phase */
+          continue;
+#endif
+      pm_periodic_stencil(P[i].Pos, to_slab_fac, st_offset, st_weight);
+      for(st = 0; st < PM_STENCIL; st++)
+        {
+          part[num_on_grid].partindex = i * PM_STENCIL + st;
+          part[num_on_grid].globalindex = pm_pencil_cell(st_offset[st]);
+          part_sortindex[num_on_grid] = num_on_grid;
+          num_on_grid++;
+        }
+    }
+#endif
+
+  /* bring the part-field into the order of the accessed cells (which is also the order of the tasks holding them). This allows the removal of duplicates */
+#if defined(OPENMP_PM)
+  pm_omp_sort_part(PM_STENCIL * NumPart);
+#elif defined(MYSORT)
+  mysort_pmperiodic(part_sortindex, num_on_grid, sizeof(int), pm_periodic_compare_sortindex);
+#else
+  qsort(part_sortindex, num_on_grid, sizeof(int), pm_periodic_compare_sortindex);
+#endif
+
+  for(i = 0, num_field_points = 0; i < num_on_grid; i++)
+    if(i == 0 || part[part_sortindex[i]].globalindex != part[part_sortindex[i - 1]].globalindex)
+      num_field_points++;
+
+  localfield_globalindex = (large_array_offset *) mymalloc("localfield_globalindex", num_field_points * sizeof(large_array_offset));
+  localfield_data = (fftw_real *) mymalloc("localfield_data", num_field_points * sizeof(fftw_real));
+  localfield_count = (int *) mymalloc("localfield_count", 4 * NTask * sizeof(int));
+  localfield_offset = localfield_count + NTask;
+  import_count = localfield_count + 2 * NTask;
+  import_offset = localfield_count + 3 * NTask;
+
+  /* establish the cross link between the part[] array and the local list of mesh points, and count how many of them are on each task */
+  for(i = 0; i < NTask; i++)
+    localfield_count[i] = 0;
+  for(i = 0, j = -1, task = 0; i < num_on_grid; i++)
+    {
+      if(i == 0 || part[part_sortindex[i]].globalindex != part[part_sortindex[i - 1]].globalindex)
+        {
+          localfield_globalindex[++j] = part[part_sortindex[i]].globalindex;
+          while(localfield_globalindex[j] >= first_cell_of_task[task + 1])
+            task++;
+          localfield_count[task]++;
+        }
+      part[part_sortindex[i]].localindex = j;
+    }
+
+  MPI_Alltoall(localfield_count, 1, MPI_INT, import_count, 1, MPI_INT, MPI_COMM_WORLD);
+  for(i = 1, localfield_offset[0] = import_offset[0] = 0; i < NTask; i++)
+    {
+      localfield_offset[i] = localfield_offset[i - 1] + localfield_count[i - 1];
+      import_offset[i] = import_offset[i - 1] + import_count[i - 1];
+    }
+  num_import = import_offset[NTask - 1] + import_count[NTask - 1];
+
+  import_globalindex = (large_array_offset *) mymalloc("import_globalindex", num_import * sizeof(large_array_offset));
+  import_data = (fftw_real *) mymalloc("import_data", num_import * sizeof(fftw_real));
+
+  MPI_Alltoallv(localfield_globalindex, localfield_count, localfield_offset, MPI_TYPE_LARGE_ARRAY_OFFSET,
+                import_globalindex, import_count, import_offset, MPI_TYPE_LARGE_ARRAY_OFFSET, MPI_COMM_WORLD);
+
+  /* now bin the local particle data onto the mesh list */
+  for(i = 0; i < num_field_points; i++)
+    localfield_data[i] = 0;
+
+#ifdef OPENMP_PM
+  pm_omp_deposit(localfield_data, part_weight, num_on_grid);
+#else
+  for(i = 0; i < num_on_grid; i += PM_STENCIL)
+    {
+      pindex = part[i].partindex / PM_STENCIL;
+      if(P[pindex].Mass <= 0) continue;
+      pm_periodic_stencil(P[pindex].Pos, to_slab_fac, 0, st_weight);
+      for(st = 0; st < PM_STENCIL; st++)
+        localfield_data[part[i + st].localindex] += pm_grid_weight * P[pindex].Mass * st_weight[st];
+    }
+#endif
+
+  /* exchange data and add contributions to the local pencils */
+  MPI_Alltoallv(localfield_data, localfield_count, localfield_offset, MPI_TYPE_FFTW,
+                import_data, import_count, import_offset, MPI_TYPE_FFTW, MPI_COMM_WORLD);
+
+  for(ip = 0; ip < pencil_nreal; ip++)
+    rhogrid[ip] = 0;
+
+  for(i = 0; i < num_import; i++)
+    rhogrid[import_globalindex[i] - first_cell_of_task[ThisTask]] += import_data[i];
+}
+
+
+/*! collects the values of the field on the local pencils at all mesh points the local particles need (into localfield_data) */
+static void pm_pencil_gather(fftw_real *field)
+{
+  int i;
+
+  for(i = 0; i < num_import; i++)
+    import_data[i] = field[import_globalindex[i] - first_cell_of_task[ThisTask]];
+
+  MPI_Alltoallv(import_data, import_count, import_offset, MPI_TYPE_FFTW,
+                localfield_data, localfield_count, localfield_offset, MPI_TYPE_FFTW, MPI_COMM_WORLD);
+}
+
+
+/*! interpolates the field collected by pm_pencil_gather to the position of the particle i. j is the running index of the
+ *  particles' entries in part[], so the particles must be visited in order (with OPENMP_PM, the entries of particle i are
+ *  at a fixed place, so j is only set here, and the particles can be visited in any order). */
+static double pm_pencil_interpolate(int i, int *j)
+{
+  int st;
+  double value, st_weight[PM_STENCIL];
+
+#ifdef OPENMP_PM
+  *j = i * PM_STENCIL;
+#else
+  while(*j < num_on_grid && part[*j].partindex / PM_STENCIL != i)
+    (*j)++;
+#endif
+
+  pm_periodic_stencil(P[i].Pos, to_slab_fac, 0, st_weight);
+  for(st = 0, value = 0; st < PM_STENCIL; st++)
+    value += localfield_data[part[*j + st].localindex] * st_weight[st];
+
+  return value;
+}
+
+
+static void pm_pencil_free_localfield(void)
+{
+  myfree(import_data);
+  myfree(import_globalindex);
+  myfree(localfield_count);
+  myfree(localfield_data);
+  myfree(localfield_globalindex);
+}
+
+
+/*! Calculates the long-range periodic force given the particle positions using the PM method, on the pencil-decomposed
+ *  mesh. Apart from the decomposition (and the differencing, done in k-space), this is the same calculation as in
+ *  pm_periodic.c. Only the ordinary force calculation (mode=0) is supported: the power spectra need the slab routines.
+ */
+void pmforce_periodic(int mode, int *typelist)
+{
+  int i, j, dim, phase = 0;
+  double fac;
+
+  if(mode != 0)
+    {
+      if(ThisTask == 0) {printf("PM_PENCIL_FFT: the PM power spectrum (pmforce_periodic mode=%d) is only available with the slab decomposition\n", mode);}
+      endrun(1);
+    }
+#ifdef PM_INTERLACE
+  if(pm_grid_weight == 1) {PM_INTERLACED_CALL(pmforce_periodic(mode, typelist)); return;}
+#endif
+
+  PRINT_STATUS("Starting periodic PM calculation (pencil decomposition).  (presently allocated=%g MB)", AllocatedBytes / (1024.0 * 1024.0));
+
+  fac = All.G / (M_PI * All.BoxSize);	/* to get potential */
+  fac *= 1 / (2 * All.BoxSize / PMGRID);	/* for finite differencing */
+
+  pm_init_periodic_allocate();
+
+#ifdef DM_SCALARFIELD_SCREENING
+  for(phase = 0; phase < 2; phase++)
+#endif
+    {
+      pm_pencil_assign_density(phase);
+
+      report_memory_usage(&HighMark_pmperiodic, "PM_PERIODIC");
+
+      /* Do the FFT of the density field, and multiply with Green's function for the potential */
+      pm_pencil_fft_forward(rhogrid, fft_of_rhogrid, workspace);
+      pm_pencil_greens_function(fft_of_rhogrid, 1, phase);
+      memcpy(fft_of_potential, fft_of_rhogrid, pencil_nxlines * sizeof(fftw_complex));
+
+#ifdef EVALPOTENTIAL		/* now read out the potential */
+      pm_pencil_fft_inverse(fft_of_rhogrid, workspace, rhogrid);
+      pm_pencil_gather(rhogrid);
+      j = 0;
+#if defined(OPENMP_PM) && defined(_OPENMP)
+#pragma omp parallel for firstprivate(j) schedule(static)
+#endif
+      for(i = 0; i < NumPart; i++)
+        {
+#ifdef DM_SCALARFIELD_SCREENING
+          if(phase == 1)
+            if(P[i].Type == 0)	/* baryons were not binned in this phase */
+              continue;
+#endif
+          P[i].PM_Potential += pm_pencil_interpolate(i, &j) * fac * (2 * All.BoxSize / PMGRID); /* compensate the finite differencing factor */
+        }
+#endif
+
+      /* get the force components by differencing the potential for each dimension, and send back the results to the right CPUs */
+      for(dim = 0; dim < 3; dim++)
+        {
+          pm_pencil_force_transfer(fft_of_potential, fft_of_rhogrid, dim, fac);
+          pm_pencil_fft_inverse(fft_of_rhogrid, workspace, rhogrid);
+          pm_pencil_gather(rhogrid);
+
+          /* read out the forces, which all have been assembled in localfield_data */
+          j = 0;
+#if defined(OPENMP_PM) && defined(_OPENMP)
+#pragma omp parallel for firstprivate(j) schedule(static)
+#endif
+          for(i = 0; i < NumPart; i++)
+            {
+#ifdef DM_SCALARFIELD_SCREENING
+              if(phase == 1)
+                if(P[i].Type == 0)	/* baryons don't get an extra scalar force */
+                  continue;
+#endif
+              P[i].GravPM[dim] += pm_pencil_interpolate(i, &j);
+            }
+        }
+
+      pm_pencil_free_localfield();
+    }
+
+  pm_init_periodic_free();
+}
+
+
+/*! Calculates the long-range potential using the PM method on the pencil-decomposed mesh (see pmforce_periodic).
+ */
+void pmpotential_periodic(void)
+{
+  int i, j;
+  double fac, pot;
+
+#ifdef PM_INTERLACE
+  if(pm_grid_weight == 1) {PM_INTERLACED_CALL(pmpotential_periodic()); return;}
+#endif
+
+  PRINT_STATUS("Starting periodic PM-potential calculation (pencil decomposition).  (presently allocated=%g MB)", AllocatedBytes / (1024.0 * 1024.0));
+
+  fac = All.G / (M_PI * All.BoxSize);	/* to get potential */
+
+  pm_init_periodic_allocate();
+
+  pm_pencil_assign_density(0);
+
+  report_memory_usage(&HighMark_pmperiodic, "PM_PERIODIC_POTENTIAL");
+
+  pm_pencil_fft_forward(rhogrid, fft_of_rhogrid, workspace);
+  pm_pencil_greens_function(fft_of_rhogrid, fac, 0);
+  pm_pencil_fft_inverse(fft_of_rhogrid, workspace, rhogrid);
+  pm_pencil_gather(rhogrid);
+
+  /* read out the potential values, which all have been assembled in localfield_data */
+  j = 0;
+#if defined(OPENMP_PM) && defined(_OPENMP)
+#pragma omp parallel for firstprivate(j) private(pot) schedule(static)
+#endif
+  for(i = 0; i < NumPart; i++)
+    {
+      pot = pm_pencil_interpolate(i, &j);
+#if defined(EVALPOTENTIAL) || defined(COMPUTE_POTENTIAL_ENERGY) || defined(OUTPUT_POTENTIAL)
+      P[i].Potential += pot;
+#endif
+    }
+
+  pm_pencil_free_localfield();
+  pm_init_periodic_free();
+  PRINT_STATUS(" ..done PM-Potential");
+}
+
+
+
+int pm_periodic_compare_sortindex(const void *a, const void *b)
+{
+  if(part[*(int *) a].globalindex < part[*(int *) b].globalindex) {return -1;}
+  if(part[*(int *) a].globalindex > part[*(int *) b].globalindex) {return +1;}
+  return 0;
+}
+
+static void msort_pmperiodic_with_tmp(int *b, size_t n, int *t)
+{
+  int *tmp;
+  int *b1, *b2;
+  size_t n1, n2;
+
+  if(n <= 1)
+    return;
+
+  n1 = n / 2;
+  n2 = n - n1;
+  b1 = b;
+  b2 = b + n1;
+
+  msort_pmperiodic_with_tmp(b1, n1, t);
+  msort_pmperiodic_with_tmp(b2, n2, t);
+
+  tmp = t;
+
+  while(n1 > 0 && n2 > 0)
+    {
+      if(part[*b1].globalindex <= part[*b2].globalindex)
+	{
+	  --n1;
+	  *tmp++ = *b1++;
+	}
+      else
+	{
+	  --n2;
+	  *tmp++ = *b2++;
+	}
+    }
+
+  if(n1 > 0)
+    memcpy(tmp, b1, n1 * sizeof(int));
+
+  memcpy(b, t, (n - n2) * sizeof(int));
+}
+
+void mysort_pmperiodic(void *b, size_t n, size_t s, int (*cmp) (const void *, const void *))
+{
+  const size_t size = n * s;
+
+  int *tmp = (int *) mymalloc("int *tmp", size);
+
+  msort_pmperiodic_with_tmp((int *) b, n, tmp);
+
+  myfree(tmp);
+}
+
+#endif
+#endif
@@ -264,6 +264,9 @@ void density_evaluate_extra_physics_gas(struct INPUT_STRUCT_NAME *local, struct
 int density_evaluate(int target, int mode, int *exportflag, int *exportnodecount, int *exportindex, int *ngblist, int loop_iteration)
 {
     int j, n, startnode, numngb_inbox, listindex = 0; double r2, h2, u, mass_j, wk;
+#ifdef HYDRO_KERNEL_SIMD
+    int n_0, n_tile, k_tile, j_tile[KERNEL_SIMD_TILE]; double dp_tile[3][KERNEL_SIMD_TILE], r2_tile[KERNEL_SIMD_TILE], r_tile[KERNEL_SIMD_TILE], wk_tile[KERNEL_SIMD_TILE], dwk_tile[KERNEL_SIMD_TILE];
+#endif
     struct kernel_density kernel; struct INPUT_STRUCT_NAME local; struct OUTPUT_STRUCT_NAME out; memset(&out, 0, sizeof(struct OUTPUT_STRUCT_NAME));
     if(mode == 0) {hydrokerneldensity_particle2in(&local, target, loop_iteration);} else {local = DATAGET_NAME[target];}
     h2 = local.Hsml * local.Hsml; kernel_hinv(local.Hsml, &kernel.hinv, &kernel.hinv3, &kernel.hinv4);
@@ -278,6 +281,36 @@ int density_evaluate(int target, int mode, int *exportflag, int *exportnodecount
         while(startnode >= 0) {
             numngb_inbox = ngb_treefind_variable_threads(local.Pos, local.Hsml, target, &startnode, mode, exportflag, exportnodecount, exportindex, ngblist);
             if(numngb_inbox < 0) {return -2;}
+#ifdef HYDRO_KERNEL_SIMD
+            for(n_0 = 0; n_0 < numngb_inbox; n_0 += KERNEL_SIMD_TILE) /* process the neighbors in tiles, with separations and kernels evaluated in SIMD lanes */
+            {
+                for(n = n_0, n_tile = 0; n < IMIN(n_0 + KERNEL_SIMD_TILE, numngb_inbox); n++) /* gather the valid neighbors */
+                {
+                    j = ngblist[n]; /* since we use the -threaded- version above of ngb-finding, its super-important this is the lower-case ngblist here! */
+#ifdef GALSF_SUBGRID_WINDS /* check if partner is a wind particle: if I'm not wind, then ignore the wind particle */
+                    if(SphP[j].DelayTime > 0) {if(!(local.DelayTime > 0)) {continue;}}
+#endif
+                    if(P[j].Mass <= 0) continue;
+                    j_tile[n_tile] = j; for(k_tile=0;k_tile<3;k_tile++) {dp_tile[k_tile][n_tile] = P[j].Pos[k_tile];}
+                    n_tile++;
+                }
+#pragma omp simd
+                for(k_tile = 0; k_tile < n_tile; k_tile++) /* separations, with the same operations as the scalar loop */
+                {
+                    double dx = local.Pos[0] - dp_tile[0][k_tile], dy = local.Pos[1] - dp_tile[1][k_tile], dz = local.Pos[2] - dp_tile[2][k_tile];
+                    NEAREST_XYZ(dx,dy,dz,1);
+                    dp_tile[0][k_tile] = dx; dp_tile[1][k_tile] = dy; dp_tile[2][k_tile] = dz;
+                    r2_tile[k_tile] = dx*dx + dy*dy + dz*dz; r_tile[k_tile] = sqrt(r2_tile[k_tile]);
+                }
+                kernel_main_tile(n_tile, r_tile, local.Hsml, kernel.hinv, kernel.hinv3, kernel.hinv4, wk_tile, dwk_tile);
+                for(k_tile = 0; k_tile < n_tile; k_tile++)
+                {
+                    if(!(r2_tile[k_tile] < h2)) {continue;} /* this loop is only considering particles inside local.Hsml, i.e. seen-by-main */
+                    j = j_tile[k_tile];
+                    kernel.dp[0] = dp_tile[0][k_tile]; kernel.dp[1] = dp_tile[1][k_tile]; kernel.dp[2] = dp_tile[2][k_tile];
+                    kernel.r = r_tile[k_tile]; kernel.wk = wk_tile[k_tile]; kernel.dwk = dwk_tile[k_tile];
+                    u = kernel.r * kernel.hinv;
+#else
             for(n = 0; n < numngb_inbox; n++)
             {
                 j = ngblist[n]; /* since we use the -threaded- version above of ngb-finding, its super-important this is the lower-case ngblist here! */
@@ -295,6 +328,7 @@ int density_evaluate(int target, int mode, int *exportflag, int *exportnodecount
                     kernel.r = sqrt(r2);
                     u = kernel.r * kernel.hinv;
                     kernel_main(u, kernel.hinv3, kernel.hinv4, &kernel.wk, &kernel.dwk, 0);
+#endif
                     mass_j = P[j].Mass;
                     kernel.mj_wk = FLT(mass_j * kernel.wk);
 
@@ -1090,7 +1124,11 @@ int cellcorrections_evaluate(int target, int mode, int *exportflag, int *exportn
     if(mode == 0) {startnode = All.MaxPart; /* root node */} else {startnode = DATAGET_NAME[target].NodeList[0]; startnode = Nodes[startnode].u.d.nextnode; /* open it */} /* start usual neighbor tree search */
     while(startnode >= 0) {
         while(startnode >= 0) {
+#ifdef HYDRO_NGBLIST_CACHE
+            numngb_inbox = ngb_treefind_pairs_threads_cached(local.Pos, local.Hsml, target, &startnode, mode, exportflag, exportnodecount, exportindex, ngblist);
+#else
             numngb_inbox = ngb_treefind_pairs_threads(local.Pos, local.Hsml, target, &startnode, mode, exportflag, exportnodecount, exportindex, ngblist);
+#endif
             if(numngb_inbox < 0) {return -2;}
             for(n=0; n<numngb_inbox; n++)
             {
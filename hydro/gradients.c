@@ -652,7 +652,7 @@ void hydro_gradient_calc(void)
             }
 
         // now we actually begin the main gradient loop //
-        NextParticle = FirstActiveParticle;	/* begin with this index */
+        NextParticle = ACTIVE_CURSOR_FIRST;	/* begin with this index */
         do
         {
             BufferFullFlag = 0; Nexport = 0; save_NextParticle = NextParticle; tstart = my_second();
@@ -685,8 +685,8 @@ void hydro_gradient_calc(void)
                 while(NextParticle >= 0)
                 {
                     if(NextParticle == last_nextparticle) {break;}
-                    if(ProcessedFlag[NextParticle] != 1) {break;}
-                    ProcessedFlag[NextParticle] = 2; NextParticle = NextActiveParticle[NextParticle];
+                    if(ProcessedFlag[ACTIVE_CURSOR_PARTICLE(NextParticle)] != 1) {break;}
+                    ProcessedFlag[ACTIVE_CURSOR_PARTICLE(NextParticle)] = 2; NextParticle = ACTIVE_CURSOR_NEXT(NextParticle);
                 }
                 if(NextParticle == save_NextParticle) {endrun(113308);} /* in this case, the buffer is too small to process even a single particle */
 
@@ -1731,12 +1731,20 @@ int GasGrad_evaluate(int target, int mode, int *exportflag, int *exportnodecount
         {
 #ifdef TURB_DIFF_DYNAMIC
             if (gradient_iteration == 0) {
+#ifdef HYDRO_NGBLIST_CACHE
+                numngb = ngb_treefind_pairs_threads_cached(local.Pos, All.TurbDynamicDiffFac * kernel.h_i, target, &startnode, mode, exportflag, exportnodecount, exportindex, ngblist);
+#else
                 numngb = ngb_treefind_pairs_threads(local.Pos, All.TurbDynamicDiffFac * kernel.h_i, target, &startnode, mode, exportflag, exportnodecount, exportindex, ngblist);
+#endif
             }
             else
 #endif
             {
+#ifdef HYDRO_NGBLIST_CACHE
+                numngb = ngb_treefind_pairs_threads_cached(local.Pos, kernel.h_i, target, &startnode, mode, exportflag, exportnodecount, exportindex, ngblist);
+#else
                 numngb = ngb_treefind_pairs_threads(local.Pos, kernel.h_i, target, &startnode, mode, exportflag, exportnodecount, exportindex, ngblist);
+#endif
             }
             if(numngb < 0) {return -2;}
 
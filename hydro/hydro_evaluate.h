@@ -21,8 +21,13 @@
 /* --------------------------------------------------------------------------------- */
 int hydro_force_evaluate(int target, int mode, int *exportflag, int *exportnodecount, int *exportindex, int *ngblist, int loop_iteration)
 {
-    int j, k, n, startnode, numngb, kernel_mode, listindex;
-    double hinv_i,hinv3_i,hinv4_i,hinv_j,hinv3_j,hinv4_j,V_i,V_j,dt_hydrostep_i,dt_hydrostep_j,dt_hydrostep,r2,rinv,rinv_soft,u,Particle_Size_i;
+    int j, k, n, startnode, numngb, listindex;
+    double hinv_i,hinv3_i,hinv4_i,V_i,V_j,dt_hydrostep_i,dt_hydrostep_j,dt_hydrostep,r2,rinv,rinv_soft,Particle_Size_i;
+#ifndef HYDRO_KERNEL_SIMD
+    int kernel_mode; double hinv_j,hinv3_j,hinv4_j,u; /* the batched kernel evaluations (always mode=0) compute their own inverse kernel lengths */
+#else
+    int n_tile=0, k_tile=0; double dp_tile[3][KERNEL_SIMD_TILE], r2_tile[KERNEL_SIMD_TILE], r_tile[KERNEL_SIMD_TILE], h_tile[KERNEL_SIMD_TILE], wk_i_tile[KERNEL_SIMD_TILE], dwk_i_tile[KERNEL_SIMD_TILE], wk_j_tile[KERNEL_SIMD_TILE], dwk_j_tile[KERNEL_SIMD_TILE];
+#endif
     double v_hll,k_hll,b_hll; v_hll=k_hll=0,b_hll=1;
     struct kernel_hydra kernel;
     struct INPUT_STRUCT_NAME local;
@@ -76,12 +81,14 @@ int hydro_force_evaluate(int target, int mode, int *exportflag, int *exportnodec
     kernel.spec_egy_u_i = local.InternalEnergyPred;
     kernel.h_i = local.Hsml;
     kernel_hinv(kernel.h_i, &hinv_i, &hinv3_i, &hinv4_i);
+#ifndef HYDRO_KERNEL_SIMD
     hinv_j=hinv3_j=hinv4_j=0;
+    kernel_mode = 0; /* need dwk and wk */
+#endif
     V_i = local.Mass / local.Density;
     Particle_Size_i = pow(V_i,1./NUMDIMS) * All.cf_atime; // in physical, used below in some routines //
     dt_hydrostep_i = local.Timestep * UNIT_INTEGERTIME_IN_PHYSICAL; /* (physical) timestep */
     out.MaxSignalVel = kernel.sound_i;
-    kernel_mode = 0; /* need dwk and wk */
     double cnumcrit2; cnumcrit2 = ((double)CONDITION_NUMBER_DANGER)*((double)CONDITION_NUMBER_DANGER) - local.ConditionNumber*local.ConditionNumber;
 #if defined(HYDRO_SPH)
 #ifdef HYDRO_PRESSURE_SPH
@@ -140,11 +147,33 @@ int hydro_force_evaluate(int target, int mode, int *exportflag, int *exportnodec
             /* --------------------------------------------------------------------------------- */
             /* get the neighbor list */
             /* --------------------------------------------------------------------------------- */
+#ifdef HYDRO_NGBLIST_CACHE
+            numngb = ngb_treefind_pairs_threads_cached(local.Pos, kernel.h_i, target, &startnode, mode, exportflag, exportnodecount, exportindex, ngblist);
+#else
             numngb = ngb_treefind_pairs_threads(local.Pos, kernel.h_i, target, &startnode, mode, exportflag, exportnodecount, exportindex, ngblist);
+#endif
             if(numngb < 0) {return -2;}
 
             for(n = 0; n < numngb; n++)
             {
+#ifdef HYDRO_KERNEL_SIMD
+                if(n % KERNEL_SIMD_TILE == 0) /* evaluate separations and both kernels for the next tile of neighbors in SIMD lanes (all of them, even those skipped below: this is cheaper than compacting) */
+                {
+                    n_tile = IMIN(KERNEL_SIMD_TILE, numngb - n);
+                    for(k_tile = 0; k_tile < n_tile; k_tile++) {j = ngblist[n + k_tile]; for(k=0;k<3;k++) {dp_tile[k][k_tile] = P[j].Pos[k];} h_tile[k_tile] = PPP[j].Hsml;}
+#pragma omp simd
+                    for(k_tile = 0; k_tile < n_tile; k_tile++) /* same operations as the scalar loop */
+                    {
+                        double dx = local.Pos[0] - dp_tile[0][k_tile], dy = local.Pos[1] - dp_tile[1][k_tile], dz = local.Pos[2] - dp_tile[2][k_tile];
+                        NEAREST_XYZ(dx,dy,dz,1);
+                        dp_tile[0][k_tile] = dx; dp_tile[1][k_tile] = dy; dp_tile[2][k_tile] = dz;
+                        r2_tile[k_tile] = dx*dx + dy*dy + dz*dz; r_tile[k_tile] = sqrt(r2_tile[k_tile]);
+                    }
+                    kernel_main_tile(n_tile, r_tile, kernel.h_i, hinv_i, hinv3_i, hinv4_i, wk_i_tile, dwk_i_tile);
+                    kernel_main_tile_hj(n_tile, r_tile, h_tile, wk_j_tile, dwk_j_tile);
+                }
+                k_tile = n % KERNEL_SIMD_TILE;
+#endif
                 j = ngblist[n]; /* since we use the -threaded- version above of ngb-finding, its super-important this is the lower-case ngblist here! */
                 if(P[j].Mass <= 0) {continue;}
                 if(SphP[j].Density <= 0) {continue;}
@@ -166,12 +195,18 @@ int hydro_force_evaluate(int target, int mode, int *exportflag, int *exportnodec
                 }
                 if(TimeBinActive[P[j].TimeBin]) {j_is_active_for_fluxes = 1;}
 #endif
+#ifdef HYDRO_KERNEL_SIMD
+                for(k=0;k<3;k++) {kernel.dp[k] = dp_tile[k][k_tile];}
+                r2 = r2_tile[k_tile];
+                kernel.h_j = h_tile[k_tile];
+#else
                 kernel.dp[0] = local.Pos[0] - P[j].Pos[0];
                 kernel.dp[1] = local.Pos[1] - P[j].Pos[1];
                 kernel.dp[2] = local.Pos[2] - P[j].Pos[2];
                 NEAREST_XYZ(kernel.dp[0],kernel.dp[1],kernel.dp[2],1); /* find the closest image in the given box size  */
                 r2 = kernel.dp[0] * kernel.dp[0] + kernel.dp[1] * kernel.dp[1] + kernel.dp[2] * kernel.dp[2];
                 kernel.h_j = PPP[j].Hsml;
+#endif
 
                 /* force applied for all particles inside each-others kernels! */
                 if((r2 >= kernel.h_i * kernel.h_i) && (r2 >= kernel.h_j * kernel.h_j)) continue;
@@ -183,7 +218,11 @@ int hydro_force_evaluate(int target, int mode, int *exportflag, int *exportnodec
 
                 /* --------------------------------------------------------------------------------- */
                 /* calculate a couple basic properties needed: separation, velocity difference (needed for timestepping) */
+#ifdef HYDRO_KERNEL_SIMD
+                kernel.r = r_tile[k_tile];
+#else
                 kernel.r = sqrt(r2);
+#endif
 #ifdef HYDRO_REGULAR_GRID
                 if(kernel.r > 1.1 * Particle_Size_i * sqrt(NUMDIMS)) continue; // only do interactions for the immediate neighbors //
 #endif
@@ -252,6 +291,10 @@ int hydro_force_evaluate(int target, int mode, int *exportflag, int *exportnodec
                 
                 /* --------------------------------------------------------------------------------- */
                 /* calculate the kernel functions (centered on both 'i' and 'j') */
+#ifdef HYDRO_KERNEL_SIMD
+                kernel.wk_i = wk_i_tile[k_tile]; kernel.dwk_i = dwk_i_tile[k_tile]; /* already evaluated for the tile above (zero outside of the kernel) */
+                kernel.wk_j = wk_j_tile[k_tile]; kernel.dwk_j = dwk_j_tile[k_tile];
+#else
                 if(kernel.r < kernel.h_i)
                 {
                     u = kernel.r * hinv_i;
@@ -273,6 +316,7 @@ int hydro_force_evaluate(int target, int mode, int *exportflag, int *exportnodec
                     kernel.dwk_j = 0;
                     kernel.wk_j = 0;
                 }
+#endif
 
                 /* --------------------------------------------------------------------------------- */
                 /* with the overhead numbers above calculated, we now 'feed into' the "core"
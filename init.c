@@ -162,6 +162,9 @@ void init(void)
     for(i = 0; i < GRAVCOSTLEVELS; i++) {All.LevelToTimeBin[i] = 0;}
 
     for(i = 0; i < NumPart; i++) {for(j = 0; j < GRAVCOSTLEVELS; j++) {P[i].GravCost[j] = 0;}}
+#ifdef DOMAIN_MEASURED_COST
+    for(i = 0; i < NumPart; i++) {for(j = 0; j < GRAVCOSTLEVELS; j++) {P[i].WorkCost[j] = 0;}}
+#endif
 
     if(All.ComovingIntegrationOn)	/*  change to new velocity variable */
         {for(i=0;i<NumPart;i++) {for(j=0;j<3;j++) {P[i].Vel[j] *= sqrt(All.Time)*All.Time;}}}
@@ -26,6 +26,115 @@ static long long ntot_type_all[6];
 
 static int n_info;
 
+#ifdef IO_ASYNC_SNAPSHOTS
+#include <pthread.h>
+FILE *open_memstream(char **ptr, size_t *sizeloc); /* POSIX-2008, declared here since it is hidden by -std=c99 */
+
+/*! With IO_ASYNC_SNAPSHOTS, the writing task of each file builds the complete file in memory (the binary formats through a
+ *  memory stream, HDF5 through its 'core' driver), with the usual write_file() machinery, and then hands the finished file
+ *  image to a background thread which writes it to disk while the simulation continues. The thread makes no MPI or HDF5
+ *  calls, so it can run alongside anything else; it is joined before the next snapshot or restart files are written. */
+static struct async_snapshot_data
+{
+    pthread_t thread;
+    int active, failed;
+    char fname[600];
+    char *image;
+    size_t size;
+}
+AsyncSnap;
+
+static void *async_snapshot_thread(void *arg)
+{
+    FILE *fd;
+    if(!(fd = fopen(AsyncSnap.fname, "w"))) {AsyncSnap.failed = 1; return NULL;}
+    if(fwrite(AsyncSnap.image, 1, AsyncSnap.size, fd) != AsyncSnap.size) {AsyncSnap.failed = 1;}
+    if(fclose(fd) != 0) {AsyncSnap.failed = 1;}
+    return NULL;
+}
+
+static void async_snapshot_start(char *fname, char *image, size_t size)
+{
+    strncpy(AsyncSnap.fname, fname, sizeof(AsyncSnap.fname) - 1);
+    AsyncSnap.image = image; AsyncSnap.size = size; AsyncSnap.failed = 0; AsyncSnap.active = 1;
+    if(pthread_create(&AsyncSnap.thread, NULL, async_snapshot_thread, NULL) != 0)
+    {
+        PRINT_WARNING("Task %d could not start the asynchronous snapshot writer, writing `%s' directly", ThisTask, fname);
+        async_snapshot_thread(NULL); AsyncSnap.active = 0; free(AsyncSnap.image);
+        if(AsyncSnap.failed) {printf("can't write snapshot file `%s'.\n", AsyncSnap.fname); endrun(123);}
+    }
+}
+
+/*! The image of a file exists twice for a moment (HDF5 core-driver or memory-stream buffer, and its copy on disk) and stays in
+ *  memory, outside the mymalloc arena, until the next snapshot. So it is only built in memory if it fits comfortably into what
+ *  the system can still commit; otherwise this file is written synchronously as usual. Returns 1 for the in-memory path. */
+static int async_snapshot_fits_in_memory(char *fname)
+{
+    long long MemTotal = 0, Committed_AS = 0, SwapTotal = 0, SwapFree = 0;
+    double image = 65536, avail; /* header and format overhead */
+    int bnr, typelist[6];
+    enum iofields blocknr;
+    for(bnr = 0; bnr < 1000; bnr++)
+    {
+        blocknr = (enum iofields) bnr;
+        if(blocknr == IO_LASTENTRY) {break;}
+        if(blockpresent(blocknr)) {image += (double) get_bytes_per_blockelement(blocknr, 0) * get_particles_in_block(blocknr, &typelist[0]);}
+    }
+    if(All.SnapFormat == 3) {image += 64. * 1024 * 1024;} /* the core driver grows its buffer in these steps */
+    avail = 1024. * report_comittable_memory(&MemTotal, &Committed_AS, &SwapTotal, &SwapFree); /* the mymalloc arena is already committed */
+    if(2 * image < avail) {return 1;}
+    PRINT_WARNING("Task %d: snapshot file `%s' (%g MB) does not fit in the free memory (%g MB), writing it synchronously", ThisTask, fname, image / (1024. * 1024.), avail / (1024. * 1024.));
+    return 0;
+}
+
+#ifdef HAVE_HDF5
+/* file-image callbacks of the HDF5 core driver: the defaults, except that the buffer is kept when the file is closed, so the
+   finished image can be handed to the writer thread as it is, without a second copy */
+static char *async_core_image = NULL;
+static size_t async_core_size = 0;
+static void *async_core_malloc(size_t size, H5FD_file_image_op_t op, void *udata) {async_core_size = size; return (async_core_image = (char *) malloc(size));}
+static void *async_core_memcpy(void *dest, const void *src, size_t size, H5FD_file_image_op_t op, void *udata) {return memcpy(dest, src, size);}
+static void *async_core_realloc(void *ptr, size_t size, H5FD_file_image_op_t op, void *udata)
+{
+    void *p = realloc(ptr, size);
+    if(p) {async_core_image = (char *) p; async_core_size = size;}
+    return p;
+}
+static herr_t async_core_free(void *ptr, H5FD_file_image_op_t op, void *udata)
+{
+    if(op != H5FD_FILE_IMAGE_OP_FILE_CLOSE) {free(ptr);} /* on close, ownership passes to async_snapshot_start() */
+    return 0;
+}
+
+/*! create an HDF5 file which is built in memory by the core driver, in a buffer that survives H5Fclose() */
+static hid_t async_snapshot_core_create(char *fname)
+{
+    H5FD_file_image_callbacks_t callbacks;
+    hid_t hdf5_fapl = H5Pcreate(H5P_FILE_ACCESS), hdf5_file;
+    callbacks.image_malloc = async_core_malloc; callbacks.image_memcpy = async_core_memcpy;
+    callbacks.image_realloc = async_core_realloc; callbacks.image_free = async_core_free;
+    callbacks.udata_copy = NULL; callbacks.udata_free = NULL; callbacks.udata = NULL;
+    H5Pset_fapl_core(hdf5_fapl, 64 * 1024 * 1024, 0); /* no backing store: the file is written by the background thread */
+    H5Pset_file_image_callbacks(hdf5_fapl, &callbacks);
+    async_core_image = NULL; async_core_size = 0;
+    hdf5_file = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, hdf5_fapl);
+    H5Pclose(hdf5_fapl);
+    return hdf5_file;
+}
+#endif
+
+/*! wait until the file handed to the background writer (if any) is completely on disk */
+void async_snapshot_wait(void)
+{
+    if(!AsyncSnap.active) {return;}
+    double t0 = my_second();
+    pthread_join(AsyncSnap.thread, NULL);
+    AsyncSnap.active = 0; free(AsyncSnap.image);
+    if(AsyncSnap.failed) {printf("can't write snapshot file `%s' (asynchronous writer).\n", AsyncSnap.fname); endrun(123);}
+    if(timediff(t0, my_second()) > 1) {PRINT_WARNING("Task %d waited %g sec for the asynchronous writer to finish the previous snapshot", ThisTask, timediff(t0, my_second()));}
+}
+#endif
+
 /*! This function writes a snapshot of the particle distribution to one or
  * several files using Gadget's default file format.  If
  * NumFilesPerSnapshot>1, the snapshot is distributed into several files,
@@ -40,6 +149,10 @@ void savepositions(int num)
 
     CPU_Step[CPU_MISC] += measure_time();
 
+#ifdef IO_ASYNC_SNAPSHOTS
+    async_snapshot_wait(); /* the writer holds the image of one file at a time */
+#endif
+
 #ifdef CHIMES_REDUCED_OUTPUT
     if (num % N_chimes_full_output_freq == 0) {Chimes_incl_full_output = 1;} else {Chimes_incl_full_output = 0;}
 #endif
@@ -69,7 +182,11 @@ void savepositions(int num)
                 ("Fatal error.\nNumber of processors must be larger or equal than All.NumFilesPerSnapshot.\n");
             endrun(0);
         }
+#if defined(IO_PARALLEL_HDF5) && defined(HAVE_HDF5)
+        if(All.SnapFormat < 1 || All.SnapFormat > 4)
+#else
         if(All.SnapFormat < 1 || All.SnapFormat > 3)
+#endif
         {
             if(ThisTask == 0)
                 printf("Unsupported File-Format\n");
@@ -94,6 +211,15 @@ void savepositions(int num)
 
         sumup_large_ints(6, n_type, ntot_type_all);
 
+#if defined(IO_PARALLEL_HDF5) && defined(HAVE_HDF5)
+        if(All.SnapFormat == 4) /* one file, written collectively by all tasks */
+        {
+            sprintf(buf, "%s%s_%03d", All.OutputDir, All.SnapshotFileBase, num);
+            write_file_parallel_hdf5(buf);
+        }
+        else
+        {
+#endif
         /* assign processors to output files */
         distribute_file(All.NumFilesPerSnapshot, 0, 0, NTask - 1, &filenr, &primaryTask, &lastTask);
 
@@ -124,6 +250,9 @@ void savepositions(int num)
             }
             MPI_Barrier(MPI_COMM_WORLD);
         }
+#if defined(IO_PARALLEL_HDF5) && defined(HAVE_HDF5)
+        }
+#endif
 
         myfree(CommBuffer);
 
@@ -3418,6 +3547,61 @@ void get_dataset_name(enum iofields blocknr, char *buf)
 
 
 
+/*! This function fills the (global) file header for a file holding ntot_type[] particles of each type */
+static void fill_file_header(int *ntot_type)
+{
+    int n;
+    for(n = 0; n < 6; n++)
+    {
+        header.npart[n] = (int) ntot_type[n];
+        header.npartTotal[n] = (unsigned int) ntot_type_all[n];
+        header.npartTotalHighWord[n] = (unsigned int) (ntot_type_all[n] >> 32);
+    }
+
+    if(header.flag_ic_info == FLAG_SECOND_ORDER_ICS) {header.flag_ic_info = FLAG_EVOLVED_2LPT;}
+    if(header.flag_ic_info == FLAG_ZELDOVICH_ICS) {header.flag_ic_info = FLAG_EVOLVED_ZELDOVICH;}
+    if(header.flag_ic_info == FLAG_NORMALICS_2LPT) {header.flag_ic_info = FLAG_EVOLVED_2LPT;}
+    if(header.flag_ic_info == 0 && All.ComovingIntegrationOn != 0) {header.flag_ic_info = FLAG_EVOLVED_ZELDOVICH;}
+
+    for(n = 0; n < 6; n++) {header.mass[n] = All.MassTable[n];}
+
+    header.time = All.Time;
+    if(All.ComovingIntegrationOn) {header.redshift = 1.0 / All.Time - 1;} else {header.redshift = 0;}
+
+    header.flag_sfr = 0;
+    header.flag_feedback = 0;
+    header.flag_cooling = 0;
+    header.flag_stellarage = 0;
+    header.flag_metals = 0;
+
+#ifdef COOLING
+    header.flag_cooling = 1;
+#endif
+
+#ifdef GALSF
+    header.flag_sfr = 1;
+    header.flag_feedback = 1;
+    header.flag_stellarage = 1;
+#endif
+
+#ifdef METALS
+    header.flag_metals = NUM_METAL_SPECIES;
+#endif
+
+    header.num_files = All.NumFilesPerSnapshot;
+    header.BoxSize = All.BoxSize;
+    header.OmegaMatter = All.OmegaMatter;
+    header.OmegaLambda = All.OmegaLambda;
+    header.HubbleParam = All.HubbleParam;
+
+#ifdef OUTPUT_IN_DOUBLEPRECISION
+    header.flag_doubleprecision = 1;
+#else
+    header.flag_doubleprecision = 0;
+#endif
+}
+
+
 /*! This function writes a snapshot file containing the data from processors
  *  'writeTask' to 'lastTask'. 'writeTask' is the one that actually writes.
  *  Each snapshot file contains a header first, then particle positions,
@@ -3441,6 +3625,11 @@ void write_file(char *fname, int writeTask, int lastTask)
     int blksize;
     MPI_Status status;
     FILE *fd = 0;
+#ifdef IO_ASYNC_SNAPSHOTS
+    char *async_image = NULL;
+    size_t async_size = 0;
+    int async_in_memory = 0;
+#endif
 
 #ifdef HAVE_HDF5
     hid_t hdf5_file = 0, hdf5_grp[6], hdf5_headergrp = 0, hdf5_dataspace_memory;
@@ -3476,64 +3665,22 @@ void write_file(char *fname, int writeTask, int lastTask)
         MPI_Recv(&ntot_type[0], 6, MPI_INT, writeTask, TAG_N, MPI_COMM_WORLD, &status);
     }
 
-    /* fill file header */
-    for(n = 0; n < 6; n++)
-    {
-        header.npart[n] = (int) ntot_type[n];
-        header.npartTotal[n] = (unsigned int) ntot_type_all[n];
-        header.npartTotalHighWord[n] = (unsigned int) (ntot_type_all[n] >> 32);
-    }
-
-    if(header.flag_ic_info == FLAG_SECOND_ORDER_ICS) {header.flag_ic_info = FLAG_EVOLVED_2LPT;}
-    if(header.flag_ic_info == FLAG_ZELDOVICH_ICS) {header.flag_ic_info = FLAG_EVOLVED_ZELDOVICH;}
-    if(header.flag_ic_info == FLAG_NORMALICS_2LPT) {header.flag_ic_info = FLAG_EVOLVED_2LPT;}
-    if(header.flag_ic_info == 0 && All.ComovingIntegrationOn != 0) {header.flag_ic_info = FLAG_EVOLVED_ZELDOVICH;}
-
-    for(n = 0; n < 6; n++) {header.mass[n] = All.MassTable[n];}
-
-    header.time = All.Time;
-    if(All.ComovingIntegrationOn) {header.redshift = 1.0 / All.Time - 1;} else {header.redshift = 0;}
-
-    header.flag_sfr = 0;
-    header.flag_feedback = 0;
-    header.flag_cooling = 0;
-    header.flag_stellarage = 0;
-    header.flag_metals = 0;
-
-#ifdef COOLING
-    header.flag_cooling = 1;
-#endif
-
-#ifdef GALSF
-    header.flag_sfr = 1;
-    header.flag_feedback = 1;
-    header.flag_stellarage = 1;
-#endif
-
-#ifdef METALS
-    header.flag_metals = NUM_METAL_SPECIES;
-#endif
-
-    header.num_files = All.NumFilesPerSnapshot;
-    header.BoxSize = All.BoxSize;
-    header.OmegaMatter = All.OmegaMatter;
-    header.OmegaLambda = All.OmegaLambda;
-    header.HubbleParam = All.HubbleParam;
-
-#ifdef OUTPUT_IN_DOUBLEPRECISION
-    header.flag_doubleprecision = 1;
-#else
-    header.flag_doubleprecision = 0;
-#endif
+    fill_file_header(ntot_type); /* fill file header */
 
     /* open file and write header */
 
     if(ThisTask == writeTask)
     {
+#ifdef IO_ASYNC_SNAPSHOTS
+        async_in_memory = async_snapshot_fits_in_memory(fname);
+#endif
         if(All.SnapFormat == 3)
         {
 #ifdef HAVE_HDF5
             sprintf(buf, "%s.hdf5", fname);
+#ifdef IO_ASYNC_SNAPSHOTS
+            if(async_in_memory) {hdf5_file = async_snapshot_core_create(buf);} else
+#endif
             hdf5_file = H5Fcreate(buf, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
 
             hdf5_headergrp = H5Gcreate(hdf5_file, "/Header", 0);
@@ -3552,7 +3699,11 @@ void write_file(char *fname, int writeTask, int lastTask)
         }
         else
         {
-            if(!(fd = fopen(fname, "w")))
+#ifdef IO_ASYNC_SNAPSHOTS
+            if(async_in_memory) {fd = open_memstream(&async_image, &async_size);} else /* build the file in memory */
+#endif
+            fd = fopen(fname, "w");
+            if(!fd)
             {
                 printf("can't open file `%s' for writing snapshot.\n", fname);
                 endrun(123);
@@ -3840,12 +3991,31 @@ void write_file(char *fname, int writeTask, int lastTask)
 #ifdef HAVE_HDF5
             for(type = 5; type >= 0; type--) {if(header.npart[type] > 0) {H5Gclose(hdf5_grp[type]);}}
             H5Gclose(hdf5_headergrp);
+#ifdef IO_ASYNC_SNAPSHOTS
+            if(async_in_memory)
+            {
+                H5Fflush(hdf5_file, H5F_SCOPE_GLOBAL); /* extends the core buffer to the end of the allocated space */
+                ssize_t image_size = H5Fget_file_image(hdf5_file, NULL, 0); /* size query only, nothing is copied */
+                H5Fclose(hdf5_file); /* the core driver leaves its buffer to us, see async_core_free() */
+                if(image_size < 0 || !async_core_image || (size_t) image_size > async_core_size)
+                {
+                    printf("failed to obtain the in-memory image of snapshot file `%s.hdf5' (%g MB).\n", fname, image_size / (1024.0 * 1024.0));
+                    endrun(124);
+                }
+                sprintf(buf, "%s.hdf5", fname);
+                async_snapshot_start(buf, async_core_image, (size_t) image_size); /* written to disk in the background */
+                async_core_image = NULL; async_core_size = 0;
+            } else
+#endif
             H5Fclose(hdf5_file);
 #endif
         }
         else
         {
             fclose(fd);
+#ifdef IO_ASYNC_SNAPSHOTS
+            if(async_in_memory) {async_snapshot_start(fname, async_image, async_size);} /* written to disk in the background */
+#endif
         }
     }
 }
@@ -3853,6 +4023,138 @@ void write_file(char *fname, int writeTask, int lastTask)
 
 
 
+#if defined(IO_PARALLEL_HDF5) && defined(HAVE_HDF5)
+/*! This function writes a snapshot as one HDF5 file shared by all tasks (SnapFormat=4), using the MPI-IO driver of a
+ *  parallel HDF5 library: every task writes its own slab of each dataset, at the offset given by the particles of the
+ *  same type on all lower tasks, with collective writes. The file layout (header attributes, groups, dataset names) is
+ *  identical to that of a single-file SnapFormat=3 snapshot, so it can be read in exactly the same way.
+ */
+void write_file_parallel_hdf5(char *fname)
+{
+    int type, n, bnr, nchunk, nchunk_max, pc, offset, typelist[6], ntot_type[6], rank;
+    long long n_type_ll[6], offset_type[6], pcsum;
+    size_t blockmaxlen;
+    enum iofields blocknr;
+    hid_t hdf5_file, hdf5_grp[6], hdf5_headergrp, hdf5_plist, hdf5_xfer, hdf5_dataspace_memory, hdf5_datatype = 0, hdf5_dataspace_in_file, hdf5_dataset;
+    hsize_t dims[2], count[2], start[2];
+    char buf[1000];
+
+    for(n = 0; n < 6; n++)
+    {
+        if(ntot_type_all[n] > 2147483647) {if(ThisTask == 0) {printf("Particle number of type %d too large for a single snapshot file (NumPart_ThisFile is a 32-bit integer): use SnapFormat=3 with NumFilesPerSnapshot>1.\n", n);} endrun(125);}
+        ntot_type[n] = (int) ntot_type_all[n];
+        n_type_ll[n] = n_type[n]; offset_type[n] = 0;
+    }
+    MPI_Exscan(n_type_ll, offset_type, 6, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD); /* first element of this task in each type's datasets */
+    if(ThisTask == 0) {for(n = 0; n < 6; n++) {offset_type[n] = 0;}} /* (undefined on the first task) */
+
+    fill_file_header(ntot_type);
+    header.num_files = 1;
+
+    sprintf(buf, "%s.hdf5", fname);
+    hdf5_plist = H5Pcreate(H5P_FILE_ACCESS);
+    H5Pset_fapl_mpio(hdf5_plist, MPI_COMM_WORLD, MPI_INFO_NULL);
+    hdf5_file = H5Fcreate(buf, H5F_ACC_TRUNC, H5P_DEFAULT, hdf5_plist);
+    H5Pclose(hdf5_plist);
+    if(hdf5_file < 0) {printf("can't open file `%s' for writing snapshot.\n", buf); endrun(123);}
+
+    hdf5_xfer = H5Pcreate(H5P_DATASET_XFER);
+    H5Pset_dxpl_mpio(hdf5_xfer, H5FD_MPIO_COLLECTIVE);
+
+    /* all structural operations (groups, datasets, attributes) are collective: every task makes them with identical arguments */
+    hdf5_headergrp = H5Gcreate(hdf5_file, "/Header", 0);
+    for(type = 0; type < 6; type++) {if(header.npart[type] > 0) {sprintf(buf, "/PartType%d", type); hdf5_grp[type] = H5Gcreate(hdf5_file, buf, 0);}}
+    write_header_attributes_in_hdf5(hdf5_headergrp);
+
+    for(bnr = 0; bnr < 1000; bnr++)
+    {
+        blocknr = (enum iofields) bnr;
+        if(blocknr == IO_LASTENTRY) {break;}
+        if(!blockpresent(blocknr)) {continue;}
+        size_t MyBufferSize = All.BufferSize;
+        blockmaxlen = (size_t) ((MyBufferSize * 1024 * 1024) / get_bytes_per_blockelement(blocknr, 0));
+        if(get_particles_in_block(blocknr, &typelist[0]) <= 0) {continue;}
+
+        if(ThisTask == 0) {get_dataset_name(blocknr, buf); printf("writing block %d (%s)...\n", bnr, buf);}
+
+        for(type = 0; type < 6; type++)
+        {
+            if(!typelist[type] || header.npart[type] <= 0) {continue;}
+            switch(get_datatype_in_block(blocknr))
+            {
+                case 0: hdf5_datatype = H5Tcopy(H5T_NATIVE_UINT); break;
+#ifdef OUTPUT_IN_DOUBLEPRECISION
+                case 1: hdf5_datatype = H5Tcopy(H5T_NATIVE_DOUBLE); break;
+#else
+                case 1: hdf5_datatype = H5Tcopy(H5T_NATIVE_FLOAT); break;
+#endif
+                case 2: hdf5_datatype = H5Tcopy(H5T_NATIVE_UINT64); break;
+#ifdef OUTPUT_POSITIONS_IN_DOUBLE
+                case 3: hdf5_datatype = H5Tcopy(H5T_NATIVE_DOUBLE); break;
+#else
+                case 3: hdf5_datatype = H5Tcopy(H5T_NATIVE_FLOAT); break;
+#endif
+            }
+            dims[0] = header.npart[type];
+            dims[1] = get_values_per_blockelement(blocknr);
+            if(dims[1] == 1) {rank = 1;} else {rank = 2;}
+            get_dataset_name(blocknr, buf);
+            hdf5_dataspace_in_file = H5Screate_simple(rank, dims, NULL);
+#ifndef IO_COMPRESS_HDF5
+            hdf5_dataset = H5Dcreate(hdf5_grp[type], buf, hdf5_datatype, hdf5_dataspace_in_file, H5P_DEFAULT);
+#else
+            if(dims[0] > 10)
+            {
+                hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
+                hsize_t cdims[2]; cdims[0] = (hsize_t) (dims[0] / 10); cdims[1] = dims[1];
+                H5Pset_chunk(plist_id, rank, cdims);
+                H5Pset_deflate(plist_id, 4); /* filtered parallel writes need HDF5 >= 1.10.2 */
+                hdf5_dataset = H5Dcreate2(hdf5_grp[type], buf, hdf5_datatype, hdf5_dataspace_in_file, H5P_DEFAULT, plist_id, H5P_DEFAULT);
+                H5Pclose(plist_id);
+            } else {
+                hdf5_dataset = H5Dcreate(hdf5_grp[type], buf, hdf5_datatype, hdf5_dataspace_in_file, H5P_DEFAULT);
+            }
+#endif
+
+            /* collective writes must be entered by all tasks the same number of times: tasks which are done write empty selections */
+            nchunk = (int) ((n_type[type] + blockmaxlen - 1) / blockmaxlen);
+            MPI_Allreduce(&nchunk, &nchunk_max, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+            for(n = 0, offset = 0, pcsum = 0; n < nchunk_max; n++)
+            {
+                pc = n_type[type] - pcsum;
+                if(pc > (int)blockmaxlen) {pc = blockmaxlen;}
+                if(pc > 0) {fill_write_buffer(blocknr, &offset, pc, type);}
+
+                dims[0] = (pc > 0) ? pc : 1;
+                hdf5_dataspace_memory = H5Screate_simple(rank, dims, NULL);
+                if(pc > 0)
+                {
+                    start[0] = offset_type[type] + pcsum; start[1] = 0;
+                    count[0] = pc; count[1] = get_values_per_blockelement(blocknr);
+                    H5Sselect_hyperslab(hdf5_dataspace_in_file, H5S_SELECT_SET, start, NULL, count, NULL);
+                } else {
+                    H5Sselect_none(hdf5_dataspace_in_file);
+                    H5Sselect_none(hdf5_dataspace_memory);
+                }
+                if(H5Dwrite(hdf5_dataset, hdf5_datatype, hdf5_dataspace_memory, hdf5_dataspace_in_file, hdf5_xfer, CommBuffer) < 0) {printf("failed to write block %d of snapshot file `%s.hdf5'.\n", bnr, fname); endrun(126);}
+                H5Sclose(hdf5_dataspace_memory);
+                if(pc > 0) {pcsum += pc;}
+            }
+
+            H5Dclose(hdf5_dataset);
+            H5Sclose(hdf5_dataspace_in_file);
+            H5Tclose(hdf5_datatype);
+        }
+    }
+
+    H5Pclose(hdf5_xfer);
+    for(type = 5; type >= 0; type--) {if(header.npart[type] > 0) {H5Gclose(hdf5_grp[type]);}}
+    H5Gclose(hdf5_headergrp);
+    H5Fclose(hdf5_file);
+}
+#endif
+
+
 #ifdef HAVE_HDF5
 void write_header_attributes_in_hdf5(hid_t handle)
 {
@@ -344,6 +344,105 @@ static inline void kernel_main(double u, double hinv3, double hinv4, double *wk,
 }
 
 
+#ifdef HYDRO_KERNEL_SIMD
+#define KERNEL_SIMD_TILE 32 /* number of neighbors gathered into one 'tile' for the batched kernel evaluations below */
+
+/* branch-free version of kernel_main (for mode=0; u must be >= 0) giving identical values, with the piecewise parts
+   written as selects so that loops over it can be vectorized. returns wk=dwk=0 for u >= 1 */
+static inline void kernel_main_lane(double u, double hinv3, double hinv4, double *wk, double *dwk)
+{
+    double w, dw, v = (u < 1) ? u : 1; /* v is used for the polynomial evaluations so these stay finite-valued for any u */
+#if (KERNEL_FUNCTION == 1) /* linear ramp */
+    dw = -1; w = 1-v;
+#endif
+#if (KERNEL_FUNCTION == 2) /* quadratic */
+    double t1 = 1-v; dw = -2*t1; w = t1*t1;
+#endif
+#if (KERNEL_FUNCTION == 3) /* cubic spline */
+    double t1 = (1.0 - v), t2 = t1 * t1;
+    double dw_in = v * (18.0 * v - 12.0), w_in = (1.0 + 6.0 * (v - 1.0) * v * v), dw_out = -6.0 * t2, w_out = 2.0 * t2 * t1;
+    dw = (v < 0.5) ? dw_in : dw_out; w = (v < 0.5) ? w_in : w_out;
+#endif
+#if (KERNEL_FUNCTION == 4) /* quartic spline */
+    double t1 = (1.0 - v), t2 = t1 * t1, t4 = t2 * t2;
+    dw = -5.0 * t4; w = t4 * t1;
+    t1 = (2.0/3.0 - v); t2 = t1 * t1; t4 = t2 * t2; double dw_2 = 30.0 * t4, w_2 = 6.0 * t4 * t1;
+    t1 = (1.0/3.0 - v); t2 = t1 * t1; t4 = t2 * t2; double dw_3 = 75.0 * t4, w_3 = 15.0 * t4 * t1;
+    dw += (v < 2.0/3.0) ? dw_2 : 0; w -= (v < 2.0/3.0) ? w_2 : 0;
+    dw -= (v < 1.0/3.0) ? dw_3 : 0; w += (v < 1.0/3.0) ? w_3 : 0;
+#endif
+#if (KERNEL_FUNCTION == 5) /* quintic spline */
+    double t1 = (1.0 - v), t2 = t1 * t1;
+    dw = -4.0 * t2 * t1; w = t2 * t2;
+    t1 = (0.6 - v); t2 = t1 * t1; double dw_2 = 20.0 * t2 * t1, w_2 = 5.0 * t2 * t2;
+    t1 = (0.2 - v); t2 = t1 * t1; double dw_3 = 40.0 * t2 * t1, w_3 = 10.0 * t2 * t2;
+    dw += (v < 0.6) ? dw_2 : 0; w -= (v < 0.6) ? w_2 : 0;
+    dw -= (v < 0.2) ? dw_3 : 0; w += (v < 0.2) ? w_3 : 0;
+#endif
+#if (KERNEL_FUNCTION == 6) /* Wendland C2 */
+    double t1 = (1 - v), t3 = t1*t1*t1;
+#if (NUMDIMS == 1)
+    dw = -12.0 * v * t1*t1; w = t3 * (1.0 + 3.0*v);
+#else
+    dw = -20.0 * v * t3; w = t3 * t1 * (1.0 + 4.0*v);
+#endif
+#endif
+#if (KERNEL_FUNCTION == 7) /* Wendland C4 */
+    double t1 = (1 - v), t5 = t1*t1; t5 *= t5*t1;
+#if (NUMDIMS == 1)
+    dw = -14.0 * ((t1*t1)*(t1*t1)) * v * (1.0 + 4.0*v); w = t5 * (1.0 + 5.0*v + 8.0*v*v); /* t5/t1 written out, since t1 can vanish here */
+#else
+    dw = -(56.0/3.0) * t5 * v * (1.0 + 5.0*v); w = t5 * t1 * (1.0 + 6.0*v + (35.0/3.0)*v*v);
+#endif
+#endif
+#if (KERNEL_FUNCTION == 8) /* quadratic '2-part' kernel */
+    double dw_in = -2*v/KERNEL_U0, w_in = 1-v*v/KERNEL_U0, dw_out = -2*(1-v)/(1-KERNEL_U0), w_out = (1-v)*(1-v)/(1-KERNEL_U0);
+    dw = (v < KERNEL_U0) ? dw_in : dw_out; w = (v < KERNEL_U0) ? w_in : w_out;
+#endif
+    dw *= KERNEL_NORM * hinv4; w *= KERNEL_NORM * hinv3;
+    *dwk = (u < 1) ? dw : 0; *wk = (u < 1) ? w : 0; /* all terms are evaluated above and only selected here, so no (possibly trapping) floating-point operations are conditional */
+}
+
+/* batched versions of kernel_main (mode=0) for a tile of n neighbors at separations r[], which compilers can vectorize.
+   wk and dwk are zero for lanes with r >= h, exactly as in the scalar loops. This version uses a common kernel length h
+   for all neighbors (the kernel centered on the 'i' particle) */
+static inline void kernel_main_tile(int n, const double *r, double h, double hinv, double hinv3, double hinv4, double *wk, double *dwk)
+{
+    int k;
+#pragma omp simd
+    for(k=0;k<n;k++) {double u = r[k]*hinv; kernel_main_lane((r[k] < h) ? u : 1, hinv3, hinv4, &wk[k], &dwk[k]);}
+}
+
+/* as kernel_main_tile, but with the kernel centered on each neighbor, with its own kernel length h[] */
+static inline void kernel_main_tile_hj(int n, const double *r, const double *h, double *wk, double *dwk)
+{
+    int k;
+#pragma omp simd
+    for(k=0;k<n;k++)
+    {
+        double hinv, hinv3, hinv4; kernel_hinv(h[k], &hinv, &hinv3, &hinv4);
+        double u = r[k]*hinv; kernel_main_lane((r[k] < h[k]) ? u : 1, hinv3, hinv4, &wk[k], &dwk[k]);
+    }
+}
+
+/* compares kernel_main_lane with kernel_main on a fine grid in 0 <= u < 1, for the compiled KERNEL_FUNCTION and NUMDIMS.
+   returns the largest deviation of wk and dwk, relative to the largest absolute values of each on the grid (done once at startup) */
+static inline double kernel_main_lane_check(void)
+{
+    int k, n = 100000;
+    double u, wk, dwk, wk_l, dwk_l, w_max = 0, dw_max = 0, w_err = 0, dw_err = 0;
+    for(k=0;k<n;k++)
+    {
+        u = (double) k / n;
+        kernel_main(u, 1, 1, &wk, &dwk, 0); kernel_main_lane(u, 1, 1, &wk_l, &dwk_l);
+        w_max = DMAX(w_max, fabs(wk)); dw_max = DMAX(dw_max, fabs(dwk));
+        w_err = DMAX(w_err, fabs(wk - wk_l)); dw_err = DMAX(dw_err, fabs(dwk - dwk_l));
+    }
+    return DMAX(w_err / w_max, dw_err / dw_max);
+}
+#endif
+
+
 /* this defines the kernel for the short-range gravitational softening, 
  which does not have to correspond to that of the gas (although for the gas
  itself, it should). dwk is the force kernel, wk is the potential kernel
@@ -128,7 +128,9 @@ void do_hermite_prediction(void)
 #endif
 		    P[i].Pos[j] = P[i].OldPos[j] + dt_grav * (P[i].OldVel[j] + dt_grav/2 * (P[i].Hermite_OldAcc[j] + dt_grav/3 * P[i].OldJerk[j])) ;
 		    P[i].Vel[j] = P[i].OldVel[j] + dt_grav * (P[i].Hermite_OldAcc[j] + dt_grav/2 * P[i].OldJerk[j]);
-		}}}} // for(i = FirstActiveParticle; i >= 0; i = NextActiveParticle[i]) 
+		}
+		PHOT_UPDATE(i); /* position was over-written */
+		}}} // for(i = FirstActiveParticle; i >= 0; i = NextActiveParticle[i]) 
 }
 
 void do_hermite_correction(void) // corrector step
@@ -151,7 +153,9 @@ void do_hermite_correction(void) // corrector step
                             P[i].OldVel[j] += P[i].GravPM[j] * (All.PM_Ti_endstep - All.PM_Ti_begstep)/2 * All.Timebase_interval;
                         }
 #endif
-		    }}}} //     for(i = FirstActiveParticle; i >= 0; i = NextActiveParticle[i])
+		    }
+                    PHOT_UPDATE(i); /* position was over-written */
+                    }}} //     for(i = FirstActiveParticle; i >= 0; i = NextActiveParticle[i])
 }
 #endif // HERMITE_INTEGRATION
 
@@ -366,6 +370,7 @@ void do_the_kick(int i, integertime tstart, integertime tend, integertime tcurre
  
         /* check for reflecting or outflow or otherwise special boundaries: if so, do the reflection/boundary! */
         apply_special_boundary_conditions(i,mass_new,1);
+        PHOT_UPDATE(i); /* the boundary conditions can re-position the particle */
         if(P[i].Mass==0) {return;} /* exit if we have zero'd the particle mass, to avoid errors with dividing by zero */
 
         /* any other gas-specific kicks (e.g. B-fields, radiation) go here */
@@ -128,6 +128,10 @@ int main(int argc, char **argv)
 
   run();			/* main simulation loop */
 
+#ifdef IO_ASYNC_SNAPSHOTS
+  async_snapshot_wait();	/* the final snapshot may still be in the hands of the background writer */
+#endif
+
   MPI_Finalize();		/* clean up & finalize MPI */
 
   return 0;
@@ -497,6 +497,7 @@ void split_particle_i(int i, int n_particles_split, int i_nearest)
      but it is important that the periodicity of the box be accounted for in relative positions and that we correct for this before allowing
      any other operations on the particles */
     P[i].Pos[0] += dx; P[j].Pos[0] -= dx; P[i].Pos[1] += dy; P[j].Pos[1] -= dy; P[i].Pos[2] += dz; P[j].Pos[2] -= dz;
+    PHOT_UPDATE(i); PHOT_UPDATE(j); /* the neighbor searches which follow (in the merge/split loop, and below in the tree) read the walk-critical copy */
 
     /* Note: New tree construction can be avoided because of  `force_add_star_to_tree()' */
 #ifdef PARTICLE_MERGE_SPLIT_EVERY_TIMESTEP    
@@ -569,6 +570,7 @@ void merge_particles_ij(int i, int j)
             P[i].dp[k] += P[i].Mass*P[i].Vel[k] - p_old_i[k];
             P[j].dp[k] += P[j].Mass*P[j].Vel[k] - p_old_j[k];
         }
+        PHOT_UPDATE(j); /* position and kernel length changed */
         return;
     } // closes merger of non-gas particles, only gas particles will see the blocks below //
 
@@ -748,6 +750,7 @@ void merge_particles_ij(int i, int j)
     }
     /* call the pressure routine to re-calculate pressure (and sound speeds) as needed */
     SphP[j].Pressure = get_pressure(j);
+    PHOT_UPDATE(j); /* position and kernel length changed */
     return;
 }
 
@@ -878,6 +881,7 @@ void rearrange_particle_sequence(void)
                 psave = P[i]; /* otherwise, save the old pointer */
                 P[i] = P[j]; /* now set the pointer equal to this new P[j] */
                 P[j] = psave; /* now set the P[j] equal to the old, saved pointer */
+                PHOT_UPDATE(i); PHOT_UPDATE(j); /* the walk-critical copy follows the particles */
                 /* so we've swapped the two P[i] and P[j] */
                 sphsave = SphP[i];
                 SphP[i] = SphP[j];
@@ -914,6 +918,7 @@ void rearrange_particle_sequence(void)
 
                 P[i] = P[N_gas - 1];
                 SphP[i] = SphP[N_gas - 1];
+                PHOT_UPDATE(i);
 #ifdef MAINTAIN_TREE_IN_REARRANGE
                 swap_treewalk_pointers(i, N_gas-1);
 #endif
@@ -925,6 +930,7 @@ void rearrange_particle_sequence(void)
 #endif
 
                 P[N_gas - 1] = P[NumPart - 1]; /* redirect the final gas pointer to go to the final particle (BH) */
+                PHOT_UPDATE(N_gas - 1);
 #ifdef MAINTAIN_TREE_IN_REARRANGE
                 swap_treewalk_pointers(N_gas - 1, NumPart-1);
                 remove_particle_from_treewalk(NumPart - 1);
@@ -938,6 +944,7 @@ void rearrange_particle_sequence(void)
                 P[i] = P[NumPart - 1]; /* re-directs pointer for this particle to pointer at final particle -- so we
                                         swap the two; note that ordering -does not- matter among the non-SPH particles
                                         so its fine if this mixes up the list ordering of different particle types */
+                PHOT_UPDATE(i);
 #ifdef MAINTAIN_TREE_IN_REARRANGE
                 swap_treewalk_pointers(i, NumPart - 1);
                 remove_particle_from_treewalk(NumPart - 1);
@@ -50,6 +50,11 @@ extern pthread_mutex_t mutex_nexport, mutex_partnodedrift;
 #define UNLOCK_PARTNODEDRIFT
 #endif
 
+#ifdef HYDRO_NGBLIST_CACHE /* neighbor-list cache, see ngb_treefind_pairs_threads_cached below */
+static int *NgbCache_Offset, *NgbCache_List; static MyFloat *NgbCache_Hsml; static long long NgbCache_Used, NgbCache_Size;
+static __thread int NgbCache_WalkExported; /* set by the threaded neighbor-search code-block if the current walk exported */
+#endif
+
 
 
 #ifdef REDUCE_TREEWALK_BRANCHING
@@ -103,14 +108,86 @@ int ngb_treefind_pairs_threads(MyDouble searchcenter[3], MyFloat hsml, int targe
                                int mode, int *exportflag, int *exportnodecount, int *exportindex, int *ngblist)
 {
 #include "system/ngb_codeblock_before_condition.h"
-    if(P[p].Type > 0) continue; // skip particles with non-gas types
-    if(P[p].Mass <= 0) continue; // skip zero-mass particles
+#define NGB_SKIP_PARTICLE(p) ((P[p].Type > 0) || (P[p].Mass <= 0)) // skip particles with non-gas types, and zero-mass particles
 #define SEARCHBOTHWAYS 1 // need neighbors that can -mutually- see one another, not just single-directional searching here
 #include "system/ngb_codeblock_after_condition_threaded.h"
 #undef SEARCHBOTHWAYS // must be undefined after code block inserted, or compiler will crash
+#undef NGB_SKIP_PARTICLE
 }
 
 
+#ifdef HYDRO_NGBLIST_CACHE
+/*! Cache of the (mutual) neighbor lists of the local active gas elements, shared between the hydro loops within one step (the
+ *  volume-correction, gradient, and hydro-force loops all search for the same pairs: positions, Hsml, and the node hmax values
+ *  do not change between them). The list is stored the first time a local (mode=0) pair search for an element completes, but
+ *  only if that search did not require any exports -- the cached list then replaces the full tree-walk, with nothing else to
+ *  do. Elements near domain boundaries, searches with a larger radius than the cached one, and anything which does not fit in
+ *  the (fixed-size) cache simply fall back to the normal tree-walk. The cache is only valid between ngb_cache_allocate() and
+ *  ngb_cache_free(), which must be called after the density/hmax update and after the hydro-force loop, respectively.
+ */
+
+void ngb_cache_allocate(void)
+{
+    int i; long long n_active = 0;
+    for(i = FirstActiveParticle; i >= 0; i = NextActiveParticle[i]) {if(P[i].Type == 0) {n_active++;}}
+    NgbCache_Size = (long long) (2. * All.DesNumNgb * n_active); /* typical pair lists are somewhat larger than DesNumNgb; anything beyond this falls back to walking */
+    long long size_max = (long long) (0.25 * FreeBytes / sizeof(int)) - 2*N_gas; /* leave the bulk of the free memory for the loops themselves */
+    if(size_max > 2147483647LL) {size_max = 2147483647LL;} /* offsets are stored as int */
+    if(NgbCache_Size > size_max) {NgbCache_Size = (size_max > 0) ? size_max : 0;}
+    NgbCache_Offset = (int *) mymalloc("NgbCache_Offset", N_gas * sizeof(int));
+    NgbCache_Hsml = (MyFloat *) mymalloc("NgbCache_Hsml", N_gas * sizeof(MyFloat));
+    NgbCache_List = (int *) mymalloc("NgbCache_List", NgbCache_Size * sizeof(int));
+    for(i = 0; i < N_gas; i++) {NgbCache_Offset[i] = -1;}
+    NgbCache_Used = 0;
+}
+
+void ngb_cache_free(void)
+{
+    myfree(NgbCache_List); myfree(NgbCache_Hsml); myfree(NgbCache_Offset);
+    NgbCache_List = NULL; NgbCache_Hsml = NULL; NgbCache_Offset = NULL; NgbCache_Size = NgbCache_Used = 0;
+}
+
+/*! Identical in calling and results to ngb_treefind_pairs_threads (which it falls back to), but uses/fills the cache above.
+ *  The returned list can be a superset of the exact pairs if the cached search radius was larger, so (as everywhere) the
+ *  calling routine must apply its own distance criteria.
+ */
+int ngb_treefind_pairs_threads_cached(MyDouble searchcenter[3], MyFloat hsml, int target, int *startnode,
+                                      int mode, int *exportflag, int *exportnodecount, int *exportindex, int *ngblist)
+{
+    if(mode != 0 || target < 0 || target >= N_gas || *startnode != All.MaxPart || !NgbCache_List)
+        {return ngb_treefind_pairs_threads(searchcenter, hsml, target, startnode, mode, exportflag, exportnodecount, exportindex, ngblist);}
+    int k, numngb, offset = NgbCache_Offset[target];
+    if(offset >= 0 && hsml <= NgbCache_Hsml[target]) /* cache hit: no walk needed, and we know no exports are needed */
+    {
+        numngb = NgbCache_List[offset];
+        for(k = 0; k < numngb; k++) {ngblist[k] = NgbCache_List[offset + 1 + k];}
+        *startnode = -1;
+        return numngb;
+    }
+    NgbCache_WalkExported = 0;
+    numngb = ngb_treefind_pairs_threads(searchcenter, hsml, target, startnode, mode, exportflag, exportnodecount, exportindex, ngblist);
+    if(numngb < 0 || NgbCache_WalkExported || *startnode >= 0) {return numngb;} /* buffer full, or element needs remote neighbors: don't cache */
+    offset = -1;
+    LOCK_NEXPORT;
+#ifdef _OPENMP
+#pragma omp critical(_ngbcache_)
+#endif
+    {
+        if(NgbCache_Used + numngb + 1 <= NgbCache_Size) {offset = (int) NgbCache_Used; NgbCache_Used += numngb + 1;}
+    }
+    UNLOCK_NEXPORT;
+    if(offset >= 0)
+    {
+        NgbCache_List[offset] = numngb;
+        for(k = 0; k < numngb; k++) {NgbCache_List[offset + 1 + k] = ngblist[k];}
+        NgbCache_Hsml[target] = hsml;
+        NgbCache_Offset[target] = offset; /* each target is only evaluated by one thread at a time, so this needs no lock */
+    }
+    return numngb;
+}
+#endif
+
+
 /*! This function returns neighbours with distance <= hsml and returns them in Ngblist. Actually, particles in a box of half side length hsml are
  *  returned, i.e. the reduction to a sphere still needs to be done in the calling routine.
  */
@@ -118,11 +195,11 @@ int ngb_treefind_variable_threads(MyDouble searchcenter[3], MyFloat hsml, int ta
 				  int mode, int *exportflag, int *exportnodecount, int *exportindex, int *ngblist)
 {
 #include "system/ngb_codeblock_before_condition.h"
-    if(P[p].Type > 0) continue; // skip particles with non-gas types
-    if(P[p].Mass <= 0) continue; // skip zero-mass particles
+#define NGB_SKIP_PARTICLE(p) ((P[p].Type > 0) || (P[p].Mass <= 0)) // skip particles with non-gas types, and zero-mass particles
 #define SEARCHBOTHWAYS 0 // only need neighbors inside of search radius, not particles 'looking at' primary
 #include "system/ngb_codeblock_after_condition_threaded.h"
 #undef SEARCHBOTHWAYS
+#undef NGB_SKIP_PARTICLE
 }
 
 /* this is the same as above, but the simpler un-threaded version, useful for historical reasons and because some sub-routines use 
@@ -134,22 +211,22 @@ int ngb_treefind_variable_targeted(MyDouble searchcenter[3], MyFloat hsml, int t
 {
     long nexport_save = *nexport; /* this line must be here in the un-threaded versions */
 #include "system/ngb_codeblock_before_condition.h" // call the same variable/initialization block
-    if(!((1 << P[p].Type) & (TARGET_BITMASK))) continue; // skip anything not of the desired type
-    if(P[p].Mass <= 0) continue; // skip zero-mass particles
+#define NGB_SKIP_PARTICLE(p) ((!((1 << P[p].Type) & (TARGET_BITMASK))) || (P[p].Mass <= 0)) // skip anything not of the desired type, and zero-mass particles
 #define SEARCHBOTHWAYS 0 // only need neighbors inside of search radius, not particles 'looking at' primary
 #include "system/ngb_codeblock_after_condition_unthreaded.h" // call the main loop block as above, but this time the -unthreaded- version
 #undef SEARCHBOTHWAYS
+#undef NGB_SKIP_PARTICLE
 }
 /* identical to above but includes 'both ways' search for interacting neighbors */
 int ngb_treefind_pairs_targeted(MyDouble searchcenter[3], MyFloat hsml, int target, int *startnode, int mode, int *nexport, int *nsend_local, int TARGET_BITMASK)
 {
     long nexport_save = *nexport; /* this line must be here in the un-threaded versions */
 #include "system/ngb_codeblock_before_condition.h" // call the same variable/initialization block
-    if(!((1 << P[p].Type) & (TARGET_BITMASK))) continue; // skip anything not of the desired type
-    if(P[p].Mass <= 0) continue; // skip zero-mass particles
+#define NGB_SKIP_PARTICLE(p) ((!((1 << P[p].Type) & (TARGET_BITMASK))) || (P[p].Mass <= 0)) // skip anything not of the desired type, and zero-mass particles
 #define SEARCHBOTHWAYS 1 // only need neighbors inside of search radius, not particles 'looking at' primary
 #include "system/ngb_codeblock_after_condition_unthreaded.h" // call the main loop block as above, but this time the -unthreaded- version
 #undef SEARCHBOTHWAYS
+#undef NGB_SKIP_PARTICLE
 }
 
 
@@ -162,11 +239,11 @@ int ngb_treefind_variable_threads_targeted(MyDouble searchcenter[3], MyFloat hsm
                                            int *ngblist, int TARGET_BITMASK)
 {
 #include "system/ngb_codeblock_before_condition.h"
-    if(!((1 << P[p].Type) & (TARGET_BITMASK))) continue; // skip anything not of the desired type
-    if(P[p].Mass <= 0) continue; // skip zero-mass particles
+#define NGB_SKIP_PARTICLE(p) ((!((1 << P[p].Type) & (TARGET_BITMASK))) || (P[p].Mass <= 0)) // skip anything not of the desired type, and zero-mass particles
 #define SEARCHBOTHWAYS 0 // only need neighbors inside of search radius, not particles 'looking at' primary
 #include "system/ngb_codeblock_after_condition_threaded.h"
 #undef SEARCHBOTHWAYS
+#undef NGB_SKIP_PARTICLE
 }
 /* identical to above but includes 'both ways' search for interacting neighbors */
 int ngb_treefind_pairs_threads_targeted(MyDouble searchcenter[3], MyFloat hsml, int target, int *startnode,
@@ -174,11 +251,11 @@ int ngb_treefind_pairs_threads_targeted(MyDouble searchcenter[3], MyFloat hsml,
                                            int *ngblist, int TARGET_BITMASK)
 {
 #include "system/ngb_codeblock_before_condition.h"
-    if(!((1 << P[p].Type) & (TARGET_BITMASK))) continue; // skip anything not of the desired type
-    if(P[p].Mass <= 0) continue; // skip zero-mass particles
+#define NGB_SKIP_PARTICLE(p) ((!((1 << P[p].Type) & (TARGET_BITMASK))) || (P[p].Mass <= 0)) // skip anything not of the desired type, and zero-mass particles
 #define SEARCHBOTHWAYS 1 // only need neighbors inside of search radius, not particles 'looking at' primary
 #include "system/ngb_codeblock_after_condition_threaded.h"
 #undef SEARCHBOTHWAYS
+#undef NGB_SKIP_PARTICLE
 }
 
 
@@ -190,9 +267,10 @@ int ngb_treefind_pairs_threads_targeted(MyDouble searchcenter[3], MyFloat hsml,
 /* 
     custom code for FOF finder -- needs to be able to deal with complications like pure node-linkages and hard-codes a
     local requirement, so we can't use our simple routines above. this is a customized version of the "ngb_treefind_variable" routine above. 
-    as a result, updates to the core neighbor search routine will not alter this subroutine 
+    as a result, updates to the core neighbor search routine will not alter this subroutine. the neighbors are returned in ngblist, so with 
+    mode=-1 (purely local linking) it can be called from several threads at once, each with its own list 
  */
-int ngb_treefind_fof_primary(MyDouble searchcenter[3], MyFloat hsml, int target, int *startnode, int mode, int *nexport, int *nsend_local, int MyFOF_PRIMARY_LINK_TYPES)
+int ngb_treefind_fof_primary(MyDouble searchcenter[3], MyFloat hsml, int target, int *startnode, int mode, int *nexport, int *nsend_local, int MyFOF_PRIMARY_LINK_TYPES, int *ngblist)
 {
     int numngb, no, p, task, nexport_save;
     struct NODE *current;
@@ -240,7 +318,7 @@ int ngb_treefind_fof_primary(MyDouble searchcenter[3], MyFloat hsml, int target,
             if(dz > dist) continue;
             if(dx * dx + dy * dy + dz * dz > dist * dist) continue;
 #endif
-            Ngblist[numngb++] = p;
+            ngblist[numngb++] = p;
         }
         else
         {
@@ -303,7 +381,7 @@ int ngb_treefind_fof_primary(MyDouble searchcenter[3], MyFloat hsml, int target,
 #ifndef REDUCE_TREEWALK_BRANCHING
                     return numngb;
 #else
-                    return ngb_filter_variables(numngb, Ngblist, &vcenter, &box, &hbox, hsml, 0);
+                    return ngb_filter_variables(numngb, ngblist, &vcenter, &box, &hbox, hsml, 0);
 #endif
                 }
             }
@@ -354,7 +432,7 @@ int ngb_treefind_fof_primary(MyDouble searchcenter[3], MyFloat hsml, int target,
                                         dz = NGB_PERIODIC_BOX_LONG_Z(P[p].Pos[0] - searchcenter[0], P[p].Pos[1] - searchcenter[1], P[p].Pos[2] - searchcenter[2],-1);
                                         if(dx * dx + dy * dy + dz * dz > hsml * hsml) break;
 #endif
-                                        Ngblist[numngb++] = p;
+                                        ngblist[numngb++] = p;
                                         break;
                                     }
                                     p = Nextnode[p];
@@ -369,6 +447,9 @@ int ngb_treefind_fof_primary(MyDouble searchcenter[3], MyFloat hsml, int target,
                         else
                         {
                             /* flag it now */
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
                             current->u.d.bitflags |= (1 << BITFLAG_INSIDE_LINKINGLENGTH);
                         }
                     }
@@ -382,7 +463,7 @@ int ngb_treefind_fof_primary(MyDouble searchcenter[3], MyFloat hsml, int target,
 #ifndef REDUCE_TREEWALK_BRANCHING
     return numngb;
 #else
-    return ngb_filter_variables(numngb, Ngblist, &vcenter, &box, &hbox, hsml, 0);
+    return ngb_filter_variables(numngb, ngblist, &vcenter, &box, &hbox, hsml, 0);
 #endif
 }
 
@@ -241,9 +241,26 @@ void drift_particle(int i, integertime time1)
     apply_special_boundary_conditions(i,P[i].Mass,0);
 
     P[i].Ti_current = time1;
+    PHOT_UPDATE(i); /* position, kernel length, and time all changed: refresh the walk-critical copy */
 }
 
 
+#ifdef HOTCOLD_PARTICLE_LAYOUT
+/*! refresh the walk-critical copy (PHot) of all local particles from P. this is only needed when the tree is (re-)built, after
+ *  the domain exchange and re-ordering have moved the particles in P; every other write to the position, kernel length, or
+ *  current time of a particle (drift, kicks with HERMITE_INTEGRATION, black hole re-positioning, merge/split, box-wrapping,
+ *  re-centering, ...) is followed directly by PHOT_UPDATE() for that particle */
+void particle_hot_refresh_all(void)
+{
+    int i;
+#ifdef _OPENMP
+#pragma omp parallel for private(i)
+#endif
+    for(i = 0; i < NumPart; i++) {PHOT_UPDATE(i);}
+}
+#endif
+
+
 
 
 
@@ -353,6 +370,7 @@ void do_box_wrapping(void)
 #endif
             }
         }
+        PHOT_UPDATE(i);
     }
 }
 #endif
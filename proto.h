@@ -102,6 +102,23 @@ void calculate_non_standard_physics(void);
 void compute_statistics(void);
 void execute_resubmit_command(void);
 void make_list_of_active_particles(void);
+#ifdef ACTIVE_PARTICLE_ARRAY
+int active_particle_claim_chunk(int max_chunk, int *n_claimed);
+#endif
+#ifdef THREAD_WORK_STEALING_IS_ACTIVE
+void thread_scheduler_begin(int cost_type);
+int thread_scheduler_claim(int max_chunk, int *n_claimed);
+void thread_scheduler_end(void);
+void thread_scheduler_times(double *t_busy, double *t_idle);
+#endif
+#ifdef PERFORMANCE_TRACE
+void perf_timer_start(const char *name);
+void perf_timer_stop(const char *name);
+void perf_xchange_begin(void);
+void perf_xchange_thread_time(int thread_id, double dt);
+void perf_xchange_record(long long n_export, long long n_import, long long n_rounds, long long n_bytes, double t_comp, double t_comm, double t_wait);
+void perf_trace_write(double load, int do_output);
+#endif
 void output_extra_log_messages(void);
 
 
@@ -191,6 +208,9 @@ int MPI_Sizelimited_Sendrecv(void *sendbuf, int sendcount, MPI_Datatype sendtype
 			     MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status * status);
 
 int mpi_calculate_offsets(int *send_count, int *send_offset, int *recv_count, int *recv_offset, int send_identical);
+#ifdef USE_NONBLOCKING_XCHANGE
+void mpi_sparse_exchange_counts(int *send_count, int *recv_count);
+#endif
 void sort_based_on_field(void *data, int field_offset, int n_items, int item_size, void **data2ptr);
 void mpi_distribute_items_to_tasks(void *data, int task_offset, int *n_items, int *max_n, int item_size);
 
@@ -228,6 +248,9 @@ int compare_densities_for_sort(const void *a, const void *b);
 int io_compare_P_ID(const void *a, const void *b);
 int io_compare_P_GrNr_SubNr(const void *a, const void *b);
 void drift_particle(int i, integertime time1);
+#ifdef HOTCOLD_PARTICLE_LAYOUT
+void particle_hot_refresh_all(void);
+#endif
 void put_symbol(double t0, double t1, char c);
 void write_cpu_log(void);
 int get_timestep_bin(integertime ti_step);
@@ -354,6 +377,9 @@ void fof_make_black_holes(void);
 int io_compare_P_GrNr_ID(const void *a, const void *b);
 
 void write_file(char *fname, int readTask, int lastTask);
+#if defined(IO_PARALLEL_HDF5) && defined(HAVE_HDF5)
+void write_file_parallel_hdf5(char *fname);
+#endif
 
 void distribute_file(int nfiles, int firstfile, int firsttask, int lasttask, int *filenr, int *primary_taskID, int *last);
 
@@ -574,6 +600,9 @@ void chimes_compute_depletions(double nH, double T, int thread_id);
 #else
 #endif
 void cooling_parent_routine(void);
+#ifdef COOL_EQM_FASTPATH
+void cooling_fastpath_counts(long long *n_hit, long long *n_miss);
+#endif
 void count_hot_phase(void);
 void delete_node(int i);
 void density(void);
@@ -636,6 +665,9 @@ void reorder_particles(void);
 void restart(int modus);
 void run(void);
 void savepositions(int num);
+#ifdef IO_ASYNC_SNAPSHOTS
+void async_snapshot_wait(void);
+#endif
 void savepositions_ioformat1(int num);
 double my_second(void);
 void set_softenings(void);
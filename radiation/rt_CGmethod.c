@@ -233,7 +233,7 @@ void rt_diffusion_cg_matrix_multiply(double **matrixmult_in, double **matrixmult
     DataIndexTable = (struct data_index *) mymalloc("DataIndexTable", All.BunchSize * sizeof(struct data_index));
     DataNodeList = (struct data_nodelist *) mymalloc("DataNodeList", All.BunchSize * sizeof(struct data_nodelist));
     
-    NextParticle = FirstActiveParticle;	/* begin with this index */
+    NextParticle = ACTIVE_CURSOR_FIRST;	/* begin with this index */
     do
     {
         BufferFullFlag = 0;
@@ -278,9 +278,9 @@ void rt_diffusion_cg_matrix_multiply(double **matrixmult_in, double **matrixmult
             while(NextParticle >= 0)
             {
                 if(NextParticle == last_nextparticle) break;
-                if(ProcessedFlag[NextParticle] != 1) break;
-                ProcessedFlag[NextParticle] = 2;
-                NextParticle = NextActiveParticle[NextParticle];
+                if(ProcessedFlag[ACTIVE_CURSOR_PARTICLE(NextParticle)] != 1) break;
+                ProcessedFlag[ACTIVE_CURSOR_PARTICLE(NextParticle)] = 2;
+                NextParticle = ACTIVE_CURSOR_NEXT(NextParticle);
             }
             if(NextParticle == save_NextParticle)
             {
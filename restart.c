@@ -24,6 +24,10 @@ static ChimesFloat *sphAbundancesBuf;
 static void in(int *x, int modus);
 static void byten(void *x, size_t n, int modus);
 
+#ifdef IO_RESTART_ANY_NTASK
+static void restart_anytask(int modus);
+#endif
+
 int old_MaxPart = 0, new_MaxPart;
 
 
@@ -58,6 +62,13 @@ void restart(int modus)
     int partIndex, abunIndex; 
 #endif 
     
+#ifdef IO_ASYNC_SNAPSHOTS
+    if(modus == 0) {async_snapshot_wait();} /* make sure the last snapshot is complete on disk before the restart files */
+#endif
+#ifdef IO_RESTART_ANY_NTASK
+    restart_anytask(modus); return; /* decomposition-independent format, which can be read back on any number of tasks */
+#endif
+
     if(ThisTask == 0 && modus == 0) // writing re-start files: move old files to .bak
     {
         sprintf(buf, "%s/restartfiles", All.OutputDir);
@@ -390,3 +401,375 @@ void in(int *x, int modus)
   else
     my_fwrite(x, 1, sizeof(int), fd);
 }
+
+
+
+#ifdef IO_RESTART_ANY_NTASK
+/* Decomposition-independent restart files (IO_RESTART_ANY_NTASK). All tasks stream their particles (gas first) into their own
+    file at the same time, rather than in NumFilesWrittenInParallel groups. After a domain decomposition the particles on each
+    task are in Peano-Hilbert order, so each file holds one contiguous Peano-Hilbert range; the record counts of the files are
+    recorded in an index file written by task 0, together with the global data and a checksum for every block of RESTART_BLOCK_RECORDS records. On
+    reading, the files are treated as one global list of gas records followed by one of the other particles, which any number of
+    tasks read equal slices of; the checksums are verified, and a domain decomposition then moves the particles where they belong. */
+
+#define RESTART_ANYTASK_MAGIC   0x47495a52
+#define RESTART_ANYTASK_VERSION 2
+#define RESTART_BLOCK_RECORDS   16384
+#define RESTART_HASH_SEED       14695981039346656037ULL
+#define RESTART_BCAST_CHUNK     (1LL << 30) /* bytes per MPI_Bcast of the index */
+#ifdef CHIMES
+#define RESTART_N_STREAMS 5 /* P (gas), SphP, ChimesGasVars, CHIMES abundances, P (non-gas) */
+#else
+#define RESTART_N_STREAMS 3 /* P (gas), SphP, P (non-gas) */
+#endif
+
+struct restart_index_header
+{
+    int magic, version, ntask_written, size_all, rng_size, n_species;
+    int record_size[RESTART_N_STREAMS];
+    long long n_blocks;
+};
+
+struct restart_writer_info
+{
+    long long n_gas, n_other; /* records in this file */
+};
+
+static char *IndexCursor, *IndexEnd;
+static unsigned long long IndexHash;
+
+
+/* 64-bit FNV-1a hash of n bytes, continuing from h */
+static unsigned long long restart_hash(unsigned long long h, void *x, size_t n)
+{
+    unsigned char *c = (unsigned char *) x; size_t k;
+    for(k = 0; k < n; k++) {h ^= c[k]; h *= 1099511628211ULL;}
+    return h;
+}
+
+
+static size_t restart_record_size(int s, int n_species)
+{
+    if(s == 0 || s == RESTART_N_STREAMS-1) {return sizeof(struct particle_data);}
+    if(s == 1) {return sizeof(struct sph_particle_data);}
+#ifdef CHIMES
+    if(s == 2) {return sizeof(struct gasVariables);}
+    if(s == 3) {return n_species * sizeof(ChimesFloat);}
+#endif
+    return 0;
+}
+
+
+static long long restart_stream_records(struct restart_writer_info *wi, int s)
+{
+    if(s == RESTART_N_STREAMS-1) {return wi->n_other;}
+    return wi->n_gas;
+}
+
+
+static long long restart_n_blocks(long long n) {return (n + RESTART_BLOCK_RECORDS - 1) / RESTART_BLOCK_RECORDS;}
+
+
+static void restart_filename(char *buf, int writer, int use_bak)
+{
+    if(writer < 0) {sprintf(buf, "%s/restartfiles/%s.anytask.index%s", All.OutputDir, All.RestartFile, use_bak ? ".bak" : "");}
+    else {sprintf(buf, "%s/restartfiles/%s.anytask.%d%s", All.OutputDir, All.RestartFile, writer, use_bak ? ".bak" : "");}
+}
+
+
+/* writes one item of the index file (and adds it to the index checksum), or takes it from the index read into memory */
+static void restart_index_item(void *x, size_t n, int modus)
+{
+    if(modus)
+    {
+        if(IndexCursor + n > IndexEnd) {if(ThisTask == 0) {printf("Restart index file is truncated.\n");} endrun(7874);}
+        memcpy(x, IndexCursor, n); IndexCursor += n;
+    }
+    else
+    {
+        my_fwrite(x, n, 1, fd);
+        IndexHash = restart_hash(IndexHash, x, n);
+    }
+}
+
+
+/* the items shared by all tasks, kept in the index file */
+static void restart_index_globals(int modus)
+{
+    restart_index_item(&All, sizeof(struct global_data_all_processes), modus);
+    restart_index_item(gsl_rng_state(random_generator), gsl_rng_size(random_generator), modus);
+    restart_index_item(&SelRnd, sizeof(SelRnd), modus);
+#ifdef TURB_DRIVING
+    restart_index_item(gsl_rng_state(StRng), gsl_rng_size(StRng), modus);
+    restart_index_item(&StNModes, sizeof(StNModes), modus);
+    restart_index_item(StOUPhases, StNModes*6*sizeof(double), modus);
+    restart_index_item(StAmpl, StNModes*3*sizeof(double), modus);
+    restart_index_item(StAka, StNModes*3*sizeof(double), modus);
+    restart_index_item(StAkb, StNModes*3*sizeof(double), modus);
+    restart_index_item(StMode, StNModes*3*sizeof(double), modus);
+    restart_index_item(&StTPrev, sizeof(StTPrev), modus);
+#endif
+    restart_index_item(TimeBinActive, TIMEBINS * sizeof(int), modus);
+}
+
+
+/* index of the first block checksum of every stream of every writer, in the global list of block checksums */
+static long long restart_block_base(struct restart_writer_info *wi, int ntask_written, long long *block_base)
+{
+    long long n_blocks = 0; int w, s;
+    for(w = 0; w < ntask_written; w++)
+        for(s = 0; s < RESTART_N_STREAMS; s++) {block_base[w*RESTART_N_STREAMS + s] = n_blocks; n_blocks += restart_n_blocks(restart_stream_records(&wi[w], s));}
+    return n_blocks;
+}
+
+
+static void restart_anytask_write(void)
+{
+    char buf[500], buf_bak[500];
+    struct restart_index_header head;
+    struct restart_writer_info my_info, *wi = 0;
+    long long i, n_rec[RESTART_N_STREAMS], my_blocks = 0, *block_base;
+    int s, w, n_species = 0, *block_count = 0, *block_offset = 0;
+    unsigned long long *block_sum, *all_block_sum = 0;
+    char *stream_base[RESTART_N_STREAMS];
+#ifdef CHIMES
+    ChimesFloat *abundances; int k;
+    n_species = ChimesGlobalVars.totalNumberOfSpecies;
+#endif
+
+    rearrange_particle_sequence(); /* folds Gas_split and Stars_converted in, so that the gas is contiguous at the start of P */
+    All.NumForcesSinceLastDomainDecomp = (long long) (1 + All.TreeDomainUpdateFrequency * All.TotNumPart); /* ensures that new tree will be constructed */
+
+    if(ThisTask == 0) // move old files to .bak
+    {
+        sprintf(buf, "%s/restartfiles", All.OutputDir);
+        mkdir(buf, 02755);
+#ifndef NOCALLSOFSYSTEM
+        restart_filename(buf, -1, 0);
+        if((fd = fopen(buf, "r")))
+        {
+            if(fread(&head, sizeof(head), 1, fd) != 1 || head.magic != RESTART_ANYTASK_MAGIC) {head.ntask_written = 0;}
+            fclose(fd);
+            restart_filename(buf_bak, -1, 1); rename(buf, buf_bak);
+            for(w = 0; w < head.ntask_written; w++) {restart_filename(buf, w, 0); restart_filename(buf_bak, w, 1); rename(buf, buf_bak);}
+        }
+#endif
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    my_info.n_gas = N_gas; my_info.n_other = NumPart - N_gas;
+
+    stream_base[0] = (char *) P; stream_base[1] = (char *) SphP; stream_base[RESTART_N_STREAMS-1] = (char *) (P + N_gas);
+#ifdef CHIMES
+    abundances = (ChimesFloat *) malloc(((size_t) N_gas * n_species + 1) * sizeof(ChimesFloat));
+    for(i = 0; i < N_gas; i++) {for(k = 0; k < n_species; k++) {abundances[i * n_species + k] = ChimesGasVars[i].abundances[k];}}
+    stream_base[2] = (char *) ChimesGasVars; stream_base[3] = (char *) abundances;
+#endif
+    for(s = 0; s < RESTART_N_STREAMS; s++) {n_rec[s] = restart_stream_records(&my_info, s); my_blocks += restart_n_blocks(n_rec[s]);}
+    block_sum = (unsigned long long *) mymalloc("block_sum", (my_blocks + 1) * sizeof(unsigned long long));
+    memset(block_sum, 0, (my_blocks + 1) * sizeof(unsigned long long));
+
+    restart_filename(buf, ThisTask, 0); /* every task streams its own file at the same time */
+    if(!(fd = fopen(buf, "w"))) {printf("Restart file '%s' cannot be opened.\n", buf); endrun(7878);}
+    for(s = 0, my_blocks = 0; s < RESTART_N_STREAMS; s++)
+    {
+        size_t size = restart_record_size(s, n_species);
+        for(i = 0; i < n_rec[s]; i++) {block_sum[my_blocks + i / RESTART_BLOCK_RECORDS] += restart_hash(RESTART_HASH_SEED, stream_base[s] + i * size, size);}
+        if(n_rec[s] > 0) {my_fwrite(stream_base[s], size, n_rec[s], fd);}
+        my_blocks += restart_n_blocks(n_rec[s]);
+    }
+    fclose(fd);
+#ifdef CHIMES
+    free(abundances);
+#endif
+
+    /* collect the writer table and the block checksums on task 0, which writes the index once all the files are complete */
+    if(ThisTask == 0)
+    {
+        wi = (struct restart_writer_info *) mymalloc("wi", NTask * sizeof(struct restart_writer_info));
+        block_count = (int *) mymalloc("block_count", 2 * NTask * sizeof(int)); block_offset = block_count + NTask;
+    }
+    MPI_Gather(&my_info, sizeof(struct restart_writer_info), MPI_BYTE, wi, sizeof(struct restart_writer_info), MPI_BYTE, 0, MPI_COMM_WORLD);
+    int my_bytes = (int) (my_blocks * sizeof(unsigned long long));
+    MPI_Gather(&my_bytes, 1, MPI_INT, block_count, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if(ThisTask == 0)
+    {
+        block_base = (long long *) mymalloc("block_base", NTask * RESTART_N_STREAMS * sizeof(long long));
+        head.n_blocks = restart_block_base(wi, NTask, block_base);
+        all_block_sum = (unsigned long long *) mymalloc("all_block_sum", (head.n_blocks + 1) * sizeof(unsigned long long));
+        for(w = 0; w < NTask; w++) {block_offset[w] = (int) (block_base[w * RESTART_N_STREAMS] * sizeof(unsigned long long));}
+    }
+    MPI_Gatherv(block_sum, my_bytes, MPI_BYTE, all_block_sum, block_count, block_offset, MPI_BYTE, 0, MPI_COMM_WORLD);
+
+    if(ThisTask == 0)
+    {
+        head.magic = RESTART_ANYTASK_MAGIC; head.version = RESTART_ANYTASK_VERSION; head.ntask_written = NTask;
+        head.size_all = sizeof(struct global_data_all_processes); head.rng_size = gsl_rng_size(random_generator); head.n_species = n_species;
+        for(s = 0; s < RESTART_N_STREAMS; s++) {head.record_size[s] = restart_record_size(s, n_species);}
+
+        sprintf(buf_bak, "%s/restartfiles/%s.anytask.index.tmp", All.OutputDir, All.RestartFile);
+        if(!(fd = fopen(buf_bak, "w"))) {printf("Restart file '%s' cannot be opened.\n", buf_bak); endrun(7878);}
+        IndexHash = RESTART_HASH_SEED;
+        restart_index_item(&head, sizeof(head), 0);
+        restart_index_globals(0);
+        restart_index_item(wi, NTask * sizeof(struct restart_writer_info), 0);
+        restart_index_item(all_block_sum, head.n_blocks * sizeof(unsigned long long), 0);
+        my_fwrite(&IndexHash, sizeof(IndexHash), 1, fd);
+        fclose(fd);
+        restart_filename(buf, -1, 0); rename(buf_bak, buf); /* the index only appears once it is complete */
+
+        myfree(all_block_sum); myfree(block_base); myfree(block_count); myfree(wi);
+    }
+    myfree(block_sum);
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+
+/* reads the global records [lo,hi) of stream s from whichever files hold them, adding them to the block checksums as they come */
+static void restart_stream_read(struct restart_writer_info *wi, int ntask_written, long long *block_base, int s, int n_species, long long lo, long long hi, char *dest, unsigned long long *block_sum, int use_bak)
+{
+    char buf[500]; long long offset_w = 0, a, b, j; int w, s_prev; size_t size = restart_record_size(s, n_species);
+    for(w = 0; w < ntask_written && offset_w < hi; offset_w += restart_stream_records(&wi[w], s), w++)
+    {
+        a = (lo > offset_w) ? lo : offset_w; b = offset_w + restart_stream_records(&wi[w], s); if(b > hi) {b = hi;}
+        if(b <= a) {continue;}
+        off_t position = (off_t) (a - offset_w) * size;
+        for(s_prev = 0; s_prev < s; s_prev++) {position += (off_t) restart_stream_records(&wi[w], s_prev) * restart_record_size(s_prev, n_species);}
+        restart_filename(buf, w, use_bak);
+        if(!(fd = fopen(buf, "r"))) {printf("Restart file '%s' not found (task=%d).\n", buf, ThisTask); endrun(7870);}
+        if(fseeko(fd, position, SEEK_SET)) {printf("Restart file '%s' is truncated (task=%d).\n", buf, ThisTask); endrun(7873);}
+        my_fread(dest + (a - lo) * size, size, b - a, fd);
+        fclose(fd);
+        for(j = a; j < b; j++) {block_sum[block_base[w*RESTART_N_STREAMS + s] + (j - offset_w) / RESTART_BLOCK_RECORDS] += restart_hash(RESTART_HASH_SEED, dest + (j - lo) * size, size);}
+    }
+}
+
+
+static void restart_anytask_read(void)
+{
+    char buf[500], *index_buf = 0;
+    struct restart_index_header head;
+    struct restart_writer_info *wi;
+    long long i, index_size = 0, tot_gas = 0, tot_other = 0, gas_lo, gas_hi, other_lo, other_hi, *block_base, n_bad = 0;
+    unsigned long long *block_sum, *index_block_sum;
+    double save_PartAllocFactor = All.PartAllocFactor;
+    int s, w, use_bak, n_species = 0;
+#ifdef CHIMES
+    ChimesFloat *abundances; int k;
+    n_species = ChimesGlobalVars.totalNumberOfSpecies;
+#endif
+
+    if(ThisTask == 0) /* read and verify the index, falling back to the backup if it is missing or corrupted */
+    {
+        for(use_bak = 0; use_bak < 2; use_bak++)
+        {
+            restart_filename(buf, -1, use_bak);
+            if(!(fd = fopen(buf, "r"))) {continue;}
+            fseeko(fd, 0, SEEK_END); index_size = (long long) ftello(fd); rewind(fd);
+            if(index_size > (long long) sizeof(unsigned long long))
+            {
+                index_buf = (char *) malloc(index_size);
+                if(fread(index_buf, index_size, 1, fd) == 1)
+                {
+                    unsigned long long stored; memcpy(&stored, index_buf + index_size - sizeof(stored), sizeof(stored));
+                    if(restart_hash(RESTART_HASH_SEED, index_buf, index_size - sizeof(stored)) == stored) {fclose(fd); break;}
+                }
+                free(index_buf); index_buf = 0;
+            }
+            fclose(fd);
+            printf("Restart index file '%s' is incomplete or corrupted.\n", buf);
+        }
+        if(use_bak == 2) {printf("Fatal error. No valid restart index file found in '%s/restartfiles'.\n", All.OutputDir); endrun(7871);}
+        if(use_bak) {printf("Attempting to use the backup restart files.\n");}
+    }
+    MPI_Bcast(&use_bak, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&index_size, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    if(ThisTask != 0) {index_buf = (char *) malloc(index_size);}
+    for(i = 0; i < index_size; i += RESTART_BCAST_CHUNK) /* in pieces, the count of MPI_Bcast is an int */
+        {MPI_Bcast(index_buf + i, (int) DMIN(RESTART_BCAST_CHUNK, index_size - i), MPI_BYTE, 0, MPI_COMM_WORLD);}
+    IndexCursor = index_buf; IndexEnd = index_buf + index_size - sizeof(unsigned long long);
+
+    restart_index_item(&head, sizeof(head), 1);
+    int bad_format = (head.magic != RESTART_ANYTASK_MAGIC) || (head.version != RESTART_ANYTASK_VERSION) || (head.size_all != (int) sizeof(struct global_data_all_processes))
+        || (head.rng_size != (int) gsl_rng_size(random_generator)) || (head.n_species != n_species);
+    for(s = 0; s < RESTART_N_STREAMS; s++) {if(head.record_size[s] != (int) restart_record_size(s, n_species)) {bad_format = 1;}}
+    if(bad_format) {if(ThisTask == 0) {printf("Restart files were written by a code compiled with different options (structure sizes or format version differ).\n");} endrun(7872);}
+
+    restart_index_globals(1);
+    /* plain malloc for these, since they are freed after the particle storage is allocated */
+    wi = (struct restart_writer_info *) malloc(head.ntask_written * sizeof(struct restart_writer_info));
+    restart_index_item(wi, head.ntask_written * sizeof(struct restart_writer_info), 1);
+    index_block_sum = (unsigned long long *) malloc((head.n_blocks + 1) * sizeof(unsigned long long));
+    restart_index_item(index_block_sum, head.n_blocks * sizeof(unsigned long long), 1);
+    if(IndexCursor != IndexEnd) {if(ThisTask == 0) {printf("Restart index file has the wrong length.\n");} endrun(7874);}
+
+    for(w = 0; w < head.ntask_written; w++) {tot_gas += wi[w].n_gas; tot_other += wi[w].n_other;}
+    if(tot_gas != All.TotN_gas || tot_gas + tot_other != All.TotNumPart) {if(ThisTask == 0) {printf("Restart files do not hold the expected number of particles.\n");} endrun(7875);}
+    if(ThisTask == 0) {printf("Reading restart files written by %d tasks on %d tasks.\n", head.ntask_written, NTask); fflush(stdout);}
+
+    /* the particle numbers are set for the new number of tasks, always with the current PartAllocFactor */
+    All.PartAllocFactor = save_PartAllocFactor;
+    All.MaxPart = (int) (All.PartAllocFactor * (All.TotNumPart / NTask));
+    All.MaxPartSph = (int) (All.PartAllocFactor * (All.TotN_gas / NTask));
+#ifdef ALLOW_IMBALANCED_GASPARTICLELOAD
+    All.MaxPartSph = All.MaxPart;
+#endif
+    old_MaxPart = 0; new_MaxPart = All.MaxPart;
+    allocate_memory();
+
+    gas_lo = (tot_gas * ThisTask) / NTask; gas_hi = (tot_gas * (ThisTask + 1)) / NTask;
+    other_lo = (tot_other * ThisTask) / NTask; other_hi = (tot_other * (ThisTask + 1)) / NTask;
+    N_gas = (int) (gas_hi - gas_lo); NumPart = (int) (N_gas + other_hi - other_lo);
+    if(NumPart > All.MaxPart || N_gas > All.MaxPartSph)
+    {
+        printf("it seems you have set 'PartAllocFactor' below the value needed to load the restart file (task=%d NumPart=%d MaxPart=%d N_gas=%d MaxPartSph=%d).\n", ThisTask, NumPart, All.MaxPart, N_gas, All.MaxPartSph);
+        endrun(22);
+    }
+
+    block_base = (long long *) malloc(head.ntask_written * RESTART_N_STREAMS * sizeof(long long));
+    restart_block_base(wi, head.ntask_written, block_base);
+    block_sum = (unsigned long long *) malloc((head.n_blocks + 1) * sizeof(unsigned long long));
+    memset(block_sum, 0, (head.n_blocks + 1) * sizeof(unsigned long long));
+
+    restart_stream_read(wi, head.ntask_written, block_base, 0, n_species, gas_lo, gas_hi, (char *) P, block_sum, use_bak);
+    restart_stream_read(wi, head.ntask_written, block_base, 1, n_species, gas_lo, gas_hi, (char *) SphP, block_sum, use_bak);
+#ifdef CHIMES
+    abundances = (ChimesFloat *) malloc(((size_t) N_gas * n_species + 1) * sizeof(ChimesFloat));
+    restart_stream_read(wi, head.ntask_written, block_base, 2, n_species, gas_lo, gas_hi, (char *) ChimesGasVars, block_sum, use_bak);
+    restart_stream_read(wi, head.ntask_written, block_base, 3, n_species, gas_lo, gas_hi, (char *) abundances, block_sum, use_bak);
+#endif
+    restart_stream_read(wi, head.ntask_written, block_base, RESTART_N_STREAMS-1, n_species, other_lo, other_hi, (char *) (P + N_gas), block_sum, use_bak);
+
+    /* every block was read by one or several tasks, whose partial sums together must give the checksum written */
+    MPI_Allreduce(MPI_IN_PLACE, block_sum, (int) head.n_blocks, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    for(i = 0; i < head.n_blocks; i++) {if(block_sum[i] != index_block_sum[i]) {n_bad++;}}
+    if(n_bad) {if(ThisTask == 0) {printf("Restart files are corrupted: %lld of %lld blocks fail their checksum.\n", n_bad, head.n_blocks);} endrun(7873);}
+
+#ifdef CHIMES
+    for(i = 0; i < N_gas; i++)
+    {
+        allocate_gas_abundances_memory(&(ChimesGasVars[i]), &ChimesGlobalVars);
+        for(k = 0; k < n_species; k++) {ChimesGasVars[i].abundances[k] = abundances[i * n_species + k];}
+#ifdef CHIMES_TURB_DIFF_IONS
+        chimes_update_turbulent_abundances(i, 1);
+#endif
+    }
+    free(abundances);
+#endif
+    Gas_split = 0; /* these were folded into the particle list before writing */
+#ifdef GALSF
+    Stars_converted = 0;
+#endif
+
+    free(block_sum); free(block_base); free(index_block_sum); free(wi); free(index_buf);
+
+    if(ThisTask == 0) {printf("Restart files read and verified.\n"); fflush(stdout);}
+    /* the particles are now in arbitrary slices: begrun() does the domain decomposition, once the parameter-file values are restored */
+}
+
+
+static void restart_anytask(int modus)
+{
+    if(modus) {restart_anytask_read();} else {restart_anytask_write();}
+}
+#endif
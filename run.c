@@ -269,6 +269,7 @@ void gammie_cool()
 
 void calculate_non_standard_physics(void)
 {
+    PERF_TIMER_START("non_standard_physics");
 #ifdef PARTICLE_EXCISION
     apply_excision();
 #endif
@@ -346,9 +347,11 @@ void calculate_non_standard_physics(void)
       for(i=0;i<NumPart;i++)
       {
         for(k=0;k<3;k++) {P[i].Pos[k]-=xcmt[k]; P[i].Vel[k]-=vcmt[k]; if(P[i].Type==0) SphP[i].VelPred[k]-=vcmt[k];}
+        PHOT_UPDATE(i);
       }
      }
 #endif
+    PERF_TIMER_STOP("non_standard_physics");
 }
 
 void compute_statistics(void)
@@ -391,6 +394,7 @@ void find_next_sync_point_and_drift(void)
   integertime dt_bin, ti_next_for_bin, ti_next_kick, ti_next_kick_global;
   int highest_active_bin, highest_occupied_bin;
   double timeold;
+  PERF_TIMER_START("find_next_sync_point_and_drift");
 
   timeold = All.Time;
 
@@ -498,15 +502,25 @@ void find_next_sync_point_and_drift(void)
    * may still need to old list in the dynamic tree update */
   for(n = 0, prev = -1; n < TIMEBINS; n++)
     {if(TimeBinActive[n]) {for(i = FirstInTimeBin[n]; i >= 0; i = NextInTimeBin[i]) {drift_particle(i, All.Ti_Current);}}}
-
+  PERF_TIMER_STOP("find_next_sync_point_and_drift");
 }
 
 
+#ifdef THREAD_WORK_STEALING_IS_ACTIVE
+static int active_particle_compare_index(const void *a, const void *b)
+{
+    return (*(const int *) a > *(const int *) b) - (*(const int *) a < *(const int *) b);
+}
+#endif
+
 void make_list_of_active_particles(void)
 {
     int i, n, prev;
     /* make a link list with the particles in the active time bins */
     FirstActiveParticle = -1;
+#ifdef ACTIVE_PARTICLE_ARRAY
+    NumActiveParticle = 0;
+#endif
 
     for(n = 0, prev = -1; n < TIMEBINS; n++)
     {
@@ -518,12 +532,45 @@ void make_list_of_active_particles(void)
                 if(prev == -1) {FirstActiveParticle = i;}
                 if(prev >= 0) {NextActiveParticle[prev] = i;}
                 prev = i;
+#ifdef ACTIVE_PARTICLE_ARRAY
+                ActiveParticleList[NumActiveParticle++] = i; /* the same set in the same order, stored contiguously */
+#endif
             }
         }
     }
 
     if(prev >= 0) {NextActiveParticle[prev] = -1;}
+#ifdef THREAD_WORK_STEALING_IS_ACTIVE
+    qsort(ActiveParticleList, NumActiveParticle, sizeof(int), active_particle_compare_index); /* index order follows the Peano-Hilbert curve, so the ranges of the threads are compact */
+#endif
+}
+
+
+#ifdef ACTIVE_PARTICLE_ARRAY
+/*! claims the next chunk of (at most max_chunk) consecutive slots of ActiveParticleList for the calling thread, in the loops over local
+ *  particles: the shared position NextParticle is advanced with a compare-and-swap, so no lock is needed. The chunks shrink as the list is used
+ *  up (to ~1/4 of the remaining slots per thread), so the threads rarely contend at the start and still finish together. The claimed particles
+ *  are marked as not (yet) processed. Returns the first slot of the chunk, with its length in *n_claimed, or -1 if the list is used up. */
+int active_particle_claim_chunk(int max_chunk, int *n_claimed)
+{
+#ifdef THREAD_WORK_STEALING_IS_ACTIVE
+    return thread_scheduler_claim(max_chunk, n_claimed); /* the threads take work from their own ranges instead (set up by thread_scheduler_begin) */
+#else
+    int first, next, n, k;
+    do
+    {
+        first = NextParticle;
+        if(first < 0) {*n_claimed = 0; return -1;}
+        n = IMAX(1, IMIN(max_chunk, (NumActiveParticle - first) / (4 * maxThreads)));
+        next = (first + n < NumActiveParticle) ? (first + n) : -1;
+    }
+    while(!__sync_bool_compare_and_swap(&NextParticle, first, next));
+    for(k = first; k < first + n; k++) {ProcessedFlag[ActiveParticleList[k]] = 0;}
+    *n_claimed = n;
+    return first;
+#endif
 }
+#endif
 
 
 
@@ -820,6 +867,16 @@ void write_cpu_log(void)
       All.CPU_TimeBinMeasurements[All.HighestActiveTimeBin][All.CPU_TimeBinCountMeasurements[All.HighestActiveTimeBin]++] = max_CPU_Step[0];
     }
 
+#ifdef PERFORMANCE_TRACE
+    int perf_do_output = 1; /* the load of this task: its time outside of the waits for the other tasks */
+    double perf_load = CPU_Step[0] - (CPU_Step[CPU_TREEWAIT1] + CPU_Step[CPU_TREEWAIT2] + CPU_Step[CPU_DENSWAIT] + CPU_Step[CPU_HYDWAIT] + CPU_Step[CPU_COOLSFRIMBAL]
+                                      + CPU_Step[CPU_AGSDENSWAIT] + CPU_Step[CPU_DYNDIFFWAIT] + CPU_Step[CPU_IMPROVDIFFWAIT]);
+#ifdef IO_REDUCED_MODE
+    if(All.HighestActiveTimeBin != All.HighestOccupiedTimeBin) {perf_do_output = 0;} /* written with the cpu log, on global timesteps */
+#endif
+    perf_trace_write(perf_load, perf_do_output);
+#endif
+
     CPUThisRun += CPU_Step[0];
 
     for(i = 0; i < CPU_PARTS; i++) {CPU_Step[i] = 0;}
@@ -828,6 +885,22 @@ void write_cpu_log(void)
         for(i = 0; i < CPU_PARTS; i++) {All.CPU_Sum[i] += avg_CPU_Step[i];}
     }
 
+#ifdef COOL_EQM_FASTPATH
+    static long long cool_fastpath_N_sinceprint[2], cool_fastpath_N_total[2]; /* hits and misses, summed over tasks (on task 0) */
+    long long cool_fastpath_N_local[2], cool_fastpath_N_sum[2] = {0, 0};
+    cooling_fastpath_counts(&cool_fastpath_N_local[0], &cool_fastpath_N_local[1]);
+    MPI_Reduce(cool_fastpath_N_local, cool_fastpath_N_sum, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    for(i = 0; i < 2; i++) {cool_fastpath_N_sinceprint[i] += cool_fastpath_N_sum[i]; cool_fastpath_N_total[i] += cool_fastpath_N_sum[i];}
+#endif
+
+#ifdef THREAD_WORK_STEALING_IS_ACTIVE
+    static double thread_time_sinceprint[2], thread_time_total[2]; /* busy and idle thread-seconds in the scheduled loops, summed over tasks (on task 0) */
+    double thread_time_local[2], thread_time_sum[2] = {0, 0};
+    thread_scheduler_times(&thread_time_local[0], &thread_time_local[1]);
+    MPI_Reduce(thread_time_local, thread_time_sum, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    for(i = 0; i < 2; i++) {thread_time_sinceprint[i] += thread_time_sum[i]; thread_time_total[i] += thread_time_sum[i];}
+#endif
+
 #ifdef IO_REDUCED_MODE
     if(All.HighestActiveTimeBin == All.HighestOccupiedTimeBin) // only do the actual -print- operation on global timesteps
 #endif
@@ -980,6 +1053,20 @@ void write_cpu_log(void)
     All.CPU_Sum[CPU_RTNONFLUXOPS], (All.CPU_Sum[CPU_RTNONFLUXOPS]) / All.CPU_Sum[CPU_ALL] * 100,
 #endif
     All.CPU_Sum[CPU_MISC], (All.CPU_Sum[CPU_MISC]) / All.CPU_Sum[CPU_ALL] * 100);
+#ifdef COOL_EQM_FASTPATH
+    fprintf(FdCPU, "cooling fastpath: hits=%lld misses=%lld (since last entry), hits=%lld misses=%lld (run total)\n",
+        cool_fastpath_N_sinceprint[0], cool_fastpath_N_sinceprint[1], cool_fastpath_N_total[0], cool_fastpath_N_total[1]);
+    cool_fastpath_N_sinceprint[0] = cool_fastpath_N_sinceprint[1] = 0;
+#endif
+#ifdef THREAD_WORK_STEALING_IS_ACTIVE
+    fprintf(FdCPU, "threads in particle loops: busy=%.2f idle=%.2f (%.1f%% idle) thread-sec since last entry, busy=%.2f idle=%.2f (%.1f%% idle) run total\n",
+        thread_time_sinceprint[0], thread_time_sinceprint[1], 100. * thread_time_sinceprint[1] / (MIN_REAL_NUMBER + thread_time_sinceprint[0] + thread_time_sinceprint[1]),
+        thread_time_total[0], thread_time_total[1], 100. * thread_time_total[1] / (MIN_REAL_NUMBER + thread_time_total[0] + thread_time_total[1]));
+    thread_time_sinceprint[0] = thread_time_sinceprint[1] = 0;
+#endif
+#ifdef DOMAIN_MULTICONSTRAINT
+    domain_multiconstraint_report(FdCPU);
+#endif
 
     fprintf(FdCPU, "\n");
     fflush(FdCPU);
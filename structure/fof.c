@@ -43,6 +43,9 @@ static struct fofdata_in
   MyFloat Hsml;
   MyIDType MinID;
   MyIDType MinIDTask;
+#ifdef FOF_UNIONFIND
+  int Head; /* local index of the group on the sending task */
+#endif
   int NodeList[NODELISTLENGTH];
 }
  *FoFDataIn, *FoFDataGet;
@@ -79,6 +82,31 @@ static int MyFOF_GROUP_MIN_SIZE;
 static MyIDType *Head, *Len, *Next, *Tail, *MinID, *MinIDTask;
 static char *NonlocalFlag;
 
+#ifdef FOF_UNIONFIND
+/* links between local groups and groups on other tasks, found in the (single) exchange round of fof_find_groups */
+static struct fof_uf_label
+{
+  MyIDType MinID; /* smallest particle ID in the group: this orders the labels */
+  int Task;
+  int Head;
+}
+ *UFLabel, *UFNewLabel, *UFGrandParent;
+
+static struct fof_uf_link
+{
+  int Head; /* local group */
+  struct fof_uf_label Other; /* group on another task */
+}
+ *UFLink;
+
+static long UFNlink, UFMaxLink;
+static int *UFParent;
+
+static void fof_link_local_unionfind(int *marked, int *npart);
+static void fof_uf_add_link(int head, MyIDType minid, MyIDType task, int remote_head);
+static void fof_join_across_tasks(void);
+#endif
+
 
 static float *fof_nearest_distance;
 static float *fof_nearest_hsml;
@@ -355,7 +383,11 @@ void fof_find_groups(void)
 
   /* allocate buffers to arrange communication */
 
+#ifdef FOF_UNIONFIND
+  Ngblist = (int *) mymalloc("Ngblist", maxThreads * NumPart * sizeof(int)); /* one list per thread for the local linking */
+#else
   Ngblist = (int *) mymalloc("Ngblist", NumPart * sizeof(int));
+#endif
 
     size_t MyBufferSize = All.BufferSize;
     All.BunchSize = (int) ((MyBufferSize * 1024 * 1024) / (sizeof(struct data_index) + sizeof(struct data_nodelist) +
@@ -371,6 +403,9 @@ void fof_find_groups(void)
   t0 = my_second();
 
   /* first, link only among local particles */
+#ifdef FOF_UNIONFIND
+  fof_link_local_unionfind(&marked, &npart);
+#else
   for(i = 0, marked = 0, npart = 0; i < NumPart; i++)
     {
       if(((1 << P[i].Type) & (MyFOF_PRIMARY_LINK_TYPES)))
@@ -383,6 +418,7 @@ void fof_find_groups(void)
 	    marked++;
 	}
     }
+#endif
 
 
   sumup_large_ints(1, &marked, &totmarked);
@@ -466,6 +502,9 @@ void fof_find_groups(void)
 	      FoFDataIn[j].Pos[2] = P[place].Pos[2];
 	      FoFDataIn[j].MinID = MinID[Head[place]];
 	      FoFDataIn[j].MinIDTask = MinIDTask[Head[place]];
+#ifdef FOF_UNIONFIND
+	      FoFDataIn[j].Head = Head[place];
+#endif
 
 	      memcpy(FoFDataIn[j].NodeList,
 		     DataNodeList[DataIndexTable[j].IndexGet].NodeList, NODELISTLENGTH * sizeof(int));
@@ -566,6 +605,9 @@ void fof_find_groups(void)
 	    MinIDOld[i] = MinID[Head[i]];
 	  }
 
+#ifdef FOF_UNIONFIND
+      link_across_tot = 0; /* a single round, which only recorded the links to groups on other tasks: these are joined below */
+#endif
     }
   while(link_across_tot > 0);
 
@@ -578,6 +620,10 @@ void fof_find_groups(void)
   myfree(DataIndexTable);
   myfree(Ngblist);
 
+#ifdef FOF_UNIONFIND
+  fof_join_across_tasks();
+#endif
+
 PRINT_STATUS("Local groups found.");
 }
 
@@ -612,7 +658,7 @@ int fof_find_dmparticles_evaluate(int target, int mode, int *nexport, int *nsend
 	{
 	  if(mode == -1) {*nexport = 0;}
 
-	  numngb_inbox = ngb_treefind_fof_primary(pos, LinkL, target, &startnode, mode, nexport, nsend_local, MyFOF_PRIMARY_LINK_TYPES);
+	  numngb_inbox = ngb_treefind_fof_primary(pos, LinkL, target, &startnode, mode, nexport, nsend_local, MyFOF_PRIMARY_LINK_TYPES, Ngblist);
 	  if(numngb_inbox < 0) {return -2;}
 
 	  if(mode == -1) {if(*nexport == 0) {NonlocalFlag[target] = 0;} else {NonlocalFlag[target] = 1;}}
@@ -659,12 +705,17 @@ int fof_find_dmparticles_evaluate(int target, int mode, int *nexport, int *nsend
 		}
 	      else		/* mode is 1 */
 		{
+#ifdef FOF_UNIONFIND
+		  fof_uf_add_link(Head[j], FoFDataGet[target].MinID, FoFDataGet[target].MinIDTask, FoFDataGet[target].Head);
+		  links++;
+#else
 		  if(MinID[Head[j]] > FoFDataGet[target].MinID)
 		    {
 		      MinID[Head[j]] = FoFDataGet[target].MinID;
 		      MinIDTask[Head[j]] = FoFDataGet[target].MinIDTask;
 		      links++;
 		    }
+#endif
 		}
 	    }
 	}
@@ -686,6 +737,356 @@ int fof_find_dmparticles_evaluate(int target, int mode, int *nexport, int *nsend
 
 
 
+#ifdef FOF_UNIONFIND
+/* Union-find version of the FoF linking (FOF_UNIONFIND). Locally, all threads link the particles at once into a lock-free
+    union-find forest (UFParent), which is then converted into the Head/Next/Tail/Len lists used by the rest of the group finder.
+    Across tasks, a single exchange round records which local groups touch which groups on other tasks, and the connected
+    components of this (much smaller) graph of groups are then found with a distributed min-label propagation with pointer
+    jumping (the 'FastSV' variant of the Shiloach-Vishkin algorithm). This needs O(log) rounds, rather than (at least) one
+    full exchange round for every task that a group crosses. */
+
+struct fof_uf_hook
+{
+  int Task; /* where it is sent */
+  int Head;
+  struct fof_uf_label Label;
+};
+
+
+static int fof_uf_find(int i)
+{
+  int p, gp;
+  while(1)
+    {
+      p = UFParent[i];
+      if(p == i) {return i;}
+      gp = UFParent[p];
+      if(gp == p) {return p;}
+      __sync_bool_compare_and_swap(&UFParent[i], p, gp); /* path halving: it does not matter if another thread got there first */
+      i = gp;
+    }
+}
+
+
+static void fof_uf_union(int a, int b)
+{
+  while(1)
+    {
+      a = fof_uf_find(a);
+      b = fof_uf_find(b);
+      if(a == b) {return;}
+      if(a < b) {int tmp = a; a = b; b = tmp;}
+      if(__sync_bool_compare_and_swap(&UFParent[a], a, b)) {return;} /* roots are only ever hung below smaller indices, so no cycles can form */
+    }
+}
+
+
+static void fof_link_local_unionfind(int *marked, int *npart)
+{
+  int i, r, n_marked = 0, n_part = 0;
+
+  UFParent = (int *) mymalloc("UFParent", NumPart * sizeof(int));
+  for(i = 0; i < NumPart; i++) {UFParent[i] = i;}
+
+#ifdef _OPENMP
+#pragma omp parallel for private(i) schedule(dynamic, 256) reduction(+:n_marked,n_part)
+#endif
+  for(i = 0; i < NumPart; i++)
+    {
+      if(!((1 << P[i].Type) & (MyFOF_PRIMARY_LINK_TYPES))) {continue;}
+#ifdef _OPENMP
+      int *ngblist = Ngblist + omp_get_thread_num() * NumPart;
+#else
+      int *ngblist = Ngblist;
+#endif
+      int n, numngb, startnode = All.MaxPart, nexport = 0, dummy;
+      numngb = ngb_treefind_fof_primary(P[i].Pos, LinkL, i, &startnode, -1, &nexport, &dummy, MyFOF_PRIMARY_LINK_TYPES, ngblist);
+      NonlocalFlag[i] = (nexport > 0) ? 1 : 0;
+      for(n = 0; n < numngb; n++) {fof_uf_union(i, ngblist[n]);}
+      n_part++;
+      if(NonlocalFlag[i]) {n_marked++;}
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for private(i)
+#endif
+  for(i = 0; i < NumPart; i++) {UFParent[i] = fof_uf_find(i);}
+
+  /* each root is the smallest index in its set, so it already heads its list when its members are appended */
+  for(i = 0; i < NumPart; i++)
+    {
+      r = UFParent[i];
+      if(r == i) {continue;}
+      Head[i] = r;
+      Next[Tail[r]] = i;
+      Tail[r] = i;
+      Len[r]++;
+      if(MinID[i] < MinID[r])
+	{
+	  MinID[r] = MinID[i];
+	  MinIDTask[r] = MinIDTask[i];
+	}
+    }
+  myfree(UFParent);
+
+  UFLink = NULL;
+  UFNlink = UFMaxLink = 0;
+  *marked = n_marked;
+  *npart = n_part;
+}
+
+
+static void fof_uf_add_link(int head, MyIDType minid, MyIDType task, int remote_head)
+{
+  if(UFNlink > 0 && UFLink[UFNlink - 1].Head == head && UFLink[UFNlink - 1].Other.Head == remote_head && UFLink[UFNlink - 1].Other.Task == (int) task)
+    return; /* the usual repeat: more neighbors of the same imported particle in the same group (the rest are removed later) */
+
+  if(UFNlink >= UFMaxLink)
+    {
+      /* plain realloc, since this grows while the exchange buffers are allocated and freed above it */
+      UFMaxLink = 2 * UFMaxLink + 1024;
+      if(!(UFLink = (struct fof_uf_link *) realloc(UFLink, UFMaxLink * sizeof(struct fof_uf_link))))
+	{
+	  printf("Task=%d: failed to allocate %ld cross-task FoF links\n", ThisTask, UFMaxLink);
+	  endrun(8815);
+	}
+    }
+  UFLink[UFNlink].Head = head;
+  UFLink[UFNlink].Other.MinID = minid;
+  UFLink[UFNlink].Other.Task = (int) task;
+  UFLink[UFNlink].Other.Head = remote_head;
+  UFNlink++;
+}
+
+
+static int fof_uf_label_less(struct fof_uf_label *a, struct fof_uf_label *b)
+{
+  if(a->MinID != b->MinID) {return a->MinID < b->MinID;}
+  if(a->Task != b->Task) {return a->Task < b->Task;}
+  return a->Head < b->Head;
+}
+
+
+static int fof_compare_uf_link(const void *a, const void *b)
+{
+  const struct fof_uf_link *la = (const struct fof_uf_link *) a, *lb = (const struct fof_uf_link *) b;
+  if(la->Other.Task != lb->Other.Task) {return (la->Other.Task < lb->Other.Task) ? -1 : 1;}
+  if(la->Head != lb->Head) {return (la->Head < lb->Head) ? -1 : 1;}
+  if(la->Other.Head != lb->Other.Head) {return (la->Other.Head < lb->Other.Head) ? -1 : 1;}
+  return 0;
+}
+
+
+static int fof_compare_uf_hook_task(const void *a, const void *b)
+{
+  return ((const struct fof_uf_hook *) a)->Task - ((const struct fof_uf_hook *) b)->Task;
+}
+
+
+/* sends the items in send (sorted by destination, Send_count[task] of them for each task, none to this task), and returns
+    the items received, ordered by the sending task (Recv_count[task] from each) */
+static void *fof_uf_exchange(void *send, size_t size, int *nrecv)
+{
+  int j, ngrp, recvTask;
+  char *recv;
+
+  MPI_Alltoall(Send_count, 1, MPI_INT, Recv_count, 1, MPI_INT, MPI_COMM_WORLD);
+  for(j = 0, *nrecv = 0, Recv_offset[0] = 0, Send_offset[0] = 0; j < NTask; j++)
+    {
+      *nrecv += Recv_count[j];
+      if(j > 0)
+	{
+	  Send_offset[j] = Send_offset[j - 1] + Send_count[j - 1];
+	  Recv_offset[j] = Recv_offset[j - 1] + Recv_count[j - 1];
+	}
+    }
+  recv = (char *) mymalloc("UFRecv", (*nrecv + 1) * size);
+
+  for(ngrp = 1; ngrp < (1 << PTask); ngrp++)
+    {
+      recvTask = ThisTask ^ ngrp;
+      if(recvTask < NTask)
+	if(Send_count[recvTask] > 0 || Recv_count[recvTask] > 0)
+	  MPI_Sendrecv((char *) send + Send_offset[recvTask] * size, Send_count[recvTask] * size, MPI_BYTE, recvTask, TAG_FOF_C,
+		       recv + Recv_offset[recvTask] * size, Recv_count[recvTask] * size, MPI_BYTE, recvTask, TAG_FOF_C,
+		       MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+  return recv;
+}
+
+
+/* lowers the new label of the local group 'head' to 'label', if that is smaller */
+static void fof_uf_lower_label(int *node_of_head, int head, struct fof_uf_label *label)
+{
+  int k = node_of_head[head];
+  if(fof_uf_label_less(label, &UFNewLabel[k])) {UFNewLabel[k] = *label;}
+}
+
+
+static void fof_join_across_tasks(void)
+{
+  int j, k, n, nrecv, nnodes, nhook, rounds = 0, changed, *node_of_head, *node_head, *req_out, *req_in, *req_node;
+  long long changed_tot, nlinks_tot, nnodes_tot;
+  struct fof_uf_link *link_out, *link_in;
+  struct fof_uf_hook *hook_out, *hook_in, *hook_in2, *parent_hook;
+  struct fof_uf_label *rep_out, *rep_in;
+  double t0 = my_second(), t1;
+
+  /* every task needs all the links of its own groups: the exchange finds each link from both sides, but only as far as the
+      tree geometry guarantees it, so each link is also sent to the task of the other group */
+  qsort(UFLink, UFNlink, sizeof(struct fof_uf_link), fof_compare_uf_link);
+  for(j = 0; j < NTask; j++) {Send_count[j] = 0;}
+  link_out = (struct fof_uf_link *) mymalloc("link_out", (UFNlink + 1) * sizeof(struct fof_uf_link));
+  for(n = 0; n < UFNlink; n++)
+    {
+      Send_count[UFLink[n].Other.Task]++;
+      link_out[n].Head = UFLink[n].Other.Head;
+      link_out[n].Other.MinID = MinID[UFLink[n].Head];
+      link_out[n].Other.Task = ThisTask;
+      link_out[n].Other.Head = UFLink[n].Head;
+    }
+  link_in = (struct fof_uf_link *) fof_uf_exchange(link_out, sizeof(struct fof_uf_link), &nrecv);
+  if(UFNlink + nrecv > UFMaxLink)
+    {
+      UFMaxLink = UFNlink + nrecv;
+      if(!(UFLink = (struct fof_uf_link *) realloc(UFLink, UFMaxLink * sizeof(struct fof_uf_link))))
+	{
+	  printf("Task=%d: failed to allocate %ld cross-task FoF links\n", ThisTask, UFMaxLink);
+	  endrun(8815);
+	}
+    }
+  memcpy(UFLink + UFNlink, link_in, nrecv * sizeof(struct fof_uf_link));
+  UFNlink += nrecv;
+  myfree(link_in);
+  myfree(link_out);
+
+  qsort(UFLink, UFNlink, sizeof(struct fof_uf_link), fof_compare_uf_link); /* sorted by the task of the other group, as needed for sending */
+  for(n = 0, k = 0; n < UFNlink; n++)
+    if(k == 0 || fof_compare_uf_link(&UFLink[n], &UFLink[k - 1]) != 0)
+      UFLink[k++] = UFLink[n];
+  UFNlink = k;
+
+  /* the nodes of the graph are the local groups with links */
+  node_of_head = (int *) mymalloc("node_of_head", NumPart * sizeof(int));
+  node_head = (int *) mymalloc("node_head", (UFNlink + 1) * sizeof(int));
+  for(j = 0; j < NumPart; j++) {node_of_head[j] = -1;}
+  for(n = 0, nnodes = 0; n < UFNlink; n++)
+    if(node_of_head[UFLink[n].Head] < 0)
+      {
+	node_of_head[UFLink[n].Head] = nnodes;
+	node_head[nnodes++] = UFLink[n].Head;
+      }
+  UFLabel = (struct fof_uf_label *) mymalloc("UFLabel", 3 * (nnodes + 1) * sizeof(struct fof_uf_label));
+  UFNewLabel = UFLabel + (nnodes + 1);
+  UFGrandParent = UFNewLabel + (nnodes + 1);
+  for(k = 0; k < nnodes; k++)
+    {
+      UFLabel[k].MinID = MinID[node_head[k]];
+      UFLabel[k].Task = ThisTask;
+      UFLabel[k].Head = node_head[k];
+    }
+
+  do
+    {
+      /* grandparents: the label of the group which is each node's label */
+      for(j = 0; j < NTask; j++) {Send_count[j] = 0;}
+      for(k = 0; k < nnodes; k++)
+	{
+	  if(UFLabel[k].Task == ThisTask) {UFGrandParent[k] = UFLabel[node_of_head[UFLabel[k].Head]];}
+	  else {Send_count[UFLabel[k].Task]++;}
+	}
+      req_out = (int *) mymalloc("req_out", 2 * (nnodes + 1) * sizeof(int));
+      req_node = req_out + (nnodes + 1);
+      for(j = 0, n = 0; j < NTask; j++) {Send_offset[j] = n; n += Send_count[j];}
+      for(k = 0; k < nnodes; k++)
+	if(UFLabel[k].Task != ThisTask)
+	  {
+	    n = Send_offset[UFLabel[k].Task]++;
+	    req_out[n] = UFLabel[k].Head;
+	    req_node[n] = k;
+	  }
+      req_in = (int *) fof_uf_exchange(req_out, sizeof(int), &nrecv);
+      rep_out = (struct fof_uf_label *) mymalloc("rep_out", (nrecv + 1) * sizeof(struct fof_uf_label));
+      for(n = 0; n < nrecv; n++) {rep_out[n] = UFLabel[node_of_head[req_in[n]]];}
+      for(j = 0; j < NTask; j++) {Send_count[j] = Recv_count[j];}
+      rep_in = (struct fof_uf_label *) fof_uf_exchange(rep_out, sizeof(struct fof_uf_label), &nrecv); /* the replies come back in the order of the requests */
+      for(n = 0; n < nrecv; n++) {UFGrandParent[req_node[n]] = rep_in[n];}
+      myfree(rep_in);
+      myfree(rep_out);
+      myfree(req_in);
+      myfree(req_out);
+
+      /* hooking: across every link, the other group and its label take the grandparent of this one if that is smaller */
+      for(k = 0; k < nnodes; k++) {UFNewLabel[k] = UFLabel[k];}
+      for(j = 0; j < NTask; j++) {Send_count[j] = 0;}
+      hook_out = (struct fof_uf_hook *) mymalloc("hook_out", (UFNlink + 1) * sizeof(struct fof_uf_hook));
+      for(n = 0; n < UFNlink; n++)
+	{
+	  hook_out[n].Task = UFLink[n].Other.Task;
+	  hook_out[n].Head = UFLink[n].Other.Head;
+	  hook_out[n].Label = UFGrandParent[node_of_head[UFLink[n].Head]];
+	  Send_count[hook_out[n].Task]++;
+	}
+      hook_in = (struct fof_uf_hook *) fof_uf_exchange(hook_out, sizeof(struct fof_uf_hook), &nrecv);
+      parent_hook = (struct fof_uf_hook *) mymalloc("parent_hook", (nrecv + 1) * sizeof(struct fof_uf_hook));
+      for(n = 0, nhook = 0; n < nrecv; n++)
+	{
+	  fof_uf_lower_label(node_of_head, hook_in[n].Head, &hook_in[n].Label);
+	  k = node_of_head[hook_in[n].Head];
+	  if(UFLabel[k].Task == ThisTask) {fof_uf_lower_label(node_of_head, UFLabel[k].Head, &hook_in[n].Label);}
+	  else
+	    {
+	      parent_hook[nhook].Task = UFLabel[k].Task;
+	      parent_hook[nhook].Head = UFLabel[k].Head;
+	      parent_hook[nhook++].Label = hook_in[n].Label;
+	    }
+	}
+      qsort(parent_hook, nhook, sizeof(struct fof_uf_hook), fof_compare_uf_hook_task);
+      for(j = 0; j < NTask; j++) {Send_count[j] = 0;}
+      for(n = 0; n < nhook; n++) {Send_count[parent_hook[n].Task]++;}
+      hook_in2 = (struct fof_uf_hook *) fof_uf_exchange(parent_hook, sizeof(struct fof_uf_hook), &nrecv);
+      for(n = 0; n < nrecv; n++) {fof_uf_lower_label(node_of_head, hook_in2[n].Head, &hook_in2[n].Label);}
+      myfree(hook_in2);
+      myfree(parent_hook);
+      myfree(hook_in);
+      myfree(hook_out);
+
+      /* shortcutting: each node also takes its grandparent */
+      for(k = 0, changed = 0; k < nnodes; k++)
+	{
+	  if(fof_uf_label_less(&UFGrandParent[k], &UFNewLabel[k])) {UFNewLabel[k] = UFGrandParent[k];}
+	  if(fof_uf_label_less(&UFNewLabel[k], &UFLabel[k])) {changed++;}
+	  UFLabel[k] = UFNewLabel[k];
+	}
+      sumup_large_ints(1, &changed, &changed_tot);
+      rounds++;
+    }
+  while(changed_tot > 0);
+
+  /* every group now carries the smallest label of its connected component, which is its global MinID */
+  for(k = 0; k < nnodes; k++)
+    {
+      MinID[node_head[k]] = UFLabel[k].MinID;
+      MinIDTask[node_head[k]] = UFLabel[k].Task;
+    }
+
+  sumup_large_ints(1, &nnodes, &nnodes_tot);
+  k = (int) UFNlink;
+  sumup_large_ints(1, &k, &nlinks_tot);
+  t1 = my_second();
+  PRINT_STATUS("joined %lld groups with %lld cross-task links in %d rounds (took %g sec)", nnodes_tot, nlinks_tot / 2, rounds, timediff(t0, t1));
+
+  myfree(UFLabel);
+  myfree(node_head);
+  myfree(node_of_head);
+  free(UFLink);
+  UFLink = NULL;
+  UFNlink = UFMaxLink = 0;
+}
+#endif
+
+
+
 void fof_compile_catalogue(void)
 {
   int i, j, start, nimport, ngrp, recvTask;
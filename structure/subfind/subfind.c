@@ -364,6 +364,9 @@ void subfind(int num)
   t0 = my_second();
 
   /* we now apply a serial version of subfind to the local groups */
+#ifdef SUBFIND_SERIAL_GROUPS_THREADED
+  subfind_process_groups_serial_threaded(); /* the groups are independent, and done in parallel over the threads of this task */
+#else
   for(gr = 0, offset = 0; gr < Ngroups; gr++)
     {
       if(Group[gr].GrNr > Ncollective)
@@ -372,6 +375,7 @@ void subfind(int num)
 	    offset = subfind_process_group_serial(gr, offset);
 	}
     }
+#endif
 
   MPI_Barrier(MPI_COMM_WORLD);
 
@@ -1118,7 +1122,7 @@ void subfind_save_local_catalogue(int num)
   strcpy(buf, fname);
 
 #if defined(HAVE_HDF5)&& defined(SUBFIND_WRITE_OUTPUTS_IN_SNAPSHOT_FORMAT)
-  if(All.SnapFormat == 3)
+  if(All.SnapFormat >= 3) /* (SnapFormat=4 snapshots are HDF5 as well) */
     {
 
       sprintf(buf, "%s.hdf5", fname);
@@ -1195,7 +1199,7 @@ void subfind_save_local_catalogue(int num)
       SKIP;
     }
 #ifdef HAVE_HDF5
-  if(All.SnapFormat == 3)
+  if(All.SnapFormat >= 3)
     {
       write_header_attributes_in_hdf5(hdf5_headergrp);
     }
@@ -1330,7 +1334,7 @@ void subfind_save_local_catalogue(int num)
 	  ndim = get_values_per_sub(blocknr);
 
 #if defined(HAVE_HDF5) &&  defined(SUBFIND_WRITE_OUTPUTS_IN_SNAPSHOT_FORMAT)
-	  if(All.SnapFormat == 3)
+	  if(All.SnapFormat >= 3)
 	    {
 	      dims[0] = nwrite;
 	      dims[1] = ndim;
@@ -1396,7 +1400,7 @@ void subfind_save_local_catalogue(int num)
 		  SKIP;
 		}
 	      blksize = nwrite * bytes_per_blockelement * ndim;
-	      if(All.SnapFormat != 3)
+	      if(All.SnapFormat < 3)
 		{
 		  SKIP;
 		}
@@ -1602,7 +1606,7 @@ void subfind_save_local_catalogue(int num)
 	  if(blksize > 0)
 	    {
 #if defined(HAVE_HDF5) && defined(SUBFIND_WRITE_OUTPUTS_IN_SNAPSHOT_FORMAT)
-	      if(All.SnapFormat != 3)
+	      if(All.SnapFormat < 3)
 		{
 #endif
 		  my_fwrite(IOBuffer, blksize, sizeof(char), fd);
@@ -1611,7 +1615,7 @@ void subfind_save_local_catalogue(int num)
 #endif
 #if defined(HAVE_HDF5) && defined(SUBFIND_WRITE_OUTPUTS_IN_SNAPSHOT_FORMAT)
 		}
-	      else if(All.SnapFormat == 3)
+	      else if(All.SnapFormat >= 3)
 		{
 		  start[0] = 0;
 		  start[1] = 0;
@@ -1640,7 +1644,7 @@ void subfind_save_local_catalogue(int num)
 
     }				/* closing for bnr loop */
 #if defined(HAVE_HDF5) && defined(SUBFIND_WRITE_OUTPUTS_IN_SNAPSHOT_FORMAT)
-  if(All.SnapFormat == 3)
+  if(All.SnapFormat >= 3)
     {
 
       for(type = 0; type < 3; type++)
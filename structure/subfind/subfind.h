@@ -8,6 +8,26 @@
 #ifndef SUBFIND_H_HASBEENREAD
 #define SUBFIND_H_HASBEENREAD
 
+#if defined(SUBFIND_OPENMP_SERIAL_GROUPS) && defined(_OPENMP)
+#define SUBFIND_SERIAL_GROUPS_THREADED /* the groups processed serially (one task each) are shared out over the threads of the task */
+#endif
+
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+#if CHECK_IF_PREPROCESSOR_HAS_NUMERICAL_VALUE_(SUBFIND_INCREMENTAL_UNBIND)
+#define SUBFIND_UNBIND_REBUILD_PERCENT (SUBFIND_INCREMENTAL_UNBIND) /* rebuild the tree once this percentage of the mass it was built with has been unbound */
+#else
+#define SUBFIND_UNBIND_REBUILD_PERCENT 10
+#endif
+struct subfind_unbind_tracker /* state of the incremental unbinding of one structure (all values global over the tasks in the collective case) */
+{
+  int npass;                      /* unbinding passes done so far */
+  double center[3];               /* fixed reference point for the error bounds (the potential minimum of the first pass) */
+  double mass_left;               /* mass of the particles still bound */
+  double mass_at_build;           /* mass in the tree when it was last built */
+  double mass_removed;            /* mass unbound since the first pass */
+  double rmin_removed;            /* smallest distance from center of any particle unbound so far */
+};
+#endif
 
 
 typedef struct
@@ -67,6 +87,15 @@ void subfind_distribute_particles(int mode);
 void subfind_unbind_independent_ones(int count);
 void subfind_distribute_groups(void);
 void subfind_potential_compute(int num, struct unbind_data * d, int phase, double weakly_bound_limit);
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+void subfind_unbind_tracker_init(struct subfind_unbind_tracker *tr, double mass);
+int subfind_unbind_tracker_rebuild_tree(struct subfind_unbind_tracker *tr);
+int subfind_unbind_flag_potential_updates(struct subfind_unbind_tracker *tr, struct unbind_data *d, int num, int phase, double weakly_bound_limit);
+double subfind_unbind_tracker_distance(struct subfind_unbind_tracker *tr, int p);
+void subfind_unbind_tracker_removed(struct subfind_unbind_tracker *tr, double mass, double rmin);
+void subfind_force_tree_remove_particle(int p);
+void subfind_loctree_remove_particle(int p);
+#endif
 void subfind_process_group_collectively(int num);
 int subfind_col_unbind(struct unbind_data *d, int num, int *num_non_gas);
 void subfind_col_determine_sub_halo_properties(struct unbind_data *d, int num, double *mass,
@@ -86,9 +115,16 @@ void subfind_loctree_findExtent(int npart, struct unbind_data *mp);
 int subfind_locngb_treefind_variable(MyDouble *searchcenter, double hguess);
 size_t subfind_loctree_treeallocate(int maxnodes, int maxpart);
 void subfind_loctree_treefree(void);
+#ifdef SUBFIND_SERIAL_GROUPS_THREADED
+void subfind_loctree_thread_workspace(int maxpart, int maxnodes);
+void subfind_loctree_thread_workspace_free(void);
+#endif
 void subfind_find_nearesttwo(void);
 int subfind_nearesttwo_evaluate(int target, int mode, int *nexport, int *nsend_local);
 int subfind_process_group_serial(int gr, int offset);
+#ifdef SUBFIND_SERIAL_GROUPS_THREADED
+void subfind_process_groups_serial_threaded(void);
+#endif
 int subfind_unbind(struct unbind_data *ud, int len, int *len_non_gas);
 void subfind_determine_sub_halo_properties(struct unbind_data *ud, int num, double *mass,
 					   double *pos, double *vel, double *cm, double *veldisp,
@@ -192,6 +228,9 @@ extern struct r2data
   int   index;
 }
 *R2list;
+#ifdef SUBFIND_SERIAL_GROUPS_THREADED
+#pragma omp threadprivate(R2list) /* each thread walking its own local tree has its own neighbor list */
+#endif
 
 extern double *Dist2list;
 
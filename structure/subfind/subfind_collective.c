@@ -941,6 +941,10 @@ int subfind_col_unbind(struct unbind_data *d, int num, int *num_non_gas)
   double mass, massloc, t0, t1;
   double *bnd_energy, energy_limit, energy_limit_local, weakly_bound_limit_local, weakly_bound_limit = 0;
   double mbs, glob_mbs;
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+  struct subfind_unbind_tracker tr;
+  double dmass_loc, rmin_loc, dmass, rmin;
+#endif
 
   boxsize = All.BoxSize;
 
@@ -965,15 +969,31 @@ int subfind_col_unbind(struct unbind_data *d, int num, int *num_non_gas)
   if(ThisTask == 0)
     printf("maximum alloacted %g MB\n", glob_mbs);
 
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+  for(i = 0, massloc = 0; i < num; i++) {massloc += P[d[i].index].Mass;}
+  MPI_Allreduce(&massloc, &mass, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  subfind_unbind_tracker_init(&tr, mass);
+#endif
+
   do
     {
       t0 = my_second();
 
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+      if(subfind_unbind_tracker_rebuild_tree(&tr)) {force_treebuild(num, d);}
+      else {force_exchange_pseudodata(); force_treeupdate_pseudos(All.MaxPart);} /* the particles unbound in the last pass were subtracted from the local nodes: bring the top-level nodes up to date */
+
+      /* let's compute the potential energy, for the particles where it may have changed enough to matter */
+
+      subfind_unbind_flag_potential_updates(&tr, d, num, phaseflag, weakly_bound_limit);
+      subfind_potential_compute(num, d, 2, weakly_bound_limit);
+#else
       force_treebuild(num, d);
 
       /* let's compute the potential energy */
 
       subfind_potential_compute(num, d, phaseflag, weakly_bound_limit);
+#endif
 
       if(phaseflag == 0)
 	{
@@ -1013,6 +1033,9 @@ int subfind_col_unbind(struct unbind_data *d, int num, int *num_non_gas)
 	  /* pos[] now holds the position of minimum potential */
 	  /* we take that as the center */
 	}
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+      if(tr.npass == 1) {for(j = 0; j < 3; j++) {tr.center[j] = pos[j];}} /* the reference point of the error bounds is fixed in the first pass */
+#endif
 
       /* let's get bulk velocity and the center-of-mass */
 
@@ -1136,6 +1159,9 @@ int subfind_col_unbind(struct unbind_data *d, int num, int *num_non_gas)
 
       MPI_Allreduce(&weakly_bound_limit_local, &weakly_bound_limit, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
 
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+      dmass_loc = 0; rmin_loc = MAX_REAL_NUMBER;
+#endif
       for(i = 0, unbound = 0; i < num; i++)
 	{
 	  p = d[i].index;
@@ -1143,6 +1169,10 @@ int subfind_col_unbind(struct unbind_data *d, int num, int *num_non_gas)
 	  if(P[p].v.DM_BindingEnergy > 0 && P[p].v.DM_BindingEnergy > energy_limit)
 	    {
 	      unbound++;
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+	      dmass_loc += P[p].Mass; rmin_loc = DMIN(rmin_loc, subfind_unbind_tracker_distance(&tr, p));
+	      subfind_force_tree_remove_particle(p);
+#endif
 
 	      d[i] = d[num - 1];
 	      num--;
@@ -1159,6 +1189,11 @@ int subfind_col_unbind(struct unbind_data *d, int num, int *num_non_gas)
 
       MPI_Allreduce(&unbound, &totunbound, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
       MPI_Allreduce(&num, &numleft, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+      MPI_Allreduce(&dmass_loc, &dmass, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+      MPI_Allreduce(&rmin_loc, &rmin, 1, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+      subfind_unbind_tracker_removed(&tr, dmass, rmin);
+#endif
 
       t1 = my_second();
 
@@ -22,6 +22,28 @@ static int last;		/* auxialiary variable used to set-up non-recursive walk */
 
 static double RootLen, RootCenter[3];
 
+static struct NODE *ThreadNodes_base; /* own tree of the calling thread in the threaded pass over the serial groups (NULL: the global tree) */
+static int ThreadMaxNodes, ThreadMaxPart;
+static struct r2data *ThreadR2list_saved;
+#ifdef SUBFIND_SERIAL_GROUPS_THREADED
+#pragma omp threadprivate(last, RootLen, RootCenter, ThreadNodes_base, ThreadMaxNodes, ThreadMaxPart, ThreadR2list_saved)
+#endif
+
+/* gravitational softening of particle p in the potential walk */
+static inline double subfind_loctree_softening(int p)
+{
+  double h = All.ForceSoftening[P[p].Type];
+#if defined(ADAPTIVE_GRAVSOFT_FORALL)
+  h = P[p].AGS_Hsml;
+#elif defined(ADAPTIVE_GRAVSOFT_FORGAS)
+  if(P[p].Type == 0) h = PPP[p].Hsml;
+#endif
+  return h;
+}
+
+/* the nodes of the local tree of the calling thread (indexed from All.MaxPart, like the global Nodes) */
+static inline struct NODE *subfind_loctree_nodes(void) {return ThreadNodes_base ? ThreadNodes_base - All.MaxPart : Nodes;}
+
 void subfind_loctree_findExtent(int npart, struct unbind_data *mp)
 {
   int i, j, k;
@@ -79,11 +101,12 @@ int subfind_loctree_treebuild(int npart, struct unbind_data *mp)
   int i, k, subnode = 0, parent = -1, numnodes;
   int nfree, th, nn;
   double lenhalf;
-  struct NODE *nfreep;
+  struct NODE *nfreep, *nodes = subfind_loctree_nodes();
+  int max_nodes = ThreadNodes_base ? ThreadMaxNodes : MaxNodes;
 
   /* select first node */
   nfree = All.MaxPart;
-  nfreep = &Nodes[nfree];
+  nfreep = &nodes[nfree];
 
 
   /* create an empty  root node  */
@@ -114,14 +137,14 @@ int subfind_loctree_treebuild(int npart, struct unbind_data *mp)
 	  if(th >= All.MaxPart)	/* we are dealing with an internal node */
 	    {
 	      subnode = 0;
-	      if(P[i].Pos[0] > Nodes[th].center[0])
+	      if(P[i].Pos[0] > nodes[th].center[0])
 		subnode += 1;
-	      if(P[i].Pos[1] > Nodes[th].center[1])
+	      if(P[i].Pos[1] > nodes[th].center[1])
 		subnode += 2;
-	      if(P[i].Pos[2] > Nodes[th].center[2])
+	      if(P[i].Pos[2] > nodes[th].center[2])
 		subnode += 4;
 
-	      nn = Nodes[th].u.suns[subnode];
+	      nn = nodes[th].u.suns[subnode];
 
 	      if(nn >= 0)	/* ok, something is in the daughter slot already, need to continue */
 		{
@@ -133,7 +156,7 @@ int subfind_loctree_treebuild(int npart, struct unbind_data *mp)
 		  /* here we have found an empty slot where we can 
 		   * attach the new particle as a leaf 
 		   */
-		  Nodes[th].u.suns[subnode] = i;
+		  nodes[th].u.suns[subnode] = i;
 		  break;	/* done for that particle */
 		}
 	    }
@@ -142,25 +165,25 @@ int subfind_loctree_treebuild(int npart, struct unbind_data *mp)
 	      /* we try to insert into a leaf with a single particle
 	       * need to generate a new internal node at that point 
 	       */
-	      Nodes[parent].u.suns[subnode] = nfree;
+	      nodes[parent].u.suns[subnode] = nfree;
 
-	      nfreep->len = 0.5 * Nodes[parent].len;
-	      lenhalf = 0.25 * Nodes[parent].len;
+	      nfreep->len = 0.5 * nodes[parent].len;
+	      lenhalf = 0.25 * nodes[parent].len;
 
 	      if(subnode & 1)
-		nfreep->center[0] = Nodes[parent].center[0] + lenhalf;
+		nfreep->center[0] = nodes[parent].center[0] + lenhalf;
 	      else
-		nfreep->center[0] = Nodes[parent].center[0] - lenhalf;
+		nfreep->center[0] = nodes[parent].center[0] - lenhalf;
 
 	      if(subnode & 2)
-		nfreep->center[1] = Nodes[parent].center[1] + lenhalf;
+		nfreep->center[1] = nodes[parent].center[1] + lenhalf;
 	      else
-		nfreep->center[1] = Nodes[parent].center[1] - lenhalf;
+		nfreep->center[1] = nodes[parent].center[1] - lenhalf;
 
 	      if(subnode & 4)
-		nfreep->center[2] = Nodes[parent].center[2] + lenhalf;
+		nfreep->center[2] = nodes[parent].center[2] + lenhalf;
 	      else
-		nfreep->center[2] = Nodes[parent].center[2] - lenhalf;
+		nfreep->center[2] = nodes[parent].center[2] - lenhalf;
 
 	      nfreep->u.suns[0] = -1;
 	      nfreep->u.suns[1] = -1;
@@ -199,9 +222,16 @@ int subfind_loctree_treebuild(int npart, struct unbind_data *mp)
 	      nfree++;
 	      nfreep++;
 
-	      if((numnodes) >= MaxNodes)
+	      if((numnodes) >= max_nodes)
 		{
-		  printf("maximum number %d of tree-nodes reached.\n", MaxNodes);
+#ifdef SUBFIND_SERIAL_GROUPS_THREADED
+		  if(ThreadNodes_base) /* the own tree of this thread is too small: enlarge it, and start over */
+		    {
+		      subfind_loctree_thread_workspace(ThreadMaxPart, 2 * ThreadMaxNodes);
+		      return subfind_loctree_treebuild(npart, mp);
+		    }
+#endif
+		  printf("maximum number %d of tree-nodes reached.\n", max_nodes);
 		  printf("for particle %d  %g %g %g\n", i, P[i].Pos[0], P[i].Pos[1], P[i].Pos[2]);
 		  endrun(1);
 		}
@@ -214,7 +244,7 @@ int subfind_loctree_treebuild(int npart, struct unbind_data *mp)
   subfind_loctree_update_node_recursive(All.MaxPart, -1, -1);
 
   if(last >= All.MaxPart)
-    Nodes[last].u.d.nextnode = -1;
+    nodes[last].u.d.nextnode = -1;
   else
     Nextnode[last] = -1;
 
@@ -230,18 +260,19 @@ int subfind_loctree_treebuild(int npart, struct unbind_data *mp)
 void subfind_loctree_update_node_recursive(int no, int sib, int father)
 {
   int j, jj, p, pp = 0, nextsib, suns[8];
-  double mass;
+  double mass, maxsoft;
   double s[3];
+  struct NODE *nodes = subfind_loctree_nodes();
 
   if(no >= All.MaxPart)
     {
       for(j = 0; j < 8; j++)
-	suns[j] = Nodes[no].u.suns[j];	/* that "backup" is necessary because the nextnode entry will
+	suns[j] = nodes[no].u.suns[j];	/* that "backup" is necessary because the nextnode entry will
 					   overwrite one element (union!) */
       if(last >= 0)
 	{
 	  if(last >= All.MaxPart)
-	    Nodes[last].u.d.nextnode = no;
+	    nodes[last].u.d.nextnode = no;
 	  else
 	    Nextnode[last] = no;
 	}
@@ -249,6 +280,7 @@ void subfind_loctree_update_node_recursive(int no, int sib, int father)
       last = no;
 
       mass = 0;
+      maxsoft = 0;
       s[0] = 0;
       s[1] = 0;
       s[2] = 0;
@@ -271,10 +303,11 @@ void subfind_loctree_update_node_recursive(int no, int sib, int father)
 
 	      if(p >= All.MaxPart)	/* an internal node or pseudo particle */
 		{
-		  mass += Nodes[p].u.d.mass;	/* we assume a fixed particle mass */
-		  s[0] += Nodes[p].u.d.mass * Nodes[p].u.d.s[0];
-		  s[1] += Nodes[p].u.d.mass * Nodes[p].u.d.s[1];
-		  s[2] += Nodes[p].u.d.mass * Nodes[p].u.d.s[2];
+		  mass += nodes[p].u.d.mass;	/* we assume a fixed particle mass */
+		  s[0] += nodes[p].u.d.mass * nodes[p].u.d.s[0];
+		  s[1] += nodes[p].u.d.mass * nodes[p].u.d.s[1];
+		  s[2] += nodes[p].u.d.mass * nodes[p].u.d.s[2];
+		  maxsoft = DMAX(maxsoft, nodes[p].maxsoft);
 		}
 	      else		/* a particle */
 		{
@@ -282,6 +315,7 @@ void subfind_loctree_update_node_recursive(int no, int sib, int father)
 		  s[0] += P[p].Mass * P[p].Pos[0];
 		  s[1] += P[p].Mass * P[p].Pos[1];
 		  s[2] += P[p].Mass * P[p].Pos[2];
+		  maxsoft = DMAX(maxsoft, subfind_loctree_softening(p));
 		}
 	    }
 	}
@@ -294,25 +328,26 @@ void subfind_loctree_update_node_recursive(int no, int sib, int father)
 	}
       else
 	{
-	  s[0] = Nodes[no].center[0];
-	  s[1] = Nodes[no].center[1];
-	  s[2] = Nodes[no].center[2];
+	  s[0] = nodes[no].center[0];
+	  s[1] = nodes[no].center[1];
+	  s[2] = nodes[no].center[2];
 	}
 
-      Nodes[no].u.d.s[0] = s[0];
-      Nodes[no].u.d.s[1] = s[1];
-      Nodes[no].u.d.s[2] = s[2];
-      Nodes[no].u.d.mass = mass;
+      nodes[no].u.d.s[0] = s[0];
+      nodes[no].u.d.s[1] = s[1];
+      nodes[no].u.d.s[2] = s[2];
+      nodes[no].u.d.mass = mass;
+      nodes[no].maxsoft = maxsoft; /* largest softening in the node, used by the potential walk */
 
-      Nodes[no].u.d.sibling = sib;
-      Nodes[no].u.d.father = father;
+      nodes[no].u.d.sibling = sib;
+      nodes[no].u.d.father = father;
     }
   else				/* single particle or pseudo particle */
     {
       if(last >= 0)
 	{
 	  if(last >= All.MaxPart)
-	    Nodes[last].u.d.nextnode = no;
+	    nodes[last].u.d.nextnode = no;
 	  else
 	    Nextnode[last] = no;
 	}
@@ -336,6 +371,7 @@ double subfind_loctree_treeevaluate_potential(int target)
   double pot, pos_x, pos_y, pos_z;
     double h_p, h_p_inv, u_p, wp_p, h_max; h_p=0; h_p_inv=0; u_p=0; wp_p=0; h_max=0;
     int particle; particle=0;
+  struct NODE *nodes = subfind_loctree_nodes();
 
   pos_x = P[target].Pos[0];
   pos_y = P[target].Pos[1];
@@ -356,6 +392,9 @@ double subfind_loctree_treeevaluate_potential(int target)
     {
       if(no < All.MaxPart)	/* single particle */
 	{
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+	  if(Father[no] < 0) {no = Nextnode[no]; continue;} /* unbound, and already subtracted from the tree */
+#endif
 	  dx = P[no].Pos[0] - pos_x;
 	  dy = P[no].Pos[1] - pos_y;
 	  dz = P[no].Pos[2] - pos_z;
@@ -363,7 +402,7 @@ double subfind_loctree_treeevaluate_potential(int target)
 	}
       else
 	{
-	  nop = &Nodes[no];
+	  nop = &nodes[no];
 	  dx = nop->u.d.s[0] - pos_x;
 	  dy = nop->u.d.s[1] - pos_y;
 	  dz = nop->u.d.s[2] - pos_z;
@@ -437,7 +476,7 @@ int subfind_locngb_compare_key(const void *a, const void *b)
 }
 
 
-/*!   -- this subroutine is not openmp parallelized at present, so there's not any issue about conflicts over shared memory. if you make it openmp, make sure you protect the writes to shared memory here!!! -- */
+/*!   -- with SUBFIND_OPENMP_SERIAL_GROUPS this is called by several threads at once, each on its own tree and R2list (the only memory written here) -- */
 double subfind_locngb_treefind(MyDouble xyz[3], int desngb, double hguess)
 {
   int numngb;
@@ -475,12 +514,12 @@ double subfind_locngb_treefind(MyDouble xyz[3], int desngb, double hguess)
 }
 
 
-/*!   -- this subroutine is not openmp parallelized at present, so there's not any issue about conflicts over shared memory. if you make it openmp, make sure you protect the writes to shared memory here!!! -- */
+/*!   -- with SUBFIND_OPENMP_SERIAL_GROUPS this is called by several threads at once, each on its own tree and R2list (the only memory written here) -- */
 int subfind_locngb_treefind_variable(MyDouble searchcenter[3], double hguess)
 {
   int numngb, no, p;
   double dx, dy, dz, r2, h2;
-  struct NODE *that;
+  struct NODE *that, *nodes = subfind_loctree_nodes();
 
   h2 = hguess * hguess;
 
@@ -525,9 +564,9 @@ int subfind_locngb_treefind_variable(MyDouble searchcenter[3], double hguess)
 	}
       else
 	{
-	  that = &Nodes[no];
+	  that = &nodes[no];
 
-	  no = Nodes[no].u.d.sibling;	/* in case the node can be discarded */
+	  no = nodes[no].u.d.sibling;	/* in case the node can be discarded */
 
         dx = that->center[0] - searchcenter[0];
         dy = that->center[1] - searchcenter[1];
@@ -562,6 +601,67 @@ int subfind_locngb_treefind_variable(MyDouble searchcenter[3], double hguess)
 
 
 
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+/*! removes particle p (unbound) from the local tree: its mass and center of mass are subtracted from all the nodes containing it, and it
+ *  is marked (Father=-1) to be skipped by the potential walk. The node geometry and softenings are left as they are (still valid bounds) */
+void subfind_loctree_remove_particle(int p)
+{
+  int no, k;
+  double mass;
+  struct NODE *nodes = subfind_loctree_nodes();
+
+  no = Father[p];
+  Father[p] = -1;
+  while(no >= 0)
+    {
+      mass = nodes[no].u.d.mass - P[p].Mass;
+      if(mass > 1.0e-10 * nodes[no].u.d.mass)
+	{
+	  for(k = 0; k < 3; k++) {nodes[no].u.d.s[k] = (nodes[no].u.d.mass * nodes[no].u.d.s[k] - P[p].Mass * P[p].Pos[k]) / mass;}
+	  nodes[no].u.d.mass = mass;
+	}
+      else /* node emptied (up to round-off) */
+	{
+	  for(k = 0; k < 3; k++) {nodes[no].u.d.s[k] = nodes[no].center[k];}
+	  nodes[no].u.d.mass = 0;
+	}
+      no = nodes[no].u.d.father;
+    }
+}
+#endif
+
+
+#ifdef SUBFIND_SERIAL_GROUPS_THREADED
+/*! gives the calling thread its own local tree (and neighbor list R2list) with room for maxpart particles and maxnodes nodes,
+ *  enlarging the ones it already has if needed. Called by each thread of the threaded pass over the serial groups, for each
+ *  group; the particle-indexed Nextnode and Father arrays stay shared, as the threads work on disjoint sets of particles */
+void subfind_loctree_thread_workspace(int maxpart, int maxnodes)
+{
+  if(!ThreadNodes_base) {ThreadR2list_saved = R2list; R2list = NULL; ThreadMaxNodes = ThreadMaxPart = 0;}
+  if(maxnodes > ThreadMaxNodes)
+    {
+      struct NODE *tmp = (struct NODE *) realloc(ThreadNodes_base, (maxnodes + 1) * sizeof(struct NODE));
+      if(!tmp) {printf("Task %d failed to allocate the local tree of a thread for %d nodes\n", ThisTask, maxnodes); endrun(7751);}
+      ThreadNodes_base = tmp; ThreadMaxNodes = maxnodes;
+    }
+  if(maxpart > ThreadMaxPart)
+    {
+      struct r2data *tmp = (struct r2data *) realloc(R2list, maxpart * sizeof(struct r2data));
+      if(!tmp) {printf("Task %d failed to allocate the neighbor list of a thread for %d particles\n", ThisTask, maxpart); endrun(7752);}
+      R2list = tmp; ThreadMaxPart = maxpart;
+    }
+}
+
+/*! frees the local tree of the calling thread; the loctree routines go back to the global tree */
+void subfind_loctree_thread_workspace_free(void)
+{
+  if(!ThreadNodes_base) {return;}
+  free(R2list); free(ThreadNodes_base);
+  R2list = ThreadR2list_saved; ThreadNodes_base = NULL; ThreadMaxNodes = ThreadMaxPart = 0;
+}
+#endif
+
+
 /* that function allocates memory used for storage of the tree
  * and auxiliary arrays for tree-walk and link-lists.
  */
@@ -34,6 +34,9 @@ void subfind_potential_compute(int num, struct unbind_data *d, int phase, double
         for(nexport = 0; i < num; i++)
         {
             if(phase == 1) {if(P[d[i].index].v.DM_BindingEnergy <= weakly_bound_limit) {continue;}}
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+            if(phase == 2) {if(!d[i].pot_update) {continue;}} /* only the particles flagged by subfind_unbind_flag_potential_updates */
+#endif
             if(subfind_force_treeevaluate_potential(d[i].index, 0, &nexport, Send_count) < 0) {break;}
         }
         qsort(DataIndexTable, nexport, sizeof(struct data_index), data_index_compare);
@@ -107,6 +110,9 @@ void subfind_potential_compute(int num, struct unbind_data *d, int phase, double
     for(i = 0; i < num; i++)
     {
         if(phase == 1) {if(P[d[i].index].v.DM_BindingEnergy <= weakly_bound_limit) {continue;}}
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+        if(phase == 2) {if(!d[i].pot_update) {continue;}}
+#endif
         int p = d[i].index; double h_grav = All.ForceSoftening[P[p].Type];
 #if defined(ADAPTIVE_GRAVSOFT_FORALL)
         h_grav = P[p].AGS_Hsml;
@@ -121,5 +127,75 @@ void subfind_potential_compute(int num, struct unbind_data *d, int phase, double
     myfree(DataIndexTable);
 }
 
+
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+/* Incremental unbinding: instead of rebuilding the tree and recomputing the potential of (nearly) all particles in every unbinding pass,
+    the unbound particles are subtracted from the moments of the existing tree, which is only rebuilt once SUBFIND_UNBIND_REBUILD_PERCENT
+    of the mass it was built with has been removed. The potential of a particle is recomputed only if it is weakly bound (as before), or if
+    the mass unbound since its last evaluation could have raised its potential enough to unbind it. Since all that mass lies at least a
+    distance rmin_removed from the reference center, the potential of a particle at distance r < rmin_removed from the center can have
+    risen by at most G*dM/(rmin_removed-r). */
+
+/* sets up the tracker for a structure of total mass 'mass'. the first pass builds the tree and computes the potential of all particles */
+void subfind_unbind_tracker_init(struct subfind_unbind_tracker *tr, double mass)
+{
+    tr->npass = 0; tr->center[0] = tr->center[1] = tr->center[2] = 0;
+    tr->mass_left = tr->mass_at_build = mass; tr->mass_removed = 0; tr->rmin_removed = MAX_REAL_NUMBER;
+}
+
+/* returns 1 if the tree has to be (re)built for this pass, and resets the mass it is built with */
+int subfind_unbind_tracker_rebuild_tree(struct subfind_unbind_tracker *tr)
+{
+    if(tr->npass > 0 && tr->mass_at_build - tr->mass_left <= 0.01 * SUBFIND_UNBIND_REBUILD_PERCENT * tr->mass_at_build) {return 0;}
+    tr->mass_at_build = tr->mass_left;
+    return 1;
+}
+
+/* distance of particle p from the reference center */
+double subfind_unbind_tracker_distance(struct subfind_unbind_tracker *tr, int p)
+{
+    double dp[3]; int k; for(k=0;k<3;k++) {dp[k] = P[p].Pos[k] - tr->center[k];}
+    NEAREST_XYZ(dp[0],dp[1],dp[2],-1);
+    return sqrt(dp[0]*dp[0] + dp[1]*dp[1] + dp[2]*dp[2]);
+}
+
+/* records the unbinding of particles of total mass 'mass', the closest of which was at distance rmin from the reference center */
+void subfind_unbind_tracker_removed(struct subfind_unbind_tracker *tr, double mass, double rmin)
+{
+    tr->mass_left -= mass; tr->mass_removed += mass;
+    if(mass > 0) {tr->rmin_removed = DMIN(tr->rmin_removed, rmin);}
+}
+
+/* flags (pot_update) the particles of d whose potential has to be recomputed in this pass (phase as in subfind_potential_compute), and
+    returns their number. all particles in the first pass; afterwards the weakly-bound ones in phase 1, and any particle whose potential
+    may have risen enough since its last evaluation to make it unbound */
+int subfind_unbind_flag_potential_updates(struct subfind_unbind_tracker *tr, struct unbind_data *d, int num, int phase, double weakly_bound_limit)
+{
+    int i, p, n_update = 0;
+    double fac = All.G / All.cf_atime; /* units of DM_Potential, as set in subfind_potential_compute */
+    if(All.TotN_gas > 0 && (FOF_SECONDARY_LINK_TYPES & 1) == 0 && (FOF_PRIMARY_LINK_TYPES & 1) == 0 && All.OmegaBaryon > 0) {fac *= All.OmegaMatter / (All.OmegaMatter - All.OmegaBaryon);}
+    for(i = 0; i < num; i++)
+    {
+        p = d[i].index; d[i].pot_update = 0;
+        if(tr->npass == 0) {d[i].pot_update = 1;}
+        else if(phase == 1 && P[p].v.DM_BindingEnergy >= weakly_bound_limit) {d[i].pot_update = 1;}
+        else if(d[i].pot_mass_removed < tr->mass_removed) /* mass was unbound since the last evaluation */
+        {
+            double h_grav = All.ForceSoftening[P[p].Type], r = subfind_unbind_tracker_distance(tr, p);
+#if defined(ADAPTIVE_GRAVSOFT_FORALL)
+            h_grav = P[p].AGS_Hsml;
+#elif defined(ADAPTIVE_GRAVSOFT_FORGAS)
+            if(P[p].Type == 0) h_grav = PPP[p].Hsml;
+#endif
+            if(r + h_grav >= tr->rmin_removed) {d[i].pot_update = 1;} /* no useful bound this close to the unbound mass */
+            else if(P[p].v.DM_BindingEnergy + fac * (tr->mass_removed - d[i].pot_mass_removed) / (tr->rmin_removed - r) > 0) {d[i].pot_update = 1;}
+        }
+        if(d[i].pot_update) {d[i].pot_mass_removed = tr->mass_removed; n_update++;}
+    }
+    tr->npass++;
+    return n_update;
+}
+#endif
+
 #endif
 
@@ -25,29 +25,34 @@
 #define MAX_NGB_CHECK 2 /* max numbers of neighbours for saddle-point detection (default = 2) */
 #endif
 
-static int *Head, *Next, *Tail, *Len;
-static struct cand_dat
+struct cand_dat
 {
   int head;
   int len;
   int nsub;
   int rank, subnr, parent;
   int bound_length;
-}
- *candidates;
+};
 
+struct subfind_serial_workspace /* scratch space for the processing of one group of (up to) MaxLen particles */
+{
+  int MaxLen;
+  int *Head, *Next, *Tail, *Len;
+  struct unbind_data *ud;
+  struct cand_dat *candidates;
+  double *bnd_energy;   /* for the unbinding */
+  sort_r2list *rr_list; /* for the rotation curve */
+};
 
+static int subfind_unbind_work(struct unbind_data *ud, int len, int *len_non_gas, double *bnd_energy);
+static void subfind_determine_sub_halo_properties_work(struct unbind_data *d, int num, double *totmass, double *pos, double *vel, double *cm, double *veldisp,
+                                                       double *vmax, double *vmaxrad, double *spin, MyIDType * mostboundid, double *halfmassrad, double *mass_tab, sort_r2list *rr_list);
 
 
-/*!   -- this subroutine is not openmp parallelized at present, so there's not any issue about conflicts over shared memory. if you make it openmp, make sure you protect the writes to shared memory here!!! -- */
-int subfind_process_group_serial(int gr, int Offs)
+/* finds the first particle of group gr, starting the search at particle Offs, and checks that all particles of the group follow it */
+static int subfind_serial_find_group_offset(int gr, int Offs)
 {
-  int i, j, k, p, len, subnr, totlen, ss, ngbs, ndiff, N, head = 0, head_attach, count_cand, len_non_gas;
-  int listofdifferent[2], count, prev;
-  int ngb_index, part_index, nsubs, rank;
-  double SubMass, SubPos[3], SubVel[3], SubCM[3], SubVelDisp, SubVmax, SubVmaxRad, SubSpin[3], SubHalfMass, SubMassTab[6];
-  MyIDType SubMostBoundID;
-  static struct unbind_data *ud;
+  int i, N;
 
   while(P[Offs].GrNr != Group[gr].GrNr)
     {
@@ -60,7 +65,6 @@ int subfind_process_group_serial(int gr, int Offs)
     }
 
   N = Group[gr].Len;
-  GrNr = Group[gr].GrNr;
 
   for(i = 0; i < N; i++)
     {
@@ -73,19 +77,25 @@ int subfind_process_group_serial(int gr, int Offs)
 	}
     }
 
+  return Offs;
+}
 
-  candidates = (struct cand_dat *)mymalloc("candidates", N * sizeof(struct cand_dat));
 
-  Head = (int *)mymalloc("Head", N * sizeof(int));
-  Next = (int *)mymalloc("Next", N * sizeof(int));
-  Tail = (int *)mymalloc("Tail", N * sizeof(int));
-  Len = (int *)mymalloc("Len", N * sizeof(int));
-  ud = (struct unbind_data *) mymalloc("ud", N * sizeof(struct unbind_data));
+/* finds the substructures of group gr, whose particles start at Offs, using the scratch space ws. The properties of the substructures
+   are written to subgroups[] (at most max_subgroups of them), and their number is returned. Only the particles of the group (and the
+   local tree of the calling thread) are touched, so different groups can be processed at the same time by different threads. */
+static int subfind_serial_find_subhalos(int gr, int Offs, struct subfind_serial_workspace *ws, struct subgroup_properties *subgroups, int max_subgroups)
+{
+  int i, j, k, p, len, subnr, totlen, ss, ngbs, ndiff, N, head = 0, head_attach, count_cand, len_non_gas;
+  int listofdifferent[2], count, prev;
+  int ngb_index, part_index, nsubs, rank;
+  double SubMass, SubPos[3], SubVel[3], SubCM[3], SubVelDisp, SubVmax, SubVmaxRad, SubSpin[3], SubHalfMass, SubMassTab[6];
+  MyIDType SubMostBoundID;
+  struct cand_dat *candidates = ws->candidates;
+  struct unbind_data *ud = ws->ud;
+  int *Head = ws->Head - Offs, *Next = ws->Next - Offs, *Tail = ws->Tail - Offs, *Len = ws->Len - Offs; /* indexed by the particle index */
 
-  Head -= Offs;
-  Next -= Offs;
-  Tail -= Offs;
-  Len -= Offs;
+  N = Group[gr].Len;
 
   for(i = 0; i < N; i++)
     {
@@ -249,7 +259,7 @@ int subfind_process_group_serial(int gr, int Offs)
 	  ud[len++].index = p;
 
       if(len >= All.DesLinkNgb)
-	len = subfind_unbind(ud, len, &len_non_gas);
+	len = subfind_unbind_work(ud, len, &len_non_gas, ws->bnd_energy);
 
 #ifdef SUBFIND_REMOVE_GAS_STRUCTURES
       if(len_non_gas >= All.DesLinkNgb)
@@ -273,8 +283,10 @@ int subfind_process_group_serial(int gr, int Offs)
 	}
     }
 
+#ifndef SUBFIND_SERIAL_GROUPS_THREADED
   PRINT_STATUS("\nGroupLen=%d  (gr=%d)", N, gr);
   PRINT_STATUS("Number of substructures: %d", nsubs);
+#endif
 
   Group[gr].Nsubs = nsubs;
   Group[gr].Pos[0] = Group[gr].CM[0];
@@ -321,7 +333,9 @@ int subfind_process_group_serial(int gr, int Offs)
     {
       len = candidates[k].bound_length;
 
+#ifndef SUBFIND_SERIAL_GROUPS_THREADED
       PRINT_STATUS("subnr=%d  SubLen=%d", subnr, len);
+#endif
 
       totlen += len;
 
@@ -337,12 +351,12 @@ int subfind_process_group_serial(int gr, int Offs)
 	endrun(12);
 
 
-      subfind_determine_sub_halo_properties(ud, len, &SubMass,
+      subfind_determine_sub_halo_properties_work(ud, len, &SubMass,
 					    &SubPos[0], &SubVel[0], &SubCM[0], &SubVelDisp, &SubVmax,
 					    &SubVmaxRad, &SubSpin[0], &SubMostBoundID, &SubHalfMass,
-					    &SubMassTab[0]);
+					    &SubMassTab[0], ws->rr_list);
 
-      if(Nsubgroups >= MaxNsubgroups)
+      if(subnr >= max_subgroups)
 	endrun(899);
 
       if(subnr == 0)
@@ -351,32 +365,30 @@ int subfind_process_group_serial(int gr, int Offs)
 	    Group[gr].Pos[j] = SubPos[j];
 	}
 
-      SubGroup[Nsubgroups].Len = len;
+      subgroups[subnr].Len = len;
       if(subnr == 0)
-	SubGroup[Nsubgroups].Offset = Group[gr].Offset;
+	subgroups[subnr].Offset = Group[gr].Offset;
       else
-	SubGroup[Nsubgroups].Offset = SubGroup[Nsubgroups - 1].Offset + SubGroup[Nsubgroups - 1].Len;
-      SubGroup[Nsubgroups].GrNr = GrNr - 1;
-      SubGroup[Nsubgroups].SubNr = subnr;
-      SubGroup[Nsubgroups].SubParent = candidates[k].parent;
-      SubGroup[Nsubgroups].Mass = SubMass;
-      SubGroup[Nsubgroups].SubMostBoundID = SubMostBoundID;
-      SubGroup[Nsubgroups].SubVelDisp = SubVelDisp;
-      SubGroup[Nsubgroups].SubVmax = SubVmax;
-      SubGroup[Nsubgroups].SubVmaxRad = SubVmaxRad;
-      SubGroup[Nsubgroups].SubHalfMass = SubHalfMass;
+	subgroups[subnr].Offset = subgroups[subnr - 1].Offset + subgroups[subnr - 1].Len;
+      subgroups[subnr].GrNr = Group[gr].GrNr - 1;
+      subgroups[subnr].SubNr = subnr;
+      subgroups[subnr].SubParent = candidates[k].parent;
+      subgroups[subnr].Mass = SubMass;
+      subgroups[subnr].SubMostBoundID = SubMostBoundID;
+      subgroups[subnr].SubVelDisp = SubVelDisp;
+      subgroups[subnr].SubVmax = SubVmax;
+      subgroups[subnr].SubVmaxRad = SubVmaxRad;
+      subgroups[subnr].SubHalfMass = SubHalfMass;
 
       for(j = 0; j < 3; j++)
 	{
-	  SubGroup[Nsubgroups].Pos[j] = SubPos[j];
-	  SubGroup[Nsubgroups].CM[j] = SubCM[j];
-	  SubGroup[Nsubgroups].Vel[j] = SubVel[j];
-	  SubGroup[Nsubgroups].Spin[j] = SubSpin[j];
+	  subgroups[subnr].Pos[j] = SubPos[j];
+	  subgroups[subnr].CM[j] = SubCM[j];
+	  subgroups[subnr].Vel[j] = SubVel[j];
+	  subgroups[subnr].Spin[j] = SubSpin[j];
 	}
 
-      for(j = 0; j < 6; j++) SubGroup[Nsubgroups].MassTab[j] = SubMassTab[j];
-
-      Nsubgroups++;
+      for(j = 0; j < 6; j++) subgroups[subnr].MassTab[j] = SubMassTab[j];
 
       /* Let's now assign the subgroup number */
 
@@ -386,30 +398,154 @@ int subfind_process_group_serial(int gr, int Offs)
       subnr++;
     }
 
+#ifndef SUBFIND_SERIAL_GROUPS_THREADED
   PRINT_STATUS("Fuzz=%d", N - totlen);
+#endif
 
-  myfree(ud);
-  myfree(Len + Offs);
-  myfree(Tail + Offs);
-  myfree(Next + Offs);
-  myfree(Head + Offs);
+  return nsubs;
+}
+
+
+/* size of the scratch space for groups of up to n particles */
+static size_t subfind_serial_workspace_bytes(int n)
+{
+  return (size_t) n * (sizeof(double) + sizeof(sort_r2list) + sizeof(struct cand_dat) + sizeof(struct unbind_data) + 4 * sizeof(int));
+}
 
-  myfree(candidates);
+/* points the scratch arrays of ws into the block mem (of subfind_serial_workspace_bytes(n) bytes), for groups of up to n particles */
+static void subfind_serial_workspace_setup(struct subfind_serial_workspace *ws, int n, char *mem)
+{
+  ws->MaxLen = n;
+  ws->bnd_energy = (double *) mem; mem += n * sizeof(double);
+  ws->rr_list = (sort_r2list *) mem; mem += n * sizeof(sort_r2list);
+  ws->candidates = (struct cand_dat *) mem; mem += n * sizeof(struct cand_dat);
+  ws->ud = (struct unbind_data *) mem; mem += n * sizeof(struct unbind_data);
+  ws->Head = (int *) mem; mem += n * sizeof(int);
+  ws->Next = (int *) mem; mem += n * sizeof(int);
+  ws->Tail = (int *) mem; mem += n * sizeof(int);
+  ws->Len = (int *) mem;
+}
+
+
+/* processes the local group gr on its own, starting the search for its particles at Offs; returns the first particle of the group */
+int subfind_process_group_serial(int gr, int Offs)
+{
+  struct subfind_serial_workspace ws;
+  char *mem;
+
+  Offs = subfind_serial_find_group_offset(gr, Offs);
+  GrNr = Group[gr].GrNr;
+
+  mem = (char *) mymalloc("subfind_serial_ws", subfind_serial_workspace_bytes(Group[gr].Len));
+  subfind_serial_workspace_setup(&ws, Group[gr].Len, mem);
+
+  Nsubgroups += subfind_serial_find_subhalos(gr, Offs, &ws, &SubGroup[Nsubgroups], MaxNsubgroups - Nsubgroups);
+
+  myfree(mem);
 
   return Offs;
 }
 
 
+#ifdef SUBFIND_SERIAL_GROUPS_THREADED
+static int *SerialGroupIndex; /* the local groups processed here, in the order of Group[] */
+
+/* orders the queue of serial groups by decreasing length (and by position, for equal lengths) */
+static int subfind_compare_serial_group_length(const void *a, const void *b)
+{
+  int na = *(const int *) a, nb = *(const int *) b;
+  if(Group[SerialGroupIndex[na]].Len > Group[SerialGroupIndex[nb]].Len) {return -1;}
+  if(Group[SerialGroupIndex[na]].Len < Group[SerialGroupIndex[nb]].Len) {return +1;}
+  return (na > nb) - (na < nb);
+}
+
+/*! processes all local groups below the collective threshold, sharing them out over the threads of this task. The threads take the
+ *  groups from a queue ordered by decreasing length (so that no large group is started last), each with its own local tree and scratch
+ *  space. The substructures of each group go to its own slot of a temporary catalogue (a group of N particles has at most N/DesLinkNgb
+ *  of them), which is copied into SubGroup in the order of the groups at the end: the catalogue is the same as that of the loop over
+ *  the groups one at a time, whatever the number of threads. */
+void subfind_process_groups_serial_threaded(void)
+{
+  int gr, n, k, offset, n_groups, n_slots, next_in_queue = 0;
+  int *group_offset, *group_nsubs, *group_slot, *queue;
+  struct subgroup_properties *subgroups_tmp;
+
+  for(gr = 0, n_groups = 0; gr < Ngroups; gr++) {if(Group[gr].GrNr > Ncollective && ((Group[gr].GrNr - 1) % NTask) == ThisTask) {n_groups++;}}
+  SerialGroupIndex = (int *) mymalloc("SerialGroupIndex", 5 * (n_groups + 1) * sizeof(int));
+  group_offset = SerialGroupIndex + (n_groups + 1); group_nsubs = group_offset + (n_groups + 1); group_slot = group_nsubs + (n_groups + 1); queue = group_slot + (n_groups + 1);
+  for(gr = 0, n = 0, offset = 0, n_slots = 0; gr < Ngroups; gr++)
+    {
+      if(Group[gr].GrNr > Ncollective && ((Group[gr].GrNr - 1) % NTask) == ThisTask)
+        {
+          offset = subfind_serial_find_group_offset(gr, offset);
+          SerialGroupIndex[n] = gr; group_offset[n] = offset; group_slot[n] = n_slots; queue[n] = n;
+          n_slots += Group[gr].Len / All.DesLinkNgb; n++;
+        }
+    }
+  qsort(queue, n_groups, sizeof(int), subfind_compare_serial_group_length);
+  subgroups_tmp = (struct subgroup_properties *) mymalloc("subgroups_tmp", (n_slots + 1) * sizeof(struct subgroup_properties));
+
+#pragma omp parallel private(gr, n, k)
+  {
+    struct subfind_serial_workspace ws;
+    char *mem = NULL;
+    ws.MaxLen = 0;
+    while(1)
+      {
+#pragma omp atomic capture
+        k = next_in_queue++;
+        if(k >= n_groups) {break;}
+        n = queue[k]; gr = SerialGroupIndex[n];
+        if(Group[gr].Len > ws.MaxLen) /* the scratch space of the thread is grown as needed (usually only once, as the first group it takes is its largest) */
+          {
+            free(mem);
+            mem = (char *) malloc(subfind_serial_workspace_bytes(Group[gr].Len));
+            if(!mem) {printf("Task %d failed to allocate the scratch space of a thread for a group of %d particles\n", ThisTask, Group[gr].Len); endrun(7753);}
+            subfind_serial_workspace_setup(&ws, Group[gr].Len, mem);
+          }
+        subfind_loctree_thread_workspace(Group[gr].Len, (int) (All.TreeAllocFactor * Group[gr].Len) + 64);
+        group_nsubs[n] = subfind_serial_find_subhalos(gr, group_offset[n], &ws, &subgroups_tmp[group_slot[n]], Group[gr].Len / All.DesLinkNgb);
+      }
+    free(mem);
+    subfind_loctree_thread_workspace_free();
+  }
+
+  for(n = 0; n < n_groups; n++) /* copy the substructures into the catalogue, in the order of the groups */
+    {
+      if(Nsubgroups + group_nsubs[n] > MaxNsubgroups) {endrun(899);}
+      memcpy(&SubGroup[Nsubgroups], &subgroups_tmp[group_slot[n]], group_nsubs[n] * sizeof(struct subgroup_properties));
+      Nsubgroups += group_nsubs[n];
+    }
+
+  myfree(subgroups_tmp);
+  myfree(SerialGroupIndex);
+}
+#endif
+
+
 
 
 int subfind_unbind(struct unbind_data *ud, int len, int *len_non_gas)
 {
-  double *bnd_energy, energy_limit, weakly_bound_limit = 0;
+  double *bnd_energy = (double *) mymalloc("bnd_energy", len * sizeof(double));
+  len = subfind_unbind_work(ud, len, len_non_gas, bnd_energy);
+  myfree(bnd_energy);
+  return len;
+}
+
+/* the unbinding of the len particles in ud, with the scratch array bnd_energy (of len elements) */
+static int subfind_unbind_work(struct unbind_data *ud, int len, int *len_non_gas, double *bnd_energy)
+{
+  double energy_limit, weakly_bound_limit = 0;
   int i, j, p, minindex, unbound, phaseflag;
   double s[3], dx[3], v[3], dv[3], pos[3];
   double vel_to_phys, H_of_a, atime, pot, minpot = 0;
   double boxsize;
   double TotMass;
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+  struct subfind_unbind_tracker tr;
+  double dmass, rmin;
+#endif
 
   boxsize = All.BoxSize;
 
@@ -425,13 +561,21 @@ int subfind_unbind(struct unbind_data *ud, int len, int *len_non_gas)
       H_of_a = 0;
     }
 
-  bnd_energy = (double *) mymalloc("bnd_energy", len * sizeof(double));
-
   phaseflag = 0;		/* this means we will recompute the potential for all particles */
 
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+  for(i = 0, TotMass = 0; i < len; i++) {TotMass += P[ud[i].index].Mass;}
+  subfind_unbind_tracker_init(&tr, TotMass);
+#endif
+
   do
     {
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+      if(subfind_unbind_tracker_rebuild_tree(&tr)) {subfind_loctree_treebuild(len, ud);} /* otherwise the particles unbound so far were subtracted from it */
+      subfind_unbind_flag_potential_updates(&tr, ud, len, phaseflag, weakly_bound_limit);
+#else
       subfind_loctree_treebuild(len, ud);
+#endif
 
       /* let's compute the potential  */
 
@@ -441,6 +585,10 @@ int subfind_unbind(struct unbind_data *ud, int len, int *len_non_gas)
 	    {
 	      p = ud[i].index;
 
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+	      if(ud[i].pot_update) /* otherwise the potential of the last evaluation is still good enough */
+#endif
+	      {
 	      pot = subfind_loctree_treeevaluate_potential(p);
 	      /* note: add self-energy */
         double h_grav = All.ForceSoftening[P[p].Type];
@@ -453,6 +601,7 @@ int subfind_unbind(struct unbind_data *ud, int len, int *len_non_gas)
 	      P[p].u.DM_Potential *= All.G / atime;
 
 	      if(All.TotN_gas > 0 && (FOF_PRIMARY_LINK_TYPES & 1) == 0 && (FOF_SECONDARY_LINK_TYPES & 1) == 0 && All.OmegaBaryon > 0) {P[p].u.DM_Potential *= All.OmegaMatter / (All.OmegaMatter - All.OmegaBaryon);}
+	      }
 
 	      if(P[p].u.DM_Potential < minpot || minindex == -1)
 		{
@@ -462,6 +611,9 @@ int subfind_unbind(struct unbind_data *ud, int len, int *len_non_gas)
 	    }
 
 	  for(j = 0; j < 3; j++) {pos[j] = P[minindex].Pos[j];}	/* position of minimum potential */
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+	  if(tr.npass == 1) {for(j = 0; j < 3; j++) {tr.center[j] = pos[j];}} /* the reference point of the error bounds is fixed in the first pass */
+#endif
 	}
       else
 	{
@@ -470,7 +622,11 @@ int subfind_unbind(struct unbind_data *ud, int len, int *len_non_gas)
 	    {
 	      p = ud[i].index;
 
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+	      if(ud[i].pot_update)
+#else
 	      if(P[p].v.DM_BindingEnergy >= weakly_bound_limit)
+#endif
 		{
 		  pot = subfind_loctree_treeevaluate_potential(p);
 		  /* note: add self-energy */
@@ -562,12 +718,19 @@ int subfind_unbind(struct unbind_data *ud, int len, int *len_non_gas)
 
       /* now omit unbound particles,  but at most 1/4 of the original size */
 
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+      dmass = 0; rmin = MAX_REAL_NUMBER;
+#endif
       for(i = 0, unbound = 0, *len_non_gas = 0; i < len; i++)
 	{
 	  p = ud[i].index;
 	  if(P[p].v.DM_BindingEnergy > 0 && P[p].v.DM_BindingEnergy > energy_limit)
 	    {
 	      unbound++;
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+	      dmass += P[p].Mass; rmin = DMIN(rmin, subfind_unbind_tracker_distance(&tr, p));
+	      subfind_loctree_remove_particle(p);
+#endif
 	      ud[i] = ud[len - 1];
 	      i--;
 	      len--;
@@ -575,6 +738,9 @@ int subfind_unbind(struct unbind_data *ud, int len, int *len_non_gas)
 	  else if(P[p].Type != 0)
 	    (*len_non_gas)++;
 	}
+#ifdef SUBFIND_INCREMENTAL_UNBIND
+      subfind_unbind_tracker_removed(&tr, dmass, rmin);
+#endif
 
       if(len < All.DesLinkNgb)
 	break;
@@ -595,8 +761,6 @@ int subfind_unbind(struct unbind_data *ud, int len, int *len_non_gas)
     }
   while(unbound > 0);
 
-  myfree(bnd_energy);
-
   return (len);
 }
 
@@ -617,12 +781,22 @@ void subfind_determine_sub_halo_properties(struct unbind_data *d, int num, doubl
 					   double *pos, double *vel, double *cm, double *veldisp,
 					   double *vmax, double *vmaxrad, double *spin,
 					   MyIDType * mostboundid, double *halfmassrad, double *mass_tab)
+{
+  sort_r2list *rr_list = (sort_r2list *) mymalloc("rr_list", sizeof(sort_r2list) * (num + 1));
+  subfind_determine_sub_halo_properties_work(d, num, totmass, pos, vel, cm, veldisp, vmax, vmaxrad, spin, mostboundid, halfmassrad, mass_tab, rr_list);
+  myfree(rr_list);
+}
+
+/* the properties of the substructure of the num particles in d, with the scratch array rr_list (of num elements) */
+static void subfind_determine_sub_halo_properties_work(struct unbind_data *d, int num, double *totmass,
+					   double *pos, double *vel, double *cm, double *veldisp,
+					   double *vmax, double *vmaxrad, double *spin,
+					   MyIDType * mostboundid, double *halfmassrad, double *mass_tab, sort_r2list *rr_list)
 {
   int i, j, p, num_use, i_use;
   double s[3], v[3], max, vel_to_phys, H_of_a, atime, minpot;
   double lx, ly, lz, dv[3], dx[3], disp, rr_tmp, disp_tmp;
   double boxsize, ddxx;
-  sort_r2list *rr_list = 0;
   int minindex;
   double mass, maxrad;
   int nstar = 0, ndm = 0, ngas = 0, nbh = 0;
@@ -754,9 +928,6 @@ void subfind_determine_sub_halo_properties(struct unbind_data *d, int num, doubl
   num_use = ndm;
 #endif
 
-  if(num_use > 0)
-    rr_list = (sort_r2list *)mymalloc("rr_list", sizeof(sort_r2list) * num_use);
-
   for(i = 0, i_use = 0; i < num; i++)
     {
       p = d[i].index;
@@ -826,8 +997,6 @@ void subfind_determine_sub_halo_properties(struct unbind_data *d, int num, doubl
 
       *vmax = sqrt(All.G * max);
       *vmaxrad = maxrad;
-
-      myfree(rr_list);
     }
   else
     *veldisp = *halfmassrad = *vmax = *vmaxrad = spin[0] = spin[1] = spin[2] = 0;
@@ -45,6 +45,11 @@ void allocate_memory(void)
   NextActiveParticle = (int *) mymalloc("NextActiveParticle", bytes = All.MaxPart * sizeof(int));
   bytes_tot += bytes;
 
+#ifdef ACTIVE_PARTICLE_ARRAY
+  ActiveParticleList = (int *) mymalloc("ActiveParticleList", bytes = All.MaxPart * sizeof(int));
+  bytes_tot += bytes;
+#endif
+
   NextInTimeBin = (int *) mymalloc("NextInTimeBin", bytes = All.MaxPart * sizeof(int));
   bytes_tot += bytes;
 
@@ -61,6 +66,15 @@ void allocate_memory(void)
 	}
       bytes_tot += bytes;
 
+#ifdef HOTCOLD_PARTICLE_LAYOUT
+      if(!(PHot = (struct particle_hot *) mymalloc("PHot", bytes = All.MaxPart * sizeof(struct particle_hot))))
+	{
+	  printf("failed to allocate memory for `PHot' (%g MB).\n", bytes / (1024.0 * 1024.0));
+	  endrun(1);
+	}
+      bytes_tot += bytes;
+#endif
+
       if(ThisTask == 0)
 	printf("Allocated %g MByte for particle storage.\n", bytes_tot / (1024.0 * 1024.0));
     }
@@ -20,6 +20,30 @@ exportindex = Exportindex + thread_id * NTask;
 /* Note: exportflag is local to each thread */
 for(j = 0; j < NTask; j++) {exportflag[j] = -1;}
 /* now begin the actual loop */
+#ifdef ACTIVE_PARTICLE_ARRAY
+int k_slot = 0, n_slot = 0; /* chunk of the active-particle array claimed by this thread (no lock needed) */
+#ifdef THREAD_WORK_STEALING_IS_ACTIVE
+thread_scheduler_begin(THREAD_SCHEDULER_COST_NEIGHBORS); /* hand out cost-balanced ranges of the active particles to the threads */
+#endif
+while(1)
+{
+    if(BufferFullFlag != 0) {break;}
+    if(n_slot <= 0) {k_slot = active_particle_claim_chunk(ACTIVE_PARTICLE_MAXCHUNK, &n_slot); if(k_slot < 0) {break;}}
+    i = ActiveParticleList[k_slot++]; n_slot--;
+    CONDITION_FOR_EVALUATION
+    {
+#ifdef DOMAIN_MEASURED_COST
+        double t0_cost = my_second();
+#endif
+        if(EVALUATION_CALL < 0) {break;} // export buffer has filled up //
+        DOMAIN_MEASURED_COST_ADD(i, timediff(t0_cost, my_second())); /* time spent on this particle, for the domain decomposition */
+    }
+    ProcessedFlag[i] = 1; /* particle successfully finished */
+}
+#ifdef THREAD_WORK_STEALING_IS_ACTIVE
+thread_scheduler_end();
+#endif
+#else
 while(1)
 {
     int exitFlag = 0;
@@ -43,9 +67,14 @@ while(1)
     if(exitFlag) {break;}
     CONDITION_FOR_EVALUATION
     {
+#ifdef DOMAIN_MEASURED_COST
+        double t0_cost = my_second();
+#endif
         if(EVALUATION_CALL < 0) {break;} // export buffer has filled up //
+        DOMAIN_MEASURED_COST_ADD(i, timediff(t0_cost, my_second())); /* time spent on this particle, for the domain decomposition */
     }
     ProcessedFlag[i] = 1; /* particle successfully finished */
 }
+#endif
 /* loop completed successfully */
 return NULL;
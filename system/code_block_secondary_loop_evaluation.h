@@ -21,7 +21,13 @@ while(1)
     }
     UNLOCK_NEXPORT;
     if(j >= Nimport) {break;}
+#ifdef DOMAIN_MEASURED_COST
+    double t0_cost = my_second();
+#endif
     EVALUATION_CALL
+#ifdef DOMAIN_MEASURED_COST
+    if(XchangeImportCost) {XchangeImportCost[j] = (float) timediff(t0_cost, my_second());} /* returned to the host of the element, with its results */
+#endif
 }
 /* loop completed successfully */
 return NULL;
@@ -2,7 +2,12 @@
 be copy-pasted and can be generically optimized in a single place */
 {
     int j, k, ndone=0, ndone_flag=0, recvTask, place, save_NextParticle; long long n_exported = 0; double tstart, tend, tstart_loop; /* define some variables used only below */
-    NextParticle = FirstActiveParticle;    /* begin the main loop; start with this index */
+    NextParticle = ACTIVE_CURSOR_FIRST;    /* begin the main loop; start with this index */
+    PERF_TIMER_START(MACRO_NAME_STRING(CORE_FUNCTION_NAME)); /* the loop is timed under the name of its core function */
+#ifdef PERFORMANCE_TRACE
+    long long perf_n_import = 0, perf_n_rounds = 0, perf_n_bytes = 0; double perf_timecomp = timecomp, perf_timecomm = timecomm, perf_timewait = timewait;
+    perf_xchange_begin();
+#endif
     tstart_loop = my_second();
     do /* primary point-element loop */
     {
@@ -16,8 +21,14 @@ be copy-pasted and can be generically optimized in a single place */
             int mainthreadid = omp_get_thread_num();
 #else
             int mainthreadid = 0;
+#endif
+#ifdef PERFORMANCE_TRACE
+            double perf_tstart_thread = my_second();
 #endif
             PRIMARY_SUBFUN_NAME(&mainthreadid, loop_iteration);    /* do local particles and prepare export list */
+#ifdef PERFORMANCE_TRACE
+            perf_xchange_thread_time(mainthreadid, timediff(perf_tstart_thread, my_second()));
+#endif
         }
         tend = my_second(); timecomp += timediff(tstart, tend);
         if(BufferFullFlag) /* we've filled the buffer or reached the end of the list, prepare for communications */
@@ -26,13 +37,13 @@ be copy-pasted and can be generically optimized in a single place */
             while(NextParticle >= 0)
             {
                 if(NextParticle == last_nextparticle) {break;}
-                if(ProcessedFlag[NextParticle] != 1) {break;}
-                ProcessedFlag[NextParticle] = 2; NextParticle = NextActiveParticle[NextParticle];
+                if(ProcessedFlag[ACTIVE_CURSOR_PARTICLE(NextParticle)] != 1) {break;}
+                ProcessedFlag[ACTIVE_CURSOR_PARTICLE(NextParticle)] = 2; NextParticle = ACTIVE_CURSOR_NEXT(NextParticle);
             }
             if(NextParticle == save_NextParticle)
             {
-                PRINT_WARNING("NextParticle == save_NextParticle condition (the buffer appears too small to hold a single particle): NextParticle=%d save_NextParticle=%d last_nextparticle=%d ProcessedFlag[NextParticle]=%d NextActiveParticle[NextParticle]=%d NumPart=%d N_gas=%d NTaskTimesNumPart=%llu maxThreads=%d All.BunchSize=%ld All.BufferSize=%llu Nexport=%ld ndone=%d ndone_flag=%d NTask=%d",NextParticle,save_NextParticle,last_nextparticle,ProcessedFlag[NextParticle],NextActiveParticle[NextParticle],NumPart,N_gas,(unsigned long long)NTaskTimesNumPart,maxThreads,All.BunchSize,(unsigned long long)All.BufferSize,Nexport,ndone,ndone_flag,NTask);
-                if(NextParticle >= 0) {PRINT_WARNING("This is a live particle: NextParticle=%d ID=%llu Mass=%g Type=%d",NextParticle,(unsigned long long)P[NextParticle].ID,P[NextParticle].Mass,P[NextParticle].Type);}
+                PRINT_WARNING("NextParticle == save_NextParticle condition (the buffer appears too small to hold a single particle): NextParticle=%d save_NextParticle=%d last_nextparticle=%d ProcessedFlag[NextParticle]=%d NextActiveParticle[NextParticle]=%d NumPart=%d N_gas=%d NTaskTimesNumPart=%llu maxThreads=%d All.BunchSize=%ld All.BufferSize=%llu Nexport=%ld ndone=%d ndone_flag=%d NTask=%d",NextParticle,save_NextParticle,last_nextparticle,ProcessedFlag[ACTIVE_CURSOR_PARTICLE(NextParticle)],ACTIVE_CURSOR_NEXT(NextParticle),NumPart,N_gas,(unsigned long long)NTaskTimesNumPart,maxThreads,All.BunchSize,(unsigned long long)All.BufferSize,Nexport,ndone,ndone_flag,NTask);
+                if(NextParticle >= 0) {PRINT_WARNING("This is a live particle: NextParticle=%d ID=%llu Mass=%g Type=%d",NextParticle,(unsigned long long)P[ACTIVE_CURSOR_PARTICLE(NextParticle)].ID,P[ACTIVE_CURSOR_PARTICLE(NextParticle)].Mass,P[ACTIVE_CURSOR_PARTICLE(NextParticle)].Type);}
                 endrun(113312);
             } /* in this case, the buffer is too small to process even a single particle */
             
@@ -56,16 +67,33 @@ be copy-pasted and can be generically optimized in a single place */
             Nexport = new_export; /* counting exports... */
         }
         n_exported += Nexport;
+#ifdef USE_NONBLOCKING_XCHANGE
+        MPI_Request ndone_request; /* whether we are done is already known here, so start the global check now and let it complete in the background */
+        if(NextParticle < 0) {ndone_flag = 1;} else {ndone_flag = 0;}
+        MPI_Iallreduce(&ndone_flag, &ndone, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD, &ndone_request);
+#endif
         for(j = 0; j < NTask; j++) {Send_count[j] = 0;}
         for(j = 0; j < Nexport; j++) {Send_count[DataIndexTable[j].Task]++;}
         MYSORT_DATAINDEX(DataIndexTable, Nexport, sizeof(struct data_index), data_index_compare); /* construct export count tables */
         tstart = my_second();
+#ifdef USE_NONBLOCKING_XCHANGE
+        mpi_sparse_exchange_counts(Send_count, Recv_count); /* only contacts the tasks we actually export to */
+#else
         MPI_Alltoall(Send_count, 1, MPI_INT, Recv_count, 1, MPI_INT, MPI_COMM_WORLD); /* broadcast import/export counts */
+#endif
         tend = my_second(); timewait += timediff(tstart, tend);
+#ifdef PERFORMANCE_TRACE
+        long long perf_n_import_round = 0; /* this round of the buffer: both the data and the results are sent for every export and import */
+        for(j = 0; j < NTask; j++) {perf_n_import_round += Recv_count[j];}
+        perf_n_import += perf_n_import_round; perf_n_rounds++; perf_n_bytes += (Nexport + perf_n_import_round) * (long long) (sizeof(struct INPUT_STRUCT_NAME) + sizeof(struct OUTPUT_STRUCT_NAME));
+#endif
 
         for(j = 0, Send_offset[0] = 0; j < NTask; j++) {if(j > 0) {Send_offset[j] = Send_offset[j - 1] + Send_count[j - 1];}} /* calculate export table offsets */
         DATAIN_NAME = (struct INPUT_STRUCT_NAME *) mymalloc("DATAIN_NAME", Nexport * sizeof(struct INPUT_STRUCT_NAME));
         DATAOUT_NAME = (struct OUTPUT_STRUCT_NAME *) mymalloc("DATAOUT_NAME", Nexport * sizeof(struct OUTPUT_STRUCT_NAME));
+#ifdef DOMAIN_MEASURED_COST
+        float *export_cost = (float *) mymalloc("export_cost", Nexport * sizeof(float)); /* measured time of the evaluation of our exports on the other tasks */
+#endif
         for(j = 0; j < Nexport; j++) /* prepare particle data for export [fill in the structures to be passed] */
         {
             place = DataIndexTable[j].Index;
@@ -73,6 +101,9 @@ be copy-pasted and can be generically optimized in a single place */
             memcpy(DATAIN_NAME[j].NodeList,DataNodeList[DataIndexTable[j].IndexGet].NodeList, NODELISTLENGTH * sizeof(int));
         }
 
+#ifdef USE_NONBLOCKING_XCHANGE
+#include "code_block_xchange_perform_ops_nonblocking.h" /* non-blocking exchange of the exports/imports, evaluating imports and returning results as they arrive */
+#else
         /* ok now we have to figure out if there is enough memory to handle all the tasks sending us their data, and if not, break it into sub-chunks */
         int N_chunks_for_import, ngrp_initial, ngrp;
         for(ngrp_initial = 1; ngrp_initial < (1 << PTask); ngrp_initial += N_chunks_for_import) /* sub-chunking loop opener */
@@ -87,6 +118,9 @@ be copy-pasted and can be generically optimized in a single place */
                     if(recvTask < NTask) {if(Recv_count[recvTask] > 0) {Nimport += Recv_count[recvTask];}}
                 }
                 size_t space_needed = Nimport * sizeof(struct INPUT_STRUCT_NAME) + Nimport * sizeof(struct OUTPUT_STRUCT_NAME) + 16384; /* extra bitflag is a padding, to avoid overflows */
+#ifdef DOMAIN_MEASURED_COST
+                space_needed += Nimport * sizeof(float);
+#endif
                 if(space_needed > FreeBytes) {flag = 1;}
                 
                 MPI_Allreduce(&flag, &flagall, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
@@ -98,6 +132,9 @@ be copy-pasted and can be generically optimized in a single place */
             /* now allocated the import and results buffers */
             DATAGET_NAME = (struct INPUT_STRUCT_NAME *) mymalloc("DATAGET_NAME", Nimport * sizeof(struct INPUT_STRUCT_NAME));
             DATARESULT_NAME = (struct OUTPUT_STRUCT_NAME *) mymalloc("DATARESULT_NAME", Nimport * sizeof(struct OUTPUT_STRUCT_NAME));
+#ifdef DOMAIN_MEASURED_COST
+            XchangeImportCost = (float *) mymalloc("XchangeImportCost", Nimport * sizeof(float));
+#endif
 
             tstart = my_second(); Nimport = 0; /* reset because this will be cycled below to calculate the recieve offsets (Recv_offset) */
             for(ngrp = ngrp_initial; ngrp < ngrp_initial + N_chunks_for_import; ngrp++) /* exchange particle data */
@@ -126,8 +163,14 @@ be copy-pasted and can be generically optimized in a single place */
                 int mainthreadid = omp_get_thread_num();
 #else
                 int mainthreadid = 0;
+#endif
+#ifdef PERFORMANCE_TRACE
+                double perf_tstart_thread = my_second();
 #endif
                 SECONDARY_SUBFUN_NAME(&mainthreadid, loop_iteration);
+#ifdef PERFORMANCE_TRACE
+                perf_xchange_thread_time(mainthreadid, timediff(perf_tstart_thread, my_second()));
+#endif
             }
             tend = my_second(); timecomp += timediff(tstart, tend); tstart = my_second();
             MPI_Barrier(MPI_COMM_WORLD); /* insert MPI Barrier here - will be forced by comms below anyways but this allows for clean timing measurements */
@@ -144,11 +187,18 @@ be copy-pasted and can be generically optimized in a single place */
                         MPI_Sendrecv(&DATARESULT_NAME[Nimport], Recv_count[recvTask] * sizeof(struct OUTPUT_STRUCT_NAME), MPI_BYTE, recvTask, TAG_MPI_GENERIC_COM_BUFFER_B,
                                      &DATAOUT_NAME[Send_offset[recvTask]], Send_count[recvTask] * sizeof(struct OUTPUT_STRUCT_NAME), MPI_BYTE, recvTask, TAG_MPI_GENERIC_COM_BUFFER_B,
                                      MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+#ifdef DOMAIN_MEASURED_COST
+                        MPI_Sendrecv(&XchangeImportCost[Nimport], Recv_count[recvTask], MPI_FLOAT, recvTask, TAG_MPI_GENERIC_COM_BUFFER_C,
+                                     &export_cost[Send_offset[recvTask]], Send_count[recvTask], MPI_FLOAT, recvTask, TAG_MPI_GENERIC_COM_BUFFER_C, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+#endif
                         Nimport += Recv_count[recvTask];
                     }
                 }
             }
             tend = my_second(); timecomm += timediff(tstart, tend);
+#ifdef DOMAIN_MEASURED_COST
+            myfree(XchangeImportCost); XchangeImportCost = NULL;
+#endif
             myfree(DATARESULT_NAME); myfree(DATAGET_NAME); /* free the structures used to send data back to tasks, its sent */
             
         } /* close the sub-chunking loop: for(ngrp_initial = 1; ngrp_initial < (1 << PTask); ngrp_initial += N_chunks_for_import) */
@@ -159,17 +209,30 @@ be copy-pasted and can be generically optimized in a single place */
         {
             place = DataIndexTable[j].Index;
             OUTPUTFUNCTION_NAME(&DATAOUT_NAME[j], place, 1, loop_iteration);
+            DOMAIN_MEASURED_COST_ADD(place, export_cost[j]); /* the work done on the other tasks on behalf of this particle */
         }
         tend = my_second(); timecomp += timediff(tstart, tend);
+#endif
+#ifdef DOMAIN_MEASURED_COST
+        myfree(export_cost);
+#endif
         myfree(DATAOUT_NAME); myfree(DATAIN_NAME); /* free the structures used to prepare our initial export data, we're done here! */
         
-        if(NextParticle < 0) {ndone_flag = 1;} else {ndone_flag = 0;} /* figure out if we are done with the particular active set here */
         tstart = my_second();
+#ifdef USE_NONBLOCKING_XCHANGE
+        MPI_Wait(&ndone_request, MPI_STATUS_IGNORE); /* completes the check started above of whether all tasks are done here */
+#else
+        if(NextParticle < 0) {ndone_flag = 1;} else {ndone_flag = 0;} /* figure out if we are done with the particular active set here */
         MPI_Allreduce(&ndone_flag, &ndone, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD); /* call an allreduce to figure out if all tasks are also done here, otherwise we need to iterate */
+#endif
         tend = my_second(); timewait += timediff(tstart, tend);
     }
     while(ndone < NTask);
     timeall += timediff(tstart_loop, my_second());
+#ifdef PERFORMANCE_TRACE
+    perf_xchange_record(n_exported, perf_n_import, perf_n_rounds, perf_n_bytes, timecomp - perf_timecomp, timecomm - perf_timecomm, timewait - perf_timewait);
+#endif
+    PERF_TIMER_STOP(MACRO_NAME_STRING(CORE_FUNCTION_NAME));
     
 } /* closes clause, so variables don't 'leak' */
 
@@ -0,0 +1,135 @@
+/* This is the non-blocking alternative (USE_NONBLOCKING_XCHANGE) to the blocking hypercube exchange of the import/export
+    buffers in code_block_xchange_perform_ops.h, which it is included from (it uses the variables defined there). All exports
+    are posted at once as non-blocking sends (with the receives of their results), and imports are evaluated -- and their
+    results sent back -- as soon as each one arrives, so that computation overlaps with communication. If the imports do not
+    fit into memory they are received in chunks, but the chunking is decided locally, since every export has already been
+    posted by its sender there is no need for the global agreement (and MPI_Allreduce) of the blocking version. */
+{
+    int n_send = 0, n_recv, n_pending, n_completed, k_first, k_last, k_task;
+    MPI_Request *req_send = (MPI_Request *) mymalloc("req_send", 6 * NTask * sizeof(MPI_Request)), *req_result = req_send + NTask, *req_recv = req_send + 2*NTask, *req_return = req_send + 3*NTask;
+#ifdef DOMAIN_MEASURED_COST
+    MPI_Request *req_cost_result = req_send + 4*NTask, *req_cost_return = req_send + 5*NTask; /* the measured costs of the imports travel with their results */
+#endif
+    int *task_send = (int *) mymalloc("task_send", 4 * NTask * sizeof(int)), *task_recv = task_send + NTask, *offset_recv = task_send + 2*NTask, *index_completed = task_send + 3*NTask;
+
+    tstart = my_second(); /* post the sends of all our exports, and the receives for their results */
+    for(k_task = 1; k_task < NTask; k_task++)
+    {
+        recvTask = (ThisTask + k_task) % NTask;
+        if(Send_count[recvTask] > 0)
+        {
+            MPI_Isend(&DATAIN_NAME[Send_offset[recvTask]], Send_count[recvTask] * sizeof(struct INPUT_STRUCT_NAME), MPI_BYTE, recvTask, TAG_MPI_GENERIC_COM_BUFFER_A, MPI_COMM_WORLD, &req_send[n_send]);
+            MPI_Irecv(&DATAOUT_NAME[Send_offset[recvTask]], Send_count[recvTask] * sizeof(struct OUTPUT_STRUCT_NAME), MPI_BYTE, recvTask, TAG_MPI_GENERIC_COM_BUFFER_B, MPI_COMM_WORLD, &req_result[n_send]);
+#ifdef DOMAIN_MEASURED_COST
+            MPI_Irecv(&export_cost[Send_offset[recvTask]], Send_count[recvTask], MPI_FLOAT, recvTask, TAG_MPI_GENERIC_COM_BUFFER_C, MPI_COMM_WORLD, &req_cost_result[n_send]);
+#endif
+            task_send[n_send] = recvTask; n_send++;
+        }
+    }
+    tend = my_second(); timecomm += timediff(tstart, tend);
+
+    for(k_first = 1; k_first < NTask; k_first = k_last) /* receive the imports, in as few chunks as the free memory allows */
+    {
+        size_t space_needed = 16384; /* extra padding, to avoid overflows */
+        for(k_last = k_first, Nimport = 0; k_last < NTask; k_last++)
+        {
+            recvTask = (ThisTask - k_last + NTask) % NTask;
+            size_t space_task = Recv_count[recvTask] * (sizeof(struct INPUT_STRUCT_NAME) + sizeof(struct OUTPUT_STRUCT_NAME));
+#ifdef DOMAIN_MEASURED_COST
+            space_task += Recv_count[recvTask] * sizeof(float);
+#endif
+            if(space_needed + space_task > FreeBytes) {break;}
+            space_needed += space_task; Nimport += Recv_count[recvTask];
+        }
+        if(k_last == k_first) {recvTask = (ThisTask - k_first + NTask) % NTask; printf("Memory is insufficient for even one import-chunk: Task=%d recvTask=%d Recv_count=%d FreeBytes=%lld , but we need to allocate=%lld \n", ThisTask, recvTask, Recv_count[recvTask], (long long)FreeBytes, (long long)(Recv_count[recvTask] * (sizeof(struct INPUT_STRUCT_NAME) + sizeof(struct OUTPUT_STRUCT_NAME)) + 16384)); endrun(9977);}
+        if(k_first > 1 || k_last < NTask) {PRINT_WARNING("Task %d splitting non-blocking import operation into sub-chunks as we are hitting memory limits (check this isn't imposing large communication cost)", ThisTask);}
+
+        DATAGET_NAME = (struct INPUT_STRUCT_NAME *) mymalloc("DATAGET_NAME", Nimport * sizeof(struct INPUT_STRUCT_NAME));
+        DATARESULT_NAME = (struct OUTPUT_STRUCT_NAME *) mymalloc("DATARESULT_NAME", Nimport * sizeof(struct OUTPUT_STRUCT_NAME));
+#ifdef DOMAIN_MEASURED_COST
+        XchangeImportCost = (float *) mymalloc("XchangeImportCost", Nimport * sizeof(float));
+#endif
+
+        tstart = my_second(); n_recv = 0; Nimport = 0;
+        for(k_task = k_first; k_task < k_last; k_task++)
+        {
+            recvTask = (ThisTask - k_task + NTask) % NTask;
+            if(Recv_count[recvTask] > 0)
+            {
+                MPI_Irecv(&DATAGET_NAME[Nimport], Recv_count[recvTask] * sizeof(struct INPUT_STRUCT_NAME), MPI_BYTE, recvTask, TAG_MPI_GENERIC_COM_BUFFER_A, MPI_COMM_WORLD, &req_recv[n_recv]);
+                task_recv[n_recv] = recvTask; offset_recv[n_recv] = Nimport; n_recv++; Nimport += Recv_count[recvTask];
+            }
+        }
+        tend = my_second(); timecomm += timediff(tstart, tend);
+
+        for(n_pending = n_recv; n_pending > 0; n_pending -= n_completed) /* evaluate each import as soon as it has arrived, and immediately return its results */
+        {
+            tstart = my_second();
+            MPI_Waitsome(n_recv, req_recv, &n_completed, index_completed, MPI_STATUSES_IGNORE);
+            tend = my_second(); timewait += timediff(tstart, tend);
+            for(k = 0; k < n_completed; k++)
+            {
+                int n_task = index_completed[k]; recvTask = task_recv[n_task];
+                tstart = my_second(); NextJ = offset_recv[n_task]; Nimport = offset_recv[n_task] + Recv_count[recvTask]; /* the secondary loop evaluates elements NextJ <= j < Nimport */
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+                {
+#ifdef _OPENMP
+                    int mainthreadid = omp_get_thread_num();
+#else
+                    int mainthreadid = 0;
+#endif
+#ifdef PERFORMANCE_TRACE
+                    double perf_tstart_thread = my_second();
+#endif
+                    SECONDARY_SUBFUN_NAME(&mainthreadid, loop_iteration);
+#ifdef PERFORMANCE_TRACE
+                    perf_xchange_thread_time(mainthreadid, timediff(perf_tstart_thread, my_second()));
+#endif
+                }
+                tend = my_second(); timecomp += timediff(tstart, tend); tstart = my_second();
+                MPI_Isend(&DATARESULT_NAME[offset_recv[n_task]], Recv_count[recvTask] * sizeof(struct OUTPUT_STRUCT_NAME), MPI_BYTE, recvTask, TAG_MPI_GENERIC_COM_BUFFER_B, MPI_COMM_WORLD, &req_return[n_task]);
+#ifdef DOMAIN_MEASURED_COST
+                MPI_Isend(&XchangeImportCost[offset_recv[n_task]], Recv_count[recvTask], MPI_FLOAT, recvTask, TAG_MPI_GENERIC_COM_BUFFER_C, MPI_COMM_WORLD, &req_cost_return[n_task]);
+#endif
+                tend = my_second(); timecomm += timediff(tstart, tend);
+            }
+        }
+        tstart = my_second();
+        MPI_Waitall(n_recv, req_return, MPI_STATUSES_IGNORE); /* results must be out of the buffers before we release them */
+#ifdef DOMAIN_MEASURED_COST
+        MPI_Waitall(n_recv, req_cost_return, MPI_STATUSES_IGNORE);
+#endif
+        tend = my_second(); timewait += timediff(tstart, tend);
+#ifdef DOMAIN_MEASURED_COST
+        myfree(XchangeImportCost); XchangeImportCost = NULL;
+#endif
+        myfree(DATARESULT_NAME); myfree(DATAGET_NAME);
+    } /* close the import-chunk loop */
+
+    for(n_pending = n_send; n_pending > 0; n_pending -= n_completed) /* add the results for our exports to the local elements as they come back */
+    {
+        tstart = my_second();
+        MPI_Waitsome(n_send, req_result, &n_completed, index_completed, MPI_STATUSES_IGNORE);
+        tend = my_second(); timewait += timediff(tstart, tend); tstart = my_second();
+        for(k = 0; k < n_completed; k++)
+        {
+            recvTask = task_send[index_completed[k]];
+            for(j = Send_offset[recvTask]; j < Send_offset[recvTask] + Send_count[recvTask]; j++)
+            {
+                place = DataIndexTable[j].Index;
+                OUTPUTFUNCTION_NAME(&DATAOUT_NAME[j], place, 1, loop_iteration);
+            }
+        }
+        tend = my_second(); timecomp += timediff(tstart, tend);
+    }
+    tstart = my_second();
+    MPI_Waitall(n_send, req_send, MPI_STATUSES_IGNORE); /* our export data has been received by now (its results came back), so this just releases the requests */
+#ifdef DOMAIN_MEASURED_COST
+    MPI_Waitall(n_send, req_cost_result, MPI_STATUSES_IGNORE);
+    for(j = 0; j < Nexport; j++) {DOMAIN_MEASURED_COST_ADD(DataIndexTable[j].Index, export_cost[j]);} /* the work done on the other tasks on behalf of our particles */
+#endif
+    tend = my_second(); timewait += timediff(tstart, tend);
+    myfree(task_send); myfree(req_send);
+}
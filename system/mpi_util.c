@@ -44,6 +44,48 @@ int mpi_calculate_offsets(int *send_count, int *send_offset, int *recv_count, in
 }
 
 
+#ifdef USE_NONBLOCKING_XCHANGE
+/** Sparse alternative to the MPI_Alltoall of the send_count array: fills recv_count
+    while only exchanging messages with the tasks we actually have something to send
+    to (the 'non-blocking consensus' algorithm: synchronous sends, probing for incoming
+    counts, and a non-blocking barrier entered once all our sends have been matched).
+    The tag alternates between successive calls, so counts from a task which is already
+    one exchange ahead cannot be confused with the current one. Requires MPI-3.
+
+    All arrays should be allocated with NTask size. */
+void mpi_sparse_exchange_counts(int *send_count, int *recv_count)
+{
+  static int n_calls = 0;
+  int j, n_send = 0, flag, all_sent = 0, barrier_active = 0, tag = (n_calls++ % 2) ? TAG_SPARSE_COUNTS_B : TAG_SPARSE_COUNTS_A;
+  MPI_Request barrier_request, *requests = (MPI_Request *) mymalloc("requests", NTask * sizeof(MPI_Request));
+  MPI_Status status;
+
+  for(j = 0; j < NTask; j++)
+    {
+      recv_count[j] = 0;
+      if(send_count[j] > 0) {MPI_Issend(&send_count[j], 1, MPI_INT, j, tag, MPI_COMM_WORLD, &requests[n_send++]);}
+    }
+
+  while(1)
+    {
+      MPI_Iprobe(MPI_ANY_SOURCE, tag, MPI_COMM_WORLD, &flag, &status);
+      if(flag) {MPI_Recv(&recv_count[status.MPI_SOURCE], 1, MPI_INT, status.MPI_SOURCE, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);}
+      if(barrier_active)
+	{
+	  MPI_Test(&barrier_request, &flag, MPI_STATUS_IGNORE);
+	  if(flag) {break;} /* every task has had all of its counts received, so there is nothing left in flight to us */
+	}
+      else
+	{
+	  MPI_Testall(n_send, requests, &all_sent, MPI_STATUSES_IGNORE);
+	  if(all_sent) {MPI_Ibarrier(MPI_COMM_WORLD, &barrier_request); barrier_active = 1;}
+	}
+    }
+  myfree(requests);
+}
+#endif
+
+
 /** Compare function used to sort an array of int pointers into order
     of the pointer targets. */
 int intpointer_compare(const void *a, const void *b)
@@ -1,8 +1,14 @@
 /*
- this defines a code-block to be inserted in the neighbor search routines after the conditions for neighbor-validity are applied
- (valid particle types checked)
+ this defines a code-block to be inserted in the neighbor search routines after the conditions for neighbor-validity are defined
+ (NGB_SKIP_PARTICLE, valid particle types checked). with HOTCOLD_PARTICLE_LAYOUT they are applied only after the distance test,
+ so particles outside the search volume are rejected from the dense PHot entries without touching their particle_data entry
  */
-if(P[p].Ti_current != ti_Current)
+#if defined(HOTCOLD_PARTICLE_LAYOUT) && !defined(REDUCE_TREEWALK_BRANCHING)
+#define NGB_SKIP_PARTICLE_AFTER_DISTANCE
+#else
+if(NGB_SKIP_PARTICLE(p)) continue;
+#endif
+if(PHOT_TI_CURRENT(p) != ti_Current)
 {
     LOCK_PARTNODEDRIFT;
 #ifdef _OPENMP
@@ -14,18 +20,22 @@ if(P[p].Ti_current != ti_Current)
 
 #ifndef REDUCE_TREEWALK_BRANCHING
 #if (SEARCHBOTHWAYS==1)
-dist = DMAX(PPP[p].Hsml, hsml);
+dist = DMAX(PHOT_HSML(p), hsml);
 #else
 dist = hsml;
 #endif
-dx = NGB_PERIODIC_BOX_LONG_X(P[p].Pos[0] - searchcenter[0], P[p].Pos[1] - searchcenter[1], P[p].Pos[2] - searchcenter[2],-1);
+dx = NGB_PERIODIC_BOX_LONG_X(PHOT_POS(p)[0] - searchcenter[0], PHOT_POS(p)[1] - searchcenter[1], PHOT_POS(p)[2] - searchcenter[2],-1);
 if(dx > dist) continue;
-dy = NGB_PERIODIC_BOX_LONG_Y(P[p].Pos[0] - searchcenter[0], P[p].Pos[1] - searchcenter[1], P[p].Pos[2] - searchcenter[2],-1);
+dy = NGB_PERIODIC_BOX_LONG_Y(PHOT_POS(p)[0] - searchcenter[0], PHOT_POS(p)[1] - searchcenter[1], PHOT_POS(p)[2] - searchcenter[2],-1);
 if(dy > dist) continue;
-dz = NGB_PERIODIC_BOX_LONG_Z(P[p].Pos[0] - searchcenter[0], P[p].Pos[1] - searchcenter[1], P[p].Pos[2] - searchcenter[2],-1);
+dz = NGB_PERIODIC_BOX_LONG_Z(PHOT_POS(p)[0] - searchcenter[0], PHOT_POS(p)[1] - searchcenter[1], PHOT_POS(p)[2] - searchcenter[2],-1);
 if(dz > dist) continue;
 if(dx * dx + dy * dy + dz * dz > dist * dist) continue;
 #endif
+#ifdef NGB_SKIP_PARTICLE_AFTER_DISTANCE
+if(NGB_SKIP_PARTICLE(p)) continue;
+#undef NGB_SKIP_PARTICLE_AFTER_DISTANCE
+#endif
 ngblist[numngb++] = p;  /* Note: unlike in previous versions of the code, the buffer can hold up to all particles. note also the threaded-vs-unthreaded use of n vs N in ngblist */
 }
 else
@@ -43,6 +53,9 @@ else
         
         if(target >= 0)	/* if no target is given, export will not occur */
         {
+#ifdef HYDRO_NGBLIST_CACHE
+            NgbCache_WalkExported = 1; /* this walk needs remote elements, so it cannot be replaced by a local cached list */
+#endif
             if(exportflag[task = DomainTask[no - (maxPart + maxNodes)]] != target)
             {
                 exportflag[task] = target;
@@ -1,20 +1,29 @@
-if(P[p].Ti_current != ti_Current)
+#if defined(HOTCOLD_PARTICLE_LAYOUT) && !defined(REDUCE_TREEWALK_BRANCHING)
+#define NGB_SKIP_PARTICLE_AFTER_DISTANCE
+#else
+if(NGB_SKIP_PARTICLE(p)) continue;
+#endif
+if(PHOT_TI_CURRENT(p) != ti_Current)
 drift_particle(p, ti_Current);
 
 #ifndef REDUCE_TREEWALK_BRANCHING
 #if (SEARCHBOTHWAYS==1)
-dist = DMAX(PPP[p].Hsml, hsml);
+dist = DMAX(PHOT_HSML(p), hsml);
 #else
 dist = hsml;
 #endif
-dx = NGB_PERIODIC_BOX_LONG_X(P[p].Pos[0] - searchcenter[0], P[p].Pos[1] - searchcenter[1], P[p].Pos[2] - searchcenter[2],-1);
+dx = NGB_PERIODIC_BOX_LONG_X(PHOT_POS(p)[0] - searchcenter[0], PHOT_POS(p)[1] - searchcenter[1], PHOT_POS(p)[2] - searchcenter[2],-1);
 if(dx > dist) continue;
-dy = NGB_PERIODIC_BOX_LONG_Y(P[p].Pos[0] - searchcenter[0], P[p].Pos[1] - searchcenter[1], P[p].Pos[2] - searchcenter[2],-1);
+dy = NGB_PERIODIC_BOX_LONG_Y(PHOT_POS(p)[0] - searchcenter[0], PHOT_POS(p)[1] - searchcenter[1], PHOT_POS(p)[2] - searchcenter[2],-1);
 if(dy > dist) continue;
-dz = NGB_PERIODIC_BOX_LONG_Z(P[p].Pos[0] - searchcenter[0], P[p].Pos[1] - searchcenter[1], P[p].Pos[2] - searchcenter[2],-1);
+dz = NGB_PERIODIC_BOX_LONG_Z(PHOT_POS(p)[0] - searchcenter[0], PHOT_POS(p)[1] - searchcenter[1], PHOT_POS(p)[2] - searchcenter[2],-1);
 if(dz > dist) continue;
 if(dx * dx + dy * dy + dz * dz > dist * dist) continue;
 #endif
+#ifdef NGB_SKIP_PARTICLE_AFTER_DISTANCE
+if(NGB_SKIP_PARTICLE(p)) continue;
+#undef NGB_SKIP_PARTICLE_AFTER_DISTANCE
+#endif
 
 Ngblist[numngb++] = p;
 }
@@ -25,6 +25,11 @@ static struct peano_hilbert_data
 
 static int *Id;
 
+#ifdef OPENMP_PEANO_REORDER
+static void peano_radix_sort(struct peano_hilbert_data *b, int n);
+static void reorder_streams(int n_streams, char **base, size_t *size, int first, int n);
+#endif
+
 void peano_hilbert_order(void)
 {
   int i; PRINT_STATUS("Begin Peano-Hilbert order...");
@@ -40,7 +45,9 @@ void peano_hilbert_order(void)
 	  mp[i].key = Key[i];
 	}
 
-#ifdef MYSORT
+#if defined(OPENMP_PEANO_REORDER)
+      peano_radix_sort(mp, N_gas);
+#elif defined(MYSORT)
       mysort_peano(mp, N_gas, sizeof(struct peano_hilbert_data), peano_compare_key);
 #else
       qsort(mp, N_gas, sizeof(struct peano_hilbert_data), peano_compare_key);
@@ -71,7 +78,9 @@ void peano_hilbert_order(void)
 	  mp[i].key = Key[i];
 	}
 
-#ifdef MYSORT
+#if defined(OPENMP_PEANO_REORDER)
+      peano_radix_sort(mp + N_gas, NumPart - N_gas);
+#elif defined(MYSORT)
       mysort_peano(mp + N_gas, NumPart - N_gas, sizeof(struct peano_hilbert_data), peano_compare_key);
 #else
       qsort(mp + N_gas, NumPart - N_gas, sizeof(struct peano_hilbert_data), peano_compare_key);
@@ -101,6 +110,15 @@ int peano_compare_key(const void *a, const void *b)
 
 void reorder_gas(void)
 {
+#ifdef OPENMP_PEANO_REORDER
+  int n_streams = 2;
+  char *base[3] = {(char *) P, (char *) SphP, NULL};
+  size_t size[3] = {sizeof(struct particle_data), sizeof(struct sph_particle_data), 0};
+#ifdef CHIMES
+  base[n_streams] = (char *) ChimesGasVars; size[n_streams++] = sizeof(struct gasVariables); /* moves in lockstep with SphP */
+#endif
+  reorder_streams(n_streams, base, size, 0, N_gas);
+#else
   int i;
   struct particle_data Psave, Psource;
   struct sph_particle_data SphPsave, SphPsource;
@@ -151,11 +169,17 @@ void reorder_gas(void)
 	  while(1);
 	}
     }
+#endif
 }
 
 
 void reorder_particles(void)
 {
+#ifdef OPENMP_PEANO_REORDER
+  char *base[1] = {(char *) P};
+  size_t size[1] = {sizeof(struct particle_data)};
+  reorder_streams(1, base, size, N_gas, NumPart - N_gas);
+#else
   int i;
   struct particle_data Psave, Psource;
   int idsource, idsave, dest;
@@ -185,9 +209,120 @@ void reorder_particles(void)
 	  while(1);
 	}
     }
+#endif
+}
+
+
+
+#ifdef OPENMP_PEANO_REORDER
+/*! LSD radix sort of the keys (8 bits per pass), threaded with OpenMP: each thread histograms and then scatters its own
+ *  contiguous block of the input, so the sort is stable (equal keys keep their order, as in the merge sort of MYSORT). Passes
+ *  over digits which are the same for all keys are skipped, so typically only ceil(3*BITS_PER_DIMENSION/8) passes are made */
+static void peano_radix_sort(struct peano_hilbert_data *b, int n)
+{
+  int i, shift, n_threads = 1;
+  peanokey key_or = 0, key_and = ~((peanokey) 0);
+  struct peano_hilbert_data *tmp, *src = b, *dst;
+#ifdef _OPENMP
+  n_threads = omp_get_max_threads();
+#endif
+  int *count = (int *) mymalloc("radix_count", n_threads * 256 * sizeof(int));
+  tmp = dst = (struct peano_hilbert_data *) mymalloc("radix_tmp", n * sizeof(struct peano_hilbert_data));
+
+#ifdef _OPENMP
+#pragma omp parallel for private(i) reduction(|:key_or) reduction(&:key_and)
+#endif
+  for(i = 0; i < n; i++) {key_or |= b[i].key; key_and &= b[i].key;}
+
+  for(shift = 0; shift < (int) (8 * sizeof(peanokey)); shift += 8)
+    {
+      if((((key_or ^ key_and) >> shift) & 0xFF) == 0) continue; /* this digit is identical for all keys, so the pass would not change the order */
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+      {
+        int j, d, th = 0, n_team = 1;
+#ifdef _OPENMP
+        th = omp_get_thread_num(); n_team = omp_get_num_threads();
+#endif
+        int *c = count + 256 * th, j_start = (int) (((long long) n * th) / n_team), j_end = (int) (((long long) n * (th + 1)) / n_team);
+        for(d = 0; d < 256; d++) {c[d] = 0;}
+        for(j = j_start; j < j_end; j++) {c[(src[j].key >> shift) & 0xFF]++;}
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+        { /* exclusive prefix sum over (digit, thread), which gives every thread its own output range for every digit */
+          int k, t, sum = 0;
+          for(k = 0; k < 256; k++) {for(t = 0; t < n_team; t++) {int tmp = count[256 * t + k]; count[256 * t + k] = sum; sum += tmp;}}
+        }
+        for(j = j_start; j < j_end; j++) {dst[c[(src[j].key >> shift) & 0xFF]++] = src[j];}
+      }
+      dst = src; src = (src == b) ? tmp : b; /* the sorted output of this pass is the input of the next */
+    }
+  if(src != b) {memcpy(b, src, n * sizeof(struct peano_hilbert_data));}
+
+  myfree(tmp);
+  myfree(count);
 }
 
 
+/*! out-of-place version of reorder_gas/reorder_particles: the elements first..first+n-1 of all the given arrays ('streams',
+ *  e.g. P, SphP and ChimesGasVars, which move in lockstep) are put into the order of the sorted mp[], by gathering them into a
+ *  scratch buffer (with threaded copies) and copying them back. If the mymalloc-arena cannot hold a copy of all of them, this is
+ *  done in chunks of consecutive destinations: before a chunk is copied back, the elements which currently occupy it but still
+ *  have to go to a later destination are moved into the slots which the chunk was gathered from (which are free now), and the
+ *  permutation (mp, Id) is updated accordingly. Each element is therefore moved at most twice (plus the copy back). */
+static void reorder_streams(int n_streams, char **base, size_t *size, int first, int n)
+{
+  int s, k, k_start, k_end, i_free, i_occ, n_chunk;
+  size_t size_all = 0, offset;
+  for(s = 0; s < n_streams; s++) {size_all += size[s];}
+
+  n_chunk = n;
+  if(n_chunk * size_all + 16384 > FreeBytes) {n_chunk = (FreeBytes > 16384 + size_all) ? (int) ((FreeBytes - 16384) / size_all) : 0;}
+  if(n_chunk < 1) {PRINT_WARNING("Task %d has no memory for the out-of-place Peano-Hilbert reorder (FreeBytes=%g MB), this is fatal", ThisTask, FreeBytes / (1024.0 * 1024.0)); endrun(9988);}
+  if(n_chunk < n) {PRINT_WARNING("Task %d splitting Peano-Hilbert reorder of %d elements into chunks of %d as we are hitting memory limits", ThisTask, n, n_chunk);}
+
+  char *buf = (char *) mymalloc("reorder_buf", n_chunk * size_all);
+
+  for(k_start = first; k_start < first + n; k_start = k_end)
+    {
+      k_end = (k_start + n_chunk < first + n) ? k_start + n_chunk : first + n;
+
+      /* gather the elements destined for k_start..k_end-1 (all destinations below k_start are already final) */
+      for(s = 0, offset = 0; s < n_streams; offset += size[s] * (k_end - k_start), s++)
+        {
+#ifdef _OPENMP
+#pragma omp parallel for private(k) schedule(static)
+#endif
+          for(k = k_start; k < k_end; k++) {memcpy(buf + offset + (k - k_start) * size[s], base[s] + mp[k].index * size[s], size[s]);}
+        }
+
+      /* the elements which occupy the chunk but are destined beyond it are moved to the slots beyond it which were gathered from */
+      for(i_occ = k_start, i_free = k_start; i_occ < k_end; i_occ++)
+        {
+          if(Id[i_occ] < k_end) continue; /* this one was gathered into the chunk */
+          while(mp[i_free].index < k_end) {i_free++;} /* next destination in the chunk whose source lies beyond it */
+          int i_dest = mp[i_free].index; i_free++;
+          for(s = 0; s < n_streams; s++) {memcpy(base[s] + i_dest * size[s], base[s] + i_occ * size[s], size[s]);}
+          Id[i_dest] = Id[i_occ]; mp[Id[i_occ]].index = i_dest;
+        }
+
+      for(s = 0, offset = 0; s < n_streams; offset += size[s] * (k_end - k_start), s++)
+        {
+#ifdef _OPENMP
+#pragma omp parallel for private(k) schedule(static)
+#endif
+          for(k = k_start; k < k_end; k++) {memcpy(base[s] + k * size[s], buf + offset + (k - k_start) * size[s], size[s]);}
+        }
+      for(k = k_start; k < k_end; k++) {Id[k] = k; mp[k].index = k;}
+    }
+
+  myfree(buf);
+}
+#endif
+
 
 
 
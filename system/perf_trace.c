@@ -0,0 +1,277 @@
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "../allvars.h"
+#include "../proto.h"
+
+/*
+ * This file contains the named, nestable timers of the performance trace (PERFORMANCE_TRACE). Every timer is a node in a tree (a timer
+ *   started while another is running becomes its child), holding the calls and inclusive wall-clock time since the last output; for
+ *   the generic neighbor loops (code_block_xchange_perform_ops.h, which times itself under the name of its core function) the node also
+ *   holds the exports, imports, buffer rounds, bytes moved, the compute/communication/wait times, and the time each thread spent in
+ *   the loop. At each entry of the cpu log, the nodes of all tasks are matched up by their path and written to perf_timers.csv with their
+ *   min/avg/max over tasks (and threads), together with a histogram of the load (time outside the wait/imbalance parts) of the tasks in
+ *   perf_load.csv. With PERFORMANCE_TRACE=2, every call of a timer is also written as an event to perf_trace/trace_<task>.json, which
+ *   can be opened in Chrome-trace viewers (chrome://tracing, Perfetto).
+ */
+
+#ifdef PERFORMANCE_TRACE
+
+#define PERF_TIMER_MAXNODES 256 /* distinct timer paths per task */
+#define PERF_TIMER_MAXDEPTH 32  /* nesting depth */
+#define PERF_TIMER_NAMELEN 48
+#define PERF_TIMER_PATHLEN 256
+#define PERF_LOAD_NBINS 16      /* bins of the load histogram, in units of the mean load, from 0 to 2 (the last bin takes all above) */
+
+struct perf_timer_node
+{
+    char name[PERF_TIMER_NAMELEN];
+    int parent;                 /* index of the parent node, or -1 at the top level */
+    long long calls;
+    double t_total;             /* inclusive wall-clock time */
+    long long n_export, n_import, n_rounds, n_bytes; /* generic neighbor loops only */
+    double t_comp, t_comm, t_wait;
+    double *t_thread;           /* time spent by each thread in the threaded parts of the loop */
+};
+
+struct perf_timer_summary /* what each task sends to task 0 for every node at output */
+{
+    char path[PERF_TIMER_PATHLEN];
+    long long calls, n_export, n_import, n_rounds, n_bytes;
+    double t_total, t_comp, t_comm, t_wait, t_thread_min, t_thread_sum, t_thread_max;
+    int n_thread;
+};
+
+static struct perf_timer_node PerfNodes[PERF_TIMER_MAXNODES];
+static int PerfNodes_N, PerfStack_N, PerfStack[PERF_TIMER_MAXDEPTH], Perf_NThreads;
+static double PerfStack_t_start[PERF_TIMER_MAXDEPTH], Perf_Load;
+static double *PerfThreadTime; /* time of each thread in the current neighbor loop */
+static FILE *FdPerfTimers, *FdPerfLoad;
+#ifdef PERFORMANCE_TRACE_EVENTS
+static FILE *FdPerfEvents;
+static double Perf_t_zero;
+static long long Perf_LastXchange[3]; /* exports, imports, and buffer rounds of the last neighbor loop, for its event */
+#endif
+
+
+/*! starts the timer 'name' as a child of the timer currently running (if any). Must be called by all threads
+ *  together (outside of parallel regions); timers must be stopped in the reverse order they were started. */
+void perf_timer_start(const char *name)
+{
+    int k, parent = (PerfStack_N > 0) ? PerfStack[PerfStack_N - 1] : -1;
+    if(PerfStack_N >= PERF_TIMER_MAXDEPTH) {PRINT_WARNING("performance timers nested too deeply (at '%s'): increase PERF_TIMER_MAXDEPTH", name); endrun(7741);}
+    for(k = 0; k < PerfNodes_N; k++) {if(PerfNodes[k].parent == parent && strncmp(PerfNodes[k].name, name, PERF_TIMER_NAMELEN - 1) == 0) {break;}}
+    if(k == PerfNodes_N) /* first call of this timer at this place in the tree */
+    {
+        if(PerfNodes_N >= PERF_TIMER_MAXNODES) {PRINT_WARNING("too many performance timers (at '%s'): increase PERF_TIMER_MAXNODES", name); endrun(7742);}
+        memset(&PerfNodes[k], 0, sizeof(struct perf_timer_node));
+        strncpy(PerfNodes[k].name, name, PERF_TIMER_NAMELEN - 1); PerfNodes[k].parent = parent;
+        PerfNodes_N++;
+    }
+    PerfStack[PerfStack_N] = k; PerfStack_t_start[PerfStack_N] = my_second(); PerfStack_N++;
+}
+
+
+/*! stops the timer 'name', which must be the last one started */
+void perf_timer_stop(const char *name)
+{
+    double t_end = my_second();
+    if(PerfStack_N <= 0 || strncmp(PerfNodes[PerfStack[PerfStack_N - 1]].name, name, PERF_TIMER_NAMELEN - 1) != 0)
+        {PRINT_WARNING("performance timer '%s' stopped, but it is not the timer running last ('%s')", name, (PerfStack_N > 0) ? PerfNodes[PerfStack[PerfStack_N - 1]].name : "none"); endrun(7743);}
+    PerfStack_N--;
+    struct perf_timer_node *node = &PerfNodes[PerfStack[PerfStack_N]];
+    double dt = timediff(PerfStack_t_start[PerfStack_N], t_end);
+    node->calls++; node->t_total += dt;
+#ifdef PERFORMANCE_TRACE_EVENTS
+    if(FdPerfEvents)
+    {
+        fprintf(FdPerfEvents, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":0,\"ts\":%.1f,\"dur\":%.1f", node->name, ThisTask, 1.e6 * (PerfStack_t_start[PerfStack_N] - Perf_t_zero), 1.e6 * dt);
+        if(Perf_LastXchange[2] > 0) {fprintf(FdPerfEvents, ",\"args\":{\"exports\":%lld,\"imports\":%lld,\"rounds\":%lld}", Perf_LastXchange[0], Perf_LastXchange[1], Perf_LastXchange[2]);}
+        fprintf(FdPerfEvents, "},\n");
+        Perf_LastXchange[0] = Perf_LastXchange[1] = Perf_LastXchange[2] = 0;
+    }
+#endif
+}
+
+
+/*! called (outside of parallel regions) at the start of a generic neighbor loop, after its timer is started: clears the thread times */
+void perf_xchange_begin(void)
+{
+    int t;
+    if(!PerfThreadTime) {PerfThreadTime = (double *) calloc(maxThreads, sizeof(double));}
+    for(t = 0; t < maxThreads; t++) {PerfThreadTime[t] = 0;}
+}
+
+
+/*! adds dt to the time of thread thread_id in the current neighbor loop. Called by each thread from inside the parallel regions */
+void perf_xchange_thread_time(int thread_id, double dt)
+{
+    if(thread_id >= 0 && thread_id < maxThreads) {PerfThreadTime[thread_id] += dt;}
+}
+
+
+/*! adds the statistics of a generic neighbor loop to the timer currently running (the one of the loop) */
+void perf_xchange_record(long long n_export, long long n_import, long long n_rounds, long long n_bytes, double t_comp, double t_comm, double t_wait)
+{
+    int t;
+    if(PerfStack_N <= 0) {return;}
+    struct perf_timer_node *node = &PerfNodes[PerfStack[PerfStack_N - 1]];
+    node->n_export += n_export; node->n_import += n_import; node->n_rounds += n_rounds; node->n_bytes += n_bytes;
+    node->t_comp += t_comp; node->t_comm += t_comm; node->t_wait += t_wait;
+#ifdef PERFORMANCE_TRACE_EVENTS
+    Perf_LastXchange[0] = n_export; Perf_LastXchange[1] = n_import; Perf_LastXchange[2] = n_rounds;
+#endif
+    if(!node->t_thread) {node->t_thread = (double *) calloc(maxThreads, sizeof(double));}
+    for(t = 0; t < maxThreads; t++) {node->t_thread[t] += PerfThreadTime[t]; if(PerfThreadTime[t] > 0) {Perf_NThreads = IMAX(Perf_NThreads, t + 1);}}
+}
+
+
+/* writes the path of node k (names from the top level down, separated by '/') into path */
+static void perf_timer_path(int k, char *path)
+{
+    char tmp[PERF_TIMER_PATHLEN];
+    path[0] = 0;
+    for(; k >= 0; k = PerfNodes[k].parent)
+    {
+        if(path[0]) {snprintf(tmp, PERF_TIMER_PATHLEN, "%s/%s", PerfNodes[k].name, path);} else {snprintf(tmp, PERF_TIMER_PATHLEN, "%s", PerfNodes[k].name);}
+        strcpy(path, tmp);
+    }
+}
+
+
+/* sorts the node summaries by their path */
+static int perf_timer_summary_compare(const void *a, const void *b)
+{
+    return strcmp(((struct perf_timer_summary *) a)->path, ((struct perf_timer_summary *) b)->path);
+}
+
+
+/* opens the output files (on task 0; and the event file of every task) the first time they are needed */
+static void perf_trace_open_files(void)
+{
+    char buf[1000], mode[2];
+    if(RestartFlag == 0) {strcpy(mode, "w");} else {strcpy(mode, "a");}
+#ifdef PERFORMANCE_TRACE_EVENTS
+    if(ThisTask == 0) {sprintf(buf, "%sperf_trace", All.OutputDir); mkdir(buf, 02755);}
+    MPI_Barrier(MPI_COMM_WORLD);
+    sprintf(buf, "%sperf_trace/trace_%d.json", All.OutputDir, ThisTask); /* the JSON array format: the closing bracket may be left out */
+    if(!(FdPerfEvents = fopen(buf, "w"))) {printf("error in opening file '%s'\n", buf); endrun(1);}
+    fprintf(FdPerfEvents, "[\n");
+#endif
+    if(ThisTask != 0) {return;}
+    sprintf(buf, "%s%s", All.OutputDir, "perf_timers.csv");
+    if(!(FdPerfTimers = fopen(buf, mode))) {printf("error in opening file '%s'\n", buf); endrun(1);}
+    if(RestartFlag == 0) {fprintf(FdPerfTimers, "step,time,timer,calls,t_min,t_avg,t_max,t_thread_min,t_thread_avg,t_thread_max,exports,imports,rounds,bytes,t_comp_avg,t_comp_max,t_comm_avg,t_comm_max,t_wait_avg,t_wait_max\n");}
+    sprintf(buf, "%s%s", All.OutputDir, "perf_load.csv");
+    if(!(FdPerfLoad = fopen(buf, mode))) {printf("error in opening file '%s'\n", buf); endrun(1);}
+    if(RestartFlag == 0)
+    {
+        int b; fprintf(FdPerfLoad, "step,time,load_min,load_avg,load_max,rank_min,rank_max");
+        for(b = 0; b < PERF_LOAD_NBINS; b++) {fprintf(FdPerfLoad, ",n_%g", (2. * (b + 1)) / PERF_LOAD_NBINS);}
+        fprintf(FdPerfLoad, "\n");
+    }
+}
+
+
+/*! called by all tasks from write_cpu_log() with the time this task spent since the last call outside of the wait/imbalance
+ *  parts of CPU_Step. The timers and loads are accumulated, and written out (and reset) if do_output is set. */
+void perf_trace_write(double load, int do_output)
+{
+    int k, t, n, task;
+    static int files_open = 0;
+    Perf_Load += load;
+    if(!files_open) {perf_trace_open_files(); files_open = 1;
+#ifdef PERFORMANCE_TRACE_EVENTS
+        Perf_t_zero = my_second();
+#endif
+    }
+    if(!do_output) {return;}
+
+    /* summaries of all nodes of this task */
+    struct perf_timer_summary *loc = (struct perf_timer_summary *) mymalloc("perf_loc", (PerfNodes_N + 1) * sizeof(struct perf_timer_summary));
+    memset(loc, 0, (PerfNodes_N + 1) * sizeof(struct perf_timer_summary));
+    for(k = 0; k < PerfNodes_N; k++)
+    {
+        struct perf_timer_node *node = &PerfNodes[k];
+        perf_timer_path(k, loc[k].path);
+        loc[k].calls = node->calls; loc[k].t_total = node->t_total;
+        loc[k].n_export = node->n_export; loc[k].n_import = node->n_import; loc[k].n_rounds = node->n_rounds; loc[k].n_bytes = node->n_bytes;
+        loc[k].t_comp = node->t_comp; loc[k].t_comm = node->t_comm; loc[k].t_wait = node->t_wait;
+        if(node->t_thread && Perf_NThreads > 0)
+        {
+            loc[k].n_thread = Perf_NThreads; loc[k].t_thread_min = MAX_REAL_NUMBER;
+            for(t = 0; t < Perf_NThreads; t++) {loc[k].t_thread_min = DMIN(loc[k].t_thread_min, node->t_thread[t]); loc[k].t_thread_max = DMAX(loc[k].t_thread_max, node->t_thread[t]); loc[k].t_thread_sum += node->t_thread[t]; node->t_thread[t] = 0;}
+        }
+        node->calls = 0; node->t_total = 0; node->n_export = node->n_import = node->n_rounds = node->n_bytes = 0; node->t_comp = node->t_comm = node->t_wait = 0;
+    }
+
+    /* gather the summaries and loads of all tasks on task 0 */
+    int *n_nodes = NULL, *bytes_nodes = NULL, *offset_nodes = NULL, n_bytes_loc = PerfNodes_N * sizeof(struct perf_timer_summary);
+    double *load_all = NULL;
+    struct perf_timer_summary *all = NULL;
+    if(ThisTask == 0)
+    {
+        n_nodes = (int *) mymalloc("perf_n_nodes", 3 * NTask * sizeof(int)); bytes_nodes = n_nodes + NTask; offset_nodes = n_nodes + 2 * NTask;
+        load_all = (double *) mymalloc("perf_load_all", NTask * sizeof(double));
+    }
+    MPI_Gather(&PerfNodes_N, 1, MPI_INT, n_nodes, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gather(&Perf_Load, 1, MPI_DOUBLE, load_all, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if(ThisTask == 0)
+    {
+        for(task = 0, n = 0; task < NTask; task++) {bytes_nodes[task] = n_nodes[task] * sizeof(struct perf_timer_summary); offset_nodes[task] = n * sizeof(struct perf_timer_summary); n += n_nodes[task];}
+        all = (struct perf_timer_summary *) mymalloc("perf_all", (n + 1) * sizeof(struct perf_timer_summary));
+    }
+    MPI_Gatherv(loc, n_bytes_loc, MPI_BYTE, all, bytes_nodes, offset_nodes, MPI_BYTE, 0, MPI_COMM_WORLD);
+    Perf_Load = 0;
+
+    if(ThisTask == 0)
+    {
+        /* match up the nodes of all tasks by their path: after sorting, the entries of the same timer are contiguous (and children follow their parents) */
+        int n_all, j;
+        for(task = 0, n_all = 0; task < NTask; task++) {n_all += n_nodes[task];}
+        qsort(all, n_all, sizeof(struct perf_timer_summary), perf_timer_summary_compare);
+        for(j = 0; j < n_all; j = k)
+        {
+            struct perf_timer_summary *s = &all[j];
+            long long calls = 0, n_export = 0, n_import = 0, n_rounds = 0, n_bytes = 0;
+            double t_min = MAX_REAL_NUMBER, t_sum = 0, t_max = 0, comp_sum = 0, comp_max = 0, comm_sum = 0, comm_max = 0, wait_sum = 0, wait_max = 0;
+            double thr_min = MAX_REAL_NUMBER, thr_sum = 0, thr_max = 0; int n_thr = 0;
+            for(k = j; k < n_all && strcmp(all[k].path, s->path) == 0; k++)
+            {
+                struct perf_timer_summary *r = &all[k];
+                if(r->calls > calls) {calls = r->calls;}
+                if(r->n_rounds > n_rounds) {n_rounds = r->n_rounds;}
+                n_export += r->n_export; n_import += r->n_import; n_bytes += r->n_bytes;
+                t_min = DMIN(t_min, r->t_total); t_sum += r->t_total; t_max = DMAX(t_max, r->t_total);
+                comp_sum += r->t_comp; comp_max = DMAX(comp_max, r->t_comp); comm_sum += r->t_comm; comm_max = DMAX(comm_max, r->t_comm); wait_sum += r->t_wait; wait_max = DMAX(wait_max, r->t_wait);
+                if(r->n_thread > 0) {thr_min = DMIN(thr_min, r->t_thread_min); thr_max = DMAX(thr_max, r->t_thread_max); thr_sum += r->t_thread_sum; n_thr += r->n_thread;}
+            }
+            if(k - j < NTask) {t_min = 0;} /* the timer did not run on some tasks */
+            if(n_thr == 0) {thr_min = 0;}
+            fprintf(FdPerfTimers, "%lld,%g,%s,%lld,%g,%g,%g,%g,%g,%g,%lld,%lld,%lld,%lld,%g,%g,%g,%g,%g,%g\n", (long long) All.NumCurrentTiStep, All.Time, s->path, calls,
+                    t_min, t_sum / NTask, t_max, thr_min, thr_sum / (MIN_REAL_NUMBER + n_thr), thr_max, n_export, n_import, n_rounds, n_bytes,
+                    comp_sum / NTask, comp_max, comm_sum / NTask, comm_max, wait_sum / NTask, wait_max);
+        }
+        fflush(FdPerfTimers);
+
+        /* histogram of the loads of the tasks, in units of the mean load */
+        int hist[PERF_LOAD_NBINS], rank_min = 0, rank_max = 0; double load_sum = 0;
+        for(k = 0; k < PERF_LOAD_NBINS; k++) {hist[k] = 0;}
+        for(task = 0; task < NTask; task++) {load_sum += load_all[task]; if(load_all[task] < load_all[rank_min]) {rank_min = task;} if(load_all[task] > load_all[rank_max]) {rank_max = task;}}
+        for(task = 0; task < NTask; task++) {hist[IMIN(PERF_LOAD_NBINS - 1, (int) (0.5 * PERF_LOAD_NBINS * load_all[task] * NTask / (MIN_REAL_NUMBER + load_sum)))]++;}
+        fprintf(FdPerfLoad, "%lld,%g,%g,%g,%g,%d,%d", (long long) All.NumCurrentTiStep, All.Time, load_all[rank_min], load_sum / NTask, load_all[rank_max], rank_min, rank_max);
+        for(k = 0; k < PERF_LOAD_NBINS; k++) {fprintf(FdPerfLoad, ",%d", hist[k]);}
+        fprintf(FdPerfLoad, "\n"); fflush(FdPerfLoad);
+
+        myfree(all); myfree(load_all); myfree(n_nodes);
+    }
+    myfree(loc);
+#ifdef PERFORMANCE_TRACE_EVENTS
+    fflush(FdPerfEvents);
+#endif
+}
+
+#endif
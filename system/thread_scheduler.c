@@ -0,0 +1,148 @@
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../allvars.h"
+#include "../proto.h"
+
+/*
+ * This file contains the work-stealing scheduler (THREAD_WORK_STEALING) for the threaded loops over the local active particles
+ *   (the primary loops of the neighbor and gravity walks). Instead of all threads taking particles from one shared position in the
+ *   active-particle array, each thread starts with its own contiguous range of it, cut so that all ranges have about the same
+ *   estimated cost, and works through it from the front. A thread which runs out of work steals the back half of the range of the
+ *   thread with the most work left. The ranges follow the Peano-Hilbert order of the particles, so each thread works on a compact
+ *   region (and steals a compact region). The time each thread spends working and waiting for the others is recorded for the cpu log.
+ */
+
+#ifdef THREAD_WORK_STEALING_IS_ACTIVE
+
+/* per-thread range of slots [head, tail) in ActiveParticleList, packed into one word (head in the low 32 bits) so the owner (taking work
+    from the front) and thieves (taking work from the back) can both update it with a single compare-and-swap. padded to a cache line. */
+struct thread_scheduler_range
+{
+    volatile unsigned long long range;
+    double t_finish;
+    char pad[48];
+};
+
+static struct thread_scheduler_range *ThreadRanges;
+static int ThreadRanges_N, Scheduler_NTeam, Scheduler_FirstSlot;
+static double Scheduler_t_start, Scheduler_TimeBusy, Scheduler_TimeIdle;
+
+#define RANGE_PACK(h,t)  ((unsigned long long) (unsigned int) (h) | ((unsigned long long) (unsigned int) (t) << 32))
+#define RANGE_HEAD(r)    ((int) ((r) & 0xFFFFFFFFULL))
+#define RANGE_TAIL(r)    ((int) ((r) >> 32))
+
+
+/* estimated relative cost of the evaluation of particle i in the loop */
+static inline double thread_scheduler_cost(int i, int cost_type)
+{
+    if(cost_type == THREAD_SCHEDULER_COST_GRAVITY) {return 1. + ((TakeLevel >= 0) ? P[i].GravCost[TakeLevel] : 0);} /* interactions in the last tree-walk at this level */
+    return 1. + P[i].NumNgb; /* neighbor loops: neighbors found in the last density evaluation */
+}
+
+
+/*! sets up the ranges of all threads for the slots NextParticle...NumActiveParticle-1 of the active-particle array, and marks these particles
+ *  as not processed. Must be called by all threads of the parallel region at the start of the loop (it contains a barrier). */
+void thread_scheduler_begin(int cost_type)
+{
+#pragma omp single
+    {
+        int t, k, n_team = omp_get_num_threads(), first = NextParticle;
+        if(ThreadRanges_N < n_team)
+        {
+            if(ThreadRanges) {free(ThreadRanges);}
+            ThreadRanges = (struct thread_scheduler_range *) calloc(n_team, sizeof(struct thread_scheduler_range));
+            if(!ThreadRanges) {printf("Task %d failed to allocate the work-stealing scheduler ranges for %d threads\n", ThisTask, n_team); endrun(7731);}
+            ThreadRanges_N = n_team;
+        }
+        Scheduler_NTeam = n_team; Scheduler_FirstSlot = first;
+        if(first < 0) {for(t = 0; t < n_team; t++) {ThreadRanges[t].range = RANGE_PACK(0, 0);}}
+        else
+        {
+            double cost_tot = 0, cost_sum = 0;
+            for(k = first; k < NumActiveParticle; k++) {ProcessedFlag[ActiveParticleList[k]] = 0; cost_tot += thread_scheduler_cost(ActiveParticleList[k], cost_type);}
+            for(t = 0, k = first; t < n_team; t++) /* cut into n_team consecutive ranges of equal cost */
+            {
+                int head = k;
+                double cost_end = cost_tot * (t + 1.) / n_team;
+                if(t == n_team - 1) {k = NumActiveParticle;} else {while(k < NumActiveParticle && cost_sum + 0.5 * thread_scheduler_cost(ActiveParticleList[k], cost_type) < cost_end) {cost_sum += thread_scheduler_cost(ActiveParticleList[k], cost_type); k++;}}
+                ThreadRanges[t].range = RANGE_PACK(head, k);
+            }
+        }
+        Scheduler_t_start = my_second();
+    } /* implicit barrier: all ranges are set before any thread starts */
+}
+
+
+/*! claims the next chunk of (at most max_chunk) consecutive slots of the active-particle array for the calling thread: from the front of its
+ *  own range, or else stolen from the back of the range of the thread with the most work left. Returns the first slot of the chunk, with
+ *  its length in *n_claimed, or -1 if there is no work left. */
+int thread_scheduler_claim(int max_chunk, int *n_claimed)
+{
+    int t, h, n, victim, thread_id = omp_get_thread_num();
+    unsigned long long r;
+    struct thread_scheduler_range *own = &ThreadRanges[thread_id];
+    while(1)
+    {
+        r = own->range; h = RANGE_HEAD(r); n = RANGE_TAIL(r) - h;
+        if(n > 0)
+        {
+            n = IMIN(max_chunk, n); /* the rest of the range stays available to thieves */
+            if(__sync_bool_compare_and_swap(&own->range, r, RANGE_PACK(h + n, RANGE_TAIL(r)))) {*n_claimed = n; return h;}
+            continue; /* a thief got there first */
+        }
+        for(t = 0, victim = -1, n = 0; t < Scheduler_NTeam; t++) /* own range is empty: find the thread with the most work left */
+        {
+            r = ThreadRanges[t].range;
+            if(RANGE_TAIL(r) - RANGE_HEAD(r) > n) {n = RANGE_TAIL(r) - RANGE_HEAD(r); victim = t;}
+        }
+        if(victim < 0) {*n_claimed = 0; return -1;} /* no work left anywhere */
+        r = ThreadRanges[victim].range; h = RANGE_HEAD(r); n = RANGE_TAIL(r) - h;
+        if(n <= 0) {continue;}
+        n = (n + 1) / 2; /* steal the back half */
+        if(__sync_bool_compare_and_swap(&ThreadRanges[victim].range, r, RANGE_PACK(h, RANGE_TAIL(r) - n)))
+        {
+            own->range = RANGE_PACK(RANGE_TAIL(r) - n, RANGE_TAIL(r)); /* nobody else writes to an empty range */
+        }
+    }
+}
+
+
+/*! called by all threads of the parallel region at the end of the loop (contains a barrier). Records the busy and idle times of the threads.
+ *  The particles may have been processed in any order: if the export buffer filled up, the slots of this pass are put in the order processed
+ *  (first) and not processed, so the caller finds the processed particles at the front as usual. NextParticle is set to -1 (the caller restarts
+ *  from the first particle not processed). */
+void thread_scheduler_end(void)
+{
+    ThreadRanges[omp_get_thread_num()].t_finish = my_second();
+#pragma omp barrier
+#pragma omp single
+    {
+        int t, k, n_done;
+        double t_max = Scheduler_t_start;
+        for(t = 0; t < Scheduler_NTeam; t++) {t_max = DMAX(t_max, ThreadRanges[t].t_finish);}
+        for(t = 0; t < Scheduler_NTeam; t++) {Scheduler_TimeBusy += timediff(Scheduler_t_start, ThreadRanges[t].t_finish); Scheduler_TimeIdle += timediff(ThreadRanges[t].t_finish, t_max);}
+        if(BufferFullFlag && Scheduler_FirstSlot >= 0)
+        {
+            int n = NumActiveParticle - Scheduler_FirstSlot, *list = ActiveParticleList + Scheduler_FirstSlot;
+            int *tmp = (int *) mymalloc("thread_scheduler_tmp", n * sizeof(int));
+            for(k = 0, n_done = 0; k < n; k++) {if(ProcessedFlag[list[k]] == 1) {tmp[n_done++] = list[k];}} /* stable partition */
+            for(k = 0, t = n_done; k < n; k++) {if(ProcessedFlag[list[k]] != 1) {tmp[t++] = list[k];}}
+            memcpy(list, tmp, n * sizeof(int));
+            myfree(tmp);
+        }
+        NextParticle = -1;
+    }
+}
+
+
+/*! returns the time (summed over threads) spent by the threads of this task working and waiting in the scheduled loops since the last call */
+void thread_scheduler_times(double *t_busy, double *t_idle)
+{
+    *t_busy = Scheduler_TimeBusy; *t_idle = Scheduler_TimeIdle;
+    Scheduler_TimeBusy = Scheduler_TimeIdle = 0;
+}
+
+#endif
@@ -111,4 +111,8 @@
 
 #define TAG_MPI_GENERIC_COM_BUFFER_A 103
 #define TAG_MPI_GENERIC_COM_BUFFER_B 104
+#define TAG_MPI_GENERIC_COM_BUFFER_C 107 /* measured costs of the imports, returned with their results (DOMAIN_MEASURED_COST) */
+
+#define TAG_SPARSE_COUNTS_A 105
+#define TAG_SPARSE_COUNTS_B 106
 
@@ -1112,7 +1112,7 @@ void process_wake_ups(void)
 		}
 		P[i].Ti_begstep = All.Ti_Current;
 		P[i].dt_step = GET_INTEGERTIME_FROM_TIMEBIN(bin);
-		if(P[i].Ti_current < All.Ti_Current) {P[i].Ti_current=All.Ti_Current;}
+		if(P[i].Ti_current < All.Ti_Current) {P[i].Ti_current=All.Ti_Current; PHOT_UPDATE(i);}
 	    }
 	}
     }
@@ -259,7 +259,7 @@ void dynamic_diff_calc(void) {
     /* prepare to do the requisite number of sweeps over the particle distribution */
     for (dynamic_iteration = 0; dynamic_iteration < (All.TurbDynamicDiffIterations + 1); dynamic_iteration++) {      
         // now we actually begin the main gradient loop //
-        NextParticle = FirstActiveParticle;	/* begin with this index */
+        NextParticle = ACTIVE_CURSOR_FIRST;	/* begin with this index */
         PRINT_STATUS(" ..first loop over active particles (iter = %d)", dynamic_iteration);
 
         do {    
@@ -318,10 +318,10 @@ void dynamic_diff_calc(void) {
                 
                 while (NextParticle >= 0) {
                     if (NextParticle == last_nextparticle) break;
-                    if (ProcessedFlag[NextParticle] != 1) break;
+                    if (ProcessedFlag[ACTIVE_CURSOR_PARTICLE(NextParticle)] != 1) break;
                     
-                    ProcessedFlag[NextParticle] = 2;
-                    NextParticle = NextActiveParticle[NextParticle];
+                    ProcessedFlag[ACTIVE_CURSOR_PARTICLE(NextParticle)] = 2;
+                    NextParticle = ACTIVE_CURSOR_NEXT(NextParticle);
                 }
                 
                 if (NextParticle == save_NextParticle) {
@@ -951,7 +951,22 @@ void *DynamicDiff_evaluate_primary(void *p, int dynamic_iteration) {
     /* Note: exportflag is local to each thread */
     for (j = 0; j < NTask; j++) exportflag[j] = -1;
     
+#ifdef ACTIVE_PARTICLE_ARRAY
+    int k_slot = 0, n_slot = 0; /* chunk of the active-particle array claimed by this thread (no lock needed) */
+#ifdef THREAD_WORK_STEALING_IS_ACTIVE
+    thread_scheduler_begin(THREAD_SCHEDULER_COST_NEIGHBORS);
+#endif
+#endif
     while (1) {
+#ifdef ACTIVE_PARTICLE_ARRAY
+        if (BufferFullFlag != 0) break;
+        if (n_slot <= 0) {
+            k_slot = active_particle_claim_chunk(ACTIVE_PARTICLE_MAXCHUNK, &n_slot);
+            if (k_slot < 0) break;
+        }
+        i = ActiveParticleList[k_slot++];
+        n_slot--;
+#else
         int exitFlag = 0;
         LOCK_NEXPORT;
 #ifdef _OPENMP
@@ -970,6 +985,7 @@ void *DynamicDiff_evaluate_primary(void *p, int dynamic_iteration) {
 
         UNLOCK_NEXPORT;
         if (exitFlag) break;
+#endif
         
         if (P[i].Type == 0) {
 	    if (DynamicDiff_evaluate(i, 0, exportflag, exportnodecount, exportindex, ngblist, dynamic_iteration) < 0) break;		/* export buffer has filled up */
@@ -977,6 +993,9 @@ void *DynamicDiff_evaluate_primary(void *p, int dynamic_iteration) {
 
         ProcessedFlag[i] = 1; /* particle successfully finished */
     }
+#ifdef THREAD_WORK_STEALING_IS_ACTIVE
+    thread_scheduler_end();
+#endif
 
     return NULL;
 }
@@ -332,10 +332,91 @@ void set_turb_ampl(void)
 }
 
 
+#ifdef TURB_DRIVING_FASTMODESUM
+/* fills c[nmax+n] + i*s[nmax+n] = exp(i*n*k0x) for n = -nmax...nmax, from a single cos/sin by repeated complex multiplication (angle addition) */
+static inline void st_turbdrive_axis_phases(double k0x, int nmax, double *c, double *s)
+{
+    int n; double c1 = cos(k0x), s1 = sin(k0x);
+    c[nmax] = 1; s[nmax] = 0;
+    for(n = 1; n <= nmax; n++)
+    {
+        c[nmax+n] = c[nmax+n-1]*c1 - s[nmax+n-1]*s1; s[nmax+n] = s[nmax+n-1]*c1 + c[nmax+n-1]*s1;
+        c[nmax-n] = c[nmax+n]; s[nmax-n] = -s[nmax+n];
+    }
+}
+
+/* same sum over the modes as in add_turb_accel below, but since every mode is an integer multiple (ikx,iky,ikz) of the fundamental wavenumbers
+    of the box, exp(i*k.x) is the product of the per-axis phases exp(i*ikx*2pi*x/boxSize_X) etc, which are built once per particle from three
+    cos/sin evaluations: each mode then costs two complex multiplications instead of a cos and sin. The particles are split over the threads. */
+static void add_turb_accel_fastmodesum(double fac_sol)
+{
+    int i, j, k, m, n_active = 0, nmax[3] = {0,0,0}; double box[3] = {boxSize_X, boxSize_Y, boxSize_Z};
+    int *mode_n = (int *) mymalloc("mode_n", 3 * StNModes * sizeof(int));
+    double *coeff = (double *) mymalloc("coeff", 6 * StNModes * sizeof(double));
+    for(m = 0; m < StNModes; m++)
+    {
+        for(k = 0; k < 3; k++)
+        {
+            mode_n[3*m+k] = (int) floor(StMode[3*m+k] * box[k] / (2.*M_PI) + 0.5); nmax[k] = IMAX(nmax[k], abs(mode_n[3*m+k]));
+            coeff[6*m+k] = fac_sol * StAmpl[m] * StAka[3*m+k]; coeff[6*m+3+k] = fac_sol * StAmpl[m] * StAkb[3*m+k]; /* real/imaginary coefficients, with the amplitude and normalization folded in */
+        }
+    }
+    int *active_indices = (int *) mymalloc("active_indices", NumPart * sizeof(int));
+    for(i = FirstActiveParticle; i >= 0; i = NextActiveParticle[i]) {if(P[i].Type == 0) {active_indices[n_active++] = i;}}
+
+#ifdef _OPENMP
+#pragma omp parallel private(i, j, k, m)
+#endif
+    { /* open parallel block */
+    int ntab = 2*(nmax[0]+nmax[1]+nmax[2]) + 3;
+    double *ctab = (double *) malloc(2 * ntab * sizeof(double)), *stab = ctab + ntab; /* per-thread phase tables of the three axes (mymalloc is not thread-safe) */
+    int off[3] = {0, 2*nmax[0]+1, 2*(nmax[0]+nmax[1])+2};
+    double *cx = ctab + off[0] + nmax[0], *sx = stab + off[0] + nmax[0], *cy = ctab + off[1] + nmax[1], *sy = stab + off[1] + nmax[1];
+    double *cz = ctab + off[2] + nmax[2], *sz = stab + off[2] + nmax[2]; /* centered, so they are indexed by the (signed) integer mode number */
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(j = 0; j < n_active; j++)
+    {
+        i = active_indices[j];
+        if(P[i].Mass > 0.)
+        {
+            double fx = 0, fy = 0, fz = 0;
+            for(k = 0; k < 3; k++) {st_turbdrive_axis_phases(2.*M_PI*P[i].Pos[k]/box[k], nmax[k], ctab + off[k], stab + off[k]);}
+            for(m=0; m<StNModes; m++) // calc force
+            {
+                int nx = mode_n[3*m+0], ny = mode_n[3*m+1], nz = mode_n[3*m+2];
+                double cxy = cx[nx]*cy[ny] - sx[nx]*sy[ny], sxy = sx[nx]*cy[ny] + cx[nx]*sy[ny];
+                double realt = cxy*cz[nz] - sxy*sz[nz], imagt = sxy*cz[nz] + cxy*sz[nz]; /* = cos(k.x), sin(k.x) */
+                fx += coeff[6*m+0]*realt - coeff[6*m+3]*imagt;
+                fy += coeff[6*m+1]*realt - coeff[6*m+4]*imagt;
+                fz += coeff[6*m+2]*realt - coeff[6*m+5]*imagt;
+            }
+            SphP[i].TurbAccel[0] = fx; SphP[i].TurbAccel[1] = SphP[i].TurbAccel[2] = 0;
+#if (NUMDIMS > 1)
+            SphP[i].TurbAccel[1] = fy;
+#endif
+#if (NUMDIMS > 2)
+            SphP[i].TurbAccel[2] = fz;
+#endif
+        } else {
+            SphP[i].TurbAccel[0] = SphP[i].TurbAccel[1] = SphP[i].TurbAccel[2]=0;
+        }
+    }
+    free(ctab);
+    } /* close parallel block */
+    myfree(active_indices); myfree(coeff); myfree(mode_n);
+}
+#endif
+
+
 /* routine to actually calculate the turbulent acceleration 'driving field' force on every resolution element */
 void add_turb_accel()
 {
     set_turb_ampl();
+#ifdef TURB_DRIVING_FASTMODESUM
+    add_turb_accel_fastmodesum(2.*solenoidal_frac_total_weight_renormalization());
+#else
     int i, j, m; double acc[3], fac_sol = 2.*solenoidal_frac_total_weight_renormalization();
     for(i = FirstActiveParticle; i >= 0; i = NextActiveParticle[i])
     {
@@ -368,6 +449,7 @@ void add_turb_accel()
             }
         }
     }
+#endif
     PRINT_STATUS("Finished turbulence driving (acceleration) computation");
 }
 